@@ -0,0 +1,84 @@
+//
+//  OTRAccountStore.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+/**
+ *  One record per account and protocol, kept in a compacted file at path
+ *  plus a journal that each change is appended to. Changing one account
+ *  costs one small write no matter how many accounts there are, and a failed
+ *  write can only lose that change.
+ *
+ *  Once the journal grows past the compacted file, every live record is
+ *  written to a new compacted file that atomically replaces the old one and
+ *  the journal is emptied. A torn record at the end of the journal, left by a
+ *  crash during an append, is dropped when loading.
+ *
+ *  OTRKit keeps private keys and instance tags in these, each record holding
+ *  the account's entry in libotr's file format. Not thread safe.
+ */
+@interface OTRAccountStore : NSObject
+
+/** The compacted file */
+@property (nonatomic, copy, readonly) NSString *path;
+/** path with "-journal" appended */
+@property (nonatomic, copy, readonly) NSString *journalPath;
+/** Number of accounts with a record */
+@property (nonatomic, readonly) NSUInteger count;
+/** Bytes appended since the last compaction */
+@property (nonatomic, readonly) unsigned long long journalLength;
+/** The journal isn't compacted while shorter than this. Defaults to 64KB. */
+@property (nonatomic) unsigned long long compactionThreshold;
+/**
+ *  Set when loadWithError: found the compacted file damaged. The store is read-only
+ *  then, setRecord: and compactWithError: fail with this error so the records that
+ *  couldn't be read are never written over.
+ */
+@property (nonatomic, strong, readonly, nullable) NSError *loadError;
+/** path with "-damaged" appended, a copy of the damaged compacted file is kept here */
+@property (nonatomic, copy, readonly) NSString *damagedPath;
+
+/** Doesn't touch the disk until loadWithError: */
+- (instancetype) initWithPath:(NSString*)path NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+/**
+ *  Reads the compacted file and replays the journal over it. Missing files
+ *  are fine, the store is just empty.
+ *
+ *  @return NO if the compacted file is damaged. Records read before the damage are kept,
+ *          the file is copied to damagedPath and the store is read-only, see loadError.
+ */
+- (BOOL) loadWithError:(NSError**)error;
+
+/** Whether either file exists, i.e. the store was written before */
+- (BOOL) existsOnDisk;
+
+- (nullable NSData*) recordForAccountName:(NSString*)accountName protocol:(NSString*)protocol;
+
+/**
+ *  Appends the change to the journal and syncs it, compacting if the journal is due.
+ *
+ *  @param record the new record, or nil to remove the account's record
+ *  @return NO if the change couldn't be written or the store is read-only, the store is unchanged then
+ */
+- (BOOL) setRecord:(nullable NSData*)record forAccountName:(NSString*)accountName protocol:(NSString*)protocol error:(NSError**)error;
+
+/** Changes the record in memory only, for bulk imports. The next compactWithError: writes it. */
+- (void) stageRecord:(nullable NSData*)record forAccountName:(NSString*)accountName protocol:(NSString*)protocol;
+
+/** Records in the order their accounts were first added */
+- (void) enumerateRecordsUsingBlock:(void (^)(NSString *accountName, NSString *protocol, NSData *record, BOOL *stop))block;
+
+/** Writes every record to a new compacted file, replaces the old one and empties the journal */
+- (BOOL) compactWithError:(NSError**)error;
+
+@end
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,314 @@
+//
+//  OTRAccountStore.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRAccountStore.h"
+#import "OTRErrorUtility.h"
+#import "gcrypt.h"
+#import <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const unsigned long long kOTRAccountStoreDefaultCompactionThreshold = 64 * 1024;
+
+/** Records are framed as a 4 byte big endian payload length, the payload and its 4 byte big endian CRC-32 */
+static const NSUInteger kOTRAccountStoreFrameOverhead = 8;
+
+typedef NS_ENUM(uint8_t, OTRAccountStoreOperation) {
+    OTRAccountStoreOperationRemove = 0,
+    OTRAccountStoreOperationSet = 1
+};
+
+@interface OTRAccountStore()
+/** Keyed by keyForAccountName:protocol: */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, NSData*> *records;
+/** Keys of records in the order they were added */
+@property (nonatomic, strong, readonly) NSMutableOrderedSet<NSString*> *order;
+/** Size of the compacted file when it was last read or written */
+@property (nonatomic) unsigned long long compactedLength;
+@property (nonatomic, readwrite) unsigned long long journalLength;
+@property (nonatomic, strong, readwrite, nullable) NSError *loadError;
+@end
+
+@implementation OTRAccountStore
+
+- (instancetype) initWithPath:(NSString*)path {
+    if (self = [super init]) {
+        _path = [path copy];
+        _journalPath = [path stringByAppendingString:@"-journal"];
+        _damagedPath = [path stringByAppendingString:@"-damaged"];
+        _records = [NSMutableDictionary dictionary];
+        _order = [NSMutableOrderedSet orderedSet];
+        _compactionThreshold = kOTRAccountStoreDefaultCompactionThreshold;
+    }
+    return self;
+}
+
+- (NSUInteger) count {
+    return self.records.count;
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p %@ accounts: %d journal: %d bytes>", NSStringFromClass([self class]), self, self.path.lastPathComponent, (int)self.count, (int)self.journalLength];
+}
+
+#pragma mark Records
+
+/** Protocols never contain a newline so the key splits at the last one */
++ (NSString*) keyForAccountName:(NSString*)accountName protocol:(NSString*)protocol {
+    return [NSString stringWithFormat:@"%@\n%@", accountName, protocol];
+}
+
+- (nullable NSData*) recordForAccountName:(NSString*)accountName protocol:(NSString*)protocol {
+    return [self.records objectForKey:[[self class] keyForAccountName:accountName protocol:protocol]];
+}
+
+- (void) enumerateRecordsUsingBlock:(void (^)(NSString *accountName, NSString *protocol, NSData *record, BOOL *stop))block {
+    BOOL stop = NO;
+    for (NSString *key in self.order) {
+        NSRange newline = [key rangeOfString:@"\n" options:NSBackwardsSearch];
+        block([key substringToIndex:newline.location], [key substringFromIndex:NSMaxRange(newline)], [self.records objectForKey:key], &stop);
+        if (stop) {
+            break;
+        }
+    }
+}
+
+- (void) applyOperation:(OTRAccountStoreOperation)operation key:(NSString*)key record:(nullable NSData*)record {
+    if (operation == OTRAccountStoreOperationSet && record) {
+        [self.records setObject:record forKey:key];
+        [self.order addObject:key];
+    } else {
+        [self.records removeObjectForKey:key];
+        [self.order removeObject:key];
+    }
+}
+
+#pragma mark Framing
+
++ (NSData*) frameWithOperation:(OTRAccountStoreOperation)operation accountName:(NSString*)accountName protocol:(NSString*)protocol record:(nullable NSData*)record {
+    NSData *accountData = [accountName dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *protocolData = [protocol dataUsingEncoding:NSUTF8StringEncoding];
+    uint32_t payloadLength = (uint32_t)(1 + accountData.length + 1 + protocolData.length + 1 + record.length);
+    NSMutableData *frame = [NSMutableData dataWithCapacity:payloadLength + kOTRAccountStoreFrameOverhead];
+    uint32_t bigEndianLength = CFSwapInt32HostToBig(payloadLength);
+    [frame appendBytes:&bigEndianLength length:sizeof(bigEndianLength)];
+    uint8_t zero = 0;
+    [frame appendBytes:&operation length:1];
+    [frame appendData:accountData];
+    [frame appendBytes:&zero length:1];
+    [frame appendData:protocolData];
+    [frame appendBytes:&zero length:1];
+    if (record) {
+        [frame appendData:record];
+    }
+    uint32_t checksum = CFSwapInt32HostToBig((uint32_t)crc32(0, (const Bytef*)frame.bytes + 4, payloadLength));
+    [frame appendBytes:&checksum length:sizeof(checksum)];
+    return frame;
+}
+
+/** Applies every intact record in data. Returns the length of data up to the end of the last one. */
+- (NSUInteger) applyFramesInData:(NSData*)data {
+    const uint8_t *bytes = data.bytes;
+    NSUInteger length = data.length;
+    NSUInteger offset = 0;
+    while (length - offset >= kOTRAccountStoreFrameOverhead) {
+        uint32_t payloadLength = 0;
+        memcpy(&payloadLength, bytes + offset, sizeof(payloadLength));
+        payloadLength = CFSwapInt32BigToHost(payloadLength);
+        if (payloadLength > length - offset - kOTRAccountStoreFrameOverhead) {
+            break;
+        }
+        const uint8_t *payload = bytes + offset + 4;
+        uint32_t checksum = 0;
+        memcpy(&checksum, payload + payloadLength, sizeof(checksum));
+        if (CFSwapInt32BigToHost(checksum) != (uint32_t)crc32(0, payload, payloadLength)) {
+            break;
+        }
+        // Operation, then NUL terminated account name and protocol
+        const uint8_t *end = payload + payloadLength;
+        const uint8_t *accountEnd = payloadLength > 1 ? memchr(payload + 1, 0, end - payload - 1) : NULL;
+        const uint8_t *protocolEnd = accountEnd ? memchr(accountEnd + 1, 0, end - accountEnd - 1) : NULL;
+        if (!protocolEnd) {
+            break;
+        }
+        NSString *accountName = [[NSString alloc] initWithBytes:payload + 1 length:accountEnd - payload - 1 encoding:NSUTF8StringEncoding];
+        NSString *protocol = [[NSString alloc] initWithBytes:accountEnd + 1 length:protocolEnd - accountEnd - 1 encoding:NSUTF8StringEncoding];
+        if (!accountName || !protocol) {
+            break;
+        }
+        NSData *record = [NSData dataWithBytes:protocolEnd + 1 length:end - protocolEnd - 1];
+        [self applyOperation:payload[0] key:[[self class] keyForAccountName:accountName protocol:protocol] record:record];
+        offset += payloadLength + kOTRAccountStoreFrameOverhead;
+    }
+    return offset;
+}
+
+#pragma mark Disk
+
+- (BOOL) existsOnDisk {
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    return [fileManager fileExistsAtPath:self.path] || [fileManager fileExistsAtPath:self.journalPath];
+}
+
+- (BOOL) loadWithError:(NSError**)error {
+    [self.records removeAllObjects];
+    [self.order removeAllObjects];
+    self.compactedLength = 0;
+    self.journalLength = 0;
+    self.loadError = nil;
+    NSData *compacted = [NSData dataWithContentsOfFile:self.path options:NSDataReadingMappedIfSafe error:nil];
+    if (compacted) {
+        self.compactedLength = compacted.length;
+        if ([self applyFramesInData:compacted] != compacted.length) {
+            // Only ever replaced atomically, so this isn't a torn write. Keep a copy for recovery
+            // and stop writing, a compaction would only save the records read so far.
+            self.loadError = [OTRErrorUtility errorForGPGError:GPG_ERR_INV_DATA];
+            NSFileManager *fileManager = [NSFileManager defaultManager];
+            if (![fileManager fileExistsAtPath:self.damagedPath]) {
+                [fileManager copyItemAtPath:self.path toPath:self.damagedPath error:nil];
+            }
+        }
+    }
+    NSData *journal = [NSData dataWithContentsOfFile:self.journalPath options:NSDataReadingMappedIfSafe error:nil];
+    if (journal) {
+        NSUInteger intactLength = [self applyFramesInData:journal];
+        if (intactLength != journal.length) {
+            // Interrupted append, drop it so later appends aren't stuck behind it
+            truncate(self.journalPath.fileSystemRepresentation, intactLength);
+        }
+        self.journalLength = intactLength;
+    }
+    if (self.loadError) {
+        if (error) {
+            *error = self.loadError;
+        }
+        return NO;
+    }
+    return YES;
+}
+
+- (BOOL) setRecord:(nullable NSData*)record forAccountName:(NSString*)accountName protocol:(NSString*)protocol error:(NSError**)error {
+    NSParameterAssert(accountName.length);
+    NSParameterAssert(protocol.length);
+    if (!accountName.length || !protocol.length) {
+        if (error) {
+            *error = [OTRErrorUtility errorForGPGError:GPG_ERR_INV_ARG];
+        }
+        return NO;
+    }
+    if (self.loadError) {
+        if (error) {
+            *error = self.loadError;
+        }
+        return NO;
+    }
+    NSString *key = [[self class] keyForAccountName:accountName protocol:protocol];
+    if (!record && ![self.records objectForKey:key]) {
+        return YES;
+    }
+    OTRAccountStoreOperation operation = record ? OTRAccountStoreOperationSet : OTRAccountStoreOperationRemove;
+    NSData *frame = [[self class] frameWithOperation:operation accountName:accountName protocol:protocol record:record];
+    int fd = open(self.journalPath.fileSystemRepresentation, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    if (fd < 0) {
+        if (error) {
+            *error = [OTRErrorUtility errorForGPGError:gcry_error_from_errno(errno)];
+        }
+        return NO;
+    }
+    ssize_t written = write(fd, frame.bytes, frame.length);
+    int result = (written == (ssize_t)frame.length) ? fsync(fd) : -1;
+    int writeErrno = errno;
+    if (result != 0) {
+        // Don't leave a partial frame for the next append to land behind
+        ftruncate(fd, (off_t)self.journalLength);
+    }
+    close(fd);
+    if (result != 0) {
+        if (error) {
+            *error = [OTRErrorUtility errorForGPGError:gcry_error_from_errno(writeErrno ?: EIO)];
+        }
+        return NO;
+    }
+    self.journalLength += frame.length;
+    [self applyOperation:operation key:key record:record];
+    if (self.journalLength >= self.compactionThreshold && self.journalLength >= self.compactedLength) {
+        // The change is already safe in the journal, compaction can wait for the next one
+        [self compactWithError:nil];
+    }
+    return YES;
+}
+
+- (void) stageRecord:(nullable NSData*)record forAccountName:(NSString*)accountName protocol:(NSString*)protocol {
+    OTRAccountStoreOperation operation = record ? OTRAccountStoreOperationSet : OTRAccountStoreOperationRemove;
+    [self applyOperation:operation key:[[self class] keyForAccountName:accountName protocol:protocol] record:record];
+}
+
+- (BOOL) compactWithError:(NSError**)error {
+    if (self.loadError) {
+        if (error) {
+            *error = self.loadError;
+        }
+        return NO;
+    }
+    NSMutableData *compacted = [NSMutableData data];
+    [self enumerateRecordsUsingBlock:^(NSString *accountName, NSString *protocol, NSData *record, BOOL *stop) {
+        [compacted appendData:[[self class] frameWithOperation:OTRAccountStoreOperationSet accountName:accountName protocol:protocol record:record]];
+    }];
+    // Like the journal, only readable by us. writeToFile: would use the default permissions.
+    NSString *temporaryPath = [self.path stringByAppendingString:@"-compacting"];
+    unlink(temporaryPath.fileSystemRepresentation);
+    int fd = open(temporaryPath.fileSystemRepresentation, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        if (error) {
+            *error = [OTRErrorUtility errorForGPGError:gcry_error_from_errno(errno)];
+        }
+        return NO;
+    }
+    const uint8_t *bytes = compacted.bytes;
+    NSUInteger offset = 0;
+    int result = 0;
+    while (offset < compacted.length) {
+        ssize_t written = write(fd, bytes + offset, compacted.length - offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            result = -1;
+            break;
+        }
+        offset += written;
+    }
+    if (result == 0) {
+        result = fsync(fd);
+    }
+    int writeErrno = errno;
+    close(fd);
+    if (result == 0 && rename(temporaryPath.fileSystemRepresentation, self.path.fileSystemRepresentation) != 0) {
+        result = -1;
+        writeErrno = errno;
+    }
+    if (result != 0) {
+        unlink(temporaryPath.fileSystemRepresentation);
+        if (error) {
+            *error = [OTRErrorUtility errorForGPGError:gcry_error_from_errno(writeErrno ?: EIO)];
+        }
+        return NO;
+    }
+    self.compactedLength = compacted.length;
+    // Replaying the journal over the new file is harmless, so a crash before this is fine
+    if ([[NSFileManager defaultManager] fileExistsAtPath:self.journalPath] && truncate(self.journalPath.fileSystemRepresentation, 0) != 0) {
+        if (error) {
+            *error = [OTRErrorUtility errorForGPGError:gcry_error_from_errno(errno)];
+        }
+        return NO;
+    }
+    self.journalLength = 0;
+    return YES;
+}
+
+@end
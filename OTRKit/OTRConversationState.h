@@ -0,0 +1,41 @@
+//
+//  OTRConversationState.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+#import <OTRKit/OTRKit_Public.h>
+
+NS_ASSUME_NONNULL_BEGIN
+/**
+ *  State of one conversation as of its last message state change, published by
+ *  OTRKit so it can be read without waiting on the internal queue.
+ *  @see conversationStateForUsername:accountName:protocol:
+ */
+@interface OTRConversationState : NSObject
+
+@property (nonatomic, copy, readonly) NSString *username;
+@property (nonatomic, copy, readonly) NSString *accountName;
+@property (nonatomic, copy, readonly) NSString *protocol;
+@property (nonatomic, readonly) OTRKitMessageState messageState;
+/** Fingerprint of the current session, if any. A new copy is returned each time. */
+@property (nonatomic, strong, readonly, nullable) OTRFingerprint *fingerprint;
+/** Trust of fingerprint when published, OTRTrustLevelUnknown without one */
+@property (nonatomic, readonly) OTRTrustLevel trustLevel;
+/** Number of remote OTRv3 instances we have contexts for */
+@property (nonatomic, readonly) NSUInteger instanceCount;
+
+- (instancetype) initWithUsername:(NSString*)username
+                      accountName:(NSString*)accountName
+                         protocol:(NSString*)protocol
+                     messageState:(OTRKitMessageState)messageState
+                      fingerprint:(nullable OTRFingerprint*)fingerprint
+                    instanceCount:(NSUInteger)instanceCount NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+@end
+NS_ASSUME_NONNULL_END
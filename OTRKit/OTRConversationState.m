@@ -0,0 +1,43 @@
+//
+//  OTRConversationState.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRConversationState.h"
+
+@implementation OTRConversationState
+
+- (instancetype) initWithUsername:(NSString*)username
+                      accountName:(NSString*)accountName
+                         protocol:(NSString*)protocol
+                     messageState:(OTRKitMessageState)messageState
+                      fingerprint:(nullable OTRFingerprint*)fingerprint
+                    instanceCount:(NSUInteger)instanceCount {
+    if (self = [super init]) {
+        _username = [username copy];
+        _accountName = [accountName copy];
+        _protocol = [protocol copy];
+        _messageState = messageState;
+        _fingerprint = fingerprint;
+        _trustLevel = fingerprint ? fingerprint.trustLevel : OTRTrustLevelUnknown;
+        _instanceCount = instanceCount;
+    }
+    return self;
+}
+
+/** A new object every time, so changing its trustLevel doesn't change the published state */
+- (nullable OTRFingerprint*) fingerprint {
+    if (!_fingerprint) {
+        return nil;
+    }
+    return [[OTRFingerprint alloc] initWithUsername:_fingerprint.username accountName:_fingerprint.accountName protocol:_fingerprint.protocol fingerprint:_fingerprint.fingerprint trustLevel:self.trustLevel];
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p %@ -> %@ (%@) state: %d trust: %d instances: %d>", NSStringFromClass([self class]), self, self.accountName, self.username, self.protocol, (int)self.messageState, (int)self.trustLevel, (int)self.instanceCount];
+}
+
+@end
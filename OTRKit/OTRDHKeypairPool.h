@@ -0,0 +1,48 @@
+//
+//  OTRDHKeypairPool.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+/**
+ *  Process-wide pool of precomputed Diffie-Hellman keypairs.
+ *
+ *  Every AKE and key rotation in libotr needs a fresh 1536-bit DH keypair,
+ *  which is normally computed on OTRKit's internal queue. The pool computes
+ *  them ahead of time on a background queue and libotr draws from it, falling
+ *  back to inline generation when the pool is empty. Keypairs are never reused.
+ *
+ *  The pool is installed the first time an OTRKit instance is created.
+ */
+@interface OTRDHKeypairPool : NSObject
+
+/** Shared pool used by all OTRKit instances */
+@property (class, nonatomic, readonly) OTRDHKeypairPool *sharedPool;
+
+/**
+ *  Maximum number of precomputed keypairs to keep. Setting this to 0 disables
+ *  the pool and frees any keypairs already computed. Defaults to 16.
+ */
+@property (atomic, readwrite) NSUInteger capacity;
+
+/** Number of precomputed keypairs currently available */
+@property (atomic, readonly) NSUInteger count;
+
+/**
+ *  Top up the pool to capacity on a background queue. This happens
+ *  automatically whenever a keypair is taken, but you may want to prewarm
+ *  the pool before starting many sessions at once.
+ *
+ *  @param completion called on main queue with the number of keypairs available once filled
+ */
+- (void) fillWithCompletion:(nullable void (^)(NSUInteger count))completion;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+@end
+NS_ASSUME_NONNULL_END
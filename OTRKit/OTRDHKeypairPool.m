@@ -0,0 +1,203 @@
+//
+//  OTRDHKeypairPool.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRDHKeypairPool.h"
+#import <libotr/dh.h>
+
+static const NSUInteger kOTRDHKeypairPoolDefaultCapacity = 16;
+
+@interface OTRDHKeypairPool ()
+/** Guards the keypair storage ivars and fillCompletions */
+@property (nonatomic, strong, readonly) dispatch_queue_t poolQueue;
+@property (nonatomic, strong, readonly) dispatch_queue_t workerQueue;
+@property (nonatomic, strong, readonly) NSMutableArray<void (^)(NSUInteger count)> *fillCompletions;
+@end
+
+@implementation OTRDHKeypairPool {
+    DH_keypair *_keypairs;
+    NSUInteger _count;
+    NSUInteger _capacity;
+    NSUInteger _workerCount;
+    BOOL _installed;
+}
+
+/** Installed in libotr via otrl_dh_set_keypair_generator. Called on an OTRKit internal queue. */
+static gcry_error_t pool_keypair_generator(void *data, unsigned int groupid, DH_keypair *kp)
+{
+    OTRDHKeypairPool *pool = (__bridge OTRDHKeypairPool*)data;
+    return [pool takeKeypairForGroup:groupid keypair:kp];
+}
+
++ (OTRDHKeypairPool*) sharedPool {
+    static OTRDHKeypairPool *sharedPool = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedPool = [[OTRDHKeypairPool alloc] initWithCapacity:kOTRDHKeypairPoolDefaultCapacity];
+    });
+    return sharedPool;
+}
+
+- (instancetype) initWithCapacity:(NSUInteger)capacity {
+    if (self = [super init]) {
+        _poolQueue = dispatch_queue_create("OTRDHKeypairPool Queue", 0);
+        _workerQueue = dispatch_get_global_queue(QOS_CLASS_UTILITY, 0);
+        _fillCompletions = [NSMutableArray array];
+        _capacity = capacity;
+        if (capacity > 0) {
+            _keypairs = calloc(capacity, sizeof(DH_keypair));
+        }
+    }
+    return self;
+}
+
+- (void) dealloc {
+    for (NSUInteger i = 0; i < _count; i++) {
+        otrl_dh_keypair_free(&_keypairs[i]);
+    }
+    free(_keypairs);
+}
+
+/** Called by OTRKit once libotr has been initialized. Keypairs can't be generated before otrl_dh_init. */
+- (void) installAfterLibotrInit {
+    dispatch_async(self.poolQueue, ^{
+        if (self->_installed) {
+            return;
+        }
+        self->_installed = YES;
+        otrl_dh_set_keypair_generator(pool_keypair_generator, (__bridge void *)self);
+        [self scheduleWorkers];
+        [self finishFillIfNeeded];
+    });
+}
+
+#pragma mark Public
+
+- (NSUInteger) capacity {
+    __block NSUInteger capacity = 0;
+    dispatch_sync(self.poolQueue, ^{
+        capacity = self->_capacity;
+    });
+    return capacity;
+}
+
+- (void) setCapacity:(NSUInteger)capacity {
+    dispatch_async(self.poolQueue, ^{
+        while (self->_count > capacity) {
+            self->_count--;
+            otrl_dh_keypair_free(&self->_keypairs[self->_count]);
+        }
+        if (capacity == 0) {
+            free(self->_keypairs);
+            self->_keypairs = NULL;
+        } else {
+            DH_keypair *keypairs = realloc(self->_keypairs, capacity * sizeof(DH_keypair));
+            if (!keypairs) {
+                return;
+            }
+            self->_keypairs = keypairs;
+        }
+        self->_capacity = capacity;
+        [self scheduleWorkers];
+        [self finishFillIfNeeded];
+    });
+}
+
+- (NSUInteger) count {
+    __block NSUInteger count = 0;
+    dispatch_sync(self.poolQueue, ^{
+        count = self->_count;
+    });
+    return count;
+}
+
+- (void) fillWithCompletion:(void (^)(NSUInteger count))completion {
+    dispatch_async(self.poolQueue, ^{
+        if (completion) {
+            [self.fillCompletions addObject:completion];
+        }
+        [self scheduleWorkers];
+        [self finishFillIfNeeded];
+    });
+}
+
+#pragma mark Private
+
+/** Called from libotr on any thread */
+- (gcry_error_t) takeKeypairForGroup:(unsigned int)groupid keypair:(DH_keypair*)kp {
+    __block BOOL found = NO;
+    dispatch_sync(self.poolQueue, ^{
+        if (groupid == DH1536_GROUP_ID && self->_count > 0) {
+            self->_count--;
+            *kp = self->_keypairs[self->_count];
+            found = YES;
+        }
+        [self scheduleWorkers];
+    });
+    if (!found) {
+        return gcry_error(GPG_ERR_NO_DATA);
+    }
+    return gcry_error(GPG_ERR_NO_ERROR);
+}
+
+/** Must be called on poolQueue. Use at most half the cores so we don't compete with the AKEs we're trying to speed up. */
+- (void) scheduleWorkers {
+    if (!_installed) {
+        return;
+    }
+    NSUInteger maxWorkers = MAX(1, [NSProcessInfo processInfo].activeProcessorCount / 2);
+    while (_workerCount < maxWorkers && _count + _workerCount < _capacity) {
+        _workerCount++;
+        dispatch_async(self.workerQueue, ^{
+            [self runWorker];
+        });
+    }
+}
+
+/** Runs on workerQueue, generating keypairs until the pool is full */
+- (void) runWorker {
+    __block BOOL keepGoing = YES;
+    while (keepGoing) {
+        __block DH_keypair keypair;
+        otrl_dh_keypair_init(&keypair);
+        gcry_error_t error = otrl_dh_gen_keypair_direct(DH1536_GROUP_ID, &keypair);
+        dispatch_sync(self.poolQueue, ^{
+            if (!error && self->_count < self->_capacity) {
+                self->_keypairs[self->_count] = keypair;
+                self->_count++;
+            } else {
+                otrl_dh_keypair_free(&keypair);
+            }
+            // Other workers will fill the remaining slots
+            keepGoing = !error && self->_count + self->_workerCount - 1 < self->_capacity;
+            if (!keepGoing) {
+                self->_workerCount--;
+            }
+            [self finishFillIfNeeded];
+        });
+    }
+}
+
+/** Must be called on poolQueue */
+- (void) finishFillIfNeeded {
+    if (!self.fillCompletions.count) {
+        return;
+    }
+    if (!_installed || (_count < _capacity && _workerCount > 0)) {
+        return;
+    }
+    NSArray<void (^)(NSUInteger count)> *completions = [self.fillCompletions copy];
+    [self.fillCompletions removeAllObjects];
+    NSUInteger count = _count;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        for (void (^completion)(NSUInteger count) in completions) {
+            completion(count);
+        }
+    });
+}
+
+@end
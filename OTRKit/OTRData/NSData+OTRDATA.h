@@ -13,7 +13,19 @@
 /** Returns SHA-1 Digest of NSData */
 - (nullable NSData*) otr_SHA1;
 
-/** Returns hexadecimal string of NSData. Empty string if data is empty. */
+/** Returns SHA-256 Digest of NSData */
+- (nullable NSData*) otr_SHA256;
+
+/** Returns lowercase hexadecimal string of NSData. Empty string if data is empty. */
 - (nonnull NSString*) otr_hexString;
 
+/** Parses upper or lowercase hex. Returns nil for odd lengths or anything that isn't hex. */
++ (nullable instancetype) otr_dataWithHexString:(nonnull NSString*)hexString;
+
+/** zlib stream, i.e. HTTP's "deflate" content coding. Returns nil unless it came out smaller. */
+- (nullable NSData*) otr_deflatedData;
+
+/** Inflates a zlib stream that must come out to exactly length bytes. Returns nil otherwise. */
+- (nullable NSData*) otr_inflatedDataWithLength:(NSUInteger)length;
+
 @end
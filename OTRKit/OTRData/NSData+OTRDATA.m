@@ -7,33 +7,114 @@
 //
 
 #import "NSData+OTRDATA.h"
-#import <CommonCrypto/CommonDigest.h>
+#import "OTRDigest.h"
+#import <zlib.h>
+
+/** Both hex digits of every byte value, written two at a time */
+static uint16_t OTRHexEncodeTable[256];
+/** Nibble for every character, 0xff for anything that isn't hex */
+static uint8_t OTRHexDecodeTable[256];
+
+static void OTRBuildHexTables(void) {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        const char *digits = "0123456789abcdef";
+        for (NSUInteger i = 0; i < 256; i++) {
+            char pair[2] = {digits[i >> 4], digits[i & 0xf]};
+            memcpy(&OTRHexEncodeTable[i], pair, sizeof(pair));
+        }
+        memset(OTRHexDecodeTable, 0xff, sizeof(OTRHexDecodeTable));
+        for (uint8_t i = 0; i < 10; i++) {
+            OTRHexDecodeTable['0' + i] = i;
+        }
+        for (uint8_t i = 0; i < 6; i++) {
+            OTRHexDecodeTable['a' + i] = 10 + i;
+            OTRHexDecodeTable['A' + i] = 10 + i;
+        }
+    });
+}
 
 @implementation NSData (OTRDATA)
 
 - (NSData*) otr_SHA1 {
-    NSMutableData *digest = [NSMutableData dataWithLength:CC_SHA1_DIGEST_LENGTH];
-    if (!digest) {
+    return [OTRDigest digestWithAlgorithm:OTRDigestAlgorithmSHA1 data:self];
+}
+
+- (NSData*) otr_SHA256 {
+    return [OTRDigest digestWithAlgorithm:OTRDigestAlgorithmSHA256 data:self];
+}
+
+- (NSString *)otr_hexString {
+    NSUInteger dataLength = self.length;
+    if (!dataLength) {
+        return [NSString string];
+    }
+    OTRBuildHexTables();
+    uint16_t *hex = malloc(dataLength * 2);
+    if (!hex) {
+        return [NSString string];
+    }
+    __block uint16_t *out = hex;
+    [self enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        const uint8_t *in = bytes;
+        for (NSUInteger i = 0; i < byteRange.length; i++) {
+            out[i] = OTRHexEncodeTable[in[i]];
+        }
+        out += byteRange.length;
+    }];
+    return [[NSString alloc] initWithBytesNoCopy:hex length:dataLength * 2 encoding:NSASCIIStringEncoding freeWhenDone:YES];
+}
+
++ (instancetype) otr_dataWithHexString:(NSString*)hexString {
+    const char *hex = hexString.UTF8String;
+    size_t hexLength = hex ? strlen(hex) : 0;
+    if (hexLength % 2) {
         return nil;
     }
-    CC_SHA1(self.bytes, (CC_LONG)self.length, digest.mutableBytes);
-    return digest;
+    OTRBuildHexTables();
+    NSUInteger dataLength = hexLength / 2;
+    uint8_t *bytes = malloc(MAX(dataLength, 1));
+    if (!bytes) {
+        return nil;
+    }
+    // OR the nibbles together so one check per byte catches any bad character
+    for (NSUInteger i = 0; i < dataLength; i++) {
+        uint8_t high = OTRHexDecodeTable[(uint8_t)hex[i * 2]];
+        uint8_t low = OTRHexDecodeTable[(uint8_t)hex[i * 2 + 1]];
+        if ((high | low) & 0xf0) {
+            free(bytes);
+            return nil;
+        }
+        bytes[i] = (uint8_t)(high << 4) | low;
+    }
+    return [self dataWithBytesNoCopy:bytes length:dataLength freeWhenDone:YES];
 }
 
-// http://stackoverflow.com/a/9084784/805882
-- (NSString *)otr_hexString {    
-    const unsigned char *dataBuffer = (const unsigned char *)[self bytes];
-    
-    if (!dataBuffer)
-        return [NSString string];
-    
-    NSUInteger          dataLength  = [self length];
-    NSMutableString     *hexString  = [NSMutableString stringWithCapacity:(dataLength * 2)];
-    
-    for (int i = 0; i < dataLength; ++i)
-        [hexString appendString:[NSString stringWithFormat:@"%02lx", (unsigned long)dataBuffer[i]]];
-    
-    return [NSString stringWithString:hexString];
+- (nullable NSData*) otr_deflatedData {
+    if (!self.length || self.length > UINT32_MAX) {
+        return nil;
+    }
+    // Anything at least as long as the input is useless to the caller
+    uLongf deflatedLength = self.length - 1;
+    NSMutableData *deflated = [NSMutableData dataWithLength:deflatedLength];
+    if (compress2(deflated.mutableBytes, &deflatedLength, self.bytes, self.length, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        return nil;
+    }
+    deflated.length = deflatedLength;
+    return deflated;
+}
+
+- (nullable NSData*) otr_inflatedDataWithLength:(NSUInteger)length {
+    if (!self.length || length > UINT32_MAX) {
+        return nil;
+    }
+    // The output buffer is the limit, a stream that inflates past it fails instead of growing
+    uLongf inflatedLength = length;
+    NSMutableData *inflated = [NSMutableData dataWithLength:length];
+    if (uncompress(inflated.mutableBytes, &inflatedLength, self.bytes, self.length) != Z_OK || inflatedLength != length) {
+        return nil;
+    }
+    return inflated;
 }
 
 @end
@@ -0,0 +1,64 @@
+//
+//  OTRDataContentStore.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+/** File data shared by every outgoing transfer of the same file */
+@interface OTRDataContent : NSObject
+/** Hex SHA-1 of data */
+@property (nonatomic, strong, readonly) NSString *fileHash;
+@property (nonatomic, strong, readonly) NSData *data;
+/** Number of transfers using this content */
+@property (nonatomic, readonly) NSUInteger transferCount;
+
+- (instancetype) init NS_UNAVAILABLE;
+@end
+
+/**
+ *  Reference counted store of outgoing file data keyed by SHA-1, so sending the
+ *  same file to many peers hashes and holds it once.
+ *
+ *  The same NSData instance or file (by path, size and modification date) is
+ *  only hashed the first time. Different buffers with the same contents are
+ *  hashed but share the first buffer. Files are memory mapped when possible.
+ *  Content is dropped once its last transfer releases it.
+ *
+ *  Chunks served to peers are kept in a small cache, so each recipient asking
+ *  for the same range doesn't copy it out again.
+ *
+ *  Not thread safe, OTRDataHandler only uses it from its internal queue.
+ */
+@interface OTRDataContentStore : NSObject
+
+/** Upper bound on bytes of cached chunks */
+@property (nonatomic, readwrite) NSUInteger chunkCacheLimit;
+
+/** Number of unique files currently stored */
+@property (nonatomic, readonly) NSUInteger contentCount;
+
+/** Bytes of file data currently stored */
+@property (nonatomic, readonly) NSUInteger residentBytes;
+
+- (instancetype) initWithChunkCacheLimit:(NSUInteger)chunkCacheLimit NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+/** Returns shared content for data, adding a reference. Balance with releaseContent: */
+- (OTRDataContent*) retainContentWithData:(NSData*)data;
+
+/** Returns shared content for a file, adding a reference. Balance with releaseContent: */
+- (nullable OTRDataContent*) retainContentWithFileURL:(NSURL*)fileURL error:(NSError**)error;
+
+- (void) releaseContent:(OTRDataContent*)content;
+
+/** Returns the bytes in range, or nil if range is out of bounds */
+- (nullable NSData*) chunkForContent:(OTRDataContent*)content range:(NSRange)range;
+
+@end
+NS_ASSUME_NONNULL_END
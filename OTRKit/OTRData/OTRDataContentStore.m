@@ -0,0 +1,167 @@
+//
+//  OTRDataContentStore.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRDataContentStore.h"
+#import "NSData+OTRDATA.h"
+
+@interface OTRDataContent ()
+@property (nonatomic, readwrite) NSUInteger transferCount;
+/** Keys in OTRDataContentStore's fileContents pointing at this content */
+@property (nonatomic, strong, readonly) NSMutableSet<NSString*> *fileKeys;
+@end
+
+@implementation OTRDataContent
+
+- (instancetype) initWithFileHash:(NSString*)fileHash data:(NSData*)data {
+    if (self = [super init]) {
+        _fileHash = fileHash;
+        _data = data;
+        _fileKeys = [NSMutableSet set];
+    }
+    return self;
+}
+
+/** Length is part of the key, like OTRDATA offers */
+- (NSString*) storeKey {
+    return [NSString stringWithFormat:@"%@-%lu", self.fileHash, (unsigned long)self.data.length];
+}
+
+@end
+
+@interface OTRDataContentStore ()
+/** OTRDataContent keyed to hash and length */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, OTRDataContent*> *contents;
+/** OTRDataContent keyed to file path, size and modification date */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, OTRDataContent*> *fileContents;
+/** OTRDataContent keyed weakly by NSData identity, so the same buffer isn't hashed twice */
+@property (nonatomic, strong, readonly) NSMapTable<NSData*, OTRDataContent*> *bufferContents;
+@property (nonatomic, strong, readonly) NSCache<NSString*, NSData*> *chunkCache;
+@end
+
+@implementation OTRDataContentStore
+
+- (instancetype) initWithChunkCacheLimit:(NSUInteger)chunkCacheLimit {
+    if (self = [super init]) {
+        _contents = [NSMutableDictionary dictionary];
+        _fileContents = [NSMutableDictionary dictionary];
+        _bufferContents = [[NSMapTable alloc] initWithKeyOptions:NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality valueOptions:NSPointerFunctionsStrongMemory capacity:0];
+        _chunkCache = [[NSCache alloc] init];
+        self.chunkCacheLimit = chunkCacheLimit;
+    }
+    return self;
+}
+
+- (void) setChunkCacheLimit:(NSUInteger)chunkCacheLimit {
+    _chunkCacheLimit = chunkCacheLimit;
+    self.chunkCache.totalCostLimit = chunkCacheLimit;
+    if (!chunkCacheLimit) {
+        [self.chunkCache removeAllObjects];
+    }
+}
+
+- (NSUInteger) contentCount {
+    return self.contents.count;
+}
+
+- (NSUInteger) residentBytes {
+    NSUInteger residentBytes = 0;
+    for (OTRDataContent *content in self.contents.allValues) {
+        residentBytes += content.data.length;
+    }
+    return residentBytes;
+}
+
+- (OTRDataContent*) retainContentWithData:(NSData*)data {
+    OTRDataContent *content = [self.bufferContents objectForKey:data];
+    if (content.transferCount) {
+        content.transferCount++;
+        return content;
+    }
+    NSString *fileHash = [[data otr_SHA1] otr_hexString];
+    content = [self retainContentWithFileHash:fileHash data:data];
+    [self.bufferContents setObject:content forKey:data];
+    return content;
+}
+
+- (nullable OTRDataContent*) retainContentWithFileURL:(NSURL*)fileURL error:(NSError**)error {
+    NSString *path = fileURL.path;
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:error];
+    if (!attributes) {
+        return nil;
+    }
+    NSString *fileKey = [NSString stringWithFormat:@"%@-%llu-%f", path, attributes.fileSize, attributes.fileModificationDate.timeIntervalSinceReferenceDate];
+    OTRDataContent *content = [self.fileContents objectForKey:fileKey];
+    if (content) {
+        content.transferCount++;
+        return content;
+    }
+    NSData *data = [NSData dataWithContentsOfURL:fileURL options:NSDataReadingMappedIfSafe error:error];
+    if (!data) {
+        return nil;
+    }
+    NSString *fileHash = [[data otr_SHA1] otr_hexString];
+    content = [self retainContentWithFileHash:fileHash data:data];
+    [self.fileContents setObject:content forKey:fileKey];
+    [content.fileKeys addObject:fileKey];
+    return content;
+}
+
+- (OTRDataContent*) retainContentWithFileHash:(NSString*)fileHash data:(NSData*)data {
+    OTRDataContent *content = [[OTRDataContent alloc] initWithFileHash:fileHash data:data];
+    OTRDataContent *existingContent = [self.contents objectForKey:content.storeKey];
+    if (existingContent) {
+        content = existingContent;
+    } else {
+        [self.contents setObject:content forKey:content.storeKey];
+    }
+    content.transferCount++;
+    return content;
+}
+
+- (void) releaseContent:(OTRDataContent*)content {
+    NSParameterAssert(content.transferCount > 0);
+    if (!content.transferCount) {
+        return;
+    }
+    content.transferCount--;
+    if (content.transferCount) {
+        return;
+    }
+    [self.contents removeObjectForKey:content.storeKey];
+    [self.fileContents removeObjectsForKeys:content.fileKeys.allObjects];
+    [content.fileKeys removeAllObjects];
+    // Weak keys to other buffers with this content may still be around
+    NSMutableArray<NSData*> *buffers = [NSMutableArray array];
+    for (NSData *buffer in self.bufferContents) {
+        if ([self.bufferContents objectForKey:buffer] == content) {
+            [buffers addObject:buffer];
+        }
+    }
+    for (NSData *buffer in buffers) {
+        [self.bufferContents removeObjectForKey:buffer];
+    }
+}
+
+- (nullable NSData*) chunkForContent:(OTRDataContent*)content range:(NSRange)range {
+    NSData *data = content.data;
+    if (range.location > data.length || range.length > data.length - range.location) {
+        return nil;
+    }
+    if (!self.chunkCacheLimit) {
+        return [data subdataWithRange:range];
+    }
+    NSString *chunkKey = [NSString stringWithFormat:@"%@:%lu-%lu", content.storeKey, (unsigned long)range.location, (unsigned long)range.length];
+    NSData *chunk = [self.chunkCache objectForKey:chunkKey];
+    if (!chunk) {
+        chunk = [data subdataWithRange:range];
+        [self.chunkCache setObject:chunk forKey:chunkKey cost:chunk.length];
+    }
+    return chunk;
+}
+
+@end
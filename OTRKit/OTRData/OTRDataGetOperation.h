@@ -13,9 +13,9 @@
 
 NS_ASSUME_NONNULL_BEGIN
 /**
- The `OTRDataGetOperation` class is a small wrapper to control the number of get requests that can be open at one given time.
- There's no real heavy lifting going on here just makes a request and hands it off to the dataHandler. The dataHandler is then
- in charge of keeping track of the operation and marking it as completed when the data is received.
+ The `OTRDataGetOperation` class is a small wrapper around one chunk GET request. The dataHandler's OTRDataTransferScheduler
+ decides when it's started, which just sends the request. The dataHandler is then in charge of keeping track of the operation
+ and marking it as completed when the data is received.
  */
 @interface OTRDataGetOperation : NSOperation
 
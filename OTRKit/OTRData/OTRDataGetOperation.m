@@ -13,8 +13,8 @@
 
 @interface OTRDataGetOperation ()
 
-@property (nonatomic) BOOL requesting;
-@property (nonatomic) BOOL completed;
+@property (atomic) BOOL requesting;
+@property (atomic) BOOL completed;
 
 @end
 
@@ -30,7 +30,10 @@
         NSString *rangeString = [NSString stringWithFormat:@"bytes=%d-%d", (int)range.location, (int)(range.location + range.length - 1)];
         
         NSString *requestId = [[NSUUID UUID] UUIDString];
-        NSDictionary *headers = @{kHTTPHeaderRange: rangeString, kHTTPHeaderRequestID: requestId};
+        NSMutableDictionary *headers = [@{kHTTPHeaderRange: rangeString, kHTTPHeaderRequestID: requestId} mutableCopy];
+        if (transfer.acceptEncoding) {
+            [headers setObject:transfer.acceptEncoding forKey:kHTTPHeaderAcceptEncoding];
+        }
         
         _request = [[OTRDataRequest alloc] initWithRequestId:requestId url:transfer.offeredURL httpMethod:@"GET" httpHeaders:headers];
         _request.range = range;
@@ -40,6 +43,9 @@
 }
 
 - (void)requestCompleted {
+    if (self.completed) {
+        return;
+    }
     [self willChangeValueForKey:NSStringFromSelector(@selector(isFinished))];
     self.completed = YES;
     [self didChangeValueForKey:NSStringFromSelector(@selector(isFinished))];
@@ -49,6 +55,11 @@
 
 - (void)start
 {
+    // Cancelled before it got a turn, never send the request
+    if (self.isCancelled) {
+        [self requestCompleted];
+        return;
+    }
     [self willChangeValueForKey:NSStringFromSelector(@selector(isExecuting))];
     self.requesting = YES;
     [self didChangeValueForKey:NSStringFromSelector(@selector(isExecuting))];
@@ -58,6 +69,15 @@
     
 }
 
+- (void)cancel
+{
+    [super cancel];
+    // The response may never come, don't hold a slot in the queue waiting for it
+    if (self.requesting) {
+        [self requestCompleted];
+    }
+}
+
 - (BOOL)isAsynchronous
 {
     return YES;
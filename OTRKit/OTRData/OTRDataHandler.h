@@ -9,21 +9,44 @@
 #import <OTRKit/OTRDataTransfer.h>
 #import <OTRKit/OTRDataOutgoingTransfer.h>
 #import <OTRKit/OTRDataIncomingTransfer.h>
+#import <OTRKit/OTRDataManifestTransfer.h>
 #import <OTRKit/OTRTLVHandler.h>
+#import <OTRKit/OTRDataHandlerStats.h>
+#import <OTRKit/OTRNotificationCoalescer.h>
 
 @class OTRKit;
 @class OTRDataHandler;
 
 NS_ASSUME_NONNULL_BEGIN
 extern  NSString* OTRKitGetMimeTypeForExtension(NSString* extension);
+/** YES for image, audio, video and archive types that deflate wouldn't shrink */
+extern  BOOL OTRKitIsCompressedMimeType(NSString * _Nullable mimeType);
 extern  NSString *const kHTTPHeaderRange;
 extern  NSString *const kHTTPHeaderRequestID;
+extern  NSString *const kHTTPHeaderAcceptEncoding;
+/** Domain for OTRDataError */
+extern  NSString *const kOTRDataErrorDomain;
+
+typedef NS_ENUM(NSInteger, OTRDataError) {
+    OTRDataErrorIncompleteHeaders = 100,
+    OTRDataErrorFileTooLarge = 101,
+    OTRDataErrorBadHash = 102,
+    /** Cancelled with cancelTransfer: */
+    OTRDataErrorCancelled = 103,
+    /** The offer was never fetched or accepted, or the transfer stopped making progress */
+    OTRDataErrorExpired = 104,
+    /** Removed to stay under maxResidentBytes */
+    OTRDataErrorEvicted = 105,
+    /** The peer answered a request with an error status */
+    OTRDataErrorBadResponse = 106
+};
 
 @protocol OTRDataHandlerDelegate <NSObject>
 
+/** fingerprint is nil for transfers that were cancelled, expired or evicted */
 - (void)dataHandler:(OTRDataHandler*)dataHandler
            transfer:(OTRDataTransfer*)transfer
-        fingerprint:(OTRFingerprint*)fingerprint
+        fingerprint:(nullable OTRFingerprint*)fingerprint
               error:(NSError*)error;
 
 - (void)dataHandler:(OTRDataHandler*)dataHandler
@@ -53,7 +76,33 @@ extern  NSString *const kHTTPHeaderRequestID;
  *  All OTRDataHandlerDelegate callbacks will be done on this queue.
  *  Defaults to main queue.
  */
-@property (nonatomic, strong, readwrite, nullable) dispatch_queue_t callbackQueue;
+@property (nonatomic, strong, readwrite, null_resettable) dispatch_queue_t callbackQueue;
+
+/**
+ *  Progress callbacks for a transfer are delivered at most this often, only
+ *  the latest is kept in between. Callbacks for different transfers are
+ *  batched into one block on the callbackQueue. Offers, completions and
+ *  errors are never delayed or dropped, and arrive after any pending progress
+ *  for the same transfer. Defaults to 0.25 seconds.
+ */
+@property (atomic, readwrite) NSTimeInterval progressInterval;
+
+/**
+ *  In OTRKitCallbackModeInline, delegate methods are called right away on
+ *  the handler's internal queue instead of going through the callbackQueue,
+ *  and progressInterval doesn't apply (progressStep still does). The same
+ *  rules as OTRKit's callbackMode apply: return quickly, and don't wait on
+ *  anything that might be waiting on this handler. stats, chunkCacheLimit
+ *  and expireStaleTransfers are safe to call from these callbacks.
+ *  Set it before starting transfers. Defaults to OTRKitCallbackModeQueue.
+ */
+@property (atomic, readwrite) OTRKitCallbackMode callbackMode;
+
+/**
+ *  Progress changes smaller than this fraction of the file aren't reported.
+ *  Progress of 1 is always reported. Defaults to 0.01 (1%).
+ */
+@property (atomic, readwrite) float progressStep;
 
 /**
  *  Implement a delegate listener to handle file events.
@@ -67,22 +116,121 @@ extern  NSString *const kHTTPHeaderRequestID;
 
 - (instancetype) init NS_UNAVAILABLE;
 
+#pragma mark Transfer Lifecycle
+
+/**
+ *  Offers that haven't been fetched (outgoing) or started (incoming) within
+ *  this many seconds are removed and reported with OTRDataErrorExpired.
+ *  0 disables. Defaults to 1 hour.
+ */
+@property (atomic, readwrite) NSTimeInterval offerTimeout;
+
+/**
+ *  Transfers that have started but haven't sent or received a chunk within
+ *  this many seconds are removed and reported with OTRDataErrorExpired.
+ *  0 disables. Defaults to 2 minutes.
+ */
+@property (atomic, readwrite) NSTimeInterval idleTimeout;
+
+/**
+ *  Soft limit on file bytes held by all transfers. When exceeded, the least
+ *  recently active transfers are removed and reported with OTRDataErrorEvicted
+ *  until back under the limit. A single transfer larger than the limit is
+ *  evicted as well. 0 is unlimited, which is the default.
+ */
+@property (atomic, readwrite) NSUInteger maxResidentBytes;
+
+/**
+ *  Incoming transfers save received chunks here, so a download interrupted by
+ *  a dropped session or restart resumes when the same file (by File-Hash-SHA1
+ *  and length) is offered and started again. Only the missing ranges are
+ *  requested. Checkpoints are kept when a transfer expires or is evicted and
+ *  deleted when it completes or is cancelled.
+ *
+ *  Defaults to an "OTRDATA" folder inside OTRKit's dataPath. nil disables.
+ */
+@property (atomic, copy, readwrite, nullable) NSString *checkpointDirectory;
+
+/** Checkpoints that haven't been written to in this long are deleted. 0 keeps them forever. Defaults to 7 days. */
+@property (atomic, readwrite) NSTimeInterval checkpointTimeout;
+
+/**
+ *  Stops an incoming or outgoing transfer, cancels its outstanding chunk
+ *  requests and releases its file data. The delegate is notified with
+ *  OTRDataErrorCancelled. Does nothing if the transfer already finished.
+ */
+- (void) cancelTransfer:(OTRDataTransfer*)transfer;
+
+/**
+ *  Removes expired transfers right away instead of waiting for the next
+ *  periodic sweep, then applies maxResidentBytes.
+ *
+ *  @return number of transfers expired or evicted
+ */
+- (NSUInteger) expireStaleTransfers;
+
+/** Current transfer counts and memory use. Blocks while the internal queue is busy. */
+- (OTRDataHandlerStats*) stats;
+
 #pragma mark Sending Data
 
-/** For now, this won't work for large files because of RAM limitations */
-- (void) sendFileWithURL:(NSURL*)fileURL
-                username:(NSString*)username
-             accountName:(NSString*)accountName
-                protocol:(NSString*)protocol
-                     tag:(nullable id)tag;
-
-/** For now, this won't work for large files because of RAM limitations */
-- (void) sendFileWithName:(NSString*)fileName
-                 fileData:(NSData*)fileData
-                 username:(NSString*)username
-              accountName:(NSString*)accountName
-                 protocol:(NSString*)protocol
-                      tag:(nullable id)tag;
+/**
+ *  Outgoing transfers of the same file share one buffer, so sending a file to
+ *  many peers hashes and holds it once. This caps the bytes of recently served
+ *  chunks kept around for other peers requesting the same ranges. 0 disables
+ *  the chunk cache. Defaults to 1 MB.
+ */
+@property (atomic, readwrite) NSUInteger chunkCacheLimit;
+
+/**
+ *  Negotiates "deflate" compression of chunks with the peer. Offers carry an
+ *  Accept-Encoding header unless the file's Mime-Type is already compressed,
+ *  the receiver echoes it on each GET, and chunks that come out smaller are
+ *  sent with Content-Encoding: deflate. Peers that don't know the headers
+ *  ignore them and get plain chunks. Defaults to YES.
+ */
+@property (atomic, readwrite) BOOL compressesChunks;
+
+/**
+ *  For now, this won't work for large files because of RAM limitations
+ *
+ *  @return the transfer, which can be passed to cancelTransfer:, or nil if the file couldn't be read
+ */
+- (nullable OTRDataOutgoingTransfer*) sendFileWithURL:(NSURL*)fileURL
+                                             username:(NSString*)username
+                                          accountName:(NSString*)accountName
+                                             protocol:(NSString*)protocol
+                                                  tag:(nullable id)tag;
+
+/**
+ *  For now, this won't work for large files because of RAM limitations
+ *
+ *  @return the transfer, which can be passed to cancelTransfer:
+ */
+- (OTRDataOutgoingTransfer*) sendFileWithName:(NSString*)fileName
+                                     fileData:(NSData*)fileData
+                                     username:(NSString*)username
+                                  accountName:(NSString*)accountName
+                                     protocol:(NSString*)protocol
+                                          tag:(nullable id)tag;
+
+/**
+ *  Offers several files with one OFFER. The receiver gets a single
+ *  OTRDataManifestTransfer to accept, and the chunks of all files go through
+ *  one request pipeline, so a batch of small files costs one offer round trip
+ *  instead of one per file. Each file still completes on its own. Peers that
+ *  don't support manifests reject the offer and the transfers expire after
+ *  offerTimeout. Fails with OTRDataErrorFileTooLarge if the file list doesn't
+ *  fit in one message, a few hundred files depending on name lengths.
+ *
+ *  @return one transfer per file, in order, which can be passed to cancelTransfer:
+ */
+- (NSArray<OTRDataOutgoingTransfer*>*) sendFilesWithNames:(NSArray<NSString*>*)fileNames
+                                                 fileData:(NSArray<NSData*>*)fileData
+                                                 username:(NSString*)username
+                                              accountName:(NSString*)accountName
+                                                 protocol:(NSString*)protocol
+                                                      tag:(nullable id)tag;
 
 /** Used internally for access to directly send a request */
 - (void) sendRequest:(OTRDataRequest*)request
@@ -93,8 +241,24 @@ extern  NSString *const kHTTPHeaderRequestID;
 
 #pragma mark Receiving Data
 
+/**
+ *  Chunk GETs waiting on a response across all started incoming transfers.
+ *  Queued chunks of every transfer take turns for these, weighted by each
+ *  transfer's priority, so a small file isn't stuck behind a big one.
+ *  Defaults to 16.
+ */
+@property (atomic, readwrite) NSUInteger maxOutstandingRequests;
+
+/**
+ *  Chunk GETs waiting on a response for any one peer, so one conversation
+ *  can't take every request. Peers take turns like transfers do. Defaults to 5.
+ */
+@property (atomic, readwrite) NSUInteger maxOutstandingRequestsPerPeer;
+
 /**
  *  Use this to start a transfer offered by the delegate method dataHandler:offeredTransfer:
+ *  Starting an OTRDataManifestTransfer starts all of its files. Set the
+ *  transfer's priority to change its share of chunk requests.
  *
  *  @param transfer transfer to be started
  */
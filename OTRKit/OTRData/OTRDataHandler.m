@@ -10,12 +10,17 @@
 #import "OTRHTTPMessage.h"
 #import "OTRDataTransfer.h"
 #import "OTRDataIncomingTransfer.h"
+#import "OTRDataManifestTransfer.h"
 #import "OTRDataOutgoingTransfer.h"
 #import "OTRTLV.h"
 #import "OTRKit.h"
 #import "NSData+OTRDATA.h"
 #import "OTRDataRequest.h"
 #import "OTRDataGetOperation.h"
+#import "OTRDataTransferScheduler.h"
+#import "OTRDataTransferCheckpoint.h"
+#import "OTRDataContentStore.h"
+#import "OTRNotificationCoalescer.h"
 
 #if TARGET_OS_IPHONE
 #import <MobileCoreServices/MobileCoreServices.h>
@@ -24,18 +29,37 @@
 #endif
 
 NSString * const kOTRDataHandlerURLScheme = @"otr-in-band";
-static NSString * const kOTRDataErrorDomain = @"org.chatsecure.OTRDataError";
+NSString * const kOTRDataErrorDomain = @"org.chatsecure.OTRDataError";
 
 NSString * const kHTTPHeaderRange = @"Range";
 NSString * const kHTTPHeaderRequestID = @"Request-Id";
+NSString * const kHTTPHeaderAcceptEncoding = @"Accept-Encoding";
+static NSString * const kHTTPHeaderContentEncoding = @"Content-Encoding";
+static NSString * const kOTRDataContentEncodingDeflate = @"deflate";
 static NSString * const kHTTPHeaderFileLength = @"File-Length";
 static NSString * const kHTTPHeaderFileHashSHA1 = @"File-Hash-SHA1";
 static NSString * const kHTTPHeaderMimeType = @"Mime-Type";
 static NSString * const kHTTPHeaderFileName = @"File-Name";
+static NSString * const kHTTPHeaderContentType = @"Content-Type";
+/** Body of a manifest OFFER, a JSON array with the offer headers of each file plus its Url */
+static NSString * const kOTRDataManifestContentType = @"application/vnd.otrdata-manifest+json";
+static NSString * const kOTRDataManifestURLKey = @"Url";
+/** Leaves room for the headers in a TLV, which can't be longer than UINT16_MAX */
+static const NSUInteger kOTRDataMaxManifestLength = 60000;
 
 static const NSUInteger kOTRDataMaxChunkLength = 16384;
 static const NSUInteger kOTRDataMaxFileSize = 1024*1024*64;
-static const NSUInteger kOTRDataMaxOutstandingRequests = 5;
+static const NSUInteger kOTRDataDefaultMaxOutstandingRequests = 16;
+static const NSUInteger kOTRDataDefaultMaxOutstandingRequestsPerPeer = 5;
+static const NSTimeInterval kOTRDataDefaultOfferTimeout = 60 * 60;
+static const NSTimeInterval kOTRDataDefaultIdleTimeout = 2 * 60;
+static const NSTimeInterval kOTRDataDefaultCheckpointTimeout = 7 * 24 * 60 * 60;
+static NSString * const kOTRDataCheckpointDirectoryName = @"OTRDATA";
+static const NSUInteger kOTRDataDefaultChunkCacheLimit = 1024 * 1024;
+static const NSTimeInterval kOTRDataDefaultProgressInterval = 0.25;
+static const float kOTRDataDefaultProgressStep = 0.01;
+/** How often stale transfers are swept */
+static const NSTimeInterval kOTRDataSweepInterval = 30;
 
 NSString* OTRKitGetMimeTypeForExtension(NSString* extension) {
     NSString* mimeType = @"application/octet-stream";
@@ -50,6 +74,31 @@ NSString* OTRKitGetMimeTypeForExtension(NSString* extension) {
     return mimeType;
 }
 
+BOOL OTRKitIsCompressedMimeType(NSString *mimeType) {
+    mimeType = [mimeType lowercaseString];
+    if (!mimeType.length) {
+        return NO;
+    }
+    static NSSet<NSString*> *uncompressedMediaTypes = nil;
+    static NSSet<NSString*> *compressedApplicationTypes = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        uncompressedMediaTypes = [NSSet setWithObjects:@"image/svg+xml", @"image/bmp", @"image/x-ms-bmp", @"image/tiff", @"audio/wav", @"audio/x-wav", @"audio/aiff", @"audio/x-aiff", nil];
+        compressedApplicationTypes = [NSSet setWithObjects:@"application/zip", @"application/gzip", @"application/x-gzip", @"application/x-bzip2", @"application/x-xz", @"application/x-7z-compressed", @"application/x-rar-compressed", @"application/vnd.rar", @"application/pdf", @"application/epub+zip", @"application/java-archive", @"application/vnd.android.package-archive", @"application/x-apple-diskimage", nil];
+    });
+    if ([uncompressedMediaTypes containsObject:mimeType]) {
+        return NO;
+    }
+    if ([mimeType hasPrefix:@"image/"] || [mimeType hasPrefix:@"audio/"] || [mimeType hasPrefix:@"video/"]) {
+        return YES;
+    }
+    // Office documents are zip files
+    if ([mimeType hasPrefix:@"application/vnd.openxmlformats-officedocument."] || [mimeType hasPrefix:@"application/vnd.oasis.opendocument."]) {
+        return YES;
+    }
+    return [compressedApplicationTypes containsObject:mimeType];
+}
+
 
 @interface OTRDataHandler()
 
@@ -65,271 +114,687 @@ NSString* OTRKitGetMimeTypeForExtension(NSString* extension) {
  */
 @property (nonatomic, strong, readonly) NSMutableDictionary *outgoingTransfers;
 
+/** OTRDataContent backing each outgoing transfer, keyed to URL */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSURL*, OTRDataContent*> *outgoingContents;
+
+/** Shared file data for outgoing transfers, only touched on internalQueue */
+@property (nonatomic, strong, readonly) OTRDataContentStore *contentStore;
+
 /** OTRDataRequest keyed to Request-Id  */
 @property (nonatomic, strong, readonly) NSMutableDictionary *requestCache;
 
-@property (nonatomic, strong) NSOperationQueue *dataGetOperationQueue;
+/** Decides which queued chunk GET is sent next, only touched on internalQueue */
+@property (nonatomic, strong, readonly) OTRDataTransferScheduler *transferScheduler;
+/** OTRDataGetOperation queued or waiting on a response, keyed to Request-Id */
 @property (nonatomic, strong, readonly) NSMutableDictionary *getOperationCache;
 
+/** Started OTRDataManifestTransfer keyed to URL, their files are in incomingTransfers */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSURL*, OTRDataManifestTransfer*> *incomingManifests;
+
+/** URLs of incoming transfers that have been started, the rest are unaccepted offers */
+@property (nonatomic, strong, readonly) NSMutableSet<NSURL*> *startedIncomingTransfers;
+
+/** OTRDataTransferCheckpoint for started incoming transfers, keyed to URL */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSURL*, OTRDataTransferCheckpoint*> *checkpoints;
+
+/** All delegate callbacks go through here so progress can be coalesced without reordering */
+@property (nonatomic, strong, readonly) OTRNotificationCoalescer *notificationCoalescer;
+
+/** Last progress reported for each transfer, keyed to transferId */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, NSNumber*> *reportedProgress;
+
+/** Fires on internalQueue to expire stale transfers */
+@property (nonatomic, strong, readonly) dispatch_source_t sweepTimer;
+
+/** Totals for stats, only touched on internalQueue */
+@property (nonatomic) NSUInteger expiredTransferCount;
+@property (nonatomic) NSUInteger evictedTransferCount;
+@property (nonatomic) NSUInteger cancelledTransferCount;
+@property (nonatomic) NSUInteger servedChunkBytes;
+@property (nonatomic) NSUInteger servedBodyBytes;
+
 @end
 
+/** Set to the handler on its internalQueue so public getters can be called from inline callbacks */
+static void *IsOnOTRDataQueueKey = &IsOnOTRDataQueueKey;
+
 @implementation OTRDataHandler
 
 - (instancetype) initWithOTRKit:(OTRKit*)otrKit delegate:(id<OTRDataHandlerDelegate>)delegate {
     if (self = [super init]) {
         _internalQueue = dispatch_queue_create("OTRDATA Queue", 0);
+        dispatch_queue_set_specific(_internalQueue, IsOnOTRDataQueueKey, (__bridge void *)self, NULL);
         _delegate = delegate;
         _otrKit = otrKit;
         _callbackQueue = dispatch_get_main_queue();
+        _notificationCoalescer = [[OTRNotificationCoalescer alloc] initWithTargetQueue:_callbackQueue];
+        _notificationCoalescer.minimumInterval = kOTRDataDefaultProgressInterval;
+        _progressStep = kOTRDataDefaultProgressStep;
+        _reportedProgress = [[NSMutableDictionary alloc] init];
         _incomingTransfers = [[NSMutableDictionary alloc] init];
         _outgoingTransfers = [[NSMutableDictionary alloc] init];
         _requestCache = [[NSMutableDictionary alloc] init];
         _getOperationCache = [[NSMutableDictionary alloc] init];
-        self.dataGetOperationQueue = [[NSOperationQueue alloc] init];
-        self.dataGetOperationQueue.maxConcurrentOperationCount = kOTRDataMaxOutstandingRequests;
-        [otrKit registerTLVHandler:self];
+        _transferScheduler = [[OTRDataTransferScheduler alloc] initWithMaxOutstandingRequests:kOTRDataDefaultMaxOutstandingRequests maxOutstandingRequestsPerPeer:kOTRDataDefaultMaxOutstandingRequestsPerPeer];
+        _startedIncomingTransfers = [[NSMutableSet alloc] init];
+        _incomingManifests = [[NSMutableDictionary alloc] init];
+        _offerTimeout = kOTRDataDefaultOfferTimeout;
+        _idleTimeout = kOTRDataDefaultIdleTimeout;
+        _checkpoints = [[NSMutableDictionary alloc] init];
+        _outgoingContents = [[NSMutableDictionary alloc] init];
+        _contentStore = [[OTRDataContentStore alloc] initWithChunkCacheLimit:kOTRDataDefaultChunkCacheLimit];
+        _checkpointDirectory = [otrKit.dataPath stringByAppendingPathComponent:kOTRDataCheckpointDirectoryName];
+        _checkpointTimeout = kOTRDataDefaultCheckpointTimeout;
+        _compressesChunks = YES;
+        _sweepTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _internalQueue);
+        uint64_t interval = (uint64_t)(kOTRDataSweepInterval * NSEC_PER_SEC);
+        dispatch_source_set_timer(_sweepTimer, dispatch_time(DISPATCH_TIME_NOW, interval), interval, interval / 10);
+        __weak typeof(self) weakSelf = self;
+        dispatch_source_set_event_handler(_sweepTimer, ^{
+            [weakSelf sweepTransfers];
+        });
+        dispatch_resume(_sweepTimer);
+        [otrKit registerTLVHandler:self targetQueue:_internalQueue];
     }
     return self;
 }
 
+- (void) dealloc {
+    dispatch_source_cancel(_sweepTimer);
+}
+
+- (void) setCallbackQueue:(nullable dispatch_queue_t)callbackQueue {
+    if (!callbackQueue) {
+        callbackQueue = dispatch_get_main_queue();
+    }
+    _callbackQueue = callbackQueue;
+    self.notificationCoalescer.targetQueue = callbackQueue;
+}
+
+/** Runs block on internalQueue and waits, or right away if already there */
+- (void) performBlock:(dispatch_block_t)block {
+    if (dispatch_get_specific(IsOnOTRDataQueueKey) == (__bridge void *)self) {
+        block();
+    } else {
+        dispatch_sync(self.internalQueue, block);
+    }
+}
+
+/** Must be called on internalQueue. Calls block right away in OTRKitCallbackModeInline, otherwise it goes through the coalescer. */
+- (void) deliverCallback:(dispatch_block_t)block forKey:(nullable NSString*)key {
+    if (self.callbackMode == OTRKitCallbackModeInline) {
+        block();
+    } else {
+        [self.notificationCoalescer enqueueBlock:block forKey:key];
+    }
+}
+
+- (NSTimeInterval) progressInterval {
+    return self.notificationCoalescer.minimumInterval;
+}
+
+- (void) setProgressInterval:(NSTimeInterval)progressInterval {
+    self.notificationCoalescer.minimumInterval = progressInterval;
+}
+
+/** Must be called on internalQueue. Skips updates smaller than progressStep, the rest are coalesced per transfer. */
+- (void) reportProgress:(float)progress forTransfer:(OTRDataTransfer*)transfer fingerprint:(OTRFingerprint*)fingerprint {
+    NSString *transferId = transfer.transferId;
+    NSNumber *reportedProgress = [self.reportedProgress objectForKey:transferId];
+    if (progress < 1 && reportedProgress && progress - reportedProgress.floatValue < self.progressStep) {
+        return;
+    }
+    if (progress < 1) {
+        [self.reportedProgress setObject:@(progress) forKey:transferId];
+    } else {
+        [self.reportedProgress removeObjectForKey:transferId];
+    }
+    [self deliverCallback:^{
+        [self.delegate dataHandler:self transfer:transfer progress:progress fingerprint:fingerprint];
+    } forKey:transferId];
+}
+
 - (NSURL*)urlForTransfer:(OTRDataTransfer*)transfer {
     NSString *urlString = [NSString stringWithFormat:@"%@:/storage/%@/%@", kOTRDataHandlerURLScheme, transfer.transferId, transfer.fileName];
     NSURL *url = [NSURL URLWithString:urlString];
     return url;
 }
 
+/** Must be called on internalQueue */
 - (void) handleIncomingRequestData:(NSData *)requestData username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol fingerprint:fingerprint tag:(id)tag {
-    dispatch_async(self.internalQueue, ^{
-        NSError *error = nil;
-        OTRHTTPMessage *request = [[OTRHTTPMessage alloc] initEmptyRequest];
-        [request appendData:requestData];
-        if (!request.isHeaderComplete) {
-            error = [NSError errorWithDomain:kOTRDataErrorDomain code:100 userInfo:@{NSLocalizedDescriptionKey: @"Message has incomplete headers"}];
-            OTRDataIncomingTransfer *transfer = [[OTRDataIncomingTransfer alloc] initWithFileLength:0 username:username accountName:accountName protocol:protocol tag:tag];
-            dispatch_async(self.callbackQueue, ^{
-                [self.delegate dataHandler:self transfer:transfer fingerprint:fingerprint error:error];
-            });
+    NSError *error = nil;
+    OTRHTTPMessage *request = [[OTRHTTPMessage alloc] initEmptyRequest];
+    [request appendData:requestData];
+    if (!request.isHeaderComplete) {
+        error = [NSError errorWithDomain:kOTRDataErrorDomain code:OTRDataErrorIncompleteHeaders userInfo:@{NSLocalizedDescriptionKey: @"Message has incomplete headers"}];
+        OTRDataIncomingTransfer *transfer = [[OTRDataIncomingTransfer alloc] initWithFileLength:0 username:username accountName:accountName protocol:protocol tag:tag];
+        [self deliverCallback:^{
+            [self.delegate dataHandler:self transfer:transfer fingerprint:fingerprint error:error];
+        } forKey:nil];
+        return;
+    }
+    
+    NSString *requestMethod = request.HTTPMethod;
+    NSString *requestID = [request valueForHTTPHeaderField:kHTTPHeaderRequestID];
+    NSURL *url = request.url;
+    
+    if ([requestMethod isEqualToString:@"OFFER"]) {
+        if ([[request valueForHTTPHeaderField:kHTTPHeaderContentType] isEqualToString:kOTRDataManifestContentType]) {
+            [self handleManifestOffer:request username:username accountName:accountName protocol:protocol fingerprint:fingerprint tag:tag];
+            return;
+        }
+        [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:200 httpStatusString:@"OK" httpBody:nil tag:tag];
+        NSMutableDictionary<NSString*, NSString*> *offerHeaders = [NSMutableDictionary dictionary];
+        for (NSString *field in @[kHTTPHeaderFileLength, kHTTPHeaderFileHashSHA1, kHTTPHeaderMimeType, kHTTPHeaderFileName, kHTTPHeaderAcceptEncoding]) {
+            NSString *value = [request valueForHTTPHeaderField:field];
+            if (value) {
+                [offerHeaders setObject:value forKey:field];
+            }
+        }
+        NSString *errorString = nil;
+        OTRDataIncomingTransfer *transfer = [self incomingTransferWithOfferHeaders:offerHeaders url:url username:username accountName:accountName protocol:protocol tag:tag errorString:&errorString];
+        if (!transfer) {
+            [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:errorString httpBody:nil tag:tag];
             return;
         }
+        [self.incomingTransfers setObject:transfer forKey:url];
+        // notify delegate of new offered transfer
+        [self deliverCallback:^{
+            [self.delegate dataHandler:self offeredTransfer:transfer fingerprint:fingerprint];
+        } forKey:nil];
+    } else if ([requestMethod isEqualToString:@"GET"]) {
+        OTRDataOutgoingTransfer *transfer = [self.outgoingTransfers objectForKey:url];
         
-        NSString *requestMethod = request.HTTPMethod;
-        NSString *requestID = [request valueForHTTPHeaderField:kHTTPHeaderRequestID];
-        NSURL *url = request.url;
+        if (!transfer) {
+            [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"No such offer made" httpBody:nil tag:tag];
+            return;
+        }
         
-        if ([requestMethod isEqualToString:@"OFFER"]) {
-            [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:200 httpStatusString:@"OK" httpBody:nil tag:tag];
-            NSString *fileLengthString = [request valueForHTTPHeaderField:kHTTPHeaderFileLength];
-            if (!fileLengthString) {
-                [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"File-Length must be supplied" httpBody:nil tag:tag];
-                return;
-            }
-            NSInteger fileLength = [fileLengthString integerValue];
-            NSString *fileHashString = [request valueForHTTPHeaderField:kHTTPHeaderFileHashSHA1];
-            if (!fileHashString) {
-                [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"File-Hash-SHA1 must be supplied" httpBody:nil tag:tag];
-                return;
-            }
-            NSString *mimeTypeString = [request valueForHTTPHeaderField:kHTTPHeaderMimeType];
-            NSString *fileNameString = [request valueForHTTPHeaderField:kHTTPHeaderFileName];
-            OTRDataIncomingTransfer *transfer = [[OTRDataIncomingTransfer alloc] initWithFileLength:fileLength username:username accountName:accountName protocol:protocol tag:tag];
-            transfer.mimeType = mimeTypeString;
-            if (fileNameString) {
-                transfer.fileName = fileNameString;
-            } else {
-                transfer.fileName = [url lastPathComponent];
-            }
-            transfer.fileHash = fileHashString;
-            transfer.offeredURL = url;
-            [self.incomingTransfers setObject:transfer forKey:url];
-            // notify delegate of new offered transfer
-            dispatch_async(self.callbackQueue, ^{
-                [self.delegate dataHandler:self offeredTransfer:transfer fingerprint:fingerprint];
-            });
-        } else if ([requestMethod isEqualToString:@"GET"]) {
-            OTRDataOutgoingTransfer *transfer = [self.outgoingTransfers objectForKey:url];
-            
-            if (!transfer) {
-                [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"No such offer made" httpBody:nil tag:tag];
-                return;
-            }
-            
-            NSString *rangeHeader = [request valueForHTTPHeaderField:kHTTPHeaderRange];
-            if (!rangeHeader) {
-                [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"Must have Range header" httpBody:nil tag:tag];
-                return;
-            }
-            
-            NSArray *rangeComponents = [rangeHeader componentsSeparatedByString:@"="];
-            if (rangeComponents.count != 2 || ![[rangeComponents firstObject] isEqualToString:@"bytes"]) {
-                [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"Range must start with bytes=" httpBody:nil tag:tag];
-                return;
-            }
-            
-            NSArray *startEndRanges = [[rangeComponents lastObject] componentsSeparatedByString:@"-"];
-            
-            if (startEndRanges.count != 2) {
-                [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"Range must be START-END" httpBody:nil tag:tag];
-                return;
-            }
-            
-            NSString *startRangeString = [startEndRanges firstObject];
-            NSString *endRangeString = [startEndRanges lastObject];
-            NSUInteger startOfRange = [startRangeString integerValue];
-            NSUInteger endOfRange = [endRangeString integerValue];
-            NSUInteger chunkLength = endOfRange - startOfRange;
-            
-            if (chunkLength > kOTRDataMaxChunkLength || startOfRange > endOfRange) {
-                [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"Invalid Range" httpBody:nil tag:tag];
-                return;
-            }
-            NSRange range = NSMakeRange(startOfRange, endOfRange - startOfRange + 1);
-            NSData *subdata = [transfer.fileData subdataWithRange:range];
-            transfer.bytesTransferred += subdata.length;
-            float percentageComplete = (float)transfer.bytesTransferred / (float)transfer.fileData.length;
-            
-            dispatch_async(self.callbackQueue, ^{
-                [self.delegate dataHandler:self transfer:transfer progress:percentageComplete fingerprint:fingerprint];
-            });
-            
-            if (transfer.bytesTransferred == transfer.fileData.length) {
-                [self.outgoingTransfers removeObjectForKey:url];
-                dispatch_async(self.callbackQueue, ^{
-                    [self.delegate dataHandler:self transferComplete:transfer fingerprint:fingerprint];
-                });
-            }
-            
-            [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:200 httpStatusString:@"OK" httpBody:subdata tag:tag];
+        NSString *rangeHeader = [request valueForHTTPHeaderField:kHTTPHeaderRange];
+        if (!rangeHeader) {
+            [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"Must have Range header" httpBody:nil tag:tag];
+            return;
         }
-    });
-}
-
-- (void) handleIncomingResponseData:(NSData *)responseData username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol fingerprint:(OTRFingerprint*)fingerprint tag:(id)tag {
-    dispatch_async(self.internalQueue, ^{
-        OTRHTTPMessage *incomingResponse = [[OTRHTTPMessage alloc] initEmptyRequest];
-        [incomingResponse appendData:responseData];
-        NSError *error = nil;
-        if (!incomingResponse.isHeaderComplete) {
-            OTRDataIncomingTransfer *transfer = [[OTRDataIncomingTransfer alloc] initWithFileLength:0 username:username accountName:accountName protocol:protocol tag:tag];
-            error = [NSError errorWithDomain:kOTRDataErrorDomain code:100 userInfo:@{NSLocalizedDescriptionKey: @"Message has incomplete headers"}];
-            dispatch_async(self.callbackQueue, ^{
-                [self.delegate dataHandler:self transfer:transfer fingerprint:fingerprint error:error];
-            });
+        
+        NSArray *rangeComponents = [rangeHeader componentsSeparatedByString:@"="];
+        if (rangeComponents.count != 2 || ![[rangeComponents firstObject] isEqualToString:@"bytes"]) {
+            [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"Range must start with bytes=" httpBody:nil tag:tag];
             return;
         }
-        NSString *requestID = [incomingResponse valueForHTTPHeaderField:kHTTPHeaderRequestID];
         
-        if (!requestID) {
+        NSArray *startEndRanges = [[rangeComponents lastObject] componentsSeparatedByString:@"-"];
+        
+        if (startEndRanges.count != 2) {
+            [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"Range must be START-END" httpBody:nil tag:tag];
             return;
         }
         
-        OTRDataGetOperation *operation = [self.getOperationCache objectForKey:requestID];
+        NSString *startRangeString = [startEndRanges firstObject];
+        NSString *endRangeString = [startEndRanges lastObject];
+        NSUInteger startOfRange = [startRangeString integerValue];
+        NSUInteger endOfRange = [endRangeString integerValue];
+        NSUInteger chunkLength = endOfRange - startOfRange;
         
-        if (!operation) {
+        if (chunkLength > kOTRDataMaxChunkLength || startOfRange > endOfRange) {
+            [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"Invalid Range" httpBody:nil tag:tag];
+            return;
+        }
+        NSRange range = NSMakeRange(startOfRange, endOfRange - startOfRange + 1);
+        OTRDataContent *content = [self.outgoingContents objectForKey:url];
+        NSData *subdata = nil;
+        if (content) {
+            subdata = [self.contentStore chunkForContent:content range:range];
+        }
+        if (!subdata) {
+            [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"Invalid Range" httpBody:nil tag:tag];
             return;
         }
-        [operation requestCompleted];
-        [self.requestCache removeObjectForKey:requestID];
+        BOOL complete = [transfer addServedRange:NSMakeRange(range.location, subdata.length)];
+        transfer.lastActivityDate = [NSDate date];
+        float percentageComplete = (float)transfer.bytesTransferred / (float)transfer.fileLength;
+        
+        [self reportProgress:percentageComplete forTransfer:transfer fingerprint:fingerprint];
         
+        if (complete) {
+            [self removeOutgoingTransferForURL:url];
+            [self deliverCallback:^{
+                [self.delegate dataHandler:self transferComplete:transfer fingerprint:fingerprint];
+            } forKey:nil];
+        }
         
-        OTRDataIncomingTransfer *transfer = [self.incomingTransfers objectForKey:operation.request.url];
+        // Only compressed when the receiver asked and the offer said it was worth trying
+        NSData *body = subdata;
+        NSDictionary *headers = nil;
+        if ([self acceptsDeflate:[request valueForHTTPHeaderField:kHTTPHeaderAcceptEncoding]] && !OTRKitIsCompressedMimeType(transfer.mimeType)) {
+            NSData *deflated = [subdata otr_deflatedData];
+            if (deflated) {
+                body = deflated;
+                headers = @{kHTTPHeaderContentEncoding: kOTRDataContentEncodingDeflate};
+            }
+        }
+        self.servedChunkBytes += subdata.length;
+        self.servedBodyBytes += body.length;
+        [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:200 httpStatusString:@"OK" httpHeaders:headers httpBody:body tag:tag];
+    }
+}
+
+/** Whether an Accept-Encoding value lists deflate */
+- (BOOL) acceptsDeflate:(nullable NSString*)acceptEncoding {
+    for (NSString *coding in [acceptEncoding componentsSeparatedByString:@","]) {
+        NSString *name = [[[coding componentsSeparatedByString:@";"] firstObject] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        if ([name caseInsensitiveCompare:kOTRDataContentEncodingDeflate] == NSOrderedSame) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+/**
+ *  Must be called on internalQueue. Builds the transfer for one offered file,
+ *  from the OFFER's headers or an entry of a manifest.
+ *
+ *  @return nil with the status string for the 400 response if a header is missing
+ */
+- (nullable OTRDataIncomingTransfer*) incomingTransferWithOfferHeaders:(NSDictionary<NSString*, NSString*>*)headers
+                                                                   url:(NSURL*)url
+                                                              username:(NSString*)username
+                                                           accountName:(NSString*)accountName
+                                                              protocol:(NSString*)protocol
+                                                                   tag:(id)tag
+                                                           errorString:(NSString**)errorString {
+    NSString *fileLengthString = [headers objectForKey:kHTTPHeaderFileLength];
+    if (!fileLengthString) {
+        *errorString = @"File-Length must be supplied";
+        return nil;
+    }
+    NSInteger fileLength = [fileLengthString integerValue];
+    NSString *fileHashString = [headers objectForKey:kHTTPHeaderFileHashSHA1];
+    if (!fileHashString) {
+        *errorString = @"File-Hash-SHA1 must be supplied";
+        return nil;
+    }
+    NSString *fileNameString = [headers objectForKey:kHTTPHeaderFileName];
+    OTRDataIncomingTransfer *transfer = [[OTRDataIncomingTransfer alloc] initWithFileLength:fileLength username:username accountName:accountName protocol:protocol tag:tag];
+    transfer.mimeType = [headers objectForKey:kHTTPHeaderMimeType];
+    if (fileNameString) {
+        transfer.fileName = fileNameString;
+    } else {
+        transfer.fileName = [url lastPathComponent];
+    }
+    transfer.fileHash = fileHashString;
+    transfer.offeredURL = url;
+    if (self.compressesChunks && [self acceptsDeflate:[headers objectForKey:kHTTPHeaderAcceptEncoding]]) {
+        transfer.acceptEncoding = kOTRDataContentEncodingDeflate;
+    }
+    return transfer;
+}
+
+/** Must be called on internalQueue. The whole manifest is rejected if any entry is bad. */
+- (void) handleManifestOffer:(OTRHTTPMessage*)request username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol fingerprint:(OTRFingerprint*)fingerprint tag:(id)tag {
+    NSString *requestID = [request valueForHTTPHeaderField:kHTTPHeaderRequestID];
+    NSData *body = request.HTTPBody;
+    NSArray *entries = body.length ? [NSJSONSerialization JSONObjectWithData:body options:0 error:nil] : nil;
+    if (![entries isKindOfClass:[NSArray class]] || !entries.count) {
+        [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"Manifest must list files" httpBody:nil tag:tag];
+        return;
+    }
+    NSMutableArray<OTRDataIncomingTransfer*> *files = [NSMutableArray arrayWithCapacity:entries.count];
+    NSMutableSet<NSURL*> *urls = [NSMutableSet setWithCapacity:entries.count];
+    for (NSDictionary *entry in entries) {
+        NSMutableDictionary<NSString*, NSString*> *headers = [NSMutableDictionary dictionary];
+        if ([entry isKindOfClass:[NSDictionary class]]) {
+            [entry enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+                if ([key isKindOfClass:[NSString class]] && [obj isKindOfClass:[NSString class]]) {
+                    [headers setObject:obj forKey:key];
+                }
+            }];
+        }
+        NSString *urlString = [headers objectForKey:kOTRDataManifestURLKey];
+        NSURL *url = urlString ? [NSURL URLWithString:urlString] : nil;
+        if (![url.scheme isEqualToString:kOTRDataHandlerURLScheme] || [urls containsObject:url] || [self.incomingTransfers objectForKey:url]) {
+            [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:@"Invalid Url in manifest" httpBody:nil tag:tag];
+            return;
+        }
+        NSString *errorString = nil;
+        OTRDataIncomingTransfer *transfer = [self incomingTransferWithOfferHeaders:headers url:url username:username accountName:accountName protocol:protocol tag:tag errorString:&errorString];
         if (!transfer) {
+            [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:400 httpStatusString:errorString httpBody:nil tag:tag];
             return;
         }
-        NSData *incomingData = incomingResponse.HTTPBody;
-        if (incomingData.length) {
-            [transfer handleResponse:incomingData forRequest:operation.request];
-        }
-        if (transfer.bytesTransferred == transfer.fileLength) {
-            [self.incomingTransfers removeObjectForKey:operation.request.url];
-            NSData *fileHash = [transfer.fileData otr_SHA1];
-            NSString *fileHashString = [fileHash otr_hexString];
-            if ([transfer.fileHash isEqualToString:fileHashString]) {
-                dispatch_async(self.callbackQueue, ^{
-                    [self.delegate dataHandler:self transferComplete:transfer fingerprint:fingerprint];
-                });
-            } else {
-                dispatch_async(self.callbackQueue, ^{
-                    [self.delegate dataHandler:self transfer:transfer fingerprint:fingerprint error:[NSError errorWithDomain:kOTRDataErrorDomain code:102 userInfo:@{NSLocalizedDescriptionKey: @"Bad SHA hash"}]];
-                });
-            }
-            
+        [files addObject:transfer];
+        [urls addObject:url];
+    }
+    [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:200 httpStatusString:@"OK" httpBody:nil tag:tag];
+    OTRDataManifestTransfer *manifest = [[OTRDataManifestTransfer alloc] initWithFiles:files username:username accountName:accountName protocol:protocol tag:tag];
+    manifest.offeredURL = request.url;
+    [self.incomingTransfers setObject:manifest forKey:request.url];
+    [self deliverCallback:^{
+        [self.delegate dataHandler:self offeredTransfer:manifest fingerprint:fingerprint];
+    } forKey:nil];
+}
+
+/** Must be called on internalQueue. Reports progress of all files of manifest together. */
+- (void) reportProgressForManifest:(OTRDataManifestTransfer*)manifest fingerprint:(nullable OTRFingerprint*)fingerprint {
+    NSUInteger bytesTransferred = 0;
+    for (OTRDataIncomingTransfer *file in manifest.files) {
+        bytesTransferred += file.bytesTransferred;
+    }
+    manifest.bytesTransferred = bytesTransferred;
+    manifest.lastActivityDate = [NSDate date];
+    if (bytesTransferred < manifest.fileLength) {
+        [self reportProgress:(float)bytesTransferred / (float)manifest.fileLength forTransfer:manifest fingerprint:fingerprint];
+    }
+}
+
+/**
+ *  Must be called on internalQueue once a file of a manifest has completed or failed.
+ *  The manifest completes after its last file, or fails with the first error.
+ */
+- (void) manifestFile:(OTRDataIncomingTransfer*)file finishedWithError:(nullable NSError*)error fingerprint:(nullable OTRFingerprint*)fingerprint {
+    OTRDataManifestTransfer *manifest = file.manifest;
+    NSURL *url = manifest.offeredURL;
+    if (!url || [self.incomingManifests objectForKey:url] != manifest) {
+        return;
+    }
+    if (error) {
+        // The remaining files are stopped too, like a single file failing part way
+        [self removeTransfer:manifest error:error fingerprint:fingerprint];
+        return;
+    }
+    [self reportProgressForManifest:manifest fingerprint:fingerprint];
+    for (OTRDataIncomingTransfer *file in manifest.files) {
+        if (file.bytesTransferred < file.fileLength) {
+            return;
+        }
+    }
+    [self.incomingManifests removeObjectForKey:url];
+    [self.reportedProgress removeObjectForKey:manifest.transferId];
+    [self deliverCallback:^{
+        [self.delegate dataHandler:self transferComplete:manifest fingerprint:fingerprint];
+    } forKey:nil];
+}
+
+/** Must be called on internalQueue */
+- (void) handleIncomingResponseData:(NSData *)responseData username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol fingerprint:(OTRFingerprint*)fingerprint tag:(id)tag {
+    OTRHTTPMessage *incomingResponse = [[OTRHTTPMessage alloc] initEmptyRequest];
+    [incomingResponse appendData:responseData];
+    NSError *error = nil;
+    if (!incomingResponse.isHeaderComplete) {
+        OTRDataIncomingTransfer *transfer = [[OTRDataIncomingTransfer alloc] initWithFileLength:0 username:username accountName:accountName protocol:protocol tag:tag];
+        error = [NSError errorWithDomain:kOTRDataErrorDomain code:OTRDataErrorIncompleteHeaders userInfo:@{NSLocalizedDescriptionKey: @"Message has incomplete headers"}];
+        [self deliverCallback:^{
+            [self.delegate dataHandler:self transfer:transfer fingerprint:fingerprint error:error];
+        } forKey:nil];
+        return;
+    }
+    NSString *requestID = [incomingResponse valueForHTTPHeaderField:kHTTPHeaderRequestID];
+    
+    if (!requestID) {
+        return;
+    }
+    // OFFER responses don't have an operation, either way the request is done
+    [self.requestCache removeObjectForKey:requestID];
+    
+    OTRDataGetOperation *operation = [self.getOperationCache objectForKey:requestID];
+    
+    if (!operation) {
+        return;
+    }
+    [operation requestCompleted];
+    [self.getOperationCache removeObjectForKey:requestID];
+    // Keep the pipeline full while this chunk is handled
+    [self.transferScheduler operationFinished:operation];
+    [self sendScheduledRequests];
+    
+    OTRDataIncomingTransfer *transfer = [self.incomingTransfers objectForKey:operation.request.url];
+    if (!transfer) {
+        return;
+    }
+    NSData *incomingData = incomingResponse.HTTPBody;
+    NSString *contentEncoding = [incomingResponse valueForHTTPHeaderField:kHTTPHeaderContentEncoding];
+    if (incomingData.length && contentEncoding) {
+        if ([contentEncoding caseInsensitiveCompare:kOTRDataContentEncodingDeflate] == NSOrderedSame) {
+            incomingData = [incomingData otr_inflatedDataWithLength:operation.request.range.length];
         } else {
-            float progress = (float)transfer.bytesTransferred / (float)transfer.fileLength;
-            dispatch_async(self.callbackQueue, ^{
-                [self.delegate dataHandler:self transfer:transfer progress:progress fingerprint:fingerprint];
-            });
-            //[self processOutstandingRequestsForIncomingTransfer:transfer];
+            incomingData = nil;
         }
-    });
+        if (!incomingData) {
+            NSError *encodingError = [NSError errorWithDomain:kOTRDataErrorDomain code:OTRDataErrorBadResponse userInfo:@{NSLocalizedDescriptionKey: @"Bad Content-Encoding"}];
+            [self removeTransfer:transfer error:encodingError fingerprint:fingerprint];
+            return;
+        }
+    }
+    if (!incomingData.length && transfer.fileLength > 0) {
+        // Only error responses come back without a body, e.g. the offer expired on the other end
+        NSError *responseError = [NSError errorWithDomain:kOTRDataErrorDomain code:OTRDataErrorBadResponse userInfo:@{NSLocalizedDescriptionKey: @"Request failed"}];
+        [self removeTransfer:transfer error:responseError fingerprint:fingerprint];
+        return;
+    }
+    OTRDataTransferCheckpoint *checkpoint = [self.checkpoints objectForKey:operation.request.url];
+    if (incomingData.length) {
+        [transfer handleResponse:incomingData forRequest:operation.request];
+        // Losing the checkpoint only costs resumability, the transfer carries on
+        if (checkpoint && ![checkpoint writeData:incomingData range:operation.request.range error:nil]) {
+            [checkpoint close];
+            [self.checkpoints removeObjectForKey:operation.request.url];
+        }
+    }
+    if (transfer.bytesTransferred == transfer.fileLength) {
+        [self.incomingTransfers removeObjectForKey:operation.request.url];
+        [self.startedIncomingTransfers removeObject:operation.request.url];
+        // Done with the checkpoint either way, after a bad hash its data can't be trusted
+        [checkpoint remove];
+        [self.checkpoints removeObjectForKey:operation.request.url];
+        [self.reportedProgress removeObjectForKey:transfer.transferId];
+        // Compare digests rather than strings so the offer's hex can be either case
+        NSData *fileHash = [transfer.fileData otr_SHA1];
+        NSData *offeredFileHash = transfer.fileHash ? [NSData otr_dataWithHexString:transfer.fileHash] : nil;
+        NSError *hashError = nil;
+        if (offeredFileHash && [fileHash isEqualToData:offeredFileHash]) {
+            [self deliverCallback:^{
+                [self.delegate dataHandler:self transferComplete:transfer fingerprint:fingerprint];
+            } forKey:nil];
+        } else {
+            hashError = [NSError errorWithDomain:kOTRDataErrorDomain code:OTRDataErrorBadHash userInfo:@{NSLocalizedDescriptionKey: @"Bad SHA hash"}];
+            [self deliverCallback:^{
+                [self.delegate dataHandler:self transfer:transfer fingerprint:fingerprint error:hashError];
+            } forKey:nil];
+        }
+        if (transfer.manifest) {
+            [self manifestFile:transfer finishedWithError:hashError fingerprint:fingerprint];
+        }
+    } else if (transfer.manifest) {
+        [self reportProgressForManifest:transfer.manifest fingerprint:fingerprint];
+    } else {
+        float progress = (float)transfer.bytesTransferred / (float)transfer.fileLength;
+        [self reportProgress:progress forTransfer:transfer fingerprint:fingerprint];
+        //[self processOutstandingRequestsForIncomingTransfer:transfer];
+    }
 }
 
 /** For now, this won't work for large files because of RAM limitations */
-- (void) sendFileWithURL:(NSURL*)fileURL
-                username:(NSString*)username
-             accountName:(NSString*)accountName
-                protocol:(NSString*)protocol
-                     tag:(id)tag {
+- (OTRDataOutgoingTransfer*) sendFileWithURL:(NSURL*)fileURL
+                                    username:(NSString*)username
+                                 accountName:(NSString*)accountName
+                                    protocol:(NSString*)protocol
+                                         tag:(id)tag {
     NSString *fileName = [[fileURL path] lastPathComponent];
-    NSData *fileData = [NSData dataWithContentsOfURL:fileURL];
-    [self sendFileWithName:fileName fileData:fileData username:username accountName:accountName protocol:protocol tag:tag];
+    NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:fileURL.path error:nil];
+    if (!attributes) {
+        return nil;
+    }
+    OTRDataOutgoingTransfer *transfer = [[OTRDataOutgoingTransfer alloc] initWithFileLength:(NSUInteger)attributes.fileSize username:username accountName:accountName protocol:protocol tag:tag];
+    transfer.fileName = fileName;
+    dispatch_async(self.internalQueue, ^{
+        if (transfer.fileLength > kOTRDataMaxFileSize) {
+            [self failTransferTooLarge:transfer];
+            return;
+        }
+        NSError *error = nil;
+        OTRDataContent *content = [self.contentStore retainContentWithFileURL:fileURL error:&error];
+        if (!content) {
+            [self deliverCallback:^{
+                [self.delegate dataHandler:self transfer:transfer fingerprint:nil error:error];
+            } forKey:nil];
+            return;
+        }
+        [self offerOutgoingTransfer:transfer content:content];
+    });
+    return transfer;
 }
 
 /** For now, this won't work for large files because of RAM limitations */
-- (void) sendFileWithName:(NSString*)fileName
-                 fileData:(NSData*)fileData
-                 username:(NSString*)username
-              accountName:(NSString*)accountName
-                 protocol:(NSString*)protocol
-                      tag:(id)tag {
+- (OTRDataOutgoingTransfer*) sendFileWithName:(NSString*)fileName
+                                     fileData:(NSData*)fileData
+                                     username:(NSString*)username
+                                  accountName:(NSString*)accountName
+                                     protocol:(NSString*)protocol
+                                          tag:(id)tag {
+    OTRDataOutgoingTransfer *transfer = [[OTRDataOutgoingTransfer alloc] initWithFileLength:fileData.length username:username accountName:accountName protocol:protocol tag:tag];
+    transfer.fileName = fileName;
     dispatch_async(self.internalQueue, ^{
-        NSUInteger fileLength = fileData.length;
-        
-        if (fileLength > kOTRDataMaxFileSize) {
-            dispatch_async(self.callbackQueue, ^{
-                //[self.delegate dataHandler:self errorSendingFile:fileName error:[NSError errorWithDomain:kOTRDataErrorDomain code:101 userInfo:@{NSLocalizedDescriptionKey: @"File too large"}] tag:tag];
-            });
+        if (fileData.length > kOTRDataMaxFileSize) {
+            [self failTransferTooLarge:transfer];
             return;
         }
-        
-        NSString *requestID = [[NSUUID UUID] UUIDString];
-        
-        NSData *fileHash = [fileData otr_SHA1];
-        NSString *fileHashString = [fileHash otr_hexString];
-        NSString *fileExtension = [fileName pathExtension];
-        NSString *mimeType = OTRKitGetMimeTypeForExtension(fileExtension);
-        
-        NSMutableDictionary *httpHeaders = [NSMutableDictionary dictionary];
-        
-        if (@(fileLength).stringValue) {
-            [httpHeaders setObject:@(fileLength).stringValue forKey:kHTTPHeaderFileLength];
-        }
-        if (fileHashString) {
-            [httpHeaders setObject:fileHashString forKey:kHTTPHeaderFileHashSHA1];
-        }
-        if (fileName) {
-            [httpHeaders setObject:fileName forKey:kHTTPHeaderFileName];
-        }
-        if (requestID) {
-            [httpHeaders setObject:requestID forKey:kHTTPHeaderRequestID];
-        }
-        if (mimeType) {
-            [httpHeaders setObject:mimeType forKey:kHTTPHeaderMimeType];
+        OTRDataContent *content = [self.contentStore retainContentWithData:fileData];
+        [self offerOutgoingTransfer:transfer content:content];
+    });
+    return transfer;
+}
+
+- (NSArray<OTRDataOutgoingTransfer*>*) sendFilesWithNames:(NSArray<NSString*>*)fileNames
+                                                 fileData:(NSArray<NSData*>*)fileData
+                                                 username:(NSString*)username
+                                              accountName:(NSString*)accountName
+                                                 protocol:(NSString*)protocol
+                                                      tag:(id)tag {
+    NSParameterAssert(fileNames.count == fileData.count);
+    NSUInteger count = MIN(fileNames.count, fileData.count);
+    NSMutableArray<OTRDataOutgoingTransfer*> *transfers = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        OTRDataOutgoingTransfer *transfer = [[OTRDataOutgoingTransfer alloc] initWithFileLength:[fileData objectAtIndex:i].length username:username accountName:accountName protocol:protocol tag:tag];
+        transfer.fileName = [fileNames objectAtIndex:i];
+        [transfers addObject:transfer];
+    }
+    dispatch_async(self.internalQueue, ^{
+        NSMutableArray<OTRDataOutgoingTransfer*> *offeredTransfers = [NSMutableArray arrayWithCapacity:count];
+        NSMutableArray<OTRDataContent*> *contents = [NSMutableArray arrayWithCapacity:count];
+        [transfers enumerateObjectsUsingBlock:^(OTRDataOutgoingTransfer *transfer, NSUInteger idx, BOOL *stop) {
+            NSData *data = [fileData objectAtIndex:idx];
+            if (data.length > kOTRDataMaxFileSize) {
+                [self failTransferTooLarge:transfer];
+                return;
+            }
+            [offeredTransfers addObject:transfer];
+            [contents addObject:[self.contentStore retainContentWithData:data]];
+        }];
+        if (offeredTransfers.count) {
+            [self offerOutgoingTransfers:offeredTransfers contents:contents];
         }
-        
-        OTRDataOutgoingTransfer *transfer = [[OTRDataOutgoingTransfer alloc] initWithFileLength:fileLength username:username accountName:accountName protocol:protocol tag:tag];
-        transfer.fileData = fileData;
-        transfer.fileName = fileName;
-        transfer.fileHash = fileHashString;
-        transfer.mimeType = mimeType;
-        
-        NSURL *url = [self urlForTransfer:transfer];
-        
-        [self.outgoingTransfers setObject:transfer forKey:url];
-        
-        OTRDataRequest *request = [[OTRDataRequest alloc] initWithRequestId:requestID url:url httpMethod:@"OFFER" httpHeaders:httpHeaders];
-        [self.requestCache setObject:request forKey:requestID];
-        [self sendRequest:request username:username accountName:accountName protocol:protocol tag:tag];
     });
+    return transfers;
+}
+
+/** Must be called on internalQueue */
+- (void) failTransferTooLarge:(OTRDataOutgoingTransfer*)transfer {
+    NSError *error = [NSError errorWithDomain:kOTRDataErrorDomain code:OTRDataErrorFileTooLarge userInfo:@{NSLocalizedDescriptionKey: @"File too large"}];
+    [self deliverCallback:^{
+        [self.delegate dataHandler:self transfer:transfer fingerprint:nil error:error];
+    } forKey:nil];
+}
+
+/**
+ *  Must be called on internalQueue. Fills in transfer from content, registers it
+ *  for GETs and returns the headers describing it in an offer.
+ */
+- (NSMutableDictionary<NSString*, NSString*>*) offerHeadersForOutgoingTransfer:(OTRDataOutgoingTransfer*)transfer content:(OTRDataContent*)content {
+    NSString *fileName = transfer.fileName;
+    NSUInteger fileLength = content.data.length;
+    
+    NSString *fileHashString = content.fileHash;
+    NSString *fileExtension = [fileName pathExtension];
+    NSString *mimeType = OTRKitGetMimeTypeForExtension(fileExtension);
+    
+    NSMutableDictionary *httpHeaders = [NSMutableDictionary dictionary];
+    
+    if (@(fileLength).stringValue) {
+        [httpHeaders setObject:@(fileLength).stringValue forKey:kHTTPHeaderFileLength];
+    }
+    if (fileHashString) {
+        [httpHeaders setObject:fileHashString forKey:kHTTPHeaderFileHashSHA1];
+    }
+    if (fileName) {
+        [httpHeaders setObject:fileName forKey:kHTTPHeaderFileName];
+    }
+    if (mimeType) {
+        [httpHeaders setObject:mimeType forKey:kHTTPHeaderMimeType];
+    }
+    if (self.compressesChunks && !OTRKitIsCompressedMimeType(mimeType)) {
+        [httpHeaders setObject:kOTRDataContentEncodingDeflate forKey:kHTTPHeaderAcceptEncoding];
+    }
+    
+    transfer.fileData = content.data;
+    transfer.fileHash = fileHashString;
+    transfer.mimeType = mimeType;
+    
+    NSURL *url = [self urlForTransfer:transfer];
+    
+    [self.outgoingTransfers setObject:transfer forKey:url];
+    [self.outgoingContents setObject:content forKey:url];
+    return httpHeaders;
+}
+
+/** Must be called on internalQueue. Takes over the reference to content. */
+- (void) offerOutgoingTransfer:(OTRDataOutgoingTransfer*)transfer content:(OTRDataContent*)content {
+    NSString *requestID = [[NSUUID UUID] UUIDString];
+    NSMutableDictionary *httpHeaders = [self offerHeadersForOutgoingTransfer:transfer content:content];
+    if (requestID) {
+        [httpHeaders setObject:requestID forKey:kHTTPHeaderRequestID];
+    }
+    NSURL *url = [self urlForTransfer:transfer];
+    
+    OTRDataRequest *request = [[OTRDataRequest alloc] initWithRequestId:requestID url:url httpMethod:@"OFFER" httpHeaders:httpHeaders];
+    [self.requestCache setObject:request forKey:requestID];
+    [self sendRequest:request username:transfer.username accountName:transfer.accountName protocol:transfer.protocol tag:transfer.tag];
+    [self enforceResidentBytesLimit];
+}
+
+/** Must be called on internalQueue. Offers all transfers in one manifest, takes over the references to contents. */
+- (void) offerOutgoingTransfers:(NSArray<OTRDataOutgoingTransfer*>*)transfers contents:(NSArray<OTRDataContent*>*)contents {
+    NSMutableArray<NSDictionary*> *entries = [NSMutableArray arrayWithCapacity:transfers.count];
+    [transfers enumerateObjectsUsingBlock:^(OTRDataOutgoingTransfer *transfer, NSUInteger idx, BOOL *stop) {
+        NSMutableDictionary *entry = [self offerHeadersForOutgoingTransfer:transfer content:[contents objectAtIndex:idx]];
+        [entry setObject:[self urlForTransfer:transfer].absoluteString forKey:kOTRDataManifestURLKey];
+        [entries addObject:entry];
+    }];
+    NSData *body = [NSJSONSerialization dataWithJSONObject:entries options:0 error:nil];
+    if (!body || body.length > kOTRDataMaxManifestLength) {
+        NSError *error = [NSError errorWithDomain:kOTRDataErrorDomain code:OTRDataErrorFileTooLarge userInfo:@{NSLocalizedDescriptionKey: @"Too many files for one offer"}];
+        for (OTRDataOutgoingTransfer *transfer in transfers) {
+            [self removeTransfer:transfer error:error fingerprint:nil];
+        }
+        return;
+    }
+    OTRDataOutgoingTransfer *firstTransfer = transfers.firstObject;
+    NSString *requestID = [[NSUUID UUID] UUIDString];
+    NSString *urlString = [NSString stringWithFormat:@"%@:/storage/%@/manifest", kOTRDataHandlerURLScheme, requestID];
+    NSDictionary *httpHeaders = @{kHTTPHeaderRequestID: requestID, kHTTPHeaderContentType: kOTRDataManifestContentType};
+    OTRDataRequest *request = [[OTRDataRequest alloc] initWithRequestId:requestID url:[NSURL URLWithString:urlString] httpMethod:@"OFFER" httpHeaders:httpHeaders];
+    request.httpBody = body;
+    [self.requestCache setObject:request forKey:requestID];
+    [self sendRequest:request username:firstTransfer.username accountName:firstTransfer.accountName protocol:firstTransfer.protocol tag:firstTransfer.tag];
+    [self enforceResidentBytesLimit];
+}
+
+/** Must be called on internalQueue */
+- (void) removeOutgoingTransferForURL:(NSURL*)url {
+    [self.outgoingTransfers removeObjectForKey:url];
+    OTRDataContent *content = [self.outgoingContents objectForKey:url];
+    if (content) {
+        [self.contentStore releaseContent:content];
+        [self.outgoingContents removeObjectForKey:url];
+    }
 }
 
 - (void) sendRequest:(OTRDataRequest*)request
@@ -344,12 +809,20 @@ NSString* OTRKitGetMimeTypeForExtension(NSString* extension) {
     [httpHeaders enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
         [message setValue:obj forHTTPHeaderField:key];
     }];
+    if (request.httpBody) {
+        message.HTTPBody = request.httpBody;
+    }
     NSData *httpData = [message HTTPMessageData];
     OTRTLV *tlv = [[OTRTLV alloc] initWithType:OTRTLVTypeDataRequest data:httpData];
     if (!tlv) {
         return;
     }
-    [self.otrKit encodeMessage:nil tlvs:@[tlv] username:username accountName:accountName protocol:protocol tag:tag];
+    // Offers are shown to the user right away, chunk requests can wait behind chat messages
+    OTRKitPriority priority = OTRKitPriorityBulk;
+    if ([httpMethod isEqualToString:@"OFFER"]) {
+        priority = OTRKitPriorityInteractive;
+    }
+    [self.otrKit encodeMessage:nil tlvs:@[tlv] username:username accountName:accountName protocol:protocol tag:tag priority:priority];
 }
 
 - (void) sendResponseToUsername:(NSString*)username
@@ -360,7 +833,22 @@ NSString* OTRKitGetMimeTypeForExtension(NSString* extension) {
                httpStatusString:(NSString*)httpStatusString
                        httpBody:(NSData*)httpBody
                             tag:(id)tag {
+    [self sendResponseToUsername:username accountName:accountName protocol:protocol requestID:requestID httpStatusCode:httpStatusCode httpStatusString:httpStatusString httpHeaders:nil httpBody:httpBody tag:tag];
+}
+
+- (void) sendResponseToUsername:(NSString*)username
+                    accountName:(NSString*)accountName
+                       protocol:(NSString*)protocol
+                      requestID:(NSString*)requestID
+                 httpStatusCode:(int)httpStatusCode
+               httpStatusString:(NSString*)httpStatusString
+                    httpHeaders:(NSDictionary<NSString*, NSString*>*)httpHeaders
+                       httpBody:(NSData*)httpBody
+                            tag:(id)tag {
     OTRHTTPMessage *response = [[OTRHTTPMessage alloc] initResponseWithStatusCode:httpStatusCode description:httpStatusString version:OTRHTTPVersion1_1];
+    [httpHeaders enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSString *obj, BOOL *stop) {
+        [response setValue:obj forHTTPHeaderField:key];
+    }];
     [response setValue:requestID forHTTPHeaderField:kHTTPHeaderRequestID];
     response.HTTPBody = httpBody;
     NSData *httpData = [response HTTPMessageData];
@@ -368,38 +856,394 @@ NSString* OTRKitGetMimeTypeForExtension(NSString* extension) {
     if (!tlv) {
         return;
     }
-    [self.otrKit encodeMessage:nil tlvs:@[tlv] username:username accountName:accountName protocol:protocol tag:tag];
+    // Chunk bodies go in the bulk lane so typed messages don't wait behind a transfer
+    OTRKitPriority priority = OTRKitPriorityInteractive;
+    if (httpBody.length) {
+        priority = OTRKitPriorityBulk;
+    }
+    [self.otrKit encodeMessage:nil tlvs:@[tlv] username:username accountName:accountName protocol:protocol tag:tag priority:priority];
 }
 
 - (void) startIncomingTransfer:(OTRDataIncomingTransfer *)transfer {
-    NSArray *operations = [self createRequestOperationsForIncomingTransfer:transfer];
+    dispatch_async(self.internalQueue, ^{
+        NSURL *url = transfer.offeredURL;
+        // Already expired, cancelled or started
+        if (!url || [self.incomingTransfers objectForKey:url] != transfer || [self.startedIncomingTransfers containsObject:url]) {
+            return;
+        }
+        NSArray<OTRDataIncomingTransfer*> *files = @[transfer];
+        OTRDataManifestTransfer *manifest = nil;
+        if ([transfer isKindOfClass:[OTRDataManifestTransfer class]]) {
+            // The files take the manifest's place, and take turns with each other like any other transfers
+            manifest = (OTRDataManifestTransfer*)transfer;
+            [self.incomingTransfers removeObjectForKey:url];
+            [self.incomingManifests setObject:manifest forKey:url];
+            files = manifest.files;
+            for (OTRDataIncomingTransfer *file in files) {
+                [self.incomingTransfers setObject:file forKey:file.offeredURL];
+            }
+        }
+        NSMutableArray<OTRDataGetOperation*> *operations = [NSMutableArray array];
+        for (OTRDataIncomingTransfer *file in files) {
+            [operations addObjectsFromArray:[self operationsForStartingIncomingTransfer:file]];
+        }
+        if (manifest) {
+            [self reportProgressForManifest:manifest fingerprint:nil];
+        }
+        [self.transferScheduler enqueueOperations:operations];
+        [self sendScheduledRequests];
+        [self enforceResidentBytesLimit];
+    });
+}
+
+/** Must be called on internalQueue. Sends queued GETs until the scheduler's limits are reached. */
+- (void) sendScheduledRequests {
+    OTRDataGetOperation *operation = nil;
+    while ((operation = [self.transferScheduler dequeueOperation])) {
+        [operation start];
+    }
+}
+
+- (NSUInteger) maxOutstandingRequests {
+    __block NSUInteger maxOutstandingRequests = 0;
+    [self performBlock:^{
+        maxOutstandingRequests = self.transferScheduler.maxOutstandingRequests;
+    }];
+    return maxOutstandingRequests;
+}
+
+- (void) setMaxOutstandingRequests:(NSUInteger)maxOutstandingRequests {
+    dispatch_async(self.internalQueue, ^{
+        self.transferScheduler.maxOutstandingRequests = MAX(maxOutstandingRequests, 1);
+        [self sendScheduledRequests];
+    });
+}
+
+- (NSUInteger) maxOutstandingRequestsPerPeer {
+    __block NSUInteger maxOutstandingRequestsPerPeer = 0;
+    [self performBlock:^{
+        maxOutstandingRequestsPerPeer = self.transferScheduler.maxOutstandingRequestsPerPeer;
+    }];
+    return maxOutstandingRequestsPerPeer;
+}
+
+- (void) setMaxOutstandingRequestsPerPeer:(NSUInteger)maxOutstandingRequestsPerPeer {
+    dispatch_async(self.internalQueue, ^{
+        self.transferScheduler.maxOutstandingRequestsPerPeer = MAX(maxOutstandingRequestsPerPeer, 1);
+        [self sendScheduledRequests];
+    });
+}
+
+/** Must be called on internalQueue. Marks transfer started, restores its checkpoint and returns the GETs still needed. */
+- (NSArray<OTRDataGetOperation*>*) operationsForStartingIncomingTransfer:(OTRDataIncomingTransfer*)transfer {
+    [self.startedIncomingTransfers addObject:transfer.offeredURL];
+    transfer.lastActivityDate = [NSDate date];
+    NSIndexSet *restoredChunks = nil;
+    OTRDataTransferCheckpoint *checkpoint = [self openCheckpointForIncomingTransfer:transfer];
+    if (checkpoint) {
+        restoredChunks = [self restoreIncomingTransfer:transfer fromCheckpoint:checkpoint];
+    }
+    NSArray *operations = [self createRequestOperationsForIncomingTransfer:transfer skippingChunks:restoredChunks];
     [operations enumerateObjectsUsingBlock:^(id obj, NSUInteger idx, BOOL * stop) {
         OTRDataGetOperation *operation = (OTRDataGetOperation *)obj;
         [self.getOperationCache setObject:operation forKey:operation.request.requestId];
     }];
-    [self.dataGetOperationQueue addOperations:operations waitUntilFinished:NO];
+    return operations;
 }
 
-- (NSArray*)createRequestOperationsForIncomingTransfer:(OTRDataIncomingTransfer *)transfer {
+/** Chunks are aligned from the start of the file so they line up with checkpoint chunks */
+- (NSArray*)createRequestOperationsForIncomingTransfer:(OTRDataIncomingTransfer *)transfer skippingChunks:(nullable NSIndexSet*)skippedChunks {
     NSMutableArray *operations = [[NSMutableArray alloc] init];
     NSUInteger length = transfer.fileLength;
-    while (length > kOTRDataMaxChunkLength) {
-        length -= kOTRDataMaxChunkLength;
-        NSRange range = NSMakeRange(length, kOTRDataMaxChunkLength);
+    NSUInteger location = 0;
+    NSUInteger chunkIndex = 0;
+    do {
+        NSRange range = NSMakeRange(location, MIN(kOTRDataMaxChunkLength, length - location));
+        location += range.length;
+        if ([skippedChunks containsIndex:chunkIndex++]) {
+            continue;
+        }
         
         OTRDataGetOperation *operation = [[OTRDataGetOperation alloc] initWithRange:range incomingTransfer:transfer dataHandler:self];
         
-        [operations insertObject:operation atIndex:0];
-    }
-    
-    OTRDataGetOperation *operation = [[OTRDataGetOperation alloc] initWithRange:NSMakeRange(0, length) incomingTransfer:transfer dataHandler:self];
-    
-    [operations insertObject:operation atIndex:0];
-    
+        [operations addObject:operation];
+    } while (location < length);
     
     return operations;
 }
 
+#pragma mark Checkpoints
+
+/** Must be called on internalQueue */
+- (nullable OTRDataTransferCheckpoint*) openCheckpointForIncomingTransfer:(OTRDataIncomingTransfer*)transfer {
+    NSString *directory = self.checkpointDirectory;
+    if (!directory || !transfer.fileHash || !transfer.fileLength || !transfer.offeredURL) {
+        return nil;
+    }
+    // The same file offered twice at once, only one of them can write to it
+    for (OTRDataTransferCheckpoint *checkpoint in self.checkpoints.allValues) {
+        if (checkpoint.fileLength == transfer.fileLength && [checkpoint.fileHash caseInsensitiveCompare:transfer.fileHash] == NSOrderedSame) {
+            return nil;
+        }
+    }
+    OTRDataTransferCheckpoint *checkpoint = [[OTRDataTransferCheckpoint alloc] initWithDirectory:directory fileHash:transfer.fileHash fileLength:transfer.fileLength chunkLength:kOTRDataMaxChunkLength error:nil];
+    if (checkpoint) {
+        [self.checkpoints setObject:checkpoint forKey:transfer.offeredURL];
+    }
+    return checkpoint;
+}
+
+/**
+ *  Must be called on internalQueue. Loads chunks already on disk into the transfer.
+ *
+ *  @return indexes of the chunks that don't need to be requested
+ */
+- (NSIndexSet*) restoreIncomingTransfer:(OTRDataIncomingTransfer*)transfer fromCheckpoint:(OTRDataTransferCheckpoint*)checkpoint {
+    NSMutableIndexSet *restoredChunks = [NSMutableIndexSet indexSet];
+    NSUInteger chunkCount = checkpoint.chunkCount;
+    // If everything is on disk, fetch the last chunk again so the transfer finishes through the normal response path
+    if (checkpoint.receivedChunkCount == chunkCount) {
+        chunkCount--;
+    }
+    for (NSUInteger i = 0; i < chunkCount; i++) {
+        if (![checkpoint hasChunkAtIndex:i]) {
+            continue;
+        }
+        NSData *chunk = [checkpoint readChunkAtIndex:i error:nil];
+        if (!chunk) {
+            continue;
+        }
+        [transfer handleResponse:chunk range:[checkpoint rangeForChunkAtIndex:i]];
+        [restoredChunks addIndex:i];
+    }
+    return restoredChunks;
+}
+
+#pragma mark Transfer Lifecycle
+
+- (NSUInteger) chunkCacheLimit {
+    __block NSUInteger chunkCacheLimit = 0;
+    [self performBlock:^{
+        chunkCacheLimit = self.contentStore.chunkCacheLimit;
+    }];
+    return chunkCacheLimit;
+}
+
+- (void) setChunkCacheLimit:(NSUInteger)chunkCacheLimit {
+    dispatch_async(self.internalQueue, ^{
+        self.contentStore.chunkCacheLimit = chunkCacheLimit;
+    });
+}
+
+- (void) cancelTransfer:(OTRDataTransfer*)transfer {
+    dispatch_async(self.internalQueue, ^{
+        NSError *error = [NSError errorWithDomain:kOTRDataErrorDomain code:OTRDataErrorCancelled userInfo:@{NSLocalizedDescriptionKey: @"Transfer cancelled"}];
+        if ([self removeTransfer:transfer error:error fingerprint:nil]) {
+            self.cancelledTransferCount++;
+        }
+    });
+}
+
+- (NSUInteger) expireStaleTransfers {
+    __block NSUInteger count = 0;
+    [self performBlock:^{
+        count = [self sweepTransfers];
+    }];
+    return count;
+}
+
+- (OTRDataHandlerStats*) stats {
+    __block OTRDataHandlerStats *stats = nil;
+    [self performBlock:^{
+        NSUInteger residentBytes = [self residentBytesForTransfers:[self allTransfers]];
+        stats = [[OTRDataHandlerStats alloc] initWithIncomingTransferCount:self.incomingTransfers.count
+                                                     outgoingTransferCount:self.outgoingTransfers.count
+                                                             residentBytes:residentBytes
+                                                       pendingRequestCount:self.requestCache.count
+                                                     pendingOperationCount:self.getOperationCache.count
+                                                      expiredTransferCount:self.expiredTransferCount
+                                                      evictedTransferCount:self.evictedTransferCount
+                                                    cancelledTransferCount:self.cancelledTransferCount
+                                                          servedChunkBytes:self.servedChunkBytes
+                                                           servedBodyBytes:self.servedBodyBytes];
+    }];
+    return stats;
+}
+
+/** Must be called on internalQueue */
+- (NSArray<OTRDataTransfer*>*) allTransfers {
+    return [self.incomingTransfers.allValues arrayByAddingObjectsFromArray:self.outgoingTransfers.allValues];
+}
+
+/** Must be called on internalQueue. Started incoming transfers count their full length since the buffer is coming. */
+- (NSUInteger) residentBytesForTransfer:(OTRDataTransfer*)transfer {
+    NSUInteger residentBytes = transfer.residentBytes;
+    if ([transfer isKindOfClass:[OTRDataIncomingTransfer class]]) {
+        NSURL *url = ((OTRDataIncomingTransfer*)transfer).offeredURL;
+        if (url && [self.startedIncomingTransfers containsObject:url]) {
+            residentBytes = MAX(residentBytes, transfer.fileLength);
+        }
+    }
+    return residentBytes;
+}
+
+/** Must be called on internalQueue. Outgoing transfers of the same file share a buffer, which is counted once. */
+- (NSUInteger) residentBytesForTransfers:(NSArray<OTRDataTransfer*>*)transfers {
+    NSHashTable<NSData*> *countedBuffers = [NSHashTable hashTableWithOptions:NSPointerFunctionsObjectPointerPersonality];
+    NSUInteger residentBytes = 0;
+    for (OTRDataTransfer *transfer in transfers) {
+        if ([transfer isKindOfClass:[OTRDataOutgoingTransfer class]] && transfer.fileData) {
+            if ([countedBuffers containsObject:transfer.fileData]) {
+                continue;
+            }
+            [countedBuffers addObject:transfer.fileData];
+        }
+        residentBytes += [self residentBytesForTransfer:transfer];
+    }
+    return residentBytes;
+}
+
+/** Must be called on internalQueue */
+- (BOOL) isTransferStarted:(OTRDataTransfer*)transfer {
+    if ([transfer isKindOfClass:[OTRDataIncomingTransfer class]]) {
+        NSURL *url = ((OTRDataIncomingTransfer*)transfer).offeredURL;
+        return url && [self.startedIncomingTransfers containsObject:url];
+    }
+    return transfer.bytesTransferred > 0;
+}
+
+/** Must be called on internalQueue. Returns number of transfers removed. */
+- (NSUInteger) sweepTransfers {
+    NSDate *now = [NSDate date];
+    NSTimeInterval offerTimeout = self.offerTimeout;
+    NSTimeInterval idleTimeout = self.idleTimeout;
+    NSUInteger count = 0;
+    for (OTRDataTransfer *transfer in [self allTransfers]) {
+        NSTimeInterval timeout = [self isTransferStarted:transfer] ? idleTimeout : offerTimeout;
+        if (timeout <= 0 || [now timeIntervalSinceDate:transfer.lastActivityDate] < timeout) {
+            continue;
+        }
+        NSError *error = [NSError errorWithDomain:kOTRDataErrorDomain code:OTRDataErrorExpired userInfo:@{NSLocalizedDescriptionKey: @"Transfer expired"}];
+        if ([self removeTransfer:transfer error:error fingerprint:nil]) {
+            self.expiredTransferCount++;
+            count++;
+        }
+    }
+    count += [self enforceResidentBytesLimit];
+    NSString *checkpointDirectory = self.checkpointDirectory;
+    NSTimeInterval checkpointTimeout = self.checkpointTimeout;
+    if (checkpointDirectory && checkpointTimeout > 0) {
+        [OTRDataTransferCheckpoint removeCheckpointsInDirectory:checkpointDirectory notModifiedSince:[now dateByAddingTimeInterval:-checkpointTimeout]];
+    }
+    return count;
+}
+
+/** Must be called on internalQueue. Evicts least recently active transfers until under maxResidentBytes. */
+- (NSUInteger) enforceResidentBytesLimit {
+    NSUInteger maxResidentBytes = self.maxResidentBytes;
+    if (!maxResidentBytes) {
+        return 0;
+    }
+    NSArray<OTRDataTransfer*> *transfers = [self allTransfers];
+    NSUInteger residentBytes = [self residentBytesForTransfers:transfers];
+    if (residentBytes <= maxResidentBytes) {
+        return 0;
+    }
+    NSMutableArray<OTRDataTransfer*> *remainingTransfers = [[transfers sortedArrayUsingComparator:^NSComparisonResult(OTRDataTransfer *transfer1, OTRDataTransfer *transfer2) {
+        return [transfer1.lastActivityDate compare:transfer2.lastActivityDate];
+    }] mutableCopy];
+    NSUInteger count = 0;
+    while (residentBytes > maxResidentBytes && remainingTransfers.count) {
+        OTRDataTransfer *transfer = remainingTransfers.firstObject;
+        [remainingTransfers removeObjectAtIndex:0];
+        if (![self residentBytesForTransfer:transfer]) {
+            continue;
+        }
+        NSError *error = [NSError errorWithDomain:kOTRDataErrorDomain code:OTRDataErrorEvicted userInfo:@{NSLocalizedDescriptionKey: @"Transfer evicted to free memory"}];
+        if ([self removeTransfer:transfer error:error fingerprint:nil]) {
+            // A shared buffer is only freed once its last transfer is gone
+            residentBytes = [self residentBytesForTransfers:remainingTransfers];
+            self.evictedTransferCount++;
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ *  Must be called on internalQueue. Forgets the transfer and everything held for it,
+ *  and reports error to the delegate.
+ *
+ *  @return NO if the transfer had already finished or been removed
+ */
+- (BOOL) removeTransfer:(OTRDataTransfer*)transfer error:(NSError*)error fingerprint:(nullable OTRFingerprint*)fingerprint {
+    BOOL removed = NO;
+    if ([transfer isKindOfClass:[OTRDataManifestTransfer class]]) {
+        OTRDataManifestTransfer *manifest = (OTRDataManifestTransfer*)transfer;
+        NSURL *url = manifest.offeredURL;
+        if (url && ([self.incomingTransfers objectForKey:url] == manifest || [self.incomingManifests objectForKey:url] == manifest)) {
+            [self.incomingTransfers removeObjectForKey:url];
+            [self.incomingManifests removeObjectForKey:url];
+            removed = YES;
+            // Only started files are removed and reported, finished ones keep their completion
+            for (OTRDataIncomingTransfer *file in manifest.files) {
+                [self removeTransfer:file error:error fingerprint:fingerprint];
+            }
+        }
+    } else if ([transfer isKindOfClass:[OTRDataIncomingTransfer class]]) {
+        NSURL *url = ((OTRDataIncomingTransfer*)transfer).offeredURL;
+        if (url && [self.incomingTransfers objectForKey:url] == transfer) {
+            [self.incomingTransfers removeObjectForKey:url];
+            [self.startedIncomingTransfers removeObject:url];
+            removed = YES;
+        }
+        NSMutableArray<NSString*> *requestIds = [NSMutableArray array];
+        [self.getOperationCache enumerateKeysAndObjectsUsingBlock:^(NSString *requestId, OTRDataGetOperation *operation, BOOL *stop) {
+            if (operation.incomingTransfer == transfer) {
+                [operation cancel];
+                [requestIds addObject:requestId];
+            }
+        }];
+        [self.getOperationCache removeObjectsForKeys:requestIds];
+        // Responses for them may never come, hand their turns to other transfers
+        [self.transferScheduler removeOperationsForTransfer:(OTRDataIncomingTransfer*)transfer];
+        [self sendScheduledRequests];
+        if (url) {
+            // Keep what we have unless the user doesn't want the file anymore
+            OTRDataTransferCheckpoint *checkpoint = [self.checkpoints objectForKey:url];
+            if ([error.domain isEqualToString:kOTRDataErrorDomain] && error.code == OTRDataErrorCancelled) {
+                [checkpoint remove];
+            } else {
+                [checkpoint close];
+            }
+            [self.checkpoints removeObjectForKey:url];
+        }
+    } else if ([transfer isKindOfClass:[OTRDataOutgoingTransfer class]]) {
+        NSURL *url = [self urlForTransfer:transfer];
+        if ([self.outgoingTransfers objectForKey:url] == transfer) {
+            [self removeOutgoingTransferForURL:url];
+            removed = YES;
+        }
+        NSMutableArray<NSString*> *requestIds = [NSMutableArray array];
+        [self.requestCache enumerateKeysAndObjectsUsingBlock:^(NSString *requestId, OTRDataRequest *request, BOOL *stop) {
+            if ([request.url isEqual:url]) {
+                [requestIds addObject:requestId];
+            }
+        }];
+        [self.requestCache removeObjectsForKeys:requestIds];
+    }
+    [self.reportedProgress removeObjectForKey:transfer.transferId];
+    if (removed) {
+        [self deliverCallback:^{
+            [self.delegate dataHandler:self transfer:transfer fingerprint:fingerprint error:error];
+        } forKey:nil];
+        if ([transfer isKindOfClass:[OTRDataIncomingTransfer class]] && ((OTRDataIncomingTransfer*)transfer).manifest) {
+            [self manifestFile:(OTRDataIncomingTransfer*)transfer finishedWithError:error fingerprint:fingerprint];
+        }
+    }
+    return removed;
+}
+
 #pragma mark OTRTLVDelegate
 
 /**
@@ -411,6 +1255,7 @@ NSString* OTRKitGetMimeTypeForExtension(NSString* extension) {
  *  @param accountName Your account name
  *  @param protocol the protocol of accountName, such as @"xmpp"
  *  @param tag optional tag to attach additional application-specific data to message. Only used locally.
+ *  @note Called on internalQueue, see registerTLVHandler:targetQueue:
  */
 - (void)receiveTLV:(OTRTLV*)tlv
           username:(NSString*)username
@@ -0,0 +1,50 @@
+//
+//  OTRDataHandlerStats.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+/** Snapshot of transfers and bookkeeping held in memory by an OTRDataHandler. */
+@interface OTRDataHandlerStats : NSObject
+
+/** Incoming transfers that have been offered and not yet completed, failed or expired */
+@property (nonatomic, readonly) NSUInteger incomingTransferCount;
+/** Outgoing transfers that have been offered and not yet fully served */
+@property (nonatomic, readonly) NSUInteger outgoingTransferCount;
+/** Bytes of file data held by all incoming and outgoing transfers */
+@property (nonatomic, readonly) NSUInteger residentBytes;
+/** Sent requests still waiting on a response */
+@property (nonatomic, readonly) NSUInteger pendingRequestCount;
+/** Chunk GET operations queued or waiting on a response */
+@property (nonatomic, readonly) NSUInteger pendingOperationCount;
+/** Transfers removed because the offer or transfer went idle, since the handler was created */
+@property (nonatomic, readonly) NSUInteger expiredTransferCount;
+/** Transfers removed to stay under maxResidentBytes, since the handler was created */
+@property (nonatomic, readonly) NSUInteger evictedTransferCount;
+/** Transfers removed with cancelTransfer:, since the handler was created */
+@property (nonatomic, readonly) NSUInteger cancelledTransferCount;
+/** File bytes served to GET requests, since the handler was created */
+@property (nonatomic, readonly) NSUInteger servedChunkBytes;
+/** Response body bytes those chunks went out as, smaller than servedChunkBytes when compressed */
+@property (nonatomic, readonly) NSUInteger servedBodyBytes;
+
+- (instancetype) initWithIncomingTransferCount:(NSUInteger)incomingTransferCount
+                         outgoingTransferCount:(NSUInteger)outgoingTransferCount
+                                 residentBytes:(NSUInteger)residentBytes
+                           pendingRequestCount:(NSUInteger)pendingRequestCount
+                         pendingOperationCount:(NSUInteger)pendingOperationCount
+                          expiredTransferCount:(NSUInteger)expiredTransferCount
+                          evictedTransferCount:(NSUInteger)evictedTransferCount
+                        cancelledTransferCount:(NSUInteger)cancelledTransferCount
+                              servedChunkBytes:(NSUInteger)servedChunkBytes
+                               servedBodyBytes:(NSUInteger)servedBodyBytes NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+@end
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,42 @@
+//
+//  OTRDataHandlerStats.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRDataHandlerStats.h"
+
+@implementation OTRDataHandlerStats
+
+- (instancetype) initWithIncomingTransferCount:(NSUInteger)incomingTransferCount
+                         outgoingTransferCount:(NSUInteger)outgoingTransferCount
+                                 residentBytes:(NSUInteger)residentBytes
+                           pendingRequestCount:(NSUInteger)pendingRequestCount
+                         pendingOperationCount:(NSUInteger)pendingOperationCount
+                          expiredTransferCount:(NSUInteger)expiredTransferCount
+                          evictedTransferCount:(NSUInteger)evictedTransferCount
+                        cancelledTransferCount:(NSUInteger)cancelledTransferCount
+                              servedChunkBytes:(NSUInteger)servedChunkBytes
+                               servedBodyBytes:(NSUInteger)servedBodyBytes {
+    if (self = [super init]) {
+        _incomingTransferCount = incomingTransferCount;
+        _outgoingTransferCount = outgoingTransferCount;
+        _residentBytes = residentBytes;
+        _pendingRequestCount = pendingRequestCount;
+        _pendingOperationCount = pendingOperationCount;
+        _expiredTransferCount = expiredTransferCount;
+        _evictedTransferCount = evictedTransferCount;
+        _cancelledTransferCount = cancelledTransferCount;
+        _servedChunkBytes = servedChunkBytes;
+        _servedBodyBytes = servedBodyBytes;
+    }
+    return self;
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p incoming: %d outgoing: %d bytes: %d requests: %d operations: %d expired: %d evicted: %d cancelled: %d served: %d (%d on the wire)>", NSStringFromClass([self class]), self, (int)self.incomingTransferCount, (int)self.outgoingTransferCount, (int)self.residentBytes, (int)self.pendingRequestCount, (int)self.pendingOperationCount, (int)self.expiredTransferCount, (int)self.evictedTransferCount, (int)self.cancelledTransferCount, (int)self.servedChunkBytes, (int)self.servedBodyBytes];
+}
+
+@end
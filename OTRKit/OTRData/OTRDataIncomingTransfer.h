@@ -9,12 +9,23 @@
 #import <OTRKit/OTRDataTransfer.h>
 #import <OTRKit/OTRDataRequest.h>
 
+@class OTRDataManifestTransfer;
+
 NS_ASSUME_NONNULL_BEGIN
 @interface OTRDataIncomingTransfer : OTRDataTransfer
 
 @property (nonatomic, strong, nullable) NSURL *offeredURL;
 
+/** Content coding sent with each GET, e.g. "deflate" if both sides support it. nil requests plain chunks. */
+@property (nonatomic, copy, nullable) NSString *acceptEncoding;
+
+/** The manifest this file was offered in, nil for files offered on their own */
+@property (nonatomic, weak, nullable) OTRDataManifestTransfer *manifest;
+
 - (void) handleResponse:(NSData*)response forRequest:(OTRDataRequest*)request;
 
+/** Adds data for a byte range, e.g. a chunk restored from a checkpoint */
+- (void) handleResponse:(NSData*)response range:(NSRange)range;
+
 @end
 NS_ASSUME_NONNULL_END
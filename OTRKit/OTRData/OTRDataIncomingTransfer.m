@@ -19,14 +19,19 @@
                         accountName:(NSString*)accountName
                            protocol:(NSString*)protocol
                                 tag:(id)tag {
-    if (self = [super initWithFileLength:fileLength username:username accountName:accountName protocol:protocol tag:tag]) {
-        self.incomingFileData = [NSMutableData dataWithLength:fileLength];
-    }
-    return self;
+    // incomingFileData is allocated on the first response so unaccepted offers don't hold a full buffer
+    return [super initWithFileLength:fileLength username:username accountName:accountName protocol:protocol tag:tag];
+}
+
+- (NSUInteger) residentBytes {
+    return self.incomingFileData.length;
 }
 
 - (void) handleResponse:(NSData*)response forRequest:(OTRDataRequest*)request {
-    NSRange range = request.range;
+    [self handleResponse:response range:request.range];
+}
+
+- (void) handleResponse:(NSData*)response range:(NSRange)range {
     if (!response.length) {
         return;
     }
@@ -34,9 +39,16 @@
     if (response.length != range.length) {
         return;
     }
+    if (!self.incomingFileData) {
+        self.incomingFileData = [NSMutableData dataWithLength:self.fileLength];
+    }
+    if (NSMaxRange(range) > self.incomingFileData.length) {
+        return;
+    }
     [self.incomingFileData replaceBytesInRange:range withBytes:response.bytes length:response.length];
     
     self.bytesTransferred += response.length;
+    self.lastActivityDate = [NSDate date];
     if (self.bytesTransferred == self.fileLength) {
         self.fileData = self.incomingFileData;
     }
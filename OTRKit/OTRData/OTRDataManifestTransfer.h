@@ -0,0 +1,32 @@
+//
+//  OTRDataManifestTransfer.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <OTRKit/OTRDataIncomingTransfer.h>
+
+NS_ASSUME_NONNULL_BEGIN
+/**
+ *  Several files offered with one OFFER, see OTRDataHandler's
+ *  sendFilesWithNames:fileData:username:accountName:protocol:tag:.
+ *
+ *  It is passed to dataHandler:offeredTransfer:fingerprint: like a single
+ *  file and starting it starts all of its files. Progress is reported for the
+ *  manifest as a whole, completion for each file and then for the manifest.
+ *  fileLength and bytesTransferred cover all files, fileData is always nil.
+ */
+@interface OTRDataManifestTransfer : OTRDataIncomingTransfer
+
+@property (nonatomic, copy, readonly) NSArray<OTRDataIncomingTransfer*> *files;
+
+- (instancetype) initWithFiles:(NSArray<OTRDataIncomingTransfer*>*)files
+                      username:(NSString*)username
+                   accountName:(NSString*)accountName
+                      protocol:(NSString*)protocol
+                           tag:(nullable id)tag;
+
+@end
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,44 @@
+//
+//  OTRDataManifestTransfer.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRDataManifestTransfer.h"
+
+@implementation OTRDataManifestTransfer
+
+- (instancetype) initWithFiles:(NSArray<OTRDataIncomingTransfer*>*)files
+                      username:(NSString*)username
+                   accountName:(NSString*)accountName
+                      protocol:(NSString*)protocol
+                           tag:(id)tag {
+    NSUInteger fileLength = 0;
+    for (OTRDataIncomingTransfer *file in files) {
+        fileLength += file.fileLength;
+    }
+    if (self = [super initWithFileLength:fileLength username:username accountName:accountName protocol:protocol tag:tag]) {
+        _files = [files copy];
+        for (OTRDataIncomingTransfer *file in _files) {
+            file.manifest = self;
+        }
+    }
+    return self;
+}
+
+/** Each file holds its own data */
+- (NSUInteger) residentBytes {
+    return 0;
+}
+
+- (void) handleResponse:(NSData*)response range:(NSRange)range {
+    // Chunks are requested for the files, never for the manifest
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p files: %d %d/%d bytes>", NSStringFromClass([self class]), self, (int)self.files.count, (int)self.bytesTransferred, (int)self.fileLength];
+}
+
+@end
@@ -8,6 +8,17 @@
 
 #import <OTRKit/OTRDataTransfer.h>
 
+NS_ASSUME_NONNULL_BEGIN
 @interface OTRDataOutgoingTransfer : OTRDataTransfer
 
+/**
+ *  Records a chunk served to the receiver and updates bytesTransferred. Bytes
+ *  served more than once, e.g. retried GETs or chunks asked for again after
+ *  the receiver resumed, only count once.
+ *
+ *  @return YES once every byte of the file has been served
+ */
+- (BOOL) addServedRange:(NSRange)range;
+
 @end
+NS_ASSUME_NONNULL_END
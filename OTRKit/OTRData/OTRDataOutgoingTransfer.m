@@ -8,6 +8,30 @@
 
 #import "OTRDataOutgoingTransfer.h"
 
+@interface OTRDataOutgoingTransfer ()
+@property (nonatomic, strong, readonly) NSMutableIndexSet *servedIndexes;
+@end
+
 @implementation OTRDataOutgoingTransfer
 
+- (instancetype) initWithFileLength:(NSUInteger)fileLength
+                           username:(NSString*)username
+                        accountName:(NSString*)accountName
+                           protocol:(NSString*)protocol
+                                tag:(nullable id)tag {
+    if (self = [super initWithFileLength:fileLength username:username accountName:accountName protocol:protocol tag:tag]) {
+        _servedIndexes = [NSMutableIndexSet indexSet];
+    }
+    return self;
+}
+
+- (BOOL) addServedRange:(NSRange)range {
+    NSRange fileRange = NSIntersectionRange(range, NSMakeRange(0, self.fileLength));
+    if (fileRange.length) {
+        [self.servedIndexes addIndexesInRange:fileRange];
+    }
+    self.bytesTransferred = self.servedIndexes.count;
+    return self.bytesTransferred == self.fileLength;
+}
+
 @end
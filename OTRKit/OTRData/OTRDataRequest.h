@@ -18,6 +18,9 @@ NS_ASSUME_NONNULL_BEGIN
 
 @property (nonatomic) NSRange range;
 
+/** Sent as the request body, e.g. the file list of a manifest OFFER */
+@property (nonatomic, strong, nullable) NSData *httpBody;
+
 - (instancetype) initWithRequestId:(NSString*)requestId
                                url:(NSURL*)url
                         httpMethod:(NSString*)httpMethod
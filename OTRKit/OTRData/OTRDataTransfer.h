@@ -9,6 +9,15 @@
 #import <Foundation/Foundation.h>
 
 NS_ASSUME_NONNULL_BEGIN
+/** How big a share of the chunk requests an incoming transfer gets next to others */
+typedef NS_ENUM(NSInteger, OTRDataTransferPriority) {
+    /** A quarter of the share of a normal transfer, e.g. prefetching */
+    OTRDataTransferPriorityLow = -1,
+    OTRDataTransferPriorityNormal = 0,
+    /** Four times the share of a normal transfer, e.g. what's on screen */
+    OTRDataTransferPriorityHigh = 1
+};
+
 @interface OTRDataTransfer : NSObject
 
 /** Unique UUID string */
@@ -35,6 +44,22 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property (nonatomic, readwrite) NSUInteger bytesTransferred;
 
+/** When the transfer was offered */
+@property (nonatomic, strong, readonly) NSDate *creationDate;
+
+/** Last time a chunk was sent or received. Used to expire idle transfers. */
+@property (nonatomic, strong, readwrite) NSDate *lastActivityDate;
+
+/**
+ *  Share of chunk requests compared to other started incoming transfers, can be
+ *  changed at any time and applies from the next request. Files of a manifest
+ *  use the manifest's priority. Defaults to OTRDataTransferPriorityNormal.
+ */
+@property (atomic, readwrite) OTRDataTransferPriority priority;
+
+/** Bytes of file data currently held in memory for this transfer */
+@property (nonatomic, readonly) NSUInteger residentBytes;
+
 - (instancetype) initWithFileLength:(NSUInteger)fileLength
                            username:(NSString*)username
                         accountName:(NSString*)accountName
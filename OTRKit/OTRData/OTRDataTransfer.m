@@ -22,8 +22,14 @@
         _accountName = accountName;
         _protocol = protocol;
         _tag = tag;
+        _creationDate = [NSDate date];
+        _lastActivityDate = _creationDate;
     }
     return self;
 }
 
+- (NSUInteger) residentBytes {
+    return self.fileData.length;
+}
+
 @end
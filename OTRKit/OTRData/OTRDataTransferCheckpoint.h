@@ -0,0 +1,73 @@
+//
+//  OTRDataTransferCheckpoint.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+/**
+ *  On-disk progress of an incoming OTRDATA transfer, so a download can pick up
+ *  where it left off after the session drops or the app restarts.
+ *
+ *  A checkpoint is a partial file plus a bitmap of which fixed-size chunks
+ *  have been written. It's keyed by the offered File-Hash-SHA1 and length, so a
+ *  later offer of the same file finds it even though the offer URL is new.
+ *  Chunk data is always written before its bit, so a crash in between only
+ *  costs a re-fetch of that chunk. The file hash is still checked once the
+ *  transfer completes.
+ *
+ *  Not thread safe, OTRDataHandler only uses it from its internal queue.
+ */
+@interface OTRDataTransferCheckpoint : NSObject
+
+@property (nonatomic, strong, readonly) NSString *fileHash;
+@property (nonatomic, readonly) NSUInteger fileLength;
+@property (nonatomic, readonly) NSUInteger chunkLength;
+@property (nonatomic, readonly) NSUInteger chunkCount;
+/** Chunks already on disk */
+@property (nonatomic, readonly) NSUInteger receivedChunkCount;
+
+/**
+ *  Opens the checkpoint for a file in directory, creating it if needed.
+ *
+ *  @param fileHash hex SHA-1 from the offer. Anything else returns nil since it's used in file names.
+ *  @return nil if the hash isn't valid or the files couldn't be opened
+ */
+- (nullable instancetype) initWithDirectory:(NSString*)directory
+                                   fileHash:(NSString*)fileHash
+                                 fileLength:(NSUInteger)fileLength
+                                chunkLength:(NSUInteger)chunkLength
+                                      error:(NSError**)error NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+/** Byte range covered by a chunk. The last chunk may be short. */
+- (NSRange) rangeForChunkAtIndex:(NSUInteger)index;
+
+- (BOOL) hasChunkAtIndex:(NSUInteger)index;
+
+/**
+ *  Writes a chunk to the partial file and marks it received.
+ *
+ *  @param range must be exactly rangeForChunkAtIndex: for some chunk
+ */
+- (BOOL) writeData:(NSData*)data range:(NSRange)range error:(NSError**)error;
+
+/** Reads a chunk that has already been received */
+- (nullable NSData*) readChunkAtIndex:(NSUInteger)index error:(NSError**)error;
+
+/** Closes the files and leaves them on disk to resume later */
+- (void) close;
+
+/** Closes and deletes the files, e.g. when the transfer completes or is cancelled */
+- (void) remove;
+
+/** Deletes checkpoints in directory that haven't been written to since date */
++ (void) removeCheckpointsInDirectory:(NSString*)directory notModifiedSince:(NSDate*)date;
+
+@end
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,204 @@
+//
+//  OTRDataTransferCheckpoint.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRDataTransferCheckpoint.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+static NSString * const kOTRCheckpointDataExtension = @"part";
+static NSString * const kOTRCheckpointBitmapExtension = @"ranges";
+static const NSUInteger kOTRSHA1HexLength = 40;
+
+static NSError* posix_error() {
+    return [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+}
+
+@interface OTRDataTransferCheckpoint ()
+@property (nonatomic, strong, readonly) NSString *dataPath;
+@property (nonatomic, strong, readonly) NSString *bitmapPath;
+@property (nonatomic, strong, readonly) NSMutableData *bitmap;
+@end
+
+@implementation OTRDataTransferCheckpoint {
+    int _dataFD;
+    int _bitmapFD;
+}
+
++ (BOOL) isValidFileHash:(NSString*)fileHash {
+    if (fileHash.length != kOTRSHA1HexLength) {
+        return NO;
+    }
+    NSCharacterSet *nonHexCharacters = [[NSCharacterSet characterSetWithCharactersInString:@"0123456789abcdefABCDEF"] invertedSet];
+    return [fileHash rangeOfCharacterFromSet:nonHexCharacters].location == NSNotFound;
+}
+
+- (nullable instancetype) initWithDirectory:(NSString*)directory
+                                   fileHash:(NSString*)fileHash
+                                 fileLength:(NSUInteger)fileLength
+                                chunkLength:(NSUInteger)chunkLength
+                                      error:(NSError**)error {
+    if (![[self class] isValidFileHash:fileHash] || !chunkLength || !fileLength) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:EINVAL userInfo:nil];
+        }
+        return nil;
+    }
+    if (self = [super init]) {
+        _dataFD = -1;
+        _bitmapFD = -1;
+        _fileHash = [fileHash lowercaseString];
+        _fileLength = fileLength;
+        _chunkLength = chunkLength;
+        _chunkCount = (fileLength + chunkLength - 1) / chunkLength;
+        // Chunk length is part of the name so a bitmap is never read with the wrong chunk size
+        NSString *baseName = [NSString stringWithFormat:@"%@-%lu-%lu", _fileHash, (unsigned long)fileLength, (unsigned long)chunkLength];
+        NSString *basePath = [directory stringByAppendingPathComponent:baseName];
+        _dataPath = [basePath stringByAppendingPathExtension:kOTRCheckpointDataExtension];
+        _bitmapPath = [basePath stringByAppendingPathExtension:kOTRCheckpointBitmapExtension];
+        
+        if (![[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:error]) {
+            return nil;
+        }
+        if (![self openFiles]) {
+            if (error) {
+                *error = posix_error();
+            }
+            [self close];
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void) dealloc {
+    [self close];
+}
+
+/** Opens or creates both files. A bitmap of the wrong size means the files are stale and start over. */
+- (BOOL) openFiles {
+    NSUInteger bitmapLength = (_chunkCount + 7) / 8;
+    _bitmapFD = open(self.bitmapPath.fileSystemRepresentation, O_RDWR | O_CREAT, 0600);
+    if (_bitmapFD < 0) {
+        return NO;
+    }
+    _bitmap = [NSMutableData dataWithLength:bitmapLength];
+    ssize_t bytesRead = pread(_bitmapFD, _bitmap.mutableBytes, bitmapLength, 0);
+    if (bytesRead != (ssize_t)bitmapLength) {
+        [_bitmap resetBytesInRange:NSMakeRange(0, bitmapLength)];
+        if (ftruncate(_bitmapFD, 0) != 0 || pwrite(_bitmapFD, _bitmap.bytes, bitmapLength, 0) != (ssize_t)bitmapLength) {
+            return NO;
+        }
+    }
+    _dataFD = open(self.dataPath.fileSystemRepresentation, O_RDWR | O_CREAT, 0600);
+    if (_dataFD < 0) {
+        return NO;
+    }
+    if (ftruncate(_dataFD, (off_t)_fileLength) != 0) {
+        return NO;
+    }
+    const uint8_t *bits = _bitmap.bytes;
+    for (NSUInteger i = 0; i < bitmapLength; i++) {
+        _receivedChunkCount += __builtin_popcount(bits[i]);
+    }
+    return YES;
+}
+
+- (NSRange) rangeForChunkAtIndex:(NSUInteger)index {
+    NSUInteger location = index * _chunkLength;
+    return NSMakeRange(location, MIN(_chunkLength, _fileLength - location));
+}
+
+- (BOOL) hasChunkAtIndex:(NSUInteger)index {
+    if (index >= _chunkCount) {
+        return NO;
+    }
+    const uint8_t *bits = _bitmap.bytes;
+    return (bits[index / 8] >> (index % 8)) & 1;
+}
+
+- (BOOL) writeData:(NSData*)data range:(NSRange)range error:(NSError**)error {
+    NSUInteger index = range.location / _chunkLength;
+    if (_dataFD < 0 || index >= _chunkCount || !NSEqualRanges(range, [self rangeForChunkAtIndex:index]) || data.length != range.length) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:EINVAL userInfo:nil];
+        }
+        return NO;
+    }
+    if ([self hasChunkAtIndex:index]) {
+        return YES;
+    }
+    if (pwrite(_dataFD, data.bytes, data.length, (off_t)range.location) != (ssize_t)data.length) {
+        if (error) {
+            *error = posix_error();
+        }
+        return NO;
+    }
+    uint8_t *bits = _bitmap.mutableBytes;
+    bits[index / 8] |= (1 << (index % 8));
+    if (pwrite(_bitmapFD, &bits[index / 8], 1, (off_t)(index / 8)) != 1) {
+        bits[index / 8] &= ~(1 << (index % 8));
+        if (error) {
+            *error = posix_error();
+        }
+        return NO;
+    }
+    _receivedChunkCount++;
+    return YES;
+}
+
+- (nullable NSData*) readChunkAtIndex:(NSUInteger)index error:(NSError**)error {
+    if (_dataFD < 0 || ![self hasChunkAtIndex:index]) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:EINVAL userInfo:nil];
+        }
+        return nil;
+    }
+    NSRange range = [self rangeForChunkAtIndex:index];
+    NSMutableData *data = [NSMutableData dataWithLength:range.length];
+    if (pread(_dataFD, data.mutableBytes, range.length, (off_t)range.location) != (ssize_t)range.length) {
+        if (error) {
+            *error = posix_error();
+        }
+        return nil;
+    }
+    return data;
+}
+
+- (void) close {
+    if (_dataFD >= 0) {
+        close(_dataFD);
+        _dataFD = -1;
+    }
+    if (_bitmapFD >= 0) {
+        close(_bitmapFD);
+        _bitmapFD = -1;
+    }
+}
+
+- (void) remove {
+    [self close];
+    [[NSFileManager defaultManager] removeItemAtPath:self.dataPath error:nil];
+    [[NSFileManager defaultManager] removeItemAtPath:self.bitmapPath error:nil];
+}
+
++ (void) removeCheckpointsInDirectory:(NSString*)directory notModifiedSince:(NSDate*)date {
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    for (NSString *fileName in [fileManager contentsOfDirectoryAtPath:directory error:nil]) {
+        NSString *extension = fileName.pathExtension;
+        if (![extension isEqualToString:kOTRCheckpointDataExtension] && ![extension isEqualToString:kOTRCheckpointBitmapExtension]) {
+            continue;
+        }
+        NSString *path = [directory stringByAppendingPathComponent:fileName];
+        NSDate *modificationDate = [[fileManager attributesOfItemAtPath:path error:nil] fileModificationDate];
+        if (modificationDate && [modificationDate compare:date] == NSOrderedAscending) {
+            [fileManager removeItemAtPath:path error:nil];
+        }
+    }
+}
+
+@end
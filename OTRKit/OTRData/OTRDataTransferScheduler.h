@@ -0,0 +1,66 @@
+//
+//  OTRDataTransferScheduler.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+#import <OTRKit/OTRDataTransfer.h>
+
+@class OTRDataGetOperation;
+@class OTRDataIncomingTransfer;
+
+NS_ASSUME_NONNULL_BEGIN
+/**
+ *  Decides which chunk GET of the started incoming transfers goes out next.
+ *
+ *  Peers (username, accountName and protocol) take turns, then the transfers
+ *  of the chosen peer take turns, each weighted by priority with stride
+ *  scheduling. A transfer that joins starts at the current turn rather than
+ *  behind the chunks already queued, so a small file finishes in a few round
+ *  trips while a big one keeps using the rest of the requests.
+ *
+ *  Not thread safe, OTRDataHandler only uses it from its internal queue.
+ */
+@interface OTRDataTransferScheduler : NSObject
+
+/** Requests waiting on a response across all peers */
+@property (nonatomic, readwrite) NSUInteger maxOutstandingRequests;
+
+/** Requests waiting on a response for any one peer */
+@property (nonatomic, readwrite) NSUInteger maxOutstandingRequestsPerPeer;
+
+/** Operations not handed out yet */
+@property (nonatomic, readonly) NSUInteger queuedCount;
+
+/** Operations handed out and not yet finished */
+@property (nonatomic, readonly) NSUInteger outstandingCount;
+
+- (instancetype) initWithMaxOutstandingRequests:(NSUInteger)maxOutstandingRequests
+                  maxOutstandingRequestsPerPeer:(NSUInteger)maxOutstandingRequestsPerPeer NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+/** Queues operations behind the ones already queued for their transfer */
+- (void) enqueueOperations:(NSArray<OTRDataGetOperation*>*)operations;
+
+/**
+ *  Takes the next operation and counts it as outstanding until operationFinished:
+ *
+ *  @return nil if nothing is queued or the limits are reached
+ */
+- (nullable OTRDataGetOperation*) dequeueOperation;
+
+/** Frees the operation's slot. Does nothing for operations that aren't outstanding. */
+- (void) operationFinished:(OTRDataGetOperation*)operation;
+
+/** Drops the transfer's queued operations and frees the slots of its outstanding ones */
+- (void) removeOperationsForTransfer:(OTRDataIncomingTransfer*)transfer;
+
+/** Weight for priority, how many requests a transfer gets for each one of an OTRDataTransferPriorityLow transfer */
++ (NSUInteger) weightForPriority:(OTRDataTransferPriority)priority;
+
+@end
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,244 @@
+//
+//  OTRDataTransferScheduler.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRDataTransferScheduler.h"
+#import "OTRDataGetOperation.h"
+#import "OTRDataIncomingTransfer.h"
+#import "OTRDataManifestTransfer.h"
+#import "OTRDataRequest.h"
+
+/** Queued and outstanding operations of one transfer */
+@interface OTRDataScheduledTransfer : NSObject
+@property (nonatomic, strong, readonly) OTRDataIncomingTransfer *transfer;
+@property (nonatomic, strong, readonly) NSMutableArray<OTRDataGetOperation*> *queue;
+@property (nonatomic) NSUInteger outstandingCount;
+/** Lowest pass goes next */
+@property (nonatomic) double pass;
+@end
+
+@implementation OTRDataScheduledTransfer
+
+- (instancetype) initWithTransfer:(OTRDataIncomingTransfer*)transfer {
+    if (self = [super init]) {
+        _transfer = transfer;
+        _queue = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (NSUInteger) weight {
+    OTRDataTransfer *transfer = self.transfer.manifest ?: self.transfer;
+    return [OTRDataTransferScheduler weightForPriority:transfer.priority];
+}
+
+@end
+
+/** Transfers of one conversation */
+@interface OTRDataScheduledPeer : NSObject
+@property (nonatomic, copy, readonly) NSString *key;
+/** In the order they were added */
+@property (nonatomic, strong, readonly) NSMutableArray<OTRDataScheduledTransfer*> *transfers;
+@property (nonatomic) NSUInteger queuedCount;
+@property (nonatomic) NSUInteger outstandingCount;
+/** Lowest pass goes next */
+@property (nonatomic) double pass;
+/** Pass of the transfer that went last, transfers joining this peer start here */
+@property (nonatomic) double virtualTime;
+@end
+
+@implementation OTRDataScheduledPeer
+
+- (instancetype) initWithKey:(NSString*)key {
+    if (self = [super init]) {
+        _key = [key copy];
+        _transfers = [NSMutableArray array];
+    }
+    return self;
+}
+
+@end
+
+@interface OTRDataTransferScheduler()
+/** In the order they were added */
+@property (nonatomic, strong, readonly) NSMutableArray<OTRDataScheduledPeer*> *peers;
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, OTRDataScheduledPeer*> *peersByKey;
+/** Keyed to transferId */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, OTRDataScheduledTransfer*> *transfers;
+/** Transfer of each outstanding operation, keyed to Request-Id */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, OTRDataScheduledTransfer*> *outstandingOperations;
+/** Pass of the peer that went last, peers joining start here */
+@property (nonatomic) double virtualTime;
+@property (nonatomic, readwrite) NSUInteger queuedCount;
+@end
+
+@implementation OTRDataTransferScheduler
+
+- (instancetype) initWithMaxOutstandingRequests:(NSUInteger)maxOutstandingRequests
+                  maxOutstandingRequestsPerPeer:(NSUInteger)maxOutstandingRequestsPerPeer {
+    if (self = [super init]) {
+        _maxOutstandingRequests = maxOutstandingRequests;
+        _maxOutstandingRequestsPerPeer = maxOutstandingRequestsPerPeer;
+        _peers = [NSMutableArray array];
+        _peersByKey = [NSMutableDictionary dictionary];
+        _transfers = [NSMutableDictionary dictionary];
+        _outstandingOperations = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
++ (NSUInteger) weightForPriority:(OTRDataTransferPriority)priority {
+    switch (priority) {
+        case OTRDataTransferPriorityLow:
+            return 1;
+        case OTRDataTransferPriorityHigh:
+            return 16;
+        case OTRDataTransferPriorityNormal:
+        default:
+            return 4;
+    }
+}
+
+- (NSUInteger) outstandingCount {
+    return self.outstandingOperations.count;
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p peers: %d transfers: %d queued: %d outstanding: %d>", NSStringFromClass([self class]), self, (int)self.peers.count, (int)self.transfers.count, (int)self.queuedCount, (int)self.outstandingCount];
+}
+
+#pragma mark Queueing
+
++ (NSString*) peerKeyForTransfer:(OTRDataTransfer*)transfer {
+    return [NSString stringWithFormat:@"%@\n%@\n%@", transfer.username, transfer.accountName, transfer.protocol];
+}
+
+- (OTRDataScheduledTransfer*) scheduledTransferForTransfer:(OTRDataIncomingTransfer*)transfer {
+    OTRDataScheduledTransfer *scheduledTransfer = [self.transfers objectForKey:transfer.transferId];
+    if (scheduledTransfer) {
+        return scheduledTransfer;
+    }
+    NSString *peerKey = [[self class] peerKeyForTransfer:transfer];
+    OTRDataScheduledPeer *peer = [self.peersByKey objectForKey:peerKey];
+    if (!peer) {
+        peer = [[OTRDataScheduledPeer alloc] initWithKey:peerKey];
+        peer.pass = self.virtualTime;
+        [self.peers addObject:peer];
+        [self.peersByKey setObject:peer forKey:peerKey];
+    }
+    scheduledTransfer = [[OTRDataScheduledTransfer alloc] initWithTransfer:transfer];
+    scheduledTransfer.pass = peer.virtualTime;
+    [peer.transfers addObject:scheduledTransfer];
+    [self.transfers setObject:scheduledTransfer forKey:transfer.transferId];
+    return scheduledTransfer;
+}
+
+- (void) enqueueOperations:(NSArray<OTRDataGetOperation*>*)operations {
+    for (OTRDataGetOperation *operation in operations) {
+        OTRDataScheduledTransfer *scheduledTransfer = [self scheduledTransferForTransfer:operation.incomingTransfer];
+        OTRDataScheduledPeer *peer = [self.peersByKey objectForKey:[[self class] peerKeyForTransfer:operation.incomingTransfer]];
+        // Coming back after sitting idle doesn't earn extra turns
+        if (!peer.queuedCount) {
+            peer.pass = MAX(peer.pass, self.virtualTime);
+        }
+        if (!scheduledTransfer.queue.count) {
+            scheduledTransfer.pass = MAX(scheduledTransfer.pass, peer.virtualTime);
+        }
+        [scheduledTransfer.queue addObject:operation];
+        peer.queuedCount++;
+        self.queuedCount++;
+    }
+}
+
+- (nullable OTRDataGetOperation*) dequeueOperation {
+    if (self.outstandingCount >= self.maxOutstandingRequests) {
+        return nil;
+    }
+    OTRDataScheduledPeer *peer = nil;
+    for (OTRDataScheduledPeer *candidate in self.peers) {
+        if (!candidate.queuedCount || candidate.outstandingCount >= self.maxOutstandingRequestsPerPeer) {
+            continue;
+        }
+        if (!peer || candidate.pass < peer.pass) {
+            peer = candidate;
+        }
+    }
+    if (!peer) {
+        return nil;
+    }
+    // A peer gets turns at the weight of its highest priority transfer
+    OTRDataScheduledTransfer *scheduledTransfer = nil;
+    NSUInteger peerWeight = 1;
+    for (OTRDataScheduledTransfer *candidate in peer.transfers) {
+        if (!candidate.queue.count) {
+            continue;
+        }
+        peerWeight = MAX(peerWeight, [candidate weight]);
+        if (!scheduledTransfer || candidate.pass < scheduledTransfer.pass) {
+            scheduledTransfer = candidate;
+        }
+    }
+    OTRDataGetOperation *operation = scheduledTransfer.queue.firstObject;
+    [scheduledTransfer.queue removeObjectAtIndex:0];
+    self.virtualTime = peer.pass;
+    peer.pass += 1.0 / peerWeight;
+    peer.virtualTime = scheduledTransfer.pass;
+    scheduledTransfer.pass += 1.0 / [scheduledTransfer weight];
+
+    peer.queuedCount--;
+    self.queuedCount--;
+    peer.outstandingCount++;
+    scheduledTransfer.outstandingCount++;
+    [self.outstandingOperations setObject:scheduledTransfer forKey:operation.request.requestId];
+    return operation;
+}
+
+- (void) operationFinished:(OTRDataGetOperation*)operation {
+    NSString *requestId = operation.request.requestId;
+    OTRDataScheduledTransfer *scheduledTransfer = [self.outstandingOperations objectForKey:requestId];
+    if (!scheduledTransfer) {
+        return;
+    }
+    [self.outstandingOperations removeObjectForKey:requestId];
+    scheduledTransfer.outstandingCount--;
+    OTRDataScheduledPeer *peer = [self.peersByKey objectForKey:[[self class] peerKeyForTransfer:scheduledTransfer.transfer]];
+    peer.outstandingCount--;
+    [self removeTransferIfIdle:scheduledTransfer];
+}
+
+- (void) removeOperationsForTransfer:(OTRDataIncomingTransfer*)transfer {
+    OTRDataScheduledTransfer *scheduledTransfer = [self.transfers objectForKey:transfer.transferId];
+    if (!scheduledTransfer) {
+        return;
+    }
+    OTRDataScheduledPeer *peer = [self.peersByKey objectForKey:[[self class] peerKeyForTransfer:transfer]];
+    NSArray<NSString*> *requestIds = [self.outstandingOperations allKeysForObject:scheduledTransfer];
+    [self.outstandingOperations removeObjectsForKeys:requestIds];
+    peer.outstandingCount -= scheduledTransfer.outstandingCount;
+    peer.queuedCount -= scheduledTransfer.queue.count;
+    self.queuedCount -= scheduledTransfer.queue.count;
+    scheduledTransfer.outstandingCount = 0;
+    [scheduledTransfer.queue removeAllObjects];
+    [self removeTransferIfIdle:scheduledTransfer];
+}
+
+/** Forgets the transfer once it has nothing queued or outstanding, and its peer once that was the last transfer */
+- (void) removeTransferIfIdle:(OTRDataScheduledTransfer*)scheduledTransfer {
+    if (scheduledTransfer.queue.count || scheduledTransfer.outstandingCount) {
+        return;
+    }
+    NSString *peerKey = [[self class] peerKeyForTransfer:scheduledTransfer.transfer];
+    OTRDataScheduledPeer *peer = [self.peersByKey objectForKey:peerKey];
+    [peer.transfers removeObjectIdenticalTo:scheduledTransfer];
+    [self.transfers removeObjectForKey:scheduledTransfer.transfer.transferId];
+    if (!peer.transfers.count) {
+        [self.peers removeObjectIdenticalTo:peer];
+        [self.peersByKey removeObjectForKey:peerKey];
+    }
+}
+
+@end
@@ -0,0 +1,35 @@
+//
+//  OTREncodedMessage.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+#import <OTRKit/OTRFingerprint.h>
+
+NS_ASSUME_NONNULL_BEGIN
+/** Result of encoding a message for a single recipient. Used by the fan-out encode API. */
+@interface OTREncodedMessage : NSObject
+
+/** Intended recipient of the message */
+@property (nonatomic, copy, readonly) NSString *username;
+/** Message to be sent over the network. Nil if there was an error. */
+@property (nonatomic, copy, readonly, nullable) NSString *encodedMessage;
+/** Whether or not encodedMessage is ciphertext. This is just a check for a "?OTR" prefix. */
+@property (nonatomic, readonly) BOOL wasEncrypted;
+/** Fingerprint of contact, if in session */
+@property (nonatomic, strong, readonly, nullable) OTRFingerprint *fingerprint;
+@property (nonatomic, strong, readonly, nullable) NSError *error;
+
+- (instancetype) initWithUsername:(NSString*)username
+                   encodedMessage:(nullable NSString*)encodedMessage
+                     wasEncrypted:(BOOL)wasEncrypted
+                      fingerprint:(nullable OTRFingerprint*)fingerprint
+                            error:(nullable NSError*)error NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+@end
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,29 @@
+//
+//  OTREncodedMessage.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTREncodedMessage.h"
+
+@implementation OTREncodedMessage
+
+- (instancetype) initWithUsername:(NSString*)username
+                   encodedMessage:(nullable NSString*)encodedMessage
+                     wasEncrypted:(BOOL)wasEncrypted
+                      fingerprint:(nullable OTRFingerprint*)fingerprint
+                            error:(nullable NSError*)error {
+    NSParameterAssert(username != nil);
+    if (self = [super init]) {
+        _username = [username copy];
+        _encodedMessage = [encodedMessage copy];
+        _wasEncrypted = wasEncrypted;
+        _fingerprint = fingerprint;
+        _error = error;
+    }
+    return self;
+}
+
+@end
@@ -0,0 +1,90 @@
+//
+//  OTRFingerprintIndex.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+#import <OTRKit/OTRFingerprint.h>
+
+NS_ASSUME_NONNULL_BEGIN
+/** Which fingerprints to return from an OTRFingerprintIndex. nil properties match everything. */
+@interface OTRFingerprintQuery : NSObject
+
+/** Set together with protocol */
+@property (nonatomic, copy, readonly, nullable) NSString *accountName;
+@property (nonatomic, copy, readonly, nullable) NSString *protocol;
+/** Only used when accountName and protocol are set */
+@property (nonatomic, copy, readonly, nullable) NSString *username;
+/** OTRTrustLevel values to match */
+@property (nonatomic, copy, readonly, nullable) NSIndexSet *trustLevels;
+
+/** Matches every fingerprint */
+- (instancetype) init;
+
+- (instancetype) initWithAccountName:(nullable NSString*)accountName
+                            protocol:(nullable NSString*)protocol
+                            username:(nullable NSString*)username
+                         trustLevels:(nullable NSIndexSet*)trustLevels NS_DESIGNATED_INITIALIZER;
+
++ (instancetype) queryWithAccountName:(NSString*)accountName protocol:(NSString*)protocol;
+
++ (instancetype) queryWithTrustLevels:(NSIndexSet*)trustLevels;
+
+@end
+
+/**
+ *  Thread-safe in-memory index of known fingerprints, looked up by fingerprint
+ *  bytes, by account and by trust level without walking every entry.
+ *
+ *  Entries are kept in the order they were first added. Paged enumeration only
+ *  holds the index for the length of one page, so fingerprints added while
+ *  enumerating show up in later pages and a change to an entry already returned
+ *  is not returned again.
+ *
+ *  OTRFingerprint is mutable, so every call returns fresh copies.
+ */
+@interface OTRFingerprintIndex : NSObject
+
+/** Number of fingerprints in the index */
+@property (nonatomic, readonly) NSUInteger count;
+
+/** Replaces the contents of the index */
+- (void) resetWithFingerprints:(NSArray<OTRFingerprint*>*)fingerprints;
+
+/** Adds a fingerprint, or updates the trust level if it's already in the index */
+- (void) saveFingerprint:(OTRFingerprint*)fingerprint;
+
+- (void) removeFingerprint:(OTRFingerprint*)fingerprint;
+
+/** Exact lookup, ignores trustLevel */
+- (nullable OTRFingerprint*) fingerprintForUsername:(NSString*)username
+                                        accountName:(NSString*)accountName
+                                           protocol:(NSString*)protocol
+                                    fingerprintData:(NSData*)fingerprintData;
+
+/** Every entry with these fingerprint bytes, the same key can be known for more than one username */
+- (NSArray<OTRFingerprint*>*) fingerprintsWithData:(NSData*)fingerprintData;
+
+- (NSUInteger) countOfFingerprintsMatchingQuery:(OTRFingerprintQuery*)query;
+
+/** Materializes every match at once. Prefer enumerateFingerprintsMatchingQuery: for large indexes. */
+- (NSArray<OTRFingerprint*>*) fingerprintsMatchingQuery:(OTRFingerprintQuery*)query;
+
+/**
+ *  Synchronously calls block with successive pages of matching fingerprints.
+ *  Each page is looked up separately and block is called without holding the
+ *  index, so it's safe to modify the index from block.
+ *
+ *  @param query    fingerprints to return
+ *  @param pageSize maximum number of fingerprints per page
+ *  @param block    called on the calling thread, set stop to YES to end early
+ */
+- (void) enumerateFingerprintsMatchingQuery:(OTRFingerprintQuery*)query
+                                   pageSize:(NSUInteger)pageSize
+                                 usingBlock:(void (^)(NSArray<OTRFingerprint*> *page, BOOL *stop))block;
+
+@end
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,488 @@
+//
+//  OTRFingerprintIndex.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRFingerprintIndex.h"
+
+@implementation OTRFingerprintQuery
+
+- (instancetype) init {
+    return [self initWithAccountName:nil protocol:nil username:nil trustLevels:nil];
+}
+
+- (instancetype) initWithAccountName:(nullable NSString*)accountName
+                            protocol:(nullable NSString*)protocol
+                            username:(nullable NSString*)username
+                         trustLevels:(nullable NSIndexSet*)trustLevels {
+    NSParameterAssert((accountName == nil) == (protocol == nil));
+    NSParameterAssert(username == nil || accountName != nil);
+    if (self = [super init]) {
+        if (accountName && protocol) {
+            _accountName = [accountName copy];
+            _protocol = [protocol copy];
+            _username = [username copy];
+        }
+        _trustLevels = [trustLevels copy];
+    }
+    return self;
+}
+
++ (instancetype) queryWithAccountName:(NSString*)accountName protocol:(NSString*)protocol {
+    return [[self alloc] initWithAccountName:accountName protocol:protocol username:nil trustLevels:nil];
+}
+
++ (instancetype) queryWithTrustLevels:(NSIndexSet*)trustLevels {
+    return [[self alloc] initWithAccountName:nil protocol:nil username:nil trustLevels:trustLevels];
+}
+
+- (BOOL) matchesTrustLevel:(OTRTrustLevel)trustLevel {
+    return !self.trustLevels || [self.trustLevels containsIndex:trustLevel];
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p accountName: %@ protocol: %@ username: %@ trustLevels: %@>", NSStringFromClass([self class]), self, self.accountName, self.protocol, self.username, self.trustLevels];
+}
+
+@end
+
+/** Immutable so pages can be read after leaving indexQueue. A trust change replaces the entry, keeping its sequence. */
+@interface OTRFingerprintIndexEntry : NSObject
+/** Order the entry was first added in */
+@property (nonatomic, readonly) uint64_t sequence;
+@property (nonatomic, copy, readonly) NSString *username;
+@property (nonatomic, copy, readonly) NSString *accountName;
+@property (nonatomic, copy, readonly) NSString *protocol;
+@property (nonatomic, copy, readonly) NSData *fingerprintData;
+@property (nonatomic, readonly) OTRTrustLevel trustLevel;
+@end
+
+@implementation OTRFingerprintIndexEntry
+
+- (instancetype) initWithSequence:(uint64_t)sequence
+                      fingerprint:(OTRFingerprint*)fingerprint {
+    if (self = [super init]) {
+        _sequence = sequence;
+        _username = [fingerprint.username copy];
+        _accountName = [fingerprint.accountName copy];
+        _protocol = [fingerprint.protocol copy];
+        _fingerprintData = [fingerprint.fingerprint copy];
+        _trustLevel = fingerprint.trustLevel;
+    }
+    return self;
+}
+
+- (instancetype) initWithEntry:(OTRFingerprintIndexEntry*)entry trustLevel:(OTRTrustLevel)trustLevel {
+    if (self = [super init]) {
+        _sequence = entry.sequence;
+        _username = entry.username;
+        _accountName = entry.accountName;
+        _protocol = entry.protocol;
+        _fingerprintData = entry.fingerprintData;
+        _trustLevel = trustLevel;
+    }
+    return self;
+}
+
+- (OTRFingerprint*) fingerprint {
+    return [[OTRFingerprint alloc] initWithUsername:self.username accountName:self.accountName protocol:self.protocol fingerprint:self.fingerprintData trustLevel:self.trustLevel];
+}
+
+@end
+
+static NSString* OTRFingerprintIndexContextKey(NSString *username, NSString *accountName, NSString *protocol) {
+    return [NSString stringWithFormat:@"%@\n%@\n%@", username, accountName, protocol];
+}
+
+static NSString* OTRFingerprintIndexAccountKey(NSString *accountName, NSString *protocol) {
+    return [NSString stringWithFormat:@"%@\n%@", accountName, protocol];
+}
+
+/** Index of the first entry after sequence. entries must be in sequence order. */
+static NSUInteger OTRFingerprintIndexAfterSequence(NSArray<OTRFingerprintIndexEntry*> *entries, uint64_t sequence) {
+    NSUInteger low = 0;
+    NSUInteger high = entries.count;
+    while (low < high) {
+        NSUInteger mid = low + (high - low) / 2;
+        if (entries[mid].sequence <= sequence) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void OTRFingerprintIndexInsertEntry(NSMutableArray<OTRFingerprintIndexEntry*> *entries, OTRFingerprintIndexEntry *entry) {
+    [entries insertObject:entry atIndex:OTRFingerprintIndexAfterSequence(entries, entry.sequence)];
+}
+
+/** Removes oldEntry, and puts newEntry in its place if there is one */
+static void OTRFingerprintIndexReplaceEntry(NSMutableArray<OTRFingerprintIndexEntry*> *entries, OTRFingerprintIndexEntry *oldEntry, OTRFingerprintIndexEntry * _Nullable newEntry) {
+    NSUInteger index = OTRFingerprintIndexAfterSequence(entries, oldEntry.sequence - 1);
+    if (index >= entries.count || entries[index] != oldEntry) {
+        return;
+    }
+    if (newEntry) {
+        [entries replaceObjectAtIndex:index withObject:newEntry];
+    } else {
+        [entries removeObjectAtIndex:index];
+    }
+}
+
+@interface OTRFingerprintIndex ()
+/** Guards everything below */
+@property (nonatomic, strong, readonly) dispatch_queue_t indexQueue;
+/** Keyed by OTRFingerprintIndexContextKey, then by fingerprint bytes */
+@property (nonatomic, strong) NSMutableDictionary<NSString*, NSMutableDictionary<NSData*, OTRFingerprintIndexEntry*>*> *entriesByContext;
+@property (nonatomic, strong) NSMutableDictionary<NSData*, NSMutableArray<OTRFingerprintIndexEntry*>*> *entriesByData;
+/** The arrays below are kept in sequence order so pages can resume with a binary search */
+@property (nonatomic, strong) NSMutableArray<OTRFingerprintIndexEntry*> *allEntries;
+/** Keyed by OTRFingerprintIndexAccountKey */
+@property (nonatomic, strong) NSMutableDictionary<NSString*, NSMutableArray<OTRFingerprintIndexEntry*>*> *entriesByAccount;
+/** Keyed by OTRTrustLevel */
+@property (nonatomic, strong) NSMutableDictionary<NSNumber*, NSMutableArray<OTRFingerprintIndexEntry*>*> *entriesByTrust;
+@property (nonatomic) uint64_t nextSequence;
+@end
+
+@implementation OTRFingerprintIndex
+
+- (instancetype) init {
+    if (self = [super init]) {
+        _indexQueue = dispatch_queue_create("OTRFingerprintIndex Queue", 0);
+        [self removeAllEntries];
+    }
+    return self;
+}
+
+#pragma mark Public
+
+- (NSUInteger) count {
+    __block NSUInteger count = 0;
+    dispatch_sync(self.indexQueue, ^{
+        count = self.allEntries.count;
+    });
+    return count;
+}
+
+- (void) resetWithFingerprints:(NSArray<OTRFingerprint*>*)fingerprints {
+    dispatch_sync(self.indexQueue, ^{
+        [self removeAllEntries];
+        for (OTRFingerprint *fingerprint in fingerprints) {
+            [self saveEntryForFingerprint:fingerprint];
+        }
+    });
+}
+
+- (void) saveFingerprint:(OTRFingerprint*)fingerprint {
+    NSParameterAssert(fingerprint != nil);
+    if (!fingerprint) {
+        return;
+    }
+    dispatch_sync(self.indexQueue, ^{
+        [self saveEntryForFingerprint:fingerprint];
+    });
+}
+
+- (void) removeFingerprint:(OTRFingerprint*)fingerprint {
+    NSParameterAssert(fingerprint != nil);
+    if (!fingerprint) {
+        return;
+    }
+    dispatch_sync(self.indexQueue, ^{
+        OTRFingerprintIndexEntry *entry = [self entryForUsername:fingerprint.username accountName:fingerprint.accountName protocol:fingerprint.protocol fingerprintData:fingerprint.fingerprint];
+        if (entry) {
+            [self replaceEntry:entry withEntry:nil];
+        }
+    });
+}
+
+- (nullable OTRFingerprint*) fingerprintForUsername:(NSString*)username
+                                        accountName:(NSString*)accountName
+                                           protocol:(NSString*)protocol
+                                    fingerprintData:(NSData*)fingerprintData {
+    NSParameterAssert(username != nil);
+    NSParameterAssert(accountName != nil);
+    NSParameterAssert(protocol != nil);
+    NSParameterAssert(fingerprintData != nil);
+    if (!username || !accountName || !protocol || !fingerprintData) {
+        return nil;
+    }
+    __block OTRFingerprintIndexEntry *entry = nil;
+    dispatch_sync(self.indexQueue, ^{
+        entry = [self entryForUsername:username accountName:accountName protocol:protocol fingerprintData:fingerprintData];
+    });
+    return entry.fingerprint;
+}
+
+- (NSArray<OTRFingerprint*>*) fingerprintsWithData:(NSData*)fingerprintData {
+    NSParameterAssert(fingerprintData != nil);
+    if (!fingerprintData) {
+        return @[];
+    }
+    __block NSArray<OTRFingerprintIndexEntry*> *entries = nil;
+    dispatch_sync(self.indexQueue, ^{
+        entries = [[self.entriesByData objectForKey:fingerprintData] copy];
+    });
+    return [[self class] fingerprintsForEntries:entries];
+}
+
+- (NSUInteger) countOfFingerprintsMatchingQuery:(OTRFingerprintQuery*)query {
+    NSParameterAssert(query != nil);
+    __block NSUInteger count = 0;
+    dispatch_sync(self.indexQueue, ^{
+        if (query.accountName && query.protocol) {
+            NSArray<OTRFingerprintIndexEntry*> *candidates = [self candidateEntriesForQuery:query];
+            if (!query.trustLevels) {
+                count = candidates.count;
+                return;
+            }
+            for (OTRFingerprintIndexEntry *entry in candidates) {
+                if ([query matchesTrustLevel:entry.trustLevel]) {
+                    count++;
+                }
+            }
+        } else if (query.trustLevels) {
+            [query.trustLevels enumerateIndexesUsingBlock:^(NSUInteger trustLevel, BOOL *stop) {
+                count += [self.entriesByTrust objectForKey:@(trustLevel)].count;
+            }];
+        } else {
+            count = self.allEntries.count;
+        }
+    });
+    return count;
+}
+
+- (NSArray<OTRFingerprint*>*) fingerprintsMatchingQuery:(OTRFingerprintQuery*)query {
+    NSParameterAssert(query != nil);
+    __block NSArray<OTRFingerprintIndexEntry*> *entries = nil;
+    dispatch_sync(self.indexQueue, ^{
+        entries = [self entriesMatchingQuery:query afterSequence:0 limit:NSUIntegerMax];
+    });
+    return [[self class] fingerprintsForEntries:entries];
+}
+
+- (void) enumerateFingerprintsMatchingQuery:(OTRFingerprintQuery*)query
+                                   pageSize:(NSUInteger)pageSize
+                                 usingBlock:(void (^)(NSArray<OTRFingerprint*> *page, BOOL *stop))block {
+    NSParameterAssert(query != nil);
+    NSParameterAssert(block != nil);
+    if (!query || !block) {
+        return;
+    }
+    pageSize = MAX(pageSize, 1);
+    __block uint64_t sequence = 0;
+    BOOL stop = NO;
+    while (!stop) {
+        __block NSArray<OTRFingerprintIndexEntry*> *entries = nil;
+        dispatch_sync(self.indexQueue, ^{
+            entries = [self entriesMatchingQuery:query afterSequence:sequence limit:pageSize];
+        });
+        if (!entries.count) {
+            break;
+        }
+        sequence = entries.lastObject.sequence;
+        block([[self class] fingerprintsForEntries:entries], &stop);
+        if (entries.count < pageSize) {
+            break;
+        }
+    }
+}
+
+#pragma mark Private
+
++ (NSArray<OTRFingerprint*>*) fingerprintsForEntries:(nullable NSArray<OTRFingerprintIndexEntry*>*)entries {
+    NSMutableArray<OTRFingerprint*> *fingerprints = [NSMutableArray arrayWithCapacity:entries.count];
+    for (OTRFingerprintIndexEntry *entry in entries) {
+        [fingerprints addObject:entry.fingerprint];
+    }
+    return fingerprints;
+}
+
+/** Must be called on indexQueue */
+- (void) removeAllEntries {
+    self.entriesByContext = [NSMutableDictionary dictionary];
+    self.entriesByData = [NSMutableDictionary dictionary];
+    self.allEntries = [NSMutableArray array];
+    self.entriesByAccount = [NSMutableDictionary dictionary];
+    self.entriesByTrust = [NSMutableDictionary dictionary];
+    // Sequence 0 is before everything, for the first page
+    self.nextSequence = 1;
+}
+
+/** Must be called on indexQueue */
+- (nullable OTRFingerprintIndexEntry*) entryForUsername:(NSString*)username
+                                            accountName:(NSString*)accountName
+                                               protocol:(NSString*)protocol
+                                        fingerprintData:(NSData*)fingerprintData {
+    NSString *contextKey = OTRFingerprintIndexContextKey(username, accountName, protocol);
+    return [[self.entriesByContext objectForKey:contextKey] objectForKey:fingerprintData];
+}
+
+/** Must be called on indexQueue */
+- (void) saveEntryForFingerprint:(OTRFingerprint*)fingerprint {
+    OTRFingerprintIndexEntry *existing = [self entryForUsername:fingerprint.username accountName:fingerprint.accountName protocol:fingerprint.protocol fingerprintData:fingerprint.fingerprint];
+    if (existing) {
+        if (existing.trustLevel != fingerprint.trustLevel) {
+            OTRFingerprintIndexEntry *entry = [[OTRFingerprintIndexEntry alloc] initWithEntry:existing trustLevel:fingerprint.trustLevel];
+            [self replaceEntry:existing withEntry:entry];
+        }
+        return;
+    }
+    OTRFingerprintIndexEntry *entry = [[OTRFingerprintIndexEntry alloc] initWithSequence:self.nextSequence fingerprint:fingerprint];
+    self.nextSequence++;
+
+    NSString *contextKey = OTRFingerprintIndexContextKey(entry.username, entry.accountName, entry.protocol);
+    NSMutableDictionary<NSData*, OTRFingerprintIndexEntry*> *contextEntries = [self.entriesByContext objectForKey:contextKey];
+    if (!contextEntries) {
+        contextEntries = [NSMutableDictionary dictionary];
+        [self.entriesByContext setObject:contextEntries forKey:contextKey];
+    }
+    [contextEntries setObject:entry forKey:entry.fingerprintData];
+
+    NSMutableArray<OTRFingerprintIndexEntry*> *dataEntries = [self.entriesByData objectForKey:entry.fingerprintData];
+    if (!dataEntries) {
+        dataEntries = [NSMutableArray arrayWithCapacity:1];
+        [self.entriesByData setObject:dataEntries forKey:entry.fingerprintData];
+    }
+    [dataEntries addObject:entry];
+
+    NSString *accountKey = OTRFingerprintIndexAccountKey(entry.accountName, entry.protocol);
+    NSMutableArray<OTRFingerprintIndexEntry*> *accountEntries = [self.entriesByAccount objectForKey:accountKey];
+    if (!accountEntries) {
+        accountEntries = [NSMutableArray array];
+        [self.entriesByAccount setObject:accountEntries forKey:accountKey];
+    }
+    // New entries always have the highest sequence, so these are appends
+    [accountEntries addObject:entry];
+    [self.allEntries addObject:entry];
+    [[self trustEntriesForTrustLevel:entry.trustLevel] addObject:entry];
+}
+
+/** Must be called on indexQueue */
+- (NSMutableArray<OTRFingerprintIndexEntry*>*) trustEntriesForTrustLevel:(OTRTrustLevel)trustLevel {
+    NSMutableArray<OTRFingerprintIndexEntry*> *trustEntries = [self.entriesByTrust objectForKey:@(trustLevel)];
+    if (!trustEntries) {
+        trustEntries = [NSMutableArray array];
+        [self.entriesByTrust setObject:trustEntries forKey:@(trustLevel)];
+    }
+    return trustEntries;
+}
+
+/**
+ *  Swaps an entry for one with a new trust level, or removes it if newEntry is nil.
+ *  Must be called on indexQueue
+ */
+- (void) replaceEntry:(OTRFingerprintIndexEntry*)oldEntry withEntry:(nullable OTRFingerprintIndexEntry*)newEntry {
+    NSString *contextKey = OTRFingerprintIndexContextKey(oldEntry.username, oldEntry.accountName, oldEntry.protocol);
+    NSMutableDictionary<NSData*, OTRFingerprintIndexEntry*> *contextEntries = [self.entriesByContext objectForKey:contextKey];
+    if (newEntry) {
+        [contextEntries setObject:newEntry forKey:newEntry.fingerprintData];
+    } else {
+        [contextEntries removeObjectForKey:oldEntry.fingerprintData];
+        if (!contextEntries.count) {
+            [self.entriesByContext removeObjectForKey:contextKey];
+        }
+    }
+
+    NSMutableArray<OTRFingerprintIndexEntry*> *dataEntries = [self.entriesByData objectForKey:oldEntry.fingerprintData];
+    NSUInteger dataIndex = [dataEntries indexOfObjectIdenticalTo:oldEntry];
+    if (dataIndex != NSNotFound) {
+        if (newEntry) {
+            [dataEntries replaceObjectAtIndex:dataIndex withObject:newEntry];
+        } else {
+            [dataEntries removeObjectAtIndex:dataIndex];
+        }
+    }
+    if (!dataEntries.count) {
+        [self.entriesByData removeObjectForKey:oldEntry.fingerprintData];
+    }
+
+    OTRFingerprintIndexReplaceEntry(self.allEntries, oldEntry, newEntry);
+
+    NSString *accountKey = OTRFingerprintIndexAccountKey(oldEntry.accountName, oldEntry.protocol);
+    NSMutableArray<OTRFingerprintIndexEntry*> *accountEntries = [self.entriesByAccount objectForKey:accountKey];
+    OTRFingerprintIndexReplaceEntry(accountEntries, oldEntry, newEntry);
+    if (!accountEntries.count) {
+        [self.entriesByAccount removeObjectForKey:accountKey];
+    }
+
+    NSMutableArray<OTRFingerprintIndexEntry*> *oldTrustEntries = [self.entriesByTrust objectForKey:@(oldEntry.trustLevel)];
+    OTRFingerprintIndexReplaceEntry(oldTrustEntries, oldEntry, nil);
+    if (!oldTrustEntries.count) {
+        [self.entriesByTrust removeObjectForKey:@(oldEntry.trustLevel)];
+    }
+    if (newEntry) {
+        OTRFingerprintIndexInsertEntry([self trustEntriesForTrustLevel:newEntry.trustLevel], newEntry);
+    }
+}
+
+/** Entries to filter for an account query, in sequence order. Must be called on indexQueue */
+- (NSArray<OTRFingerprintIndexEntry*>*) candidateEntriesForQuery:(OTRFingerprintQuery*)query {
+    if (query.username) {
+        NSString *contextKey = OTRFingerprintIndexContextKey(query.username, query.accountName, query.protocol);
+        NSArray<OTRFingerprintIndexEntry*> *entries = [self.entriesByContext objectForKey:contextKey].allValues;
+        return [entries sortedArrayUsingComparator:^NSComparisonResult(OTRFingerprintIndexEntry *entry1, OTRFingerprintIndexEntry *entry2) {
+            if (entry1.sequence == entry2.sequence) {
+                return NSOrderedSame;
+            }
+            return entry1.sequence < entry2.sequence ? NSOrderedAscending : NSOrderedDescending;
+        }];
+    }
+    NSString *accountKey = OTRFingerprintIndexAccountKey(query.accountName, query.protocol);
+    return [self.entriesByAccount objectForKey:accountKey] ?: @[];
+}
+
+/** Up to limit matching entries after sequence, in sequence order. Must be called on indexQueue */
+- (NSArray<OTRFingerprintIndexEntry*>*) entriesMatchingQuery:(OTRFingerprintQuery*)query
+                                               afterSequence:(uint64_t)sequence
+                                                       limit:(NSUInteger)limit {
+    NSMutableArray<OTRFingerprintIndexEntry*> *matches = [NSMutableArray array];
+    if (query.accountName && query.protocol) {
+        [self appendEntries:[self candidateEntriesForQuery:query] matchingQuery:query afterSequence:sequence limit:limit toArray:matches];
+    } else if (query.trustLevels) {
+        // Each trust level is already in order, take up to a page from each and merge
+        [query.trustLevels enumerateIndexesUsingBlock:^(NSUInteger trustLevel, BOOL *stop) {
+            NSArray<OTRFingerprintIndexEntry*> *trustEntries = [self.entriesByTrust objectForKey:@(trustLevel)];
+            NSUInteger start = OTRFingerprintIndexAfterSequence(trustEntries, sequence);
+            NSUInteger length = MIN(trustEntries.count - start, limit);
+            if (length) {
+                [matches addObjectsFromArray:[trustEntries subarrayWithRange:NSMakeRange(start, length)]];
+            }
+        }];
+        if (query.trustLevels.count > 1) {
+            [matches sortUsingComparator:^NSComparisonResult(OTRFingerprintIndexEntry *entry1, OTRFingerprintIndexEntry *entry2) {
+                if (entry1.sequence == entry2.sequence) {
+                    return NSOrderedSame;
+                }
+                return entry1.sequence < entry2.sequence ? NSOrderedAscending : NSOrderedDescending;
+            }];
+        }
+        if (matches.count > limit) {
+            [matches removeObjectsInRange:NSMakeRange(limit, matches.count - limit)];
+        }
+    } else {
+        [self appendEntries:self.allEntries matchingQuery:query afterSequence:sequence limit:limit toArray:matches];
+    }
+    return matches;
+}
+
+/** Must be called on indexQueue */
+- (void) appendEntries:(NSArray<OTRFingerprintIndexEntry*>*)entries
+         matchingQuery:(OTRFingerprintQuery*)query
+         afterSequence:(uint64_t)sequence
+                 limit:(NSUInteger)limit
+               toArray:(NSMutableArray<OTRFingerprintIndexEntry*>*)matches {
+    NSUInteger count = entries.count;
+    for (NSUInteger i = OTRFingerprintIndexAfterSequence(entries, sequence); i < count && matches.count < limit; i++) {
+        OTRFingerprintIndexEntry *entry = entries[i];
+        if ([query matchesTrustLevel:entry.trustLevel]) {
+            [matches addObject:entry];
+        }
+    }
+}
+
+@end
@@ -48,11 +48,29 @@ FOUNDATION_EXPORT const unsigned char otrkitVersionString[];
 #import <OTRKit/OTRErrorUtility.h>
 #import <OTRKit/OTRDataGetOperation.h>
 #import <OTRKit/OTRFingerprint.h>
+#import <OTRKit/OTRFingerprintIndex.h>
+#import <OTRKit/OTREncodedMessage.h>
+#import <OTRKit/OTRSymmetricKeyUse.h>
+#import <OTRKit/OTRKitMemoryReport.h>
+#import <OTRKit/OTRSessionSnapshot.h>
+#import <OTRKit/OTRConversationState.h>
+#import <OTRKit/OTRDHKeypairPool.h>
+#import <OTRKit/OTRPriorityScheduler.h>
+#import <OTRKit/OTRNotificationCoalescer.h>
+#import <OTRKit/OTRTrafficRecorder.h>
 #import <OTRKit/NSData+OTRDATA.h>
 #import <OTRKit/OTRDataRequest.h>
 #import <OTRKit/OTRCryptoUtility.h>
+#import <OTRKit/OTRCryptoRuntime.h>
+#import <OTRKit/OTRDigest.h>
 #import <OTRKit/OTRHTTPMessage.h>
 #import <OTRKit/OTRDataHandler.h>
+#import <OTRKit/OTRDataHandlerStats.h>
+#import <OTRKit/OTRDataTransferCheckpoint.h>
+#import <OTRKit/OTRDataContentStore.h>
 #import <OTRKit/OTRTLV.h>
 #import <OTRKit/OTRDataIncomingTransfer.h>
+#import <OTRKit/OTRDataManifestTransfer.h>
 #import <OTRKit/OTRDataTransfer.h>
+#import <OTRKit/OTRDataTransferScheduler.h>
+#import <OTRKit/OTRAccountStore.h>
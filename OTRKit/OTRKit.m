@@ -39,17 +39,85 @@
 #import <libotr/proto.h>
 #import <libotr/message.h>
 #import <libotr/privkey.h>
+#import <libotr/sm.h>
 #import <libotr/proto.h>
 #import "OTRDataHandler.h"
 #import "OTRErrorUtility.h"
+#import "OTREncodedMessage.h"
+#import "OTRKitMemoryReport.h"
+#import "OTRDHKeypairPool.h"
+#import "OTRNotificationCoalescer.h"
+#import "OTRFingerprintIndex.h"
+#import "OTRSymmetricKeyUse.h"
+#import "OTRTrafficRecorder.h"
+#import "OTRCryptoRuntime.h"
+#import "NSData+OTRDATA.h"
+#import "OTRSessionSnapshot.h"
+#import "OTRConversationState.h"
+#import "OTRAccountStore.h"
+#import <stdatomic.h>
+#import <pthread.h>
 
 static NSString * const kOTRKitPrivateKeyFileName = @"otr.private_key";
 static NSString * const kOTRKitFingerprintsFileName = @"otr.fingerprints";
 static NSString * const kOTRKitInstanceTagsFileName =  @"otr.instance_tags";
+static NSString * const kOTRKitSessionSnapshotFileName = @"otr.sessions";
+static NSString * const kOTRKitPrivateKeyStoreFileName = @"otr.private_key.store";
+static NSString * const kOTRKitInstanceTagStoreFileName = @"otr.instance_tags.store";
 
 /** Length of Fingerprint->fingerprint in libotr struct */
 static const NSUInteger kOTRKitFingerprintBytes = 20;
 
+/** Default for maxConcurrentSessionInitiations */
+static const NSUInteger kOTRKitDefaultMaxConcurrentSessionInitiations = 4;
+/** Bulk session initiations that haven't gone secure by then free their slot */
+static const NSTimeInterval kOTRKitSessionInitiationTimeout = 30;
+
+/** Upper bound on how often idle contexts are swept when contextIdleTimeout is set */
+static const NSTimeInterval kOTRKitEvictionPollInterval = 60;
+
+/** Rough per-session cost of DH keypairs, session keys and MAC keys held by an encrypted context */
+static const NSUInteger kOTRKitEstimatedSessionKeyBytes = 4096;
+/** Rough cost of the MPIs held by an SMP exchange in progress */
+static const NSUInteger kOTRKitEstimatedSMPBytes = 2048;
+
+/** Fingerprints copied out of fingerprintIndex at a time when walking all of them */
+static const NSUInteger kOTRKitFingerprintPageSize = 1024;
+
+/** Received symmetric keys kept per session, oldest are dropped first */
+static const NSUInteger kOTRKitMaxReceivedSymmetricKeys = 1024;
+
+/** Progress reported to handleSMPEvent at each step, mirroring libotr */
+static const unsigned short kOTRKitSMPProgressInitiated = 20;
+static const unsigned short kOTRKitSMPProgressAsked = 25;
+static const unsigned short kOTRKitSMPProgressResponded = 40;
+static const unsigned short kOTRKitSMPProgressConfirming = 60;
+static const unsigned short kOTRKitSMPProgressDone = 100;
+
+/** One libotr SMP step, run on smpQueue against a copy of the context's SMP state */
+typedef NS_ENUM(NSUInteger, OTRSMPStep) {
+    /** otrl_sm_step1, sends SMP1 or SMP1Q */
+    OTRSMPStepInitiate,
+    /** otrl_sm_step2a, checks a received SMP1 or SMP1Q */
+    OTRSMPStepReceiveRequest,
+    /** otrl_sm_step2b, sends SMP2 */
+    OTRSMPStepRespond,
+    /** otrl_sm_step3, checks a received SMP2 and sends SMP3 */
+    OTRSMPStepReceiveResponse,
+    /** otrl_sm_step4, checks a received SMP3 and sends SMP4 */
+    OTRSMPStepReceiveConfirmation,
+    /** otrl_sm_step5, checks a received SMP4 */
+    OTRSMPStepReceiveFinal
+};
+
+/**
+ *  Stored in ConnContext->app_data of master contexts so idle contexts can be evicted.
+ *  Freed by libotr via app_data_free.
+ */
+typedef struct {
+    CFAbsoluteTime lastActivity;
+} OTRContextAppData;
+
 /**
  *  This structure will be passed through the opdata parameter in libotr functions
  *  and will allow for a reference to OTRKit "self" as well as a user-defined tag supplied
@@ -58,6 +126,10 @@ static const NSUInteger kOTRKitFingerprintBytes = 20;
 @interface OTROpData : NSObject
 @property (nonatomic, strong, readonly) OTRKit *otrKit;
 @property (nonatomic, strong, readonly) id tag;
+/** Set by received_symkey_cb while libotr processes the message */
+@property (nonatomic, strong, nullable) NSData *receivedSymmetricKey;
+/** The conversation libotr is processing a message for, if any. write_fingerprints_cb only reindexes its fingerprints. */
+@property (nonatomic, assign, nullable) ConnContext *context;
 - (instancetype) initWithOTRKit:(OTRKit*)otrKit tag:(id)tag;
 @end
 
@@ -71,33 +143,279 @@ static const NSUInteger kOTRKitFingerprintBytes = 20;
 }
 @end
 
+/** A buddy queued by initiateEncryptionWithUsernames:accountName:protocol: */
+@interface OTRSessionInitiation : NSObject
+@property (nonatomic, copy, readonly) NSString *username;
+@property (nonatomic, copy, readonly) NSString *accountName;
+@property (nonatomic, copy, readonly) NSString *protocol;
+/** Key from contextKeyForUsername:accountName:protocol: */
+@property (nonatomic, copy, readonly) NSString *key;
+/** Last activity on the master context, or 0 if we've never talked */
+@property (nonatomic, readonly) CFAbsoluteTime lastActivity;
+- (instancetype) initWithUsername:(NSString*)username accountName:(NSString*)accountName protocol:(NSString*)protocol key:(NSString*)key lastActivity:(CFAbsoluteTime)lastActivity;
+@end
+
+@implementation OTRSessionInitiation
+- (instancetype) initWithUsername:(NSString*)username accountName:(NSString*)accountName protocol:(NSString*)protocol key:(NSString*)key lastActivity:(CFAbsoluteTime)lastActivity {
+    if (self = [super init]) {
+        _username = [username copy];
+        _accountName = [accountName copy];
+        _protocol = [protocol copy];
+        _key = [key copy];
+        _lastActivity = lastActivity;
+    }
+    return self;
+}
+@end
+
+/** A message held by encodeMessage until its conversation goes secure */
+@interface OTRPendingMessage : NSObject
+@property (nonatomic, copy, readonly, nullable) NSString *message;
+@property (nonatomic, copy, readonly, nullable) NSArray<OTRTLV*> *tlvs;
+@property (nonatomic, copy, readonly) NSString *username;
+@property (nonatomic, copy, readonly) NSString *accountName;
+@property (nonatomic, copy, readonly) NSString *protocol;
+@property (nonatomic, strong, readonly, nullable) id tag;
+@property (nonatomic, copy, readonly) void (^completion)(NSString* _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint* _Nullable fingerprint, NSError* _Nullable error);
+- (instancetype) initWithMessage:(nullable NSString*)message tlvs:(nullable NSArray<OTRTLV*>*)tlvs username:(NSString*)username accountName:(NSString*)accountName protocol:(NSString*)protocol tag:(nullable id)tag completion:(void (^)(NSString* _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint* _Nullable fingerprint, NSError* _Nullable error))completion;
+@end
+
+@implementation OTRPendingMessage
+- (instancetype) initWithMessage:(nullable NSString*)message tlvs:(nullable NSArray<OTRTLV*>*)tlvs username:(NSString*)username accountName:(NSString*)accountName protocol:(NSString*)protocol tag:(nullable id)tag completion:(void (^)(NSString* _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint* _Nullable fingerprint, NSError* _Nullable error))completion {
+    if (self = [super init]) {
+        _message = [message copy];
+        _tlvs = [tlvs copy];
+        _username = [username copy];
+        _accountName = [accountName copy];
+        _protocol = [protocol copy];
+        _tag = tag;
+        _completion = [completion copy];
+    }
+    return self;
+}
+@end
+
+/** Symmetric keys a buddy announced in the current session */
+@interface OTRReceivedSymmetricKeys : NSObject
+/** Keyed by symmetric key TLV body, 4 byte use followed by useData */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSData*, NSData*> *keys;
+/** Keys of keys, oldest first */
+@property (nonatomic, strong, readonly) NSMutableArray<NSData*> *order;
+@end
+
+@implementation OTRReceivedSymmetricKeys
+- (instancetype) init {
+    if (self = [super init]) {
+        _keys = [NSMutableDictionary dictionary];
+        _order = [NSMutableArray array];
+    }
+    return self;
+}
+@end
+
+/** A handler registered with registerTLVHandler:targetQueue: */
+@interface OTRTLVSubscription : NSObject
+@property (nonatomic, strong, readonly) id<OTRTLVHandler> handler;
+/** nil to call handler synchronously on internalQueue */
+@property (nonatomic, strong, readonly, nullable) dispatch_queue_t targetQueue;
+/**
+ *  Serial queues targeting targetQueue so each conversation's TLVs arrive in order,
+ *  keyed by contextKeyForUsername:accountName:protocol: Only accessed on internalQueue.
+ */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, dispatch_queue_t> *conversationQueues;
+- (instancetype) initWithHandler:(id<OTRTLVHandler>)handler targetQueue:(nullable dispatch_queue_t)targetQueue;
+/** Must be called on internalQueue, only for subscriptions with a targetQueue */
+- (dispatch_queue_t) queueForConversation:(NSString*)key;
+@end
+
+@implementation OTRTLVSubscription
+- (instancetype) initWithHandler:(id<OTRTLVHandler>)handler targetQueue:(nullable dispatch_queue_t)targetQueue {
+    if (self = [super init]) {
+        _handler = handler;
+        _targetQueue = targetQueue;
+        _conversationQueues = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (dispatch_queue_t) queueForConversation:(NSString*)key {
+    dispatch_queue_t queue = [self.conversationQueues objectForKey:key];
+    if (!queue) {
+        // dispatch_queue_create_with_target needs macOS 10.12 / iOS 10
+        queue = dispatch_queue_create("OTRKit TLV Queue", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(queue, self.targetQueue);
+        [self.conversationQueues setObject:queue forKey:key];
+    }
+    return queue;
+}
+@end
+
+@interface OTRDHKeypairPool (OTRKit)
+/** Installs the libotr keypair generator hook. Must be called after OTRL_INIT. */
+- (void) installAfterLibotrInit;
+@end
+
+@interface OTRSessionSnapshot (OTRKit)
+/** nil unless the context is encrypted */
+- (nullable instancetype) initWithContext:(ConnContext*)context;
+/** Restores into the matching context, returns NULL if it was skipped */
+- (nullable ConnContext*) restoreInUserState:(OtrlUserState)userState;
+@end
 
 @interface OTRKit() {
     /** Used for determining correct usage of dispatch_sync */
     void *IsOnInternalQueueKey;
+    /** Backs queueDepth. Changed from any thread. */
+    _Atomic(NSUInteger) _queueDepth;
+    /** Backs maxInFlightOperations. Read from admissionQueue so can't be guarded by it. */
+    _Atomic(NSUInteger) _maxInFlightOperations;
+    /** Backs callbackMode. Read for every callback, from whichever queue makes it. */
+    _Atomic(NSUInteger) _callbackMode;
+    /** Backs otrPolicy so it can be read without going through internalQueue */
+    _Atomic(NSUInteger) _otrPolicy;
+    /** Set once the fingerprints file has been read into fingerprintIndex */
+    _Atomic(BOOL) _fingerprintIndexLoaded;
+    /** Incremented for each snapshot taken. Only accessed on internalQueue. */
+    NSUInteger _sessionSnapshotSequence;
+    /** When the poll cycle last took a snapshot. Only accessed on internalQueue. */
+    CFAbsoluteTime _lastSessionSnapshotTime;
+    /** Newest snapshot on disk, older ones that lost the race aren't written. Only accessed on snapshotQueue. */
+    NSUInteger _writtenSessionSnapshotSequence;
+    /** Guards conversationStates */
+    pthread_mutex_t _conversationStatesLock;
+    /** Last value handed out by bumpSMPGenerationForContext:, never reused. Only accessed on internalQueue. */
+    NSUInteger _lastSMPGeneration;
 }
 @property (nonatomic, readonly) dispatch_queue_t internalQueue;
+/** Orders async work on internalQueue by priority lane and peer */
+@property (nonatomic, strong, readonly) OTRPriorityScheduler *scheduler;
 @property (nonatomic, strong) NSTimer *pollTimer;
 @property (nonatomic, readonly) OtrlUserState userState;
 @property (nonatomic, strong) NSMutableDictionary<NSString*,NSNumber*> *protocolMaxSize;
 
+/** Last poll interval requested by libotr via timer_control_cb. Only accessed on main queue. */
+@property (nonatomic) NSTimeInterval libotrPollInterval;
+/** Poll interval needed for idle context eviction. Only accessed on main queue. */
+@property (nonatomic) NSTimeInterval evictionPollInterval;
+/** Poll interval needed for periodic session snapshots. Only accessed on main queue. */
+@property (nonatomic) NSTimeInterval sessionSnapshotPollInterval;
+/** Encrypts and writes session snapshots off internalQueue */
+@property (nonatomic, strong, readonly) dispatch_queue_t snapshotQueue;
+
+/** Buddies waiting for a session initiation slot, most recently active first. Only accessed on internalQueue. */
+@property (nonatomic, strong, readonly) NSMutableArray<OTRSessionInitiation*> *pendingSessionInitiations;
+/** Session initiations with an AKE in flight, keyed by contextKeyForUsername:accountName:protocol: Only accessed on internalQueue. */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, OTRSessionInitiation*> *activeSessionInitiations;
+
+/**
+ *  Messages held until their conversation goes secure, in the order they were encoded.
+ *  Keyed by contextKeyForUsername:accountName:protocol: Only accessed on internalQueue.
+ */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, NSMutableArray<OTRPendingMessage*>*> *pendingMessages;
+
+/** Guards admissionWaiters */
+@property (nonatomic, strong, readonly) dispatch_queue_t admissionQueue;
+/** Callers of requestAdmissionWithCompletion: waiting for queueDepth to drop */
+@property (nonatomic, strong, readonly) NSMutableArray<dispatch_block_t> *admissionWaiters;
+
+/**
+ *  Every known fingerprint, including those of evicted contexts, which are restored from here
+ *  when the context is recreated and appended from here when writing the fingerprints file. Updated on internalQueue
+ *  whenever libotr's fingerprints change, and read from any thread without touching libotr.
+ */
+@property (nonatomic, strong, readonly) OTRFingerprintIndex *fingerprintIndex;
+
+/**
+ *  Last message state and fingerprint sent to the delegate, keyed by contextKeyForUsername:accountName:protocol:
+ *  Used to skip updates that don't change anything.
+ */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, NSString*> *deliveredMessageStates;
+
+/** Private keys in libotr's format, one record per account. Only accessed on internalQueue. */
+@property (nonatomic, strong, readonly) OTRAccountStore *privateKeyStore;
+/** Instance tags in libotr's format, one record per account. Only accessed on internalQueue. */
+@property (nonatomic, strong, readonly) OTRAccountStore *instanceTagStore;
+
+/** Guards receivedSymmetricKeys, which is read without going through internalQueue */
+@property (nonatomic, strong, readonly) dispatch_queue_t symmetricKeyQueue;
+/** Keyed by contextKeyForUsername:accountName:protocol: and cleared whenever the session changes */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, OTRReceivedSymmetricKeys*> *receivedSymmetricKeys;
+
+/** Backs callbackQueue so it can be read without going through internalQueue */
+@property (atomic, strong) dispatch_queue_t atomicCallbackQueue;
+
+/**
+ *  Published by publishConversationStateForUsername:accountName:protocol:, keyed by
+ *  contextKeyForUsername:accountName:protocol: Changed on internalQueue, read from anywhere,
+ *  always with _conversationStatesLock held.
+ */
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, OTRConversationState*> *conversationStates;
+
+/** Batches message state updates when messageStateCoalescingInterval is set */
+@property (nonatomic, strong, readonly) OTRNotificationCoalescer *messageStateCoalescer;
+
+/** Guards tlvSubscriptions so registration takes effect without waiting for internalQueue */
+@property (nonatomic, strong, readonly) dispatch_queue_t tlvHandlerQueue;
+/**
+ *  Subscriptions in registration order keyed to boxed NSNumber of OTRTLVType.
+ *  Replaced rather than mutated, so decode can use it after leaving tlvHandlerQueue.
+ */
+@property (nonatomic, copy) NSDictionary<NSNumber*, NSArray<OTRTLVSubscription*>*> *tlvSubscriptions;
+
+/** Runs the modular exponentiations of SMP steps so internalQueue stays free for messages */
+@property (nonatomic, strong, readonly) dispatch_queue_t smpQueue;
 /**
- *  OTRTLVHandler keyed to boxed NSNumber of OTRTLVType
+ *  Bumped whenever a step is committed or SMP is aborted, keyed by boxed ConnContext pointer.
+ *  A step that finds a different value when it gets back is stale and dropped. Entries are
+ *  removed when SMP ends or the context is forgotten. Only accessed on internalQueue.
  */
-@property (nonatomic, strong, readonly) NSMutableDictionary<NSNumber*, id<OTRTLVHandler>> *tlvHandlers;
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSValue*, NSNumber*> *smpGenerations;
+/** Boxed ConnContext pointers with a step on smpQueue, these aren't evicted. Only accessed on internalQueue. */
+@property (nonatomic, strong, readonly) NSCountedSet<NSValue*> *pendingSMPContexts;
 
 
-/** Will perform block asynchronously on the internalQueue, unless we're already on internalQueue */
+/** Will perform block asynchronously on the internalQueue in the interactive lane, unless we're already on internalQueue */
 - (void) performBlockAsync:(dispatch_block_t)block;
 
+/** Will perform block asynchronously on the internalQueue in the given lane, unless we're already on internalQueue. Blocks sharing a group run in order. */
+- (void) performBlockAsync:(dispatch_block_t)block priority:(OTRKitPriority)priority group:(nullable NSString*)group;
+
 /** Will perform block synchronously on the internalQueue and block for result if called on another queue. */
 - (void) performBlock:(dispatch_block_t)block;
 
+/** Runs block on the callbackQueue, or right away in OTRKitCallbackModeInline */
+- (void) deliverCallback:(dispatch_block_t)block;
+
+/** Like deliverCallback: but waits for block, for delegate methods that return a value */
+- (void) deliverCallbackAndWait:(dispatch_block_t)block;
+
+/** Must be called on internalQueue. Finishes a key from otrl_privkey_generate_start and saves it to privateKeyStore. */
+- (nullable NSError*) finishGeneratingPrivateKey:(void*)newkey accountName:(const char*)accountname protocol:(const char*)protocol;
+
+/** Must be called on internalQueue. Generates an instance tag and saves it to instanceTagStore. */
+- (void) generateInstanceTagForAccountName:(const char*)accountname protocol:(const char*)protocol;
+
+/** Must be called on internalQueue, from libotr's SMP handler. Starts the steps for the SMP TLVs of a received message. */
+- (void) handleSMPTLVs:(OtrlTLV*)tlvs context:(ConnContext*)context opdata:(void*)opdata;
+
+/** Must be called on internalQueue. Sends held messages once libotr is done with the message that made the context secure. */
+- (void) schedulePendingMessageFlushForContext:(ConnContext*)context;
+
+/** Must be called on internalQueue. Aborts SMP and drops any step still on smpQueue. */
+- (void) abortSMPForContext:(ConnContext*)context opdata:(void*)opdata;
+
+/** Must be called on internalQueue once SMP is over for context. Any step still on smpQueue is dropped. */
+- (void) forgetSMPGenerationForContext:(ConnContext*)context;
+
+/** Must be called on internalQueue. Picks up trust libotr changed on its own, e.g. after SMP, and republishes the conversation state. */
+- (void) reindexFingerprintsForContext:(ConnContext*)context;
+
 @end
 
 @implementation OTRKit
-@synthesize otrPolicy = _otrPolicy;
-@synthesize callbackQueue = _callbackQueue;
+@synthesize contextIdleTimeout = _contextIdleTimeout;
+@synthesize maxConcurrentSessionInitiations = _maxConcurrentSessionInitiations;
+@synthesize sessionSnapshotInterval = _sessionSnapshotInterval;
 
 #pragma mark libotr ui_ops callback functions
 
@@ -124,32 +442,27 @@ static void create_privkey_cb(void *opdata, const char *accountname,
     NSString *accountNameString = [NSString stringWithUTF8String:accountname];
     NSString *protocolString = [NSString stringWithUTF8String:protocol];
     if ([otrKit.delegate respondsToSelector:@selector(otrKit:willStartGeneratingPrivateKeyForAccountName:protocol:)]) {
-        dispatch_async(otrKit.callbackQueue, ^{
+        [otrKit deliverCallback:^{
             [otrKit.delegate otrKit:otrKit willStartGeneratingPrivateKeyForAccountName:accountNameString   protocol:protocolString];
-        });
+        }];
     }
-    void *newkeyp;
-    gcry_error_t generateError = otrl_privkey_generate_start(otrKit.userState, accountname, protocol, &newkeyp);
-    FILE *privf;
-    NSString *path = [otrKit privateKeyPath];
-    privf = fopen([path UTF8String], "w+b");
-    if (generateError == gcry_error(GPG_ERR_NO_ERROR)) {
+    // The key store couldn't be read, a new key couldn't be saved and might replace one that's still in there
+    NSError *error = otrKit.privateKeyStore.loadError;
+    if (!error) {
+        void *newkeyp;
+        gcry_error_t generateError = otrl_privkey_generate_start(otrKit.userState, accountname, protocol, &newkeyp);
+        if (generateError == gcry_error(GPG_ERR_NO_ERROR)) {
             otrl_privkey_generate_calculate(newkeyp);
-            otrl_privkey_generate_finish_FILEp(otrKit.userState, newkeyp, privf);
-            if ([otrKit.delegate respondsToSelector:@selector(otrKit:didFinishGeneratingPrivateKeyForAccountName:protocol:error:)]) {
-                dispatch_async(otrKit.callbackQueue, ^{
-                    [otrKit.delegate otrKit:otrKit didFinishGeneratingPrivateKeyForAccountName:accountNameString protocol:protocolString error:nil];
-                });
-            }
-    } else {
-        NSError *error = [OTRErrorUtility errorForGPGError:generateError];
-        if ([otrKit.delegate respondsToSelector:@selector(otrKit:didFinishGeneratingPrivateKeyForAccountName:protocol:error:)]) {
-            dispatch_async(otrKit.callbackQueue, ^{
-                [otrKit.delegate otrKit:otrKit didFinishGeneratingPrivateKeyForAccountName:accountNameString protocol:protocolString error:error];
-            });
+            error = [otrKit finishGeneratingPrivateKey:newkeyp accountName:accountname protocol:protocol];
+        } else {
+            error = [OTRErrorUtility errorForGPGError:generateError];
         }
     }
-    fclose(privf);
+    if ([otrKit.delegate respondsToSelector:@selector(otrKit:didFinishGeneratingPrivateKeyForAccountName:protocol:error:)]) {
+        [otrKit deliverCallback:^{
+            [otrKit.delegate otrKit:otrKit didFinishGeneratingPrivateKeyForAccountName:accountNameString protocol:protocolString error:error];
+        }];
+    }
 }
 
 static int is_logged_in_cb(void *opdata, const char *accountname,
@@ -161,12 +474,12 @@ static int is_logged_in_cb(void *opdata, const char *accountname,
         return -1;
     }
     __block BOOL loggedIn = NO;
-    dispatch_sync(otrKit.callbackQueue, ^{
+    [otrKit deliverCallbackAndWait:^{
         loggedIn = [otrKit.delegate otrKit:otrKit
                         isUsernameLoggedIn:[NSString stringWithUTF8String:recipient]
                                accountName:[NSString stringWithUTF8String:accountname]
                                   protocol:[NSString stringWithUTF8String:protocol]];
-    });
+    }];
     return loggedIn;
 }
 
@@ -184,10 +497,11 @@ static void inject_message_cb(void *opdata, const char *accountname,
     NSString *protocolString = [NSString stringWithUTF8String:protocol];
     
     id tag = data.tag;
+    [otrKit.trafficRecorder recordEventWithType:OTRTrafficEventTypeInject message:messageString plaintext:nil tlvs:nil username:usernameString accountName:accountNameString protocol:protocolString duration:0];
     OTRFingerprint *fingerprint = [otrKit activeFingerprintForUsername:usernameString accountName:accountNameString protocol:protocolString];
-    dispatch_async(otrKit.callbackQueue, ^{
+    [otrKit deliverCallback:^{
         [otrKit.delegate otrKit:otrKit injectMessage:messageString username:usernameString accountName:accountNameString protocol:protocolString fingerprint:fingerprint tag:tag];
-    });
+    }];
 }
 
 static void update_context_list_cb(void *opdata)
@@ -220,9 +534,9 @@ static void confirm_fingerprint_cb(void *opdata, OtrlUserState us,
     NSString *accountNameString = [NSString stringWithUTF8String:accountname];
     NSString *usernameString = [NSString stringWithUTF8String:username];
     NSString *protocolString = [NSString stringWithUTF8String:protocol];
-    dispatch_async(otrKit.callbackQueue, ^{
+    [otrKit deliverCallback:^{
         [otrKit.delegate otrKit:otrKit showFingerprintConfirmationForTheirHash:theirHash ourHash:ourHash username:usernameString accountName:accountNameString protocol:protocolString];
-    });
+    }];
 }
 
 static void write_fingerprints_cb(void *opdata)
@@ -233,12 +547,11 @@ static void write_fingerprints_cb(void *opdata)
     if (!otrKit) {
         return;
     }
-    FILE *storef;
-    NSString *path = [otrKit fingerprintsPath];
-    storef = fopen([path UTF8String], "wb");
-    if (!storef) return;
-    otrl_privkey_write_fingerprints_FILEp(otrKit.userState, storef);
-    fclose(storef);
+    // libotr only calls this after changing trust or adding a fingerprint
+    if (data.context) {
+        [otrKit reindexFingerprintsForContext:data.context];
+    }
+    [otrKit writeFingerprints];
 }
 
 static void gone_secure_cb(void *opdata, ConnContext *context)
@@ -249,7 +562,11 @@ static void gone_secure_cb(void *opdata, ConnContext *context)
     if (!otrKit) {
         return;
     }
+    [otrKit resetReceivedSymmetricKeysForContext:context];
+    // A new fingerprint is added by libotr right before this
+    [otrKit indexInternalFingerprint:context->active_fingerprint];
     [otrKit updateEncryptionStatusWithContext:context];
+    [otrKit schedulePendingMessageFlushForContext:context];
 }
 
 static void gone_insecure_cb(void *opdata, ConnContext *context)
@@ -260,6 +577,7 @@ static void gone_insecure_cb(void *opdata, ConnContext *context)
     if (!otrKit) {
         return;
     }
+    [otrKit resetReceivedSymmetricKeysForContext:context];
     [otrKit updateEncryptionStatusWithContext:context];
 }
 
@@ -271,6 +589,9 @@ static void still_secure_cb(void *opdata, ConnContext *context, int is_reply)
     if (!otrKit) {
         return;
     }
+    [otrKit resetReceivedSymmetricKeysForContext:context];
+    // The AKE may have been with a new key
+    [otrKit indexInternalFingerprint:context->active_fingerprint];
     [otrKit updateEncryptionStatusWithContext:context];
 }
 
@@ -382,23 +703,30 @@ static void handle_smp_event_cb(void *opdata, OtrlSMPEvent smp_event,
             break;
         case OTRL_SMPEVENT_CHEATED :
             event = OTRKitSMPEventCheated;
-            otrl_message_abort_smp(otrKit.userState, &ui_ops, opdata, context);
+            [otrKit abortSMPForContext:context opdata:opdata];
+            [otrKit forgetSMPGenerationForContext:context];
             break;
         case OTRL_SMPEVENT_IN_PROGRESS :
             event = OTRKitSMPEventInProgress;
             break;
         case OTRL_SMPEVENT_SUCCESS :
             event = OTRKitSMPEventSuccess;
+            [otrKit reindexFingerprintsForContext:context];
+            [otrKit forgetSMPGenerationForContext:context];
             break;
         case OTRL_SMPEVENT_FAILURE :
             event = OTRKitSMPEventFailure;
+            [otrKit reindexFingerprintsForContext:context];
+            [otrKit forgetSMPGenerationForContext:context];
             break;
         case OTRL_SMPEVENT_ABORT:
             event = OTRKitSMPEventAbort;
+            [otrKit forgetSMPGenerationForContext:context];
             break;
         case OTRL_SMPEVENT_ERROR :
             event = OTRKitSMPEventError;
-            otrl_message_abort_smp(otrKit.userState, &ui_ops, opdata, context);
+            [otrKit abortSMPForContext:context opdata:opdata];
+            [otrKit forgetSMPGenerationForContext:context];
             break;
     }
     NSString *questionString = nil;
@@ -410,9 +738,81 @@ static void handle_smp_event_cb(void *opdata, OtrlSMPEvent smp_event,
     NSString *accountName = [NSString stringWithUTF8String:context->accountname];
     NSString *protocol = [NSString stringWithUTF8String:context->protocol];
     
-    dispatch_async(otrKit.callbackQueue, ^{
+    [otrKit deliverCallback:^{
         [otrKit.delegate otrKit:otrKit handleSMPEvent:event progress:progress question:questionString username:username accountName:accountName protocol:protocol];
-    });
+    }];
+}
+
+/** Installed with otrl_message_set_smp_handler, takes SMP TLVs away from libotr so the math runs on smpQueue */
+static int smp_handler_cb(void *data, void *opdata, ConnContext *context, OtrlTLV *tlvs)
+{
+    if (!opdata || !context) {
+        return 0;
+    }
+    OTROpData *opData = (__bridge OTROpData*)opdata;
+    OTRKit *otrKit = opData.otrKit;
+    if (!otrKit) {
+        return 0;
+    }
+    [otrKit handleSMPTLVs:tlvs context:context opdata:opdata];
+    return 1;
+}
+
+static gcry_mpi_t smp_mpi_copy(gcry_mpi_t mpi)
+{
+    return mpi ? gcry_mpi_copy(mpi) : NULL;
+}
+
+/** Empty SMP state for otrl_sm_step1, which initializes it. Freed with smp_state_release or smp_state_move. */
+static OtrlSMState *smp_state_create(void)
+{
+    OtrlSMState *state = malloc(sizeof(OtrlSMState));
+    if (!state) {
+        return NULL;
+    }
+    otrl_sm_state_new(state);
+    state->nextExpected = OTRL_SMP_EXPECT1;
+    return state;
+}
+
+/** Deep copy so a step can run on smpQueue while libotr keeps using the context's state */
+static OtrlSMState *smp_state_copy(const OtrlSMState *source)
+{
+    OtrlSMState *state = smp_state_create();
+    if (!state) {
+        return NULL;
+    }
+    state->secret = smp_mpi_copy(source->secret);
+    state->x2 = smp_mpi_copy(source->x2);
+    state->x3 = smp_mpi_copy(source->x3);
+    state->g1 = smp_mpi_copy(source->g1);
+    state->g2 = smp_mpi_copy(source->g2);
+    state->g3 = smp_mpi_copy(source->g3);
+    state->g3o = smp_mpi_copy(source->g3o);
+    state->p = smp_mpi_copy(source->p);
+    state->q = smp_mpi_copy(source->q);
+    state->pab = smp_mpi_copy(source->pab);
+    state->qab = smp_mpi_copy(source->qab);
+    state->nextExpected = source->nextExpected;
+    state->received_question = source->received_question;
+    state->sm_prog_state = source->sm_prog_state;
+    return state;
+}
+
+static void smp_state_release(OtrlSMState *state)
+{
+    otrl_sm_state_free(state);
+    free(state);
+}
+
+/** Replaces the MPIs of destination with those of source and frees source. nextExpected is left to the caller. */
+static void smp_state_move(OtrlSMState *destination, OtrlSMState *source)
+{
+    NextExpectedSMP nextExpected = destination->nextExpected;
+    otrl_sm_state_free(destination);
+    *destination = *source;
+    destination->nextExpected = nextExpected;
+    free(source);
 }
 
 static void handle_msg_event_cb(void *opdata, OtrlMessageEvent msg_event,
@@ -492,9 +892,9 @@ static void handle_msg_event_cb(void *opdata, OtrlMessageEvent msg_event,
     NSString *protocol = [NSString stringWithUTF8String:context->protocol];
     
     id tag = data.tag;
-    dispatch_async(otrKit.callbackQueue, ^{
+    [otrKit deliverCallback:^{
         [otrKit.delegate otrKit:otrKit handleMessageEvent:event message:messageString username:username accountName:accountName protocol:protocol tag:tag error:error];
-    });
+    }];
 }
 
 static void create_instag_cb(void *opdata, const char *accountname,
@@ -506,11 +906,7 @@ static void create_instag_cb(void *opdata, const char *accountname,
     if (!otrKit) {
         return;
     }
-    FILE *instagf;
-    NSString *path = [otrKit instanceTagsPath];
-    instagf = fopen([path UTF8String], "w+b");
-    otrl_instag_generate_FILEp(otrKit.userState, instagf, accountname, protocol);
-    fclose(instagf);
+    [otrKit generateInstanceTagForAccountName:accountname protocol:protocol];
 }
 
 static void timer_control_cb(void *opdata, unsigned int interval)
@@ -522,13 +918,8 @@ static void timer_control_cb(void *opdata, unsigned int interval)
         return;
     }
     dispatch_async(dispatch_get_main_queue(), ^{
-        if (otrKit.pollTimer) {
-            [otrKit.pollTimer invalidate];
-            otrKit.pollTimer = nil;
-        }
-        if (interval > 0) {
-            otrKit.pollTimer = [NSTimer scheduledTimerWithTimeInterval:interval target:otrKit selector:@selector(messagePoll:) userInfo:nil repeats:YES];
-        }
+        otrKit.libotrPollInterval = interval;
+        [otrKit schedulePollTimer];
     });
 }
 
@@ -538,19 +929,13 @@ static void received_symkey_cb(void *opdata, ConnContext *context,
     OTROpData *data = (__bridge OTROpData*)opdata;
     OTRKit *otrKit = data.otrKit;
     NSCParameterAssert(otrKit);
-    if (![otrKit.delegate respondsToSelector:@selector(otrKit:receivedSymmetricKey:forUse:useData:username:accountName:protocol:)]) {
+    if (!otrKit) {
         return;
     }
     NSData *symmetricKey = [[NSData alloc] initWithBytes:symkey length:OTRL_EXTRAKEY_BYTES];
     NSData *useDescriptionData = [[NSData alloc] initWithBytes:usedata length:usedatalen];
-    
-    NSString *username = [NSString stringWithUTF8String:context->username];
-    NSString *accountName = [NSString stringWithUTF8String:context->accountname];
-    NSString *protocol = [NSString stringWithUTF8String:context->protocol];
-    
-    dispatch_async(otrKit.callbackQueue, ^{
-        [otrKit.delegate otrKit:otrKit receivedSymmetricKey:symmetricKey forUse:use useData:useDescriptionData username:username accountName:accountName protocol:protocol];
-    });
+    data.receivedSymmetricKey = symmetricKey;
+    [otrKit receivedSymmetricKey:symmetricKey forUse:use useData:useDescriptionData context:context];
 }
 
 static OtrlMessageAppOps ui_ops = {
@@ -583,8 +968,8 @@ static OtrlMessageAppOps ui_ops = {
 #pragma mark Initialization
 
 + (void) initialize {
-    // This is needed to suppress the initialization warning
-    gcry_check_version(NULL);
+    // Configures libgcrypt and runs OTRL_INIT, unless the app already did with its own configuration
+    [OTRCryptoRuntime setUp];
 }
 
 - (void) dealloc {
@@ -593,22 +978,47 @@ static OtrlMessageAppOps ui_ops = {
         otrl_userstate_free(self->_userState);
         self->_userState = NULL;
     }];
+    pthread_mutex_destroy(&_conversationStatesLock);
 }
 
 - (instancetype) initWithDelegate:(id<OTRKitDelegate>)delegate dataPath:(nullable NSString*)dataPath {
     NSParameterAssert(delegate != nil);
     if (self = [super init]) {
         _delegate = delegate;
-        _callbackQueue = dispatch_get_main_queue();
+        _atomicCallbackQueue = dispatch_get_main_queue();
         _internalQueue = dispatch_queue_create("OTRKit Internal Queue", 0);
         
         // For safe usage of dispatch_sync
         IsOnInternalQueueKey = &IsOnInternalQueueKey;
         void *nonNullUnusedPointer = (__bridge void *)self;
         dispatch_queue_set_specific(_internalQueue, IsOnInternalQueueKey, nonNullUnusedPointer, NULL);
+        _scheduler = [[OTRPriorityScheduler alloc] initWithTargetQueue:_internalQueue];
+        _admissionQueue = dispatch_queue_create("OTRKit Admission Queue", 0);
+        _admissionWaiters = [NSMutableArray array];
+        atomic_init(&_queueDepth, 0);
+        atomic_init(&_maxInFlightOperations, 0);
+        atomic_init(&_callbackMode, OTRKitCallbackModeQueue);
         
-        _otrPolicy = OTRKitPolicyDefault;
-        _tlvHandlers = [NSMutableDictionary dictionary];
+        atomic_init(&_otrPolicy, OTRKitPolicyDefault);
+        _conversationStates = [NSMutableDictionary dictionary];
+        pthread_mutex_init(&_conversationStatesLock, NULL);
+        _tlvHandlerQueue = dispatch_queue_create("OTRKit TLV Handler Queue", 0);
+        _tlvSubscriptions = @{};
+        _fingerprintIndex = [[OTRFingerprintIndex alloc] init];
+        atomic_init(&_fingerprintIndexLoaded, NO);
+        _deliveredMessageStates = [NSMutableDictionary dictionary];
+        _symmetricKeyQueue = dispatch_queue_create("OTRKit Symmetric Key Queue", 0);
+        _receivedSymmetricKeys = [NSMutableDictionary dictionary];
+        _snapshotQueue = dispatch_queue_create("OTRKit Session Snapshot Queue", 0);
+        dispatch_queue_attr_t smpQueueAttributes = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_CONCURRENT, QOS_CLASS_USER_INITIATED, 0);
+        _smpQueue = dispatch_queue_create("OTRKit SMP Queue", smpQueueAttributes);
+        _smpGenerations = [NSMutableDictionary dictionary];
+        _pendingSMPContexts = [NSCountedSet set];
+        _messageStateCoalescer = [[OTRNotificationCoalescer alloc] initWithTargetQueue:_atomicCallbackQueue];
+        _pendingSessionInitiations = [NSMutableArray array];
+        _activeSessionInitiations = [NSMutableDictionary dictionary];
+        _pendingMessages = [NSMutableDictionary dictionary];
+        _maxConcurrentSessionInitiations = kOTRKitDefaultMaxConcurrentSessionInitiations;
         NSDictionary *protocolDefaults = @{@"prpl-msn":   @(1409),
                                            @"prpl-icq":   @(2346),
                                            @"prpl-aim":   @(2343),
@@ -619,7 +1029,9 @@ static OtrlMessageAppOps ui_ops = {
         _protocolMaxSize = [NSMutableDictionary dictionaryWithDictionary:protocolDefaults];
         static dispatch_once_t onceToken;
         dispatch_once(&onceToken, ^{
-            OTRL_INIT;
+            [OTRCryptoRuntime setUp];
+            [[OTRDHKeypairPool sharedPool] installAfterLibotrInit];
+            otrl_message_set_smp_handler(smp_handler_cb, NULL);
         });
         _userState = otrl_userstate_create();
         if (!dataPath) {
@@ -627,6 +1039,8 @@ static OtrlMessageAppOps ui_ops = {
         } else {
             _dataPath = [dataPath copy];
         }
+        _privateKeyStore = [[OTRAccountStore alloc] initWithPath:[_dataPath stringByAppendingPathComponent:kOTRKitPrivateKeyStoreFileName]];
+        _instanceTagStore = [[OTRAccountStore alloc] initWithPath:[_dataPath stringByAppendingPathComponent:kOTRKitInstanceTagStoreFileName]];
         [self readLibotrConfiguration];
     }
     return self;
@@ -634,30 +1048,295 @@ static OtrlMessageAppOps ui_ops = {
 
 - (void) readLibotrConfiguration {
     [self performBlockAsync:^{
-        FILE *privf = NULL;
-        NSString *path = [self privateKeyPath];
-        privf = fopen([path UTF8String], "rb");
-        if(privf) {
-            otrl_privkey_read_FILEp(self->_userState, privf);
-            fclose(privf);
-        }
+        [self readPrivateKeys];
         
         FILE *storef = NULL;
-        path = [self fingerprintsPath];
+        NSString *path = [self fingerprintsPath];
         storef = fopen([path UTF8String], "rb");
         if (storef) {
             otrl_privkey_read_fingerprints_FILEp(self->_userState, storef, NULL, NULL);
             fclose(storef);
         }
+        [self rebuildFingerprintIndex];
+        atomic_store(&self->_fingerprintIndexLoaded, YES);
         
-        FILE *tagf = NULL;
-        path = [self instanceTagsPath];
-        tagf = fopen([path UTF8String], "rb");
-        if (tagf) {
-            otrl_instag_read_FILEp(self->_userState, tagf);
-            fclose(tagf);
+        [self readInstanceTags];
+    }];
+}
+
+#pragma mark Key and Instance Tag Stores
+
+/** Backs a FILE opened by otr_data_fopen */
+typedef struct {
+    /** Retained NSMutableData */
+    void *data;
+    size_t position;
+} OTRDataFileCookie;
+
+static int otr_data_file_read(void *cookie, char *buffer, int length) {
+    OTRDataFileCookie *file = cookie;
+    NSMutableData *data = (__bridge NSMutableData*)file->data;
+    if (length <= 0 || file->position >= data.length) {
+        return 0;
+    }
+    size_t count = MIN((size_t)length, data.length - file->position);
+    memcpy(buffer, (const char*)data.bytes + file->position, count);
+    file->position += count;
+    return (int)count;
+}
+
+static int otr_data_file_write(void *cookie, const char *buffer, int length) {
+    OTRDataFileCookie *file = cookie;
+    NSMutableData *data = (__bridge NSMutableData*)file->data;
+    if (length <= 0) {
+        return 0;
+    }
+    if (file->position + length > data.length) {
+        data.length = file->position + length;
+    }
+    memcpy((char*)data.mutableBytes + file->position, buffer, length);
+    file->position += length;
+    return length;
+}
+
+static fpos_t otr_data_file_seek(void *cookie, fpos_t offset, int whence) {
+    OTRDataFileCookie *file = cookie;
+    NSMutableData *data = (__bridge NSMutableData*)file->data;
+    fpos_t base = 0;
+    if (whence == SEEK_CUR) {
+        base = (fpos_t)file->position;
+    } else if (whence == SEEK_END) {
+        base = (fpos_t)data.length;
+    }
+    if (base + offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    file->position = (size_t)(base + offset);
+    return (fpos_t)file->position;
+}
+
+static int otr_data_file_close(void *cookie) {
+    OTRDataFileCookie *file = cookie;
+    CFBridgingRelease(file->data);
+    free(file);
+    return 0;
+}
+
+/**
+ *  A FILE reading and writing data in memory, for libotr's FILEp functions.
+ *  Writes past the end grow data. fmemopen needs macOS 10.13 and a fixed buffer.
+ */
+static FILE * otr_data_fopen(NSMutableData *data) {
+    OTRDataFileCookie *cookie = calloc(1, sizeof(OTRDataFileCookie));
+    if (!cookie) {
+        return NULL;
+    }
+    cookie->data = (void*)CFBridgingRetain(data);
+    FILE *file = funopen(cookie, otr_data_file_read, otr_data_file_write, otr_data_file_seek, otr_data_file_close);
+    if (!file) {
+        otr_data_file_close(cookie);
+    }
+    return file;
+}
+
+/** One account's entry in libotr's private key file, as libotr writes it */
+static NSData * libotr_private_key_record(OtrlPrivKey *privkey) {
+    gcry_sexp_t names = NULL;
+    gcry_sexp_t protos = NULL;
+    if (gcry_sexp_build(&names, NULL, "(name %s)", privkey->accountname) ||
+        gcry_sexp_build(&protos, NULL, "(protocol %s)", privkey->protocol)) {
+        gcry_sexp_release(names);
+        return nil;
+    }
+    NSMutableData *record = [NSMutableData dataWithBytes:" (account\n" length:10];
+    gcry_sexp_t parts[] = {names, protos, privkey->privkey};
+    for (NSUInteger i = 0; i < 3; i++) {
+        size_t length = gcry_sexp_sprint(parts[i], GCRYSEXP_FMT_ADVANCED, NULL, 0);
+        NSMutableData *part = [NSMutableData dataWithLength:length];
+        gcry_sexp_sprint(parts[i], GCRYSEXP_FMT_ADVANCED, part.mutableBytes, length);
+        // The length includes the NUL
+        [record appendBytes:part.bytes length:strnlen(part.bytes, length)];
+    }
+    [record appendBytes:" )\n" length:3];
+    gcry_sexp_release(names);
+    gcry_sexp_release(protos);
+    return record;
+}
+
+/** One account's line in libotr's instance tag file */
+static NSData * libotr_instance_tag_record(const char *accountname, const char *protocol, otrl_instag_t instag) {
+    NSString *line = [NSString stringWithFormat:@"%s\t%s\t%08x\n", accountname, protocol, instag];
+    return [line dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+/** The whole private key file in libotr's format */
+- (NSMutableData*) libotrPrivateKeyData {
+    NSMutableData *data = [NSMutableData dataWithBytes:"(privkeys\n" length:10];
+    [self.privateKeyStore enumerateRecordsUsingBlock:^(NSString *accountName, NSString *protocol, NSData *record, BOOL *stop) {
+        [data appendData:record];
+    }];
+    [data appendBytes:")\n" length:2];
+    return data;
+}
+
+/** The whole instance tag file in libotr's format */
+- (NSMutableData*) libotrInstanceTagData {
+    NSMutableData *data = [NSMutableData data];
+    [self.instanceTagStore enumerateRecordsUsingBlock:^(NSString *accountName, NSString *protocol, NSData *record, BOOL *stop) {
+        [data appendData:record];
+    }];
+    return data;
+}
+
+/** Must be called on internalQueue. Replaces libotr's keys with the ones in privateKeyStore. */
+- (void) loadPrivateKeysFromStore {
+    if (!self.privateKeyStore.count) {
+        otrl_privkey_forget_all(_userState);
+        return;
+    }
+    FILE *privf = otr_data_fopen([self libotrPrivateKeyData]);
+    if (privf) {
+        otrl_privkey_read_FILEp(_userState, privf);
+        fclose(privf);
+    }
+}
+
+/**
+ *  Must be called on internalQueue. Loads privateKeyStore into libotr. The first
+ *  time there's no store yet, the keys libotr wrote to privateKeyPath are imported.
+ *  If the store is damaged the keys that could be read are used, but the store stays
+ *  read-only and no new keys are generated, see create_privkey_cb.
+ */
+- (void) readPrivateKeys {
+    OTRAccountStore *store = self.privateKeyStore;
+    if ([store existsOnDisk]) {
+        if (![store loadWithError:nil]) {
+            // Only the keys read before the damage. The store stays read-only and
+            // create_privkey_cb reports store.loadError instead of generating over them.
+        }
+        [self loadPrivateKeysFromStore];
+        return;
+    }
+    FILE *privf = fopen([self.privateKeyPath UTF8String], "rb");
+    if (!privf) {
+        return;
+    }
+    otrl_privkey_read_FILEp(_userState, privf);
+    fclose(privf);
+    for (OtrlPrivKey *privkey = _userState->privkey_root; privkey; privkey = privkey->next) {
+        NSData *record = libotr_private_key_record(privkey);
+        if (record) {
+            [store stageRecord:record forAccountName:[NSString stringWithUTF8String:privkey->accountname] protocol:[NSString stringWithUTF8String:privkey->protocol]];
         }
+    }
+    if (store.count && [store compactWithError:nil]) {
+        [self retireMigratedFileAtPath:self.privateKeyPath];
+    }
+}
+
+/**
+ *  Must be called on internalQueue. Like readPrivateKeys for instanceTagStore. Tags
+ *  generated while the store is damaged are only kept in memory.
+ */
+- (void) readInstanceTags {
+    OTRAccountStore *store = self.instanceTagStore;
+    if ([store existsOnDisk]) {
+        if (![store loadWithError:nil]) {
+            // Only the tags read before the damage, the store stays read-only
+        }
+        if (store.count) {
+            FILE *tagf = otr_data_fopen([self libotrInstanceTagData]);
+            if (tagf) {
+                otrl_instag_read_FILEp(_userState, tagf);
+                fclose(tagf);
+            }
+        }
+        return;
+    }
+    FILE *tagf = fopen([self.instanceTagsPath UTF8String], "rb");
+    if (!tagf) {
+        return;
+    }
+    otrl_instag_read_FILEp(_userState, tagf);
+    fclose(tagf);
+    for (OtrlInsTag *instag = _userState->instag_root; instag; instag = instag->next) {
+        [store stageRecord:libotr_instance_tag_record(instag->accountname, instag->protocol, instag->instag) forAccountName:[NSString stringWithUTF8String:instag->accountname] protocol:[NSString stringWithUTF8String:instag->protocol]];
+    }
+    if (store.count && [store compactWithError:nil]) {
+        [self retireMigratedFileAtPath:self.instanceTagsPath];
+    }
+}
+
+/**
+ *  Must be called on internalQueue. Renames a libotr file once its contents are in a
+ *  store, it isn't kept up to date so other readers mustn't take it for the current data.
+ */
+- (void) retireMigratedFileAtPath:(NSString*)path {
+    rename(path.fileSystemRepresentation, [path stringByAppendingString:@".migrated"].fileSystemRepresentation);
+}
+
+/**
+ *  Must be called on internalQueue. libotr adds a key by writing every key to a
+ *  file and reading them all back, so that happens in memory and only the new
+ *  key is written, to privateKeyStore.
+ */
+- (nullable NSError*) finishGeneratingPrivateKey:(void*)newkey accountName:(const char*)accountname protocol:(const char*)protocol {
+    FILE *privf = otr_data_fopen([NSMutableData data]);
+    if (!privf) {
+        otrl_privkey_generate_cancelled(_userState, newkey);
+        return [OTRErrorUtility errorForGPGError:gcry_error_from_errno(errno)];
+    }
+    gcry_error_t generateError = otrl_privkey_generate_finish_FILEp(_userState, newkey, privf);
+    fclose(privf);
+    OtrlPrivKey *privkey = otrl_privkey_find(_userState, accountname, protocol);
+    NSData *record = privkey ? libotr_private_key_record(privkey) : nil;
+    if (generateError || !record) {
+        // libotr drops every key before reading them back, get them from the store again
+        [self loadPrivateKeysFromStore];
+        return [OTRErrorUtility errorForGPGError:generateError ?: gcry_error(GPG_ERR_NO_SECKEY)];
+    }
+    NSError *error = nil;
+    if (![self.privateKeyStore setRecord:record forAccountName:[NSString stringWithUTF8String:accountname] protocol:[NSString stringWithUTF8String:protocol] error:&error]) {
+        // Don't use a key that would be gone after a restart
+        [self loadPrivateKeysFromStore];
+        return error;
+    }
+    return nil;
+}
+
+/**
+ *  Must be called on internalQueue. otrl_instag_generate_FILEp writes every tag to
+ *  add one, so the new tag's line is built here, read into libotr on its own
+ *  and saved to instanceTagStore.
+ */
+- (void) generateInstanceTagForAccountName:(const char*)accountname protocol:(const char*)protocol {
+    NSData *record = libotr_instance_tag_record(accountname, protocol, otrl_instag_get_new());
+    if (!record) {
+        return;
+    }
+    FILE *instagf = otr_data_fopen([record mutableCopy]);
+    if (!instagf) {
+        return;
+    }
+    otrl_instag_read_FILEp(_userState, instagf);
+    fclose(instagf);
+    [self.instanceTagStore setRecord:record forAccountName:[NSString stringWithUTF8String:accountname] protocol:[NSString stringWithUTF8String:protocol] error:nil];
+}
+
+- (BOOL) exportLibotrFilesWithError:(NSError**)error {
+    __block BOOL success = NO;
+    __block NSError *exportError = nil;
+    [self performBlock:^{
+        NSError *blockError = nil;
+        success = [[self libotrPrivateKeyData] writeToFile:self.privateKeyPath options:NSDataWritingAtomic error:&blockError] &&
+                  [[self libotrInstanceTagData] writeToFile:self.instanceTagsPath options:NSDataWritingAtomic error:&blockError];
+        exportError = blockError;
     }];
+    if (error) {
+        *error = exportError;
+    }
+    return success;
 }
 
 - (NSString*) documentsDirectory {
@@ -678,6 +1357,10 @@ static OtrlMessageAppOps ui_ops = {
     return [self.dataPath stringByAppendingPathComponent:kOTRKitInstanceTagsFileName];
 }
 
+- (NSString*) sessionSnapshotPath {
+    return [self.dataPath stringByAppendingPathComponent:kOTRKitSessionSnapshotFileName];
+}
+
 - (void) setMaximumProtocolSize:(NSUInteger)maxSize forProtocol:(NSString *)protocol {
     NSParameterAssert(protocol != nil);
     if (!protocol) { return; }
@@ -688,42 +1371,91 @@ static OtrlMessageAppOps ui_ops = {
 
 - (void) setCallbackQueue:(dispatch_queue_t)callbackQueue {
     if (!callbackQueue) { return; }
+    self.atomicCallbackQueue = callbackQueue;
     [self performBlockAsync:^{
-        self->_callbackQueue = callbackQueue;
+        if (self.callbackMode == OTRKitCallbackModeQueue) {
+            self.messageStateCoalescer.targetQueue = callbackQueue;
+        }
     }];
 }
 
-- (dispatch_queue_t) callbackQueue {
-    __block dispatch_queue_t callbackQueue = nil;
-    [self performBlock:^{
-        callbackQueue = self->_callbackQueue;
-    }];
-    return callbackQueue;
+- (OTRKitCallbackMode) callbackMode {
+    return atomic_load(&_callbackMode);
 }
 
-- (void) messagePoll:(NSTimer*)timer {
+- (void) setCallbackMode:(OTRKitCallbackMode)callbackMode {
+    atomic_store(&_callbackMode, callbackMode);
+    // Coalesced updates can't be inline, they're delivered later on the internal queue instead
     [self performBlockAsync:^{
-        if (self.userState) {
-            OTROpData *opdata = [[OTROpData alloc] initWithOTRKit:self tag:nil];
-            otrl_message_poll(self->_userState, &ui_ops, (__bridge void *)(opdata));
+        if (callbackMode == OTRKitCallbackModeInline) {
+            self.messageStateCoalescer.targetQueue = self->_internalQueue;
         } else {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [timer invalidate];
-            });
+            self.messageStateCoalescer.targetQueue = self.atomicCallbackQueue;
         }
     }];
 }
 
-#pragma mark Key Generation
-//////////////////////////////////////////////////////////////////////
-/// @name Key Generation
-//////////////////////////////////////////////////////////////////////
+- (NSTimeInterval) messageStateCoalescingInterval {
+    return self.messageStateCoalescer.minimumInterval;
+}
 
-/**
- *  Initiates the generation of a new key pair for a given account/protocol, and optionally returns the fingerprint of the generated key via the completionBlock. If the key already exists this is a no-op that quickly returns the fingerprint (uppercase, without spaces).
- *
- *  @param accountName Your account name
- *  @param protocol the protocol of accountName, such as @"xmpp"
+- (void) setMessageStateCoalescingInterval:(NSTimeInterval)messageStateCoalescingInterval {
+    self.messageStateCoalescer.minimumInterval = messageStateCoalescingInterval;
+}
+
+- (dispatch_queue_t) callbackQueue {
+    return self.atomicCallbackQueue;
+}
+
+/** Must be called on main queue. Polls at the shortest of the libotr, eviction and snapshot intervals. */
+- (void) schedulePollTimer {
+    if (self.pollTimer) {
+        [self.pollTimer invalidate];
+        self.pollTimer = nil;
+    }
+    NSTimeInterval interval = self.libotrPollInterval;
+    if (self.evictionPollInterval > 0 && (interval <= 0 || self.evictionPollInterval < interval)) {
+        interval = self.evictionPollInterval;
+    }
+    if (self.sessionSnapshotPollInterval > 0 && (interval <= 0 || self.sessionSnapshotPollInterval < interval)) {
+        interval = self.sessionSnapshotPollInterval;
+    }
+    if (interval > 0) {
+        self.pollTimer = [NSTimer scheduledTimerWithTimeInterval:interval target:self selector:@selector(messagePoll:) userInfo:nil repeats:YES];
+    }
+}
+
+- (void) messagePoll:(NSTimer*)timer {
+    if ([self shouldShedWorkWithPriority:OTRKitPriorityMaintenance]) {
+        // Try again next tick
+        return;
+    }
+    [self performBlockAsync:^{
+        if (self.userState) {
+            OTROpData *opdata = [[OTROpData alloc] initWithOTRKit:self tag:nil];
+            otrl_message_poll(self->_userState, &ui_ops, (__bridge void *)(opdata));
+            if (self->_contextIdleTimeout > 0) {
+                [self evictIdleContexts];
+            }
+            [self writeSessionSnapshotIfDue];
+        } else {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [timer invalidate];
+            });
+        }
+    } priority:OTRKitPriorityMaintenance group:nil];
+}
+
+#pragma mark Key Generation
+//////////////////////////////////////////////////////////////////////
+/// @name Key Generation
+//////////////////////////////////////////////////////////////////////
+
+/**
+ *  Initiates the generation of a new key pair for a given account/protocol, and optionally returns the fingerprint of the generated key via the completionBlock. If the key already exists this is a no-op that quickly returns the fingerprint (uppercase, without spaces).
+ *
+ *  @param accountName Your account name
+ *  @param protocol the protocol of accountName, such as @"xmpp"
  *  @param completionBlock optional.
  */
 - (void) generatePrivateKeyForAccountName:(NSString*)accountName
@@ -744,12 +1476,13 @@ static OtrlMessageAppOps ui_ops = {
             create_privkey_cb((__bridge void*)opdata, [accountName UTF8String], [protocol UTF8String]);
         }
         fingerprint = [self fingerprintForAccountName:accountName protocol:protocol];
-        NSParameterAssert(fingerprint != nil);
+        // Only missing if the key couldn't be generated or saved
+        NSError *error = fingerprint ? nil : (self.privateKeyStore.loadError ?: [OTRErrorUtility errorForGPGError:GPG_ERR_NO_SECKEY]);
 
         if (completionBlock) {
-            dispatch_async(self.callbackQueue, ^{
-                completionBlock(fingerprint, nil);
-            });
+            [self deliverCallback:^{
+                completionBlock(fingerprint, error);
+            }];
         }
     }];
 }
@@ -793,21 +1526,37 @@ static OtrlMessageAppOps ui_ops = {
     if (![message length] || ![username length] || ![accountName length] || ![protocol length] || !completion) {
         return;
     }
+    if (async) {
+        [self operationWillStart];
+        void (^userCompletion)(NSString*, NSArray<OTRTLV*>*, BOOL, OTRFingerprint*, NSError*) = completion;
+        completion = ^(NSString *decodedMessage, NSArray<OTRTLV*> *tlvs, BOOL wasEncrypted, OTRFingerprint *fingerprint, NSError *error) {
+            userCompletion(decodedMessage, tlvs, wasEncrypted, fingerprint, error);
+            [self operationDidFinish];
+        };
+    }
     __block dispatch_block_t finishBlock = nil;
     dispatch_block_t decodeBlock = ^{
         int ignore_message;
         char *newmessage = NULL;
         ConnContext *context = [self contextForUsername:username accountName:accountName protocol:protocol];
         NSParameterAssert(context != NULL);
-        if (!context) { return; } // Maybe don't fail silently here
+        if (!context) {
+            if (async) {
+                [self operationDidFinish];
+            }
+            return;
+        } // Maybe don't fail silently here
         
         OTROpData *opdata = [[OTROpData alloc] initWithOTRKit:self tag:tag];
+        opdata.context = context;
         
         OTRFingerprint *fingerprint = [self activeFingerprintForCurrentContext:context];
         if (fingerprint && fingerprint.trustLevel == OTRTrustLevelUnknown) {
             fingerprint = [self fixUnknownFingerprint:fingerprint];
         }
         
+        OTRTrafficRecorder *recorder = self.trafficRecorder;
+        CFAbsoluteTime decodeStart = recorder ? CFAbsoluteTimeGetCurrent() : 0;
         OtrlTLV *otr_tlvs = NULL;
         ignore_message = otrl_message_receiving(self->_userState, &ui_ops, (__bridge void*)opdata, [accountName UTF8String], [protocol UTF8String], [username UTF8String], [message UTF8String], &newmessage, &otr_tlvs, &context, NULL, NULL);
         
@@ -819,13 +1568,10 @@ static OtrlMessageAppOps ui_ops = {
         if (otr_tlvs) {
             tlvs = [[self class] tlvArrayForTLVChain:otr_tlvs];
         }
-        [tlvs enumerateObjectsUsingBlock:^(OTRTLV *tlv, NSUInteger idx, BOOL *stop) {
-            OTRTLVType tlvType = tlv.type;
-            id<OTRTLVHandler> handler = [self.tlvHandlers objectForKey:@(tlvType)];
-            if (handler) {
-                [handler receiveTLV:tlv username:username accountName:accountName protocol:protocol fingerprint:fingerprint tag:tag];
-            }
-        }];
+        if (opdata.receivedSymmetricKey && context) {
+            [self receivedBatchedSymmetricKeyTLVs:tlvs symmetricKey:opdata.receivedSymmetricKey context:context];
+        }
+        [self dispatchTLVs:tlvs username:username accountName:accountName protocol:protocol fingerprint:fingerprint tag:tag];
         if (otr_tlvs) {
             otrl_tlv_free(otr_tlvs);
         }
@@ -842,6 +1588,10 @@ static OtrlMessageAppOps ui_ops = {
             }
         }
         
+        if (recorder) {
+            [recorder recordEventWithType:OTRTrafficEventTypeDecode message:message plaintext:decodedMessage tlvs:tlvs username:username accountName:accountName protocol:protocol duration:CFAbsoluteTimeGetCurrent() - decodeStart];
+        }
+        
         NSError *error = nil;
         
         if (context) {
@@ -859,12 +1609,13 @@ static OtrlMessageAppOps ui_ops = {
             completion(decodedMessage, tlvs, wasEncrypted, fingerprint, error);
         };
         if (async) {
-            dispatch_async(self.callbackQueue, finishBlock);
+            [self deliverCallback:finishBlock];
         }
     };
     
     if (async) {
-        [self performBlockAsync:decodeBlock];
+        NSString *group = [[self class] contextKeyForUsername:username.UTF8String accountName:accountName.UTF8String protocol:protocol.UTF8String];
+        [self performBlockAsync:decodeBlock priority:OTRKitPriorityInteractive group:group];
     } else {
         [self performBlock:decodeBlock];
         finishBlock();
@@ -878,7 +1629,17 @@ static OtrlMessageAppOps ui_ops = {
           accountName:(NSString*)accountName
              protocol:(NSString*)protocol
                   tag:(nullable id)tag {
-    [self encodeMessage:message tlvs:tlvs username:username accountName:accountName protocol:protocol tag:tag async:YES completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+    [self encodeMessage:message tlvs:tlvs username:username accountName:accountName protocol:protocol tag:tag priority:OTRKitPriorityInteractive];
+}
+
+- (void)encodeMessage:(nullable NSString*)message
+                 tlvs:(nullable NSArray<OTRTLV*>*)tlvs
+             username:(NSString*)username
+          accountName:(NSString*)accountName
+             protocol:(NSString*)protocol
+                  tag:(nullable id)tag
+             priority:(OTRKitPriority)priority {
+    [self encodeMessage:message tlvs:tlvs username:username accountName:accountName protocol:protocol tag:tag priority:priority async:YES completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
         if ([self.delegate respondsToSelector:@selector(otrKit:encodedMessage:wasEncrypted:username:accountName:protocol:fingerprint:tag:error:)]) {
             [self.delegate otrKit:self encodedMessage:encodedMessage wasEncrypted:wasEncrypted username:username accountName:accountName protocol:protocol fingerprint:fingerprint tag:tag error:error];
         }
@@ -893,6 +1654,18 @@ static OtrlMessageAppOps ui_ops = {
                   tag:(nullable id)tag
                 async:(BOOL)async
            completion:(void (^)(NSString* _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint* _Nullable fingerprint, NSError* _Nullable error))completion {
+    [self encodeMessage:message tlvs:tlvs username:username accountName:accountName protocol:protocol tag:tag priority:OTRKitPriorityInteractive async:async completion:completion];
+}
+
+- (void)encodeMessage:(nullable NSString*)message
+                 tlvs:(nullable NSArray<OTRTLV*>*)tlvs
+             username:(NSString*)username
+          accountName:(NSString*)accountName
+             protocol:(NSString*)protocol
+                  tag:(nullable id)tag
+             priority:(OTRKitPriority)priority
+                async:(BOOL)async
+           completion:(void (^)(NSString* _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint* _Nullable fingerprint, NSError* _Nullable error))completion {
     NSParameterAssert(username);
     NSParameterAssert(accountName);
     NSParameterAssert(protocol);
@@ -900,6 +1673,21 @@ static OtrlMessageAppOps ui_ops = {
     if (!username.length || !accountName.length || !protocol.length || !completion) {
         return;
     }
+    if (async) {
+        if ([self shouldShedWorkWithPriority:priority]) {
+            NSError *error = [OTRErrorUtility errorForGPGError:GPG_ERR_EBUSY];
+            [self deliverCallback:^{
+                completion(nil, NO, nil, error);
+            }];
+            return;
+        }
+        [self operationWillStart];
+        void (^userCompletion)(NSString*, BOOL, OTRFingerprint*, NSError*) = completion;
+        completion = ^(NSString *encodedMessage, BOOL wasEncrypted, OTRFingerprint *fingerprint, NSError *error) {
+            userCompletion(encodedMessage, wasEncrypted, fingerprint, error);
+            [self operationDidFinish];
+        };
+    }
     // If you meant to send TLVs and message is nil,
     // libotr will ignore the encode. We fix it by
     // setting to empty string.
@@ -910,12 +1698,15 @@ static OtrlMessageAppOps ui_ops = {
     }
     __block dispatch_block_t finishBlock = nil;
     dispatch_block_t encodeBlock = ^{
-        gcry_error_t err;
-        char *newmessage = NULL;
-        
         ConnContext *context = [self contextForUsername:username accountName:accountName protocol:protocol];
         NSParameterAssert(context);
         
+        if (async && [self shouldHoldMessage:message context:context]) {
+            OTRPendingMessage *pendingMessage = [[OTRPendingMessage alloc] initWithMessage:message tlvs:tlvs username:username accountName:accountName protocol:protocol tag:tag completion:completion];
+            [self holdMessage:pendingMessage];
+            return;
+        }
+        
         // Check trust
         OTRFingerprint *fingerprint = [self activeFingerprintForCurrentContext:context];
         if (fingerprint) {
@@ -929,74 +1720,432 @@ static OtrlMessageAppOps ui_ops = {
                     completion(nil, NO, fingerprint, error);
                 };
                 if (async) {
-                    dispatch_async(self.callbackQueue, finishBlock);
+                    [self deliverCallback:finishBlock];
                 }
                 return;
             }
         }
         
         OtrlTLV *otr_tlvs = [[self class] tlvChainForTLVs:tlvs];
-        OTROpData *opdata = [[OTROpData alloc] initWithOTRKit:self tag:tag];
-        
-        err = otrl_message_sending(self->_userState, &ui_ops, (__bridge void *)(opdata),
-                                   [accountName UTF8String], [protocol UTF8String], [username UTF8String], OTRL_INSTAG_BEST, [message UTF8String], otr_tlvs, &newmessage, OTRL_FRAGMENT_SEND_SKIP, &context,
-                                   NULL, NULL);
-        if (otr_tlvs) {
-            otrl_tlv_free(otr_tlvs);
-        }
-        
         BOOL wasEncrypted = NO;
-        
-        // If the there is a newmessage then send that otherweise OTR didn't need to modify the original message.
-        NSString *encodedMessage = nil;
-        if (newmessage) {
-            encodedMessage = [NSString stringWithUTF8String:newmessage];
-            otrl_message_free(newmessage);
-            wasEncrypted = [OTRKit stringStartsWithOTRPrefix:encodedMessage];
-        } else {
-            encodedMessage = message;
-        }
-        
         NSError *error = nil;
-        if (err != GPG_ERR_NO_ERROR) {
-            error = [OTRErrorUtility errorForGPGError:err];
-            encodedMessage = nil;
+        NSString *encodedMessage = [self internalEncodeMessage:message messageString:[message UTF8String] otrlTLVs:otr_tlvs username:[username UTF8String] accountName:[accountName UTF8String] protocol:[protocol UTF8String] tag:tag wasEncrypted:&wasEncrypted error:&error];
+        if (otr_tlvs) {
+            otrl_tlv_free(otr_tlvs);
         }
         finishBlock = ^{
             completion(encodedMessage, wasEncrypted, fingerprint, error);
         };
         if (async) {
-            dispatch_async(self.callbackQueue, finishBlock);
+            [self deliverCallback:finishBlock];
         }
     };
     
     if (async) {
-        [self performBlockAsync:encodeBlock];
+        NSString *group = [[self class] contextKeyForUsername:username.UTF8String accountName:accountName.UTF8String protocol:protocol.UTF8String];
+        [self performBlockAsync:encodeBlock priority:priority group:group];
     } else {
         [self performBlock:encodeBlock];
         finishBlock();
     }
 }
 
+- (void)encodeMessage:(nullable NSString*)message
+                 tlvs:(nullable NSArray<OTRTLV*>*)tlvs
+            usernames:(NSArray<NSString*>*)usernames
+          accountName:(NSString*)accountName
+             protocol:(NSString*)protocol
+                  tag:(nullable id)tag
+           completion:(void (^)(NSArray<OTREncodedMessage*>* encodedMessages))completion {
+    NSParameterAssert(usernames);
+    NSParameterAssert(accountName);
+    NSParameterAssert(protocol);
+    NSParameterAssert(completion);
+    if (!accountName.length || !protocol.length || !completion) {
+        return;
+    }
+    // Validate and dedupe recipients up front, keeping the caller's order
+    NSOrderedSet<NSString*> *recipients = [NSOrderedSet orderedSetWithArray:usernames];
+    if (!recipients.count) {
+        [self deliverCallback:^{
+            completion(@[]);
+        }];
+        return;
+    }
+    if (message) {
+        message = [message copy];
+    } else if (tlvs.count) {
+        message = @"";
+    }
+    [self operationWillStart];
+    void (^userCompletion)(NSArray<OTREncodedMessage*>*) = completion;
+    completion = ^(NSArray<OTREncodedMessage*> *encodedMessages) {
+        userCompletion(encodedMessages);
+        [self operationDidFinish];
+    };
+    [self performBlockAsync:^{
+        // Shared plaintext preparation, done once for every recipient
+        const char *message_str = [message UTF8String];
+        const char *account_str = [accountName UTF8String];
+        const char *protocol_str = [protocol UTF8String];
+        OtrlTLV *otr_tlvs = [[self class] tlvChainForTLVs:tlvs];
+        
+        NSMutableArray *fingerprints = [NSMutableArray arrayWithCapacity:recipients.count];
+        for (NSString *username in recipients) {
+            OTRFingerprint *fingerprint = nil;
+            // Invalid recipients fail below, without leaving a context behind
+            ConnContext *context = username.length ? [self contextForUsername:username accountName:accountName protocol:protocol] : NULL;
+            if (context) {
+                fingerprint = [self activeFingerprintForCurrentContext:context];
+                if (fingerprint && fingerprint.trustLevel == OTRTrustLevelUnknown) {
+                    fingerprint = [self fixUnknownFingerprint:fingerprint];
+                }
+            }
+            [fingerprints addObject:fingerprint ?: [NSNull null]];
+        }
+        // At most one hop to the callbackQueue for all trust decisions
+        NSArray<NSNumber*> *trust = [self checkTrustForFingerprints:fingerprints];
+        
+        NSMutableArray<OTREncodedMessage*> *results = [NSMutableArray arrayWithCapacity:recipients.count];
+        [recipients enumerateObjectsUsingBlock:^(NSString *username, NSUInteger idx, BOOL *stop) {
+            OTRFingerprint *fingerprint = fingerprints[idx];
+            if ([fingerprint isKindOfClass:[NSNull class]]) {
+                fingerprint = nil;
+            }
+            BOOL wasEncrypted = NO;
+            NSError *error = nil;
+            NSString *encodedMessage = nil;
+            if (!username.length) {
+                error = [OTRErrorUtility errorForGPGError:GPG_ERR_INV_PARAMETER];
+            } else if (![trust[idx] boolValue]) {
+                error = [OTRErrorUtility errorForGPGError:GPG_ERR_BAD_PUBKEY];
+            } else {
+                encodedMessage = [self internalEncodeMessage:message messageString:message_str otrlTLVs:otr_tlvs username:[username UTF8String] accountName:account_str protocol:protocol_str tag:tag wasEncrypted:&wasEncrypted error:&error];
+            }
+            OTREncodedMessage *result = [[OTREncodedMessage alloc] initWithUsername:username encodedMessage:encodedMessage wasEncrypted:wasEncrypted fingerprint:fingerprint error:error];
+            [results addObject:result];
+        }];
+        if (otr_tlvs) {
+            otrl_tlv_free(otr_tlvs);
+        }
+        [self deliverCallback:^{
+            completion(results);
+        }];
+    }];
+}
+
+/**
+ *  Wraps otrl_message_sending. The TLV chain is not freed so it can be shared between recipients.
+ *  Must be called from performBlock/performBlockAsync to schedule on internalQueue
+ */
+- (nullable NSString*) internalEncodeMessage:(nullable NSString*)message
+                               messageString:(nullable const char*)message_str
+                                    otrlTLVs:(nullable OtrlTLV*)otr_tlvs
+                                    username:(const char*)username
+                                 accountName:(const char*)accountName
+                                    protocol:(const char*)protocol
+                                         tag:(nullable id)tag
+                                wasEncrypted:(BOOL*)wasEncrypted
+                                       error:(NSError**)error {
+    char *newmessage = NULL;
+    ConnContext *context = NULL;
+    OTROpData *opdata = [[OTROpData alloc] initWithOTRKit:self tag:tag];
+    OTRTrafficRecorder *recorder = self.trafficRecorder;
+    CFAbsoluteTime encodeStart = recorder ? CFAbsoluteTimeGetCurrent() : 0;
+    gcry_error_t err = otrl_message_sending(_userState, &ui_ops, (__bridge void *)(opdata),
+                                            accountName, protocol, username, OTRL_INSTAG_BEST, message_str, otr_tlvs, &newmessage, OTRL_FRAGMENT_SEND_SKIP, &context,
+                                            NULL, NULL);
+    NSTimeInterval encodeDuration = recorder ? CFAbsoluteTimeGetCurrent() - encodeStart : 0;
+    *wasEncrypted = NO;
+    
+    // If the there is a newmessage then send that otherweise OTR didn't need to modify the original message.
+    NSString *encodedMessage = nil;
+    if (newmessage) {
+        encodedMessage = [NSString stringWithUTF8String:newmessage];
+        otrl_message_free(newmessage);
+        *wasEncrypted = [OTRKit stringStartsWithOTRPrefix:encodedMessage];
+    } else {
+        encodedMessage = message;
+    }
+    
+    if (err != GPG_ERR_NO_ERROR) {
+        *error = [OTRErrorUtility errorForGPGError:err];
+        encodedMessage = nil;
+    } else if (recorder) {
+        // Only pay for copying the TLVs back out while recording
+        NSArray<OTRTLV*> *tlvs = otr_tlvs ? [[self class] tlvArrayForTLVChain:otr_tlvs] : nil;
+        [recorder recordEventWithType:OTRTrafficEventTypeEncode message:encodedMessage plaintext:message tlvs:tlvs username:@(username) accountName:@(accountName) protocol:@(protocol) duration:encodeDuration];
+    }
+    return encodedMessage;
+}
+
+#pragma mark Pending Messages
+
+/**
+ *  Must be called from performBlock/performBlockAsync to schedule on internalQueue.
+ *  Messages queue up behind held ones so order is kept, otherwise they're held while the
+ *  policy requires encryption and the conversation hasn't started it. OTR queries always go out.
+ */
+- (BOOL) shouldHoldMessage:(nullable NSString*)message context:(ConnContext*)context {
+    if (self.pendingMessageTimeout <= 0 || !context) {
+        return NO;
+    }
+    if (message && [OTRKit stringStartsWithOTRPrefix:message]) {
+        return NO;
+    }
+    NSString *key = [[self class] contextKeyForUsername:context->username accountName:context->accountname protocol:context->protocol];
+    if ([self.pendingMessages objectForKey:key]) {
+        return YES;
+    }
+    // A finished conversation stays refused rather than being silently restarted
+    if (context->msgstate != OTRL_MSGSTATE_PLAINTEXT) {
+        return NO;
+    }
+    // Only OTRKitPolicyAlways, where libotr would refuse to send it in plaintext anyway.
+    // Opportunistic peers may not speak OTR at all and must not wait for a timeout.
+    return ([self otrlPolicy] & OTRL_POLICY_REQUIRE_ENCRYPTION) != 0;
+}
+
+/** Must be called from performBlock/performBlockAsync to schedule on internalQueue. The first message held for a conversation starts an AKE and the timeout. */
+- (void) holdMessage:(OTRPendingMessage*)pendingMessage {
+    NSString *key = [[self class] contextKeyForUsername:pendingMessage.username.UTF8String accountName:pendingMessage.accountName.UTF8String protocol:pendingMessage.protocol.UTF8String];
+    NSMutableArray<OTRPendingMessage*> *queue = [self.pendingMessages objectForKey:key];
+    if (queue) {
+        [queue addObject:pendingMessage];
+        return;
+    }
+    queue = [NSMutableArray arrayWithObject:pendingMessage];
+    [self.pendingMessages setObject:queue forKey:key];
+    ConnContext *context = [self contextForUsername:pendingMessage.username accountName:pendingMessage.accountName protocol:pendingMessage.protocol];
+    BOOL akeInFlight = (context && context->auth.authstate != OTRL_AUTHSTATE_NONE) || [self.activeSessionInitiations objectForKey:key];
+    if (!akeInFlight) {
+        [self initiateEncryptionWithUsername:pendingMessage.username accountName:pendingMessage.accountName protocol:pendingMessage.protocol priority:OTRKitPriorityInteractive];
+    }
+    __weak typeof(self) weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.pendingMessageTimeout * NSEC_PER_SEC)), self.internalQueue, ^{
+        typeof(self) strongSelf = weakSelf;
+        if (!strongSelf || [strongSelf.pendingMessages objectForKey:key] != queue) {
+            return;
+        }
+        [strongSelf.pendingMessages removeObjectForKey:key];
+        NSError *error = [OTRErrorUtility errorForGPGError:GPG_ERR_TIMEOUT];
+        [strongSelf deliverCallback:^{
+            for (OTRPendingMessage *message in queue) {
+                message.completion(nil, NO, nil, error);
+            }
+        }];
+    });
+}
+
+- (void) schedulePendingMessageFlushForContext:(ConnContext*)context {
+    NSString *key = [[self class] contextKeyForUsername:context->username accountName:context->accountname protocol:context->protocol];
+    if (![self.pendingMessages objectForKey:key]) {
+        return;
+    }
+    // We're inside otrl_message_receiving, so encode after it returns. performBlockAsync would
+    // run it inline here, the scheduler always queues it, ahead of later encodes in the same group.
+    [self.scheduler scheduleBlock:^{
+        [self flushPendingMessagesForKey:key];
+    } priority:OTRKitPriorityInteractive group:key];
+}
+
+/** Must be called from performBlock/performBlockAsync to schedule on internalQueue. Encrypts every held message in order and runs their completions in one callback. */
+- (void) flushPendingMessagesForKey:(NSString*)key {
+    NSMutableArray<OTRPendingMessage*> *queue = [self.pendingMessages objectForKey:key];
+    OTRPendingMessage *first = queue.firstObject;
+    if (!first) {
+        return;
+    }
+    ConnContext *context = [self contextForUsername:first.username accountName:first.accountName protocol:first.protocol];
+    if (!context || context->msgstate != OTRL_MSGSTATE_ENCRYPTED) {
+        return;
+    }
+    [self.pendingMessages removeObjectForKey:key];
+    
+    OTRFingerprint *fingerprint = [self activeFingerprintForCurrentContext:context];
+    if (fingerprint && fingerprint.trustLevel == OTRTrustLevelUnknown) {
+        fingerprint = [self fixUnknownFingerprint:fingerprint];
+    }
+    BOOL trusted = !fingerprint || [self checkTrustForFingerprint:fingerprint];
+    NSMutableArray<dispatch_block_t> *finishBlocks = [NSMutableArray arrayWithCapacity:queue.count];
+    for (OTRPendingMessage *pendingMessage in queue) {
+        NSString *message = pendingMessage.message;
+        BOOL wasEncrypted = NO;
+        NSError *error = nil;
+        NSString *encodedMessage = nil;
+        if (!trusted) {
+            error = [OTRErrorUtility errorForGPGError:GPG_ERR_BAD_PUBKEY];
+        } else {
+            OtrlTLV *otr_tlvs = [[self class] tlvChainForTLVs:pendingMessage.tlvs];
+            encodedMessage = [self internalEncodeMessage:message messageString:[message UTF8String] otrlTLVs:otr_tlvs username:context->username accountName:context->accountname protocol:context->protocol tag:pendingMessage.tag wasEncrypted:&wasEncrypted error:&error];
+            if (otr_tlvs) {
+                otrl_tlv_free(otr_tlvs);
+            }
+        }
+        [finishBlocks addObject:^{
+            pendingMessage.completion(encodedMessage, wasEncrypted, fingerprint, error);
+        }];
+    }
+    [self deliverCallback:^{
+        for (dispatch_block_t finishBlock in finishBlocks) {
+            finishBlock();
+        }
+    }];
+}
+
+- (void)initiateEncryptionWithUsername:(NSString*)username
+                           accountName:(NSString*)accountName
+                              protocol:(NSString*)protocol
+{
+    [self initiateEncryptionWithUsername:username accountName:accountName protocol:protocol priority:OTRKitPriorityInteractive];
+}
+
 - (void)initiateEncryptionWithUsername:(NSString*)username
                            accountName:(NSString*)accountName
                               protocol:(NSString*)protocol
+                              priority:(OTRKitPriority)priority
 {
-    [self encodeMessage:@"?OTRv23?" tlvs:nil username:username accountName:accountName protocol:protocol tag:nil async:YES completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+    [self encodeMessage:@"?OTRv23?" tlvs:nil username:username accountName:accountName protocol:protocol tag:nil priority:priority async:YES completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
         // Inject message directly to start encryption
-        // We are already on callbackQueue in here
+        // We are already on callbackQueue in here, or inline
         // So safe to call delegate method directly
+        if (error || !encodedMessage) {
+            [self.delegate otrKit:self handleMessageEvent:OTRKitMessageEventSetupError message:@"" username:username accountName:accountName protocol:protocol tag:nil error:error];
+            // The query never went out, so let the next initiation have the slot
+            [self performBlockAsync:^{
+                [self releaseSessionInitiationForKey:[[self class] contextKeyForUsername:username.UTF8String accountName:accountName.UTF8String protocol:protocol.UTF8String]];
+            }];
+            return;
+        }
         [self.delegate otrKit:self injectMessage:encodedMessage username:username accountName:accountName protocol:protocol fingerprint:nil tag:nil];
     }];
 }
 
+- (void)initiateEncryptionWithUsernames:(NSArray<NSString*>*)usernames
+                            accountName:(NSString*)accountName
+                               protocol:(NSString*)protocol
+{
+    NSParameterAssert(accountName.length);
+    NSParameterAssert(protocol.length);
+    if (!usernames.count || !accountName.length || !protocol.length) {
+        return;
+    }
+    NSOrderedSet<NSString*> *uniqueUsernames = [NSOrderedSet orderedSetWithArray:usernames];
+    [self performBlockAsync:^{
+        if (!self->_userState) {
+            return;
+        }
+        NSMutableSet<NSString*> *queuedKeys = [NSMutableSet setWithArray:[self.pendingSessionInitiations valueForKey:NSStringFromSelector(@selector(key))]];
+        [queuedKeys addObjectsFromArray:self.activeSessionInitiations.allKeys];
+        for (NSString *username in uniqueUsernames) {
+            if (!username.length) {
+                continue;
+            }
+            NSString *key = [[self class] contextKeyForUsername:username.UTF8String accountName:accountName.UTF8String protocol:protocol.UTF8String];
+            if ([queuedKeys containsObject:key]) {
+                continue;
+            }
+            // Don't create contexts for the whole roster up front, that happens when each query is sent
+            CFAbsoluteTime lastActivity = 0;
+            ConnContext *context = otrl_context_find(self->_userState, username.UTF8String, accountName.UTF8String, protocol.UTF8String, OTRL_INSTAG_BEST, NO, NULL, NULL, NULL);
+            if (context) {
+                if (context->msgstate == OTRL_MSGSTATE_ENCRYPTED) {
+                    continue;
+                }
+                OTRContextAppData *appData = [self rootContextForContext:context]->app_data;
+                if (appData) {
+                    lastActivity = appData->lastActivity;
+                }
+            }
+            OTRSessionInitiation *initiation = [[OTRSessionInitiation alloc] initWithUsername:username accountName:accountName protocol:protocol key:key lastActivity:lastActivity];
+            [self.pendingSessionInitiations addObject:initiation];
+            [queuedKeys addObject:key];
+        }
+        // Stable sort keeps roster order for buddies with equal activity
+        [self.pendingSessionInitiations sortWithOptions:NSSortStable usingComparator:^NSComparisonResult(OTRSessionInitiation *obj1, OTRSessionInitiation *obj2) {
+            if (obj1.lastActivity > obj2.lastActivity) {
+                return NSOrderedAscending;
+            } else if (obj1.lastActivity < obj2.lastActivity) {
+                return NSOrderedDescending;
+            }
+            return NSOrderedSame;
+        }];
+        [self startPendingSessionInitiations];
+    }];
+}
+
+- (void)cancelSessionInitiationsForAccountName:(NSString*)accountName
+                                      protocol:(NSString*)protocol
+{
+    [self performBlockAsync:^{
+        NSIndexSet *indexes = [self.pendingSessionInitiations indexesOfObjectsPassingTest:^BOOL(OTRSessionInitiation *initiation, NSUInteger idx, BOOL *stop) {
+            return [initiation.accountName isEqualToString:accountName] && [initiation.protocol isEqualToString:protocol];
+        }];
+        [self.pendingSessionInitiations removeObjectsAtIndexes:indexes];
+    }];
+}
+
+/** Must be called from performBlock/performBlockAsync to schedule on internalQueue */
+- (void) startPendingSessionInitiations {
+    while (self.pendingSessionInitiations.count && self.activeSessionInitiations.count < _maxConcurrentSessionInitiations) {
+        OTRSessionInitiation *initiation = self.pendingSessionInitiations.firstObject;
+        [self.pendingSessionInitiations removeObjectAtIndex:0];
+        [self.activeSessionInitiations setObject:initiation forKey:initiation.key];
+        // Each query is encoded in its own block in the bulk lane, behind interactive traffic
+        [self initiateEncryptionWithUsername:initiation.username accountName:initiation.accountName protocol:initiation.protocol priority:OTRKitPriorityBulk];
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kOTRKitSessionInitiationTimeout * NSEC_PER_SEC)), self.internalQueue, ^{
+            if ([self.activeSessionInitiations objectForKey:initiation.key] == initiation) {
+                [self.activeSessionInitiations removeObjectForKey:initiation.key];
+                [self startPendingSessionInitiations];
+            }
+        });
+    }
+}
+
+/** Must be called from performBlock/performBlockAsync to schedule on internalQueue */
+- (void) finishSessionInitiationForContext:(ConnContext*)context {
+    if (!self.activeSessionInitiations.count || context->msgstate != OTRL_MSGSTATE_ENCRYPTED) {
+        return;
+    }
+    NSString *key = [[self class] contextKeyForUsername:context->username accountName:context->accountname protocol:context->protocol];
+    [self releaseSessionInitiationForKey:key];
+}
+
+/** Must be called from performBlock/performBlockAsync to schedule on internalQueue */
+- (void) releaseSessionInitiationForKey:(NSString*)key {
+    if (![self.activeSessionInitiations objectForKey:key]) {
+        return;
+    }
+    [self.activeSessionInitiations removeObjectForKey:key];
+    [self startPendingSessionInitiations];
+}
+
+- (NSUInteger) maxConcurrentSessionInitiations {
+    __block NSUInteger maxConcurrentSessionInitiations = 0;
+    [self performBlock:^{
+        maxConcurrentSessionInitiations = self->_maxConcurrentSessionInitiations;
+    }];
+    return maxConcurrentSessionInitiations;
+}
+
+- (void) setMaxConcurrentSessionInitiations:(NSUInteger)maxConcurrentSessionInitiations {
+    [self performBlockAsync:^{
+        self->_maxConcurrentSessionInitiations = MAX(1, maxConcurrentSessionInitiations);
+        [self startPendingSessionInitiations];
+    }];
+}
+
 - (void)disableEncryptionWithUsername:(NSString*)recipient
                           accountName:(NSString*)accountName
                              protocol:(NSString*)protocol {
     [self performBlockAsync:^{
         OTROpData *opdata = [[OTROpData alloc] initWithOTRKit:self tag:nil];
         otrl_message_disconnect_all_instances(self->_userState, &ui_ops, (__bridge void *)(opdata), [accountName UTF8String], [protocol UTF8String], [recipient UTF8String]);
-        [self updateEncryptionStatusWithContext:[self contextForUsername:recipient accountName:accountName protocol:protocol]];
+        ConnContext *context = [self contextForUsername:recipient accountName:accountName protocol:protocol];
+        if (context) {
+            [self resetReceivedSymmetricKeysForContext:context];
+        }
+        [self updateEncryptionStatusWithContext:context];
     }];
 }
 
@@ -1004,9 +2153,9 @@ static OtrlMessageAppOps ui_ops = {
 {
     if (!accountName.length || !protocol.length) {
         if (completion) {
-            dispatch_async(self.callbackQueue, ^{
+            [self deliverCallback:^{
                 completion(NO);
-            });
+            }];
         }
         return;
     }
@@ -1019,9 +2168,9 @@ static OtrlMessageAppOps ui_ops = {
         }
         BOOL keyExists = generateError == gcry_error(GPG_ERR_EEXIST);
         if (completion) {
-            dispatch_async(self.callbackQueue, ^{
+            [self deliverCallback:^{
                 completion(keyExists);
-            });
+            }];
         }
     }];
 }
@@ -1029,19 +2178,87 @@ static OtrlMessageAppOps ui_ops = {
 - (void) updateEncryptionStatusWithContext:(ConnContext*)context {
     NSParameterAssert(context != nil);
     if (!context) { return; }
+    [self finishSessionInitiationForContext:context];
+    NSString *username = [NSString stringWithUTF8String:context->username];
+    NSString *accountName = [NSString stringWithUTF8String:context->accountname];
+    NSString *protocol = [NSString stringWithUTF8String:context->protocol];
+    [self publishConversationStateForUsername:username accountName:accountName protocol:protocol];
     if ([self.delegate respondsToSelector:@selector(otrKit:updateMessageState:username:accountName:protocol:fingerprint:)]) {
-        NSString *username = [NSString stringWithUTF8String:context->username];
-        NSString *accountName = [NSString stringWithUTF8String:context->accountname];
-        NSString *protocol = [NSString stringWithUTF8String:context->protocol];
         OTRFingerprint *fingerprint = [self activeFingerprintForCurrentContext:context];
         if (fingerprint && fingerprint.trustLevel == OTRTrustLevelUnknown) {
             fingerprint = [self fixUnknownFingerprint:fingerprint];
         }
         OTRKitMessageState messageState = [self messageStateForUsername:username accountName:accountName protocol:protocol];
-        dispatch_async(self.callbackQueue, ^{
+        // still_secure_cb and re-keys land here without changing anything
+        NSString *key = [[self class] contextKeyForUsername:context->username accountName:context->accountname protocol:context->protocol];
+        NSString *deliveredState = [NSString stringWithFormat:@"%d %@ %d", (int)messageState, fingerprint.fingerprint, (int)fingerprint.trustLevel];
+        if ([[self.deliveredMessageStates objectForKey:key] isEqualToString:deliveredState]) {
+            return;
+        }
+        [self.deliveredMessageStates setObject:deliveredState forKey:key];
+        dispatch_block_t updateBlock = ^{
             [self.delegate otrKit:self updateMessageState:messageState username:username accountName:accountName protocol:protocol fingerprint:fingerprint];
-        });
+        };
+        if (self.messageStateCoalescer.minimumInterval > 0) {
+            [self.messageStateCoalescer enqueueBlock:updateBlock forKey:key];
+        } else {
+            [self deliverCallback:updateBlock];
+        }
+    }
+}
+
+/** Must be called on internalQueue. Replaces the published state of the conversation, see conversationStateForUsername:accountName:protocol: */
+- (void) publishConversationStateForUsername:(NSString*)username accountName:(NSString*)accountName protocol:(NSString*)protocol {
+    // Publishing alone shouldn't create a context
+    ConnContext *context = otrl_context_find(_userState, username.UTF8String, accountName.UTF8String, protocol.UTF8String, OTRL_INSTAG_BEST, 0, NULL, NULL, NULL);
+    if (!context) {
+        return;
+    }
+    ConnContext *master = context->m_context;
+    NSUInteger instanceCount = 0;
+    // libotr keeps a master's instances right after it in context_root
+    for (ConnContext *instance = master->next; instance && instance->m_context == master; instance = instance->next) {
+        instanceCount++;
     }
+    OTRConversationState *state = [[OTRConversationState alloc] initWithUsername:username
+                                                                     accountName:accountName
+                                                                        protocol:protocol
+                                                                    messageState:[[self class] messageStateForContext:context]
+                                                                     fingerprint:[self fingerprintForInternalFingerprint:context->active_fingerprint]
+                                                                   instanceCount:instanceCount];
+    NSString *key = [[self class] contextKeyForUsername:context->username accountName:context->accountname protocol:context->protocol];
+    pthread_mutex_lock(&_conversationStatesLock);
+    [self.conversationStates setObject:state forKey:key];
+    pthread_mutex_unlock(&_conversationStatesLock);
+}
+
+/** Must be called on internalQueue */
+- (void) unpublishConversationStateForContextKey:(NSString*)key {
+    pthread_mutex_lock(&_conversationStatesLock);
+    [self.conversationStates removeObjectForKey:key];
+    pthread_mutex_unlock(&_conversationStatesLock);
+}
+
+/** Safe to call from any thread */
+- (nullable OTRConversationState*) publishedConversationStateForKey:(NSString*)key {
+    pthread_mutex_lock(&_conversationStatesLock);
+    OTRConversationState *state = [self.conversationStates objectForKey:key];
+    pthread_mutex_unlock(&_conversationStatesLock);
+    return state;
+}
+
+- (nullable OTRConversationState*) conversationStateForUsername:(NSString*)username
+                                                    accountName:(NSString*)accountName
+                                                       protocol:(NSString*)protocol {
+    NSString *key = [[self class] contextKeyForUsername:username.UTF8String accountName:accountName.UTF8String protocol:protocol.UTF8String];
+    return [self publishedConversationStateForKey:key];
+}
+
+- (NSArray<OTRConversationState*>*) allConversationStates {
+    pthread_mutex_lock(&_conversationStatesLock);
+    NSArray<OTRConversationState*> *states = self.conversationStates.allValues;
+    pthread_mutex_unlock(&_conversationStatesLock);
+    return states;
 }
 
 - (OTRKitMessageState)messageStateForUsername:(NSString*)username
@@ -1053,32 +2270,58 @@ static OtrlMessageAppOps ui_ops = {
     if (!username.length || !accountName.length || !protocol.length) {
         return OTRKitMessageStateUnknown;
     }
+    // Off the internal queue the published state will do, on it we may be in the middle of changing it
+    if (!dispatch_get_specific(IsOnInternalQueueKey)) {
+        OTRConversationState *state = [self conversationStateForUsername:username accountName:accountName protocol:protocol];
+        if (state) {
+            return state.messageState;
+        }
+    }
     __block OTRKitMessageState messageState = OTRKitMessageStateUnknown;
     [self performBlock:^{
         ConnContext *context = [self contextForUsername:username accountName:accountName protocol:protocol];
         if (context) {
-            switch (context->msgstate) {
-                case OTRL_MSGSTATE_ENCRYPTED:
-                    messageState = OTRKitMessageStateEncrypted;
-                    break;
-                case OTRL_MSGSTATE_FINISHED:
-                    messageState = OTRKitMessageStateFinished;
-                    break;
-                case OTRL_MSGSTATE_PLAINTEXT:
-                    messageState = OTRKitMessageStatePlaintext;
-                    break;
-                default:
-                    messageState = OTRKitMessageStateUnknown;
-                    break;
-            }
+            messageState = [[self class] messageStateForContext:context];
         }
     }];
     return messageState;
 }
 
++ (OTRKitMessageState) messageStateForContext:(ConnContext*)context {
+    switch (context->msgstate) {
+        case OTRL_MSGSTATE_ENCRYPTED:
+            return OTRKitMessageStateEncrypted;
+        case OTRL_MSGSTATE_FINISHED:
+            return OTRKitMessageStateFinished;
+        case OTRL_MSGSTATE_PLAINTEXT:
+            return OTRKitMessageStatePlaintext;
+        default:
+            return OTRKitMessageStateUnknown;
+    }
+}
+
 
 #pragma mark Internal Messing Methods
 
+/** Records activity on a master context for idle eviction */
+static void touch_context(ConnContext *context) {
+    if (!context->app_data) {
+        context->app_data = calloc(1, sizeof(OTRContextAppData));
+        context->app_data_free = free;
+        if (!context->app_data) {
+            return;
+        }
+    }
+    ((OTRContextAppData*)context->app_data)->lastActivity = CFAbsoluteTimeGetCurrent();
+}
+
+/** A context can't be evicted while it holds session keys, or an AKE or SMP is in flight */
+static BOOL is_context_busy(ConnContext *context) {
+    return context->msgstate == OTRL_MSGSTATE_ENCRYPTED ||
+    context->auth.authstate != OTRL_AUTHSTATE_NONE ||
+    (context->smstate && context->smstate->nextExpected != OTRL_SMP_EXPECT1);
+}
+
 - (nullable ConnContext*) rootContextForContext:(ConnContext*)context {
     // Get root context so fingerprint fetching is more useful
     NSParameterAssert(context != nil);
@@ -1106,25 +2349,417 @@ static OtrlMessageAppOps ui_ops = {
     if (!username_str || !account_str || !protocol_str) {
         return NULL;
     }
-    ConnContext *context = otrl_context_find(_userState, username_str, account_str, protocol_str, OTRL_INSTAG_BEST, YES, NULL, NULL, NULL);
+    int added = 0;
+    ConnContext *context = otrl_context_find(_userState, username_str, account_str, protocol_str, OTRL_INSTAG_BEST, YES, &added, NULL, NULL);
     NSParameterAssert(context != NULL);
+    if (!context) {
+        return NULL;
+    }
+    ConnContext *rootContext = [self rootContextForContext:context];
+    if (added) {
+        [self restoreEvictedFingerprintsForContext:rootContext];
+    }
+    touch_context(rootContext);
     return context;
 }
 
-#pragma mark OTR Policy
+#pragma mark Backpressure
 
--(OTRKitPolicy)otrPolicy {
-    __block OTRKitPolicy otrPolicy = OTRKitPolicyDefault;
+- (NSUInteger) queueDepth {
+    return atomic_load(&_queueDepth);
+}
+
+- (NSUInteger) maxInFlightOperations {
+    return atomic_load(&_maxInFlightOperations);
+}
+
+- (void) setMaxInFlightOperations:(NSUInteger)maxInFlightOperations {
+    atomic_store(&_maxInFlightOperations, maxInFlightOperations);
+    dispatch_async(self.admissionQueue, ^{
+        [self admitWaiters];
+    });
+}
+
+/** Called from any thread when an async operation is accepted */
+- (void) operationWillStart {
+    [self willChangeValueForKey:NSStringFromSelector(@selector(queueDepth))];
+    atomic_fetch_add(&_queueDepth, 1);
+    [self didChangeValueForKey:NSStringFromSelector(@selector(queueDepth))];
+}
+
+/** Called once the operation's completion has been delivered */
+- (void) operationDidFinish {
+    [self willChangeValueForKey:NSStringFromSelector(@selector(queueDepth))];
+    atomic_fetch_sub(&_queueDepth, 1);
+    [self didChangeValueForKey:NSStringFromSelector(@selector(queueDepth))];
+    dispatch_async(self.admissionQueue, ^{
+        [self admitWaiters];
+    });
+}
+
+- (BOOL) hasCapacity {
+    NSUInteger maxInFlightOperations = self.maxInFlightOperations;
+    return maxInFlightOperations == 0 || atomic_load(&_queueDepth) < maxInFlightOperations;
+}
+
+/** Interactive work is never shed, only deferred by callers via admission */
+- (BOOL) shouldShedWorkWithPriority:(OTRKitPriority)priority {
+    if (priority == OTRKitPriorityInteractive || !self.shedsNonInteractiveWork) {
+        return NO;
+    }
+    return ![self hasCapacity];
+}
+
+- (void) requestAdmissionWithCompletion:(dispatch_block_t)completion {
+    NSParameterAssert(completion != nil);
+    if (!completion) {
+        return;
+    }
+    dispatch_async(self.admissionQueue, ^{
+        [self.admissionWaiters addObject:completion];
+        [self admitWaiters];
+    });
+}
+
+/** Must be called on admissionQueue. Admits one waiter per free slot. */
+- (void) admitWaiters {
+    if (!self.admissionWaiters.count) {
+        return;
+    }
+    NSUInteger maxInFlightOperations = self.maxInFlightOperations;
+    NSUInteger queueDepth = atomic_load(&_queueDepth);
+    NSUInteger freeSlots = self.admissionWaiters.count;
+    if (maxInFlightOperations > 0) {
+        freeSlots = queueDepth < maxInFlightOperations ? maxInFlightOperations - queueDepth : 0;
+    }
+    NSUInteger admitCount = MIN(freeSlots, self.admissionWaiters.count);
+    if (!admitCount) {
+        return;
+    }
+    NSArray<dispatch_block_t> *admitted = [self.admissionWaiters subarrayWithRange:NSMakeRange(0, admitCount)];
+    [self.admissionWaiters removeObjectsInRange:NSMakeRange(0, admitCount)];
+    [self deliverCallback:^{
+        for (dispatch_block_t completion in admitted) {
+            completion();
+        }
+    }];
+}
+
+#pragma mark Memory Management
+
+- (NSTimeInterval) contextIdleTimeout {
+    __block NSTimeInterval contextIdleTimeout = 0;
     [self performBlock:^{
-        otrPolicy = self->_otrPolicy;
+        contextIdleTimeout = self->_contextIdleTimeout;
     }];
-    return otrPolicy;
+    return contextIdleTimeout;
 }
 
-- (void) setOtrPolicy:(OTRKitPolicy)otrPolicy {
+- (void) setContextIdleTimeout:(NSTimeInterval)contextIdleTimeout {
     [self performBlockAsync:^{
-        self->_otrPolicy = otrPolicy;
+        self->_contextIdleTimeout = contextIdleTimeout;
     }];
+    NSTimeInterval evictionPollInterval = 0;
+    if (contextIdleTimeout > 0) {
+        evictionPollInterval = MIN(contextIdleTimeout, kOTRKitEvictionPollInterval);
+    }
+    dispatch_async(dispatch_get_main_queue(), ^{
+        self.evictionPollInterval = evictionPollInterval;
+        [self schedulePollTimer];
+    });
+}
+
++ (NSString*) contextKeyForUsername:(const char*)username accountName:(const char*)accountName protocol:(const char*)protocol {
+    return [NSString stringWithFormat:@"%s\n%s\n%s", username, accountName, protocol];
+}
+
+- (NSUInteger) evictIdleContexts {
+    __block NSUInteger evictedCount = 0;
+    [self performBlock:^{
+        NSTimeInterval idleTimeout = self->_contextIdleTimeout;
+        if (idleTimeout <= 0 || !self->_userState) {
+            return;
+        }
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        
+        // Any busy instance pins its master context
+        NSMutableSet<NSValue*> *busyMasters = [NSMutableSet set];
+        for (ConnContext *context = self->_userState->context_root; context; context = context->next) {
+            if (is_context_busy(context) || [self.pendingSMPContexts containsObject:[NSValue valueWithPointer:context]]) {
+                [busyMasters addObject:[NSValue valueWithPointer:context->m_context]];
+            }
+        }
+        NSMutableSet<NSValue*> *evictedMasters = [NSMutableSet set];
+        for (ConnContext *context = self->_userState->context_root; context; context = context->next) {
+            if (context->m_context != context) {
+                continue;
+            }
+            NSValue *master = [NSValue valueWithPointer:context];
+            if ([busyMasters containsObject:master]) {
+                continue;
+            }
+            OTRContextAppData *appData = context->app_data;
+            if (!appData) {
+                // Never touched by us, e.g. only read from the fingerprints file. Start the clock now.
+                touch_context(context);
+                continue;
+            }
+            if (now - appData->lastActivity < idleTimeout) {
+                continue;
+            }
+            [evictedMasters addObject:master];
+        }
+        if (!evictedMasters.count) {
+            return;
+        }
+        
+        // Forget instance contexts first, their active_fingerprint points into the master
+        ConnContext *context = self->_userState->context_root;
+        while (context) {
+            ConnContext *next = context->next;
+            if (context->m_context != context && [evictedMasters containsObject:[NSValue valueWithPointer:context->m_context]]) {
+                [self forgetSMPGenerationForContext:context];
+                otrl_context_forget(context);
+            }
+            context = next;
+        }
+        context = self->_userState->context_root;
+        while (context) {
+            ConnContext *next = context->next;
+            if ([evictedMasters containsObject:[NSValue valueWithPointer:context]]) {
+                // fingerprintIndex is all that's left of them once the context is gone
+                for (Fingerprint *fingerprint = context->fingerprint_root.next; fingerprint; fingerprint = fingerprint->next) {
+                    [self indexInternalFingerprint:fingerprint];
+                }
+                NSString *key = [[self class] contextKeyForUsername:context->username accountName:context->accountname protocol:context->protocol];
+                [self.deliveredMessageStates removeObjectForKey:key];
+                [self forgetTLVQueuesForContextKey:key];
+                [self unpublishConversationStateForContextKey:key];
+                [self resetReceivedSymmetricKeysForContext:context];
+                [self forgetSMPGenerationForContext:context];
+                otrl_context_forget(context);
+                evictedCount++;
+            }
+            context = next;
+        }
+    }];
+    return evictedCount;
+}
+
+/** Must be called from performBlock/performBlockAsync to schedule on internalQueue */
+- (void) restoreEvictedFingerprintsForContext:(ConnContext*)context {
+    OTRFingerprintQuery *query = [[OTRFingerprintQuery alloc] initWithAccountName:@(context->accountname) protocol:@(context->protocol) username:@(context->username) trustLevels:nil];
+    NSArray<OTRFingerprint*> *fingerprints = [self.fingerprintIndex fingerprintsMatchingQuery:query];
+    for (OTRFingerprint *fingerprint in fingerprints) {
+        Fingerprint *internalFingerprint = otrl_context_find_fingerprint(context, (unsigned char*)fingerprint.fingerprint.bytes, YES, NULL);
+        if (internalFingerprint) {
+            NSString *trustLevelString = [[self class] stringForTrustLevel:fingerprint.trustLevel];
+            otrl_context_set_trust(internalFingerprint, [trustLevelString UTF8String]);
+        }
+    }
+}
+
+- (OTRKitMemoryReport*) memoryReport {
+    __block NSUInteger masterContextCount = 0;
+    __block NSUInteger instanceContextCount = 0;
+    __block NSUInteger encryptedContextCount = 0;
+    __block NSUInteger fingerprintCount = 0;
+    __block NSUInteger evictedContextCount = 0;
+    __block NSUInteger evictedFingerprintCount = 0;
+    __block NSUInteger estimatedBytes = 0;
+    [self performBlock:^{
+        if (!self->_userState) {
+            return;
+        }
+        for (ConnContext *context = self->_userState->context_root; context; context = context->next) {
+            if (context->m_context == context) {
+                masterContextCount++;
+            } else {
+                instanceContextCount++;
+            }
+            estimatedBytes += sizeof(ConnContext) + sizeof(OTRContextAppData);
+            estimatedBytes += strlen(context->username) + strlen(context->accountname) + strlen(context->protocol) + 3;
+            if (context->msgstate == OTRL_MSGSTATE_ENCRYPTED) {
+                encryptedContextCount++;
+                estimatedBytes += kOTRKitEstimatedSessionKeyBytes;
+            }
+            if (context->smstate) {
+                estimatedBytes += sizeof(OtrlSMState);
+                if (context->smstate->nextExpected != OTRL_SMP_EXPECT1) {
+                    estimatedBytes += kOTRKitEstimatedSMPBytes;
+                }
+            }
+            for (Fingerprint *fingerprint = context->fingerprint_root.next; fingerprint; fingerprint = fingerprint->next) {
+                fingerprintCount++;
+                estimatedBytes += sizeof(Fingerprint) + kOTRKitFingerprintBytes;
+                if (fingerprint->trust) {
+                    estimatedBytes += strlen(fingerprint->trust) + 1;
+                }
+            }
+        }
+        NSMutableSet<NSString*> *evictedKeys = [NSMutableSet set];
+        [self enumerateEvictedFingerprintsUsingBlock:^(OTRFingerprint *fingerprint, NSString *key) {
+            [evictedKeys addObject:key];
+            evictedFingerprintCount++;
+        }];
+        evictedContextCount = evictedKeys.count;
+    }];
+    return [[OTRKitMemoryReport alloc] initWithMasterContextCount:masterContextCount instanceContextCount:instanceContextCount encryptedContextCount:encryptedContextCount fingerprintCount:fingerprintCount evictedContextCount:evictedContextCount evictedFingerprintCount:evictedFingerprintCount estimatedBytes:estimatedBytes];
+}
+
+#pragma mark Session Snapshots
+
+- (NSTimeInterval) sessionSnapshotInterval {
+    __block NSTimeInterval sessionSnapshotInterval = 0;
+    [self performBlock:^{
+        sessionSnapshotInterval = self->_sessionSnapshotInterval;
+    }];
+    return sessionSnapshotInterval;
+}
+
+- (void) setSessionSnapshotInterval:(NSTimeInterval)sessionSnapshotInterval {
+    [self performBlockAsync:^{
+        self->_sessionSnapshotInterval = sessionSnapshotInterval;
+        self->_lastSessionSnapshotTime = CFAbsoluteTimeGetCurrent();
+    }];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        self.sessionSnapshotPollInterval = MAX(sessionSnapshotInterval, 0);
+        [self schedulePollTimer];
+    });
+}
+
+/** Must be called from performBlock/performBlockAsync to schedule on internalQueue */
+- (NSArray<OTRSessionSnapshot*>*) currentSessionSnapshots {
+    NSMutableArray<OTRSessionSnapshot*> *snapshots = [NSMutableArray array];
+    for (ConnContext *context = self->_userState->context_root; context; context = context->next) {
+        OTRSessionSnapshot *snapshot = [[OTRSessionSnapshot alloc] initWithContext:context];
+        if (snapshot) {
+            [snapshots addObject:snapshot];
+        }
+    }
+    _sessionSnapshotSequence++;
+    return snapshots;
+}
+
+/** Must be called on snapshotQueue. Skips snapshots older than the one already written. */
+- (BOOL) writeSessionSnapshots:(NSArray<OTRSessionSnapshot*>*)snapshots sequence:(NSUInteger)sequence key:(NSData*)key error:(NSError**)error {
+    if (sequence <= _writtenSessionSnapshotSequence) {
+        return YES;
+    }
+    NSString *path = self.sessionSnapshotPath;
+    BOOL success = YES;
+    if (!snapshots.count) {
+        // Nothing to resume, don't leave old keys around
+        if ([[NSFileManager defaultManager] fileExistsAtPath:path]) {
+            success = [[NSFileManager defaultManager] removeItemAtPath:path error:error];
+        }
+    } else {
+        NSData *data = [OTRSessionSnapshot encryptedDataWithSnapshots:snapshots key:key error:error];
+        success = data && [data writeToFile:path options:NSDataWritingAtomic error:error];
+    }
+    if (success) {
+        _writtenSessionSnapshotSequence = sequence;
+    }
+    return success;
+}
+
+- (BOOL) writeSessionSnapshotWithError:(NSError**)error {
+    NSData *key = self.sessionSnapshotKey;
+    if (!key) {
+        if (error) {
+            *error = [OTRErrorUtility errorForGPGError:GPG_ERR_MISSING_KEY];
+        }
+        return NO;
+    }
+    __block NSArray<OTRSessionSnapshot*> *snapshots = nil;
+    __block NSUInteger sequence = 0;
+    [self performBlock:^{
+        if (!self->_userState) {
+            return;
+        }
+        snapshots = [self currentSessionSnapshots];
+        sequence = self->_sessionSnapshotSequence;
+    }];
+    if (!snapshots) {
+        return YES;
+    }
+    __block BOOL success = NO;
+    __block NSError *writeError = nil;
+    dispatch_sync(self.snapshotQueue, ^{
+        success = [self writeSessionSnapshots:snapshots sequence:sequence key:key error:&writeError];
+    });
+    if (error) {
+        *error = writeError;
+    }
+    return success;
+}
+
+/** Must be called from performBlock/performBlockAsync to schedule on internalQueue */
+- (void) writeSessionSnapshotIfDue {
+    NSData *key = self.sessionSnapshotKey;
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    if (!key || _sessionSnapshotInterval <= 0 || now - _lastSessionSnapshotTime < _sessionSnapshotInterval) {
+        return;
+    }
+    _lastSessionSnapshotTime = now;
+    NSArray<OTRSessionSnapshot*> *snapshots = [self currentSessionSnapshots];
+    NSUInteger sequence = _sessionSnapshotSequence;
+    dispatch_async(self.snapshotQueue, ^{
+        // Like the fingerprints file, a failed periodic write is tried again next time
+        [self writeSessionSnapshots:snapshots sequence:sequence key:key error:nil];
+    });
+}
+
+- (void) restoreSessionSnapshotWithCompletion:(nullable void (^)(NSArray<OTRSessionSnapshot*> *restoredSessions, NSError * _Nullable error))completion {
+    NSData *key = self.sessionSnapshotKey;
+    // Queued behind readLibotrConfiguration so keys, fingerprints and instance tags are loaded
+    [self performBlockAsync:^{
+        NSMutableArray<OTRSessionSnapshot*> *restoredSessions = [NSMutableArray array];
+        NSError *error = nil;
+        NSString *path = self.sessionSnapshotPath;
+        NSData *data = nil;
+        if (!key) {
+            error = [OTRErrorUtility errorForGPGError:GPG_ERR_MISSING_KEY];
+        } else if ([[NSFileManager defaultManager] fileExistsAtPath:path]) {
+            data = [NSData dataWithContentsOfFile:path options:0 error:&error];
+        }
+        NSArray<OTRSessionSnapshot*> *snapshots = nil;
+        if (data) {
+            snapshots = [OTRSessionSnapshot snapshotsWithEncryptedData:data key:key error:&error];
+        }
+        if (snapshots) {
+            // Restoring the same counters twice would reuse them
+            [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+        }
+        for (OTRSessionSnapshot *snapshot in snapshots) {
+            // Creates the master context and brings back evicted fingerprints first
+            if (![self contextForUsername:snapshot.username accountName:snapshot.accountName protocol:snapshot.protocol]) {
+                continue;
+            }
+            ConnContext *context = [snapshot restoreInUserState:self->_userState];
+            if (!context) {
+                continue;
+            }
+            [self indexInternalFingerprint:context->active_fingerprint];
+            [self updateEncryptionStatusWithContext:context];
+            [restoredSessions addObject:snapshot];
+        }
+        if (completion) {
+            [self deliverCallback:^{
+                completion(restoredSessions, error);
+            }];
+        }
+    }];
+}
+
+#pragma mark OTR Policy
+
+-(OTRKitPolicy)otrPolicy {
+    return atomic_load(&_otrPolicy);
+}
+
+- (void) setOtrPolicy:(OTRKitPolicy)otrPolicy {
+    atomic_store(&_otrPolicy, otrPolicy);
 }
 
 -(OtrlPolicy)otrlPolicy {
@@ -1153,20 +2788,38 @@ static OtrlMessageAppOps ui_ops = {
 #pragma mark Fingerprints
 
 - (NSArray<OTRFingerprint*>*) allFingerprints {
-    NSMutableArray<OTRFingerprint*> *allFingerprints = [NSMutableArray array];
-    [self performBlock:^{
-        ConnContext * context = self->_userState->context_root;
-        while (context) {
-            Fingerprint * fingerprint = context->fingerprint_root.next;
-            while (fingerprint) {
-                OTRFingerprint *otrFingerprint = [self fingerprintForInternalFingerprint:fingerprint];
-                [allFingerprints addObject:otrFingerprint];
-                fingerprint = fingerprint->next;
-            }
-            context = context->next;
-        }
-    }];
-    return allFingerprints;
+    [self waitForFingerprintIndex];
+    return [self.fingerprintIndex fingerprintsMatchingQuery:[[OTRFingerprintQuery alloc] init]];
+}
+
+- (NSArray<OTRFingerprint*>*) fingerprintsWithData:(NSData*)fingerprintData {
+    NSParameterAssert(fingerprintData != nil);
+    if (!fingerprintData) {
+        return @[];
+    }
+    [self waitForFingerprintIndex];
+    return [self.fingerprintIndex fingerprintsWithData:fingerprintData];
+}
+
+- (NSUInteger) countOfFingerprintsMatchingQuery:(OTRFingerprintQuery*)query {
+    NSParameterAssert(query != nil);
+    if (!query) {
+        return 0;
+    }
+    [self waitForFingerprintIndex];
+    return [self.fingerprintIndex countOfFingerprintsMatchingQuery:query];
+}
+
+- (void) enumerateFingerprintsMatchingQuery:(OTRFingerprintQuery*)query
+                                   pageSize:(NSUInteger)pageSize
+                                 usingBlock:(void (^)(NSArray<OTRFingerprint*> *page, BOOL *stop))block {
+    NSParameterAssert(query != nil);
+    NSParameterAssert(block != nil);
+    if (!query || !block) {
+        return;
+    }
+    [self waitForFingerprintIndex];
+    [self.fingerprintIndex enumerateFingerprintsMatchingQuery:query pageSize:pageSize usingBlock:block];
 }
 
 /** Synchronously fetches your own fingerprint. */
@@ -1218,6 +2871,12 @@ static OtrlMessageAppOps ui_ops = {
 - (nullable OTRFingerprint*)activeFingerprintForUsername:(NSString*)username
                                              accountName:(NSString*)accountName
                                                 protocol:(NSString*)protocol {
+    if (!dispatch_get_specific(IsOnInternalQueueKey)) {
+        OTRConversationState *state = [self conversationStateForUsername:username accountName:accountName protocol:protocol];
+        if (state) {
+            return state.fingerprint;
+        }
+    }
     __block OTRFingerprint *fingerprint = nil;
     [self performBlock:^{
         Fingerprint * rawFingerprint = [self internalActiveFingerprintForUsername:username accountName:accountName protocol:protocol];
@@ -1244,7 +2903,12 @@ static OtrlMessageAppOps ui_ops = {
         if (internalFingerprint)
         {
             otrl_context_set_trust(internalFingerprint, newTrust);
+            [self indexInternalFingerprint:internalFingerprint];
             [self writeFingerprints];
+            NSString *key = [[self class] contextKeyForUsername:username.UTF8String accountName:accountName.UTF8String protocol:protocol.UTF8String];
+            if ([self publishedConversationStateForKey:key]) {
+                [self publishConversationStateForUsername:username accountName:accountName protocol:protocol];
+            }
         }
     }];
 }
@@ -1261,8 +2925,12 @@ static OtrlMessageAppOps ui_ops = {
     [self performBlock:^{
         Fingerprint * targetFingerprint = [self internalFingerprintForUsername:username accountName:accountName protocol:protocol fingerprintData:fingerprintData];
         if (targetFingerprint) {
+            ConnContext *context = targetFingerprint->context;
             //will not delete if it is the active fingerprint;
             otrl_context_forget_fingerprint(targetFingerprint, 0);
+            if (!otrl_context_find_fingerprint(context, (unsigned char*)fingerprintData.bytes, 0, NULL)) {
+                [self.fingerprintIndex removeFingerprint:fingerprint];
+            }
             [self writeFingerprints];
             result = YES;
         } else {
@@ -1283,15 +2951,43 @@ static OtrlMessageAppOps ui_ops = {
     if (!fingerprint) { return NO; }
     __block BOOL trust = NO;
     if ([self.delegate respondsToSelector:@selector(otrKit:evaluateTrustForFingerprint:)]) {
-        dispatch_sync(self.callbackQueue, ^{
+        [self deliverCallbackAndWait:^{
             trust = [self.delegate otrKit:self evaluateTrustForFingerprint:fingerprint];
-        });
+        }];
     } else {
         trust = fingerprint.isTrusted;
     }
     return trust;
 }
 
+/**
+ *  Batch version of checkTrustForFingerprint: that evaluates every fingerprint
+ *  in a single hop to the callbackQueue, or none when inline. NSNull entries (no active session) are always trusted.
+ */
+- (NSArray<NSNumber*>*) checkTrustForFingerprints:(NSArray*)fingerprints {
+    NSMutableArray<NSNumber*> *trust = [NSMutableArray arrayWithCapacity:fingerprints.count];
+    BOOL delegateEvaluatesTrust = [self.delegate respondsToSelector:@selector(otrKit:evaluateTrustForFingerprint:)];
+    dispatch_block_t evaluateBlock = ^{
+        for (id fingerprint in fingerprints) {
+            BOOL trusted = YES;
+            if ([fingerprint isKindOfClass:[OTRFingerprint class]]) {
+                if (delegateEvaluatesTrust) {
+                    trusted = [self.delegate otrKit:self evaluateTrustForFingerprint:fingerprint];
+                } else {
+                    trusted = [fingerprint isTrusted];
+                }
+            }
+            [trust addObject:@(trusted)];
+        }
+    };
+    if (delegateEvaluatesTrust) {
+        [self deliverCallbackAndWait:evaluateBlock];
+    } else {
+        evaluateBlock();
+    }
+    return trust;
+}
+
 - (nullable OTRFingerprint*)fingerprintForInternalFingerprint:(Fingerprint*)fingerprint {
     if (!fingerprint ||
         !fingerprint->context ||
@@ -1360,19 +3056,83 @@ static OtrlMessageAppOps ui_ops = {
 }
 
 /** 
- * Enumerates over all fingerprints until it gets to one where teh fingerprint data matches.
+ * Finds the fingerprint on the user's root context whose bytes match, without copying each candidate.
  * Must be called from performBlock/performBlockAsync to schedule on internalQueue 
  */
 - (nullable Fingerprint *)internalFingerprintForUsername:(NSString*)username accountName:(NSString*)accountName protocol:(NSString*) protocol fingerprintData:(NSData *)fingerprintData {
-    __block Fingerprint * finalFingerprint = nil;
-    [self enumerateInternalFingerprintsForUsername:username accountName:accountName protocol:protocol block:^(Fingerprint *fingerprint, BOOL *stop) {
-        NSData *internalData = [NSData dataWithBytes:fingerprint->fingerprint length:kOTRKitFingerprintBytes];
-        if ([internalData isEqual:fingerprintData]) {
-            *stop = YES;
-            finalFingerprint = fingerprint;
+    if (fingerprintData.length != kOTRKitFingerprintBytes) {
+        return NULL;
+    }
+    ConnContext *context = [self contextForUsername:username accountName:accountName protocol:protocol];
+    if (!context) {
+        return NULL;
+    }
+    return otrl_context_find_fingerprint([self rootContextForContext:context], (unsigned char*)fingerprintData.bytes, 0, NULL);
+}
+
+/** Must be called on internalQueue. Mirrors a libotr fingerprint into fingerprintIndex. */
+- (void) indexInternalFingerprint:(nullable Fingerprint*)fingerprint {
+    if (!fingerprint) {
+        return;
+    }
+    OTRFingerprint *otrFingerprint = [self fingerprintForInternalFingerprint:fingerprint];
+    if (otrFingerprint) {
+        [self.fingerprintIndex saveFingerprint:otrFingerprint];
+    }
+}
+
+- (void) reindexFingerprintsForContext:(ConnContext*)context {
+    ConnContext *master = context->m_context;
+    for (Fingerprint *fingerprint = master->fingerprint_root.next; fingerprint; fingerprint = fingerprint->next) {
+        [self indexInternalFingerprint:fingerprint];
+    }
+    NSString *key = [[self class] contextKeyForUsername:master->username accountName:master->accountname protocol:master->protocol];
+    if ([self publishedConversationStateForKey:key]) {
+        [self publishConversationStateForUsername:@(master->username) accountName:@(master->accountname) protocol:@(master->protocol)];
+    }
+}
+
+/** Must be called on internalQueue */
+- (void) rebuildFingerprintIndex {
+    NSMutableArray<OTRFingerprint*> *allFingerprints = [NSMutableArray array];
+    for (ConnContext *context = _userState->context_root; context; context = context->next) {
+        for (Fingerprint *fingerprint = context->fingerprint_root.next; fingerprint; fingerprint = fingerprint->next) {
+            OTRFingerprint *otrFingerprint = [self fingerprintForInternalFingerprint:fingerprint];
+            if (otrFingerprint) {
+                [allFingerprints addObject:otrFingerprint];
+            }
+        }
+    }
+    [self.fingerprintIndex resetWithFingerprints:allFingerprints];
+}
+
+/**
+ *  Must be called on internalQueue. Calls block with every indexed fingerprint that has no
+ *  context in userState, along with its contextKeyForUsername:accountName:protocol:
+ */
+- (void) enumerateEvictedFingerprintsUsingBlock:(void (^)(OTRFingerprint *fingerprint, NSString *key))block {
+    NSMutableSet<NSString*> *liveKeys = [NSMutableSet set];
+    for (ConnContext *context = _userState->context_root; context; context = context->next) {
+        if (context->m_context == context) {
+            [liveKeys addObject:[[self class] contextKeyForUsername:context->username accountName:context->accountname protocol:context->protocol]];
+        }
+    }
+    [self.fingerprintIndex enumerateFingerprintsMatchingQuery:[[OTRFingerprintQuery alloc] init] pageSize:kOTRKitFingerprintPageSize usingBlock:^(NSArray<OTRFingerprint*> *page, BOOL *stop) {
+        for (OTRFingerprint *fingerprint in page) {
+            NSString *key = [[self class] contextKeyForUsername:fingerprint.username.UTF8String accountName:fingerprint.accountName.UTF8String protocol:fingerprint.protocol.UTF8String];
+            if (![liveKeys containsObject:key]) {
+                block(fingerprint, key);
+            }
         }
     }];
-    return finalFingerprint;
+}
+
+/** The index is filled in asynchronously on startup, this waits for that once */
+- (void) waitForFingerprintIndex {
+    if (atomic_load(&_fingerprintIndexLoaded)) {
+        return;
+    }
+    [self performBlock:^{}];
 }
 
 /** Must be called from performBlock/performBlockAsync to schedule on internalQueue */
@@ -1383,6 +3143,10 @@ static OtrlMessageAppOps ui_ops = {
     storef = fopen([path UTF8String], "wb");
     if (!storef) return;
     otrl_privkey_write_fingerprints_FILEp(_userState, storef);
+    // Evicted contexts are no longer in the userState, so append their fingerprints in the same format
+    [self enumerateEvictedFingerprintsUsingBlock:^(OTRFingerprint *fingerprint, NSString *key) {
+        fprintf(storef, "%s\t%s\t%s\t%s\t%s\n", [fingerprint.username UTF8String], [fingerprint.accountName UTF8String], [fingerprint.protocol UTF8String], [[fingerprint.fingerprint otr_hexString] UTF8String], [[[self class] stringForTrustLevel:fingerprint.trustLevel] UTF8String]);
+    }];
     fclose(storef);
 }
 
@@ -1447,6 +3211,157 @@ static OtrlMessageAppOps ui_ops = {
     return keyData;
 }
 
+- (nullable NSData*) requestSymmetricKeyForUsername:(NSString*)username
+                                        accountName:(NSString*)accountName
+                                           protocol:(NSString*)protocol
+                                            forUses:(NSArray<OTRSymmetricKeyUse*>*)uses
+                                              error:(NSError**)error {
+    NSParameterAssert(accountName != nil);
+    NSParameterAssert(protocol != nil);
+    NSParameterAssert(username != nil);
+    NSParameterAssert(uses.count > 0);
+    NSMutableArray<OTRTLV*> *tlvs = [NSMutableArray arrayWithCapacity:uses.count];
+    for (OTRSymmetricKeyUse *use in uses) {
+        OTRTLV *tlv = [[OTRTLV alloc] initWithType:OTRTLVTypeSymmetricKey data:[[self class] symmetricKeyTLVDataForUse:use.use useData:use.useData]];
+        if (!tlv) {
+            break;
+        }
+        [tlvs addObject:tlv];
+    }
+    if (!accountName || !protocol || !username || !uses.count || tlvs.count != uses.count) {
+        if (error) {
+            *error = [OTRErrorUtility errorForGPGError:GPG_ERR_INV_PARAMETER];
+        }
+        return nil;
+    }
+    __block NSData *keyData = nil;
+    __block NSError *outError = nil;
+    [self performBlock:^{
+        ConnContext *context = [self contextForUsername:username accountName:accountName protocol:protocol];
+        if (!context) {
+            outError = [OTRErrorUtility errorForGPGError:GPG_ERR_INV_PARAMETER];
+            return;
+        }
+        // Same checks and key as otrl_message_symkey, but every use goes out in one message
+        if (context->msgstate != OTRL_MSGSTATE_ENCRYPTED || context->context_priv->their_keyid == 0) {
+            outError = [OTRErrorUtility errorForGPGError:GPG_ERR_INV_VALUE];
+            return;
+        }
+        NSData *symmetricKey = [NSData dataWithBytes:context->context_priv->sesskeys[1][0].extrakey length:OTRL_EXTRAKEY_BYTES];
+        OtrlTLV *otr_tlvs = [[self class] tlvChainForTLVs:tlvs];
+        OTROpData *opdata = [[OTROpData alloc] initWithOTRKit:self tag:nil];
+        // Like otrl_message_symkey, flagged so a peer that can't decrypt it doesn't report an unreadable message
+        char *newmessage = NULL;
+        gcry_error_t err = otrl_proto_create_data(&newmessage, context, "", otr_tlvs, OTRL_MSGFLAGS_IGNORE_UNREADABLE, NULL);
+        otrl_tlv_free(otr_tlvs);
+        if (!err) {
+            err = otrl_message_fragment_and_send(&ui_ops, (__bridge void *)(opdata), context, newmessage, OTRL_FRAGMENT_SEND_ALL, NULL);
+        }
+        free(newmessage);
+        if (err != gcry_err_code(GPG_ERR_NO_ERROR)) {
+            outError = [OTRErrorUtility errorForGPGError:err];
+            return;
+        }
+        keyData = symmetricKey;
+    }];
+    if (error) {
+        *error = outError;
+    }
+    return keyData;
+}
+
+- (nullable NSData*) receivedSymmetricKeyForUsername:(NSString*)username
+                                         accountName:(NSString*)accountName
+                                            protocol:(NSString*)protocol
+                                              forUse:(NSUInteger)use
+                                             useData:(nullable NSData*)useData {
+    NSParameterAssert(accountName != nil);
+    NSParameterAssert(protocol != nil);
+    NSParameterAssert(username != nil);
+    if (!accountName || !protocol || !username) {
+        return nil;
+    }
+    NSString *key = [[self class] contextKeyForUsername:username.UTF8String accountName:accountName.UTF8String protocol:protocol.UTF8String];
+    NSData *useKey = [[self class] symmetricKeyTLVDataForUse:use useData:useData];
+    __block NSData *symmetricKey = nil;
+    dispatch_sync(self.symmetricKeyQueue, ^{
+        symmetricKey = [[self.receivedSymmetricKeys objectForKey:key].keys objectForKey:useKey];
+    });
+    return symmetricKey;
+}
+
+/** Body of a symmetric key TLV, a 4 byte big-endian use followed by useData */
++ (NSData*) symmetricKeyTLVDataForUse:(NSUInteger)use useData:(nullable NSData*)useData {
+    uint32_t useBytes = CFSwapInt32HostToBig((uint32_t)use);
+    NSMutableData *data = [NSMutableData dataWithCapacity:sizeof(useBytes) + useData.length];
+    [data appendBytes:&useBytes length:sizeof(useBytes)];
+    if (useData) {
+        [data appendData:useData];
+    }
+    return data;
+}
+
+/** Caches a key announced by the buddy and tells the delegate. Must be called on internalQueue */
+- (void) receivedSymmetricKey:(NSData*)symmetricKey forUse:(NSUInteger)use useData:(NSData*)useData context:(ConnContext*)context {
+    NSString *username = [NSString stringWithUTF8String:context->username];
+    NSString *accountName = [NSString stringWithUTF8String:context->accountname];
+    NSString *protocol = [NSString stringWithUTF8String:context->protocol];
+    NSString *key = [[self class] contextKeyForUsername:context->username accountName:context->accountname protocol:context->protocol];
+    NSData *useKey = [[self class] symmetricKeyTLVDataForUse:use useData:useData];
+    dispatch_sync(self.symmetricKeyQueue, ^{
+        OTRReceivedSymmetricKeys *sessionKeys = [self.receivedSymmetricKeys objectForKey:key];
+        if (!sessionKeys) {
+            sessionKeys = [[OTRReceivedSymmetricKeys alloc] init];
+            [self.receivedSymmetricKeys setObject:sessionKeys forKey:key];
+        }
+        if (![sessionKeys.keys objectForKey:useKey]) {
+            [sessionKeys.order addObject:useKey];
+        }
+        [sessionKeys.keys setObject:symmetricKey forKey:useKey];
+        while (sessionKeys.order.count > kOTRKitMaxReceivedSymmetricKeys) {
+            [sessionKeys.keys removeObjectForKey:sessionKeys.order.firstObject];
+            [sessionKeys.order removeObjectAtIndex:0];
+        }
+    });
+    if ([self.delegate respondsToSelector:@selector(otrKit:receivedSymmetricKey:forUse:useData:username:accountName:protocol:)]) {
+        [self deliverCallback:^{
+            [self.delegate otrKit:self receivedSymmetricKey:symmetricKey forUse:use useData:useData username:username accountName:accountName protocol:protocol];
+        }];
+    }
+}
+
+/**
+ *  libotr only reports the first symmetric key TLV in a message. Any others came from a
+ *  batch request and share its key. Must be called on internalQueue
+ */
+- (void) receivedBatchedSymmetricKeyTLVs:(NSArray<OTRTLV*>*)tlvs symmetricKey:(NSData*)symmetricKey context:(ConnContext*)context {
+    BOOL reportedByLibotr = NO;
+    for (OTRTLV *tlv in tlvs) {
+        if (tlv.type != OTRTLVTypeSymmetricKey) {
+            continue;
+        }
+        if (!reportedByLibotr) {
+            reportedByLibotr = YES;
+            continue;
+        }
+        if (tlv.data.length < sizeof(uint32_t)) {
+            continue;
+        }
+        uint32_t useBytes = 0;
+        [tlv.data getBytes:&useBytes length:sizeof(useBytes)];
+        NSData *useData = [tlv.data subdataWithRange:NSMakeRange(sizeof(useBytes), tlv.data.length - sizeof(useBytes))];
+        [self receivedSymmetricKey:symmetricKey forUse:CFSwapInt32BigToHost(useBytes) useData:useData context:context];
+    }
+}
+
+/** Keys from the buddy are only good for the session they arrived in. Must be called on internalQueue */
+- (void) resetReceivedSymmetricKeysForContext:(ConnContext*)context {
+    NSString *key = [[self class] contextKeyForUsername:context->username accountName:context->accountname protocol:context->protocol];
+    dispatch_sync(self.symmetricKeyQueue, ^{
+        [self.receivedSymmetricKeys removeObjectForKey:key];
+    });
+}
+
 #pragma mark SMP
 
 - (void) initiateSMPForUsername:(NSString*)username
@@ -1465,7 +3380,7 @@ static OtrlMessageAppOps ui_ops = {
         if (!context) {
             return;
         }
-        otrl_message_initiate_smp(self.userState, &ui_ops, NULL, context, (const unsigned char*)[secret UTF8String], [secret lengthOfBytesUsingEncoding:NSUTF8StringEncoding]);
+        [self startSMPStep:OTRSMPStepInitiate context:context secret:secret question:nil];
     }];
 }
 
@@ -1487,7 +3402,7 @@ static OtrlMessageAppOps ui_ops = {
         if (!context) {
             return;
         }
-        otrl_message_initiate_smp_q(self.userState, &ui_ops, NULL, context, [question UTF8String], (const unsigned char*)[secret UTF8String], [secret lengthOfBytesUsingEncoding:NSUTF8StringEncoding]);
+        [self startSMPStep:OTRSMPStepInitiate context:context secret:secret question:question];
     }];
 }
 
@@ -1507,24 +3422,374 @@ static OtrlMessageAppOps ui_ops = {
         if (!context) {
             return;
         }
-        otrl_message_respond_smp(self.userState, &ui_ops, NULL, context, (const unsigned char*)[secret UTF8String], [secret lengthOfBytesUsingEncoding:NSUTF8StringEncoding]);
+        [self startSMPStep:OTRSMPStepRespond context:context secret:secret question:nil];
     }];
 }
 
+/** Must be called on internalQueue. Starts SMP or answers a request, like otrl_message_initiate_smp_q and otrl_message_respond_smp. */
+- (void) startSMPStep:(OTRSMPStep)step context:(ConnContext*)context secret:(NSString*)secret question:(nullable NSString*)question {
+    if (context->msgstate != OTRL_MSGSTATE_ENCRYPTED) {
+        return;
+    }
+    NSData *combinedSecret = [self combinedSMPSecret:secret context:context initiating:step == OTRSMPStepInitiate];
+    if (!combinedSecret) {
+        return;
+    }
+    [self runSMPStep:step context:context input:combinedSecret question:question];
+}
+
+/** Must be called on internalQueue. The secret both sides feed into SMP, hashed the way libotr does so either end can be stock libotr. */
+- (nullable NSData*) combinedSMPSecret:(NSString*)secret context:(ConnContext*)context initiating:(BOOL)initiating {
+    if (!context->active_fingerprint) {
+        return nil;
+    }
+    unsigned char ourFingerprint[kOTRKitFingerprintBytes];
+    if (!otrl_privkey_fingerprint_raw(_userState, ourFingerprint, context->accountname, context->protocol)) {
+        return nil;
+    }
+    NSData *secretData = [secret dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableData *buffer = [NSMutableData dataWithCapacity:1 + 2 * kOTRKitFingerprintBytes + context->sessionid_len + secretData.length];
+    const uint8_t version = 1;
+    [buffer appendBytes:&version length:sizeof(version)];
+    if (initiating) {
+        [buffer appendBytes:ourFingerprint length:kOTRKitFingerprintBytes];
+        [buffer appendBytes:context->active_fingerprint->fingerprint length:kOTRKitFingerprintBytes];
+    } else {
+        [buffer appendBytes:context->active_fingerprint->fingerprint length:kOTRKitFingerprintBytes];
+        [buffer appendBytes:ourFingerprint length:kOTRKitFingerprintBytes];
+    }
+    [buffer appendBytes:context->sessionid length:context->sessionid_len];
+    [buffer appendData:secretData];
+    NSMutableData *combinedSecret = [NSMutableData dataWithLength:SM_DIGEST_SIZE];
+    gcry_md_hash_buffer(SM_HASH_ALGORITHM, combinedSecret.mutableBytes, buffer.bytes, buffer.length);
+    return combinedSecret;
+}
+
+- (void) handleSMPTLVs:(OtrlTLV*)tlvs context:(ConnContext*)context opdata:(void*)opdata {
+    NextExpectedSMP nextExpected = context->smstate->nextExpected;
+    OtrlTLV *tlv = otrl_tlv_find(tlvs, OTRL_TLV_SMP1Q);
+    if (tlv) {
+        // The question runs up to the first NUL, the SMP1 message follows it
+        const unsigned char *questionEnd = tlv->len ? memchr(tlv->data, '\0', tlv->len - 1) : NULL;
+        if (nextExpected == OTRL_SMP_EXPECT1 && questionEnd) {
+            NSUInteger questionLength = questionEnd - tlv->data;
+            NSString *question = [[NSString alloc] initWithBytes:tlv->data length:questionLength encoding:NSUTF8StringEncoding] ?: @"";
+            NSData *input = [NSData dataWithBytes:questionEnd + 1 length:tlv->len - questionLength - 1];
+            [self runSMPStep:OTRSMPStepReceiveRequest context:context input:input question:question];
+        } else {
+            handle_smp_event_cb(opdata, OTRL_SMPEVENT_ERROR, context, 0, NULL);
+        }
+    }
+    tlv = otrl_tlv_find(tlvs, OTRL_TLV_SMP1);
+    if (tlv) {
+        if (nextExpected == OTRL_SMP_EXPECT1) {
+            [self runSMPStep:OTRSMPStepReceiveRequest context:context input:[NSData dataWithBytes:tlv->data length:tlv->len] question:nil];
+        } else {
+            handle_smp_event_cb(opdata, OTRL_SMPEVENT_ERROR, context, 0, NULL);
+        }
+    }
+    tlv = otrl_tlv_find(tlvs, OTRL_TLV_SMP2);
+    if (tlv) {
+        if (nextExpected == OTRL_SMP_EXPECT2) {
+            [self runSMPStep:OTRSMPStepReceiveResponse context:context input:[NSData dataWithBytes:tlv->data length:tlv->len] question:nil];
+        } else {
+            handle_smp_event_cb(opdata, OTRL_SMPEVENT_ERROR, context, 0, NULL);
+        }
+    }
+    tlv = otrl_tlv_find(tlvs, OTRL_TLV_SMP3);
+    if (tlv) {
+        if (nextExpected == OTRL_SMP_EXPECT3) {
+            [self runSMPStep:OTRSMPStepReceiveConfirmation context:context input:[NSData dataWithBytes:tlv->data length:tlv->len] question:nil];
+        } else {
+            handle_smp_event_cb(opdata, OTRL_SMPEVENT_ERROR, context, 0, NULL);
+        }
+    }
+    tlv = otrl_tlv_find(tlvs, OTRL_TLV_SMP4);
+    if (tlv) {
+        if (nextExpected == OTRL_SMP_EXPECT4) {
+            [self runSMPStep:OTRSMPStepReceiveFinal context:context input:[NSData dataWithBytes:tlv->data length:tlv->len] question:nil];
+        } else {
+            handle_smp_event_cb(opdata, OTRL_SMPEVENT_ERROR, context, 0, NULL);
+        }
+    }
+    tlv = otrl_tlv_find(tlvs, OTRL_TLV_SMP_ABORT);
+    if (tlv) {
+        [self bumpSMPGenerationForContext:context];
+        context->smstate->nextExpected = OTRL_SMP_EXPECT1;
+        context->smstate->sm_prog_state = OTRL_SMP_PROG_OK;
+        handle_smp_event_cb(opdata, OTRL_SMPEVENT_ABORT, context, 0, NULL);
+    }
+}
+
+- (void) abortSMPForContext:(ConnContext*)context opdata:(void*)opdata {
+    [self bumpSMPGenerationForContext:context];
+    otrl_message_abort_smp(_userState, &ui_ops, opdata, context);
+}
+
+/** Must be called on internalQueue */
+- (NSUInteger) bumpSMPGenerationForContext:(ConnContext*)context {
+    // Unique across contexts, so a forgotten entry can't come back with a stale step's value
+    NSUInteger generation = ++_lastSMPGeneration;
+    [self.smpGenerations setObject:@(generation) forKey:[NSValue valueWithPointer:context]];
+    return generation;
+}
+
+- (void) forgetSMPGenerationForContext:(ConnContext*)context {
+    [self.smpGenerations removeObjectForKey:[NSValue valueWithPointer:context]];
+}
+
+/**
+ *  Must be called on internalQueue. Copies the context's SMP state, runs step on smpQueue, then
+ *  comes back to internalQueue to swap the new state in and send or report the result. The result is
+ *  dropped if the context left the session or had SMP aborted, finished or restarted meanwhile.
+ */
+- (void) runSMPStep:(OTRSMPStep)step context:(ConnContext*)context input:(NSData*)input question:(nullable NSString*)question {
+    NSValue *key = [NSValue valueWithPointer:context];
+    NSNumber *currentGeneration = [self.smpGenerations objectForKey:key];
+    // Initiating starts over, so anything still on smpQueue is stale
+    NSUInteger generation = (step == OTRSMPStepInitiate || !currentGeneration) ? [self bumpSMPGenerationForContext:context] : currentGeneration.unsignedIntegerValue;
+    NSData *sessionId = [NSData dataWithBytes:context->sessionid length:context->sessionid_len];
+    OtrlSMState *state = step == OTRSMPStepInitiate ? smp_state_create() : smp_state_copy(context->smstate);
+    if (!state) {
+        return;
+    }
+    BOOL receivedQuestion = question != nil;
+    [self.pendingSMPContexts addObject:key];
+    dispatch_async(self.smpQueue, ^{
+        unsigned char *output = NULL;
+        int outputLength = 0;
+        const unsigned char *bytes = input.bytes;
+        int length = (int)input.length;
+        gcry_error_t error = gcry_error(GPG_ERR_NO_ERROR);
+        switch (step) {
+            case OTRSMPStepInitiate:
+                error = otrl_sm_step1(state, bytes, length, &output, &outputLength);
+                break;
+            case OTRSMPStepReceiveRequest:
+                error = otrl_sm_step2a(state, bytes, length, receivedQuestion);
+                break;
+            case OTRSMPStepRespond:
+                error = otrl_sm_step2b(state, bytes, length, &output, &outputLength);
+                break;
+            case OTRSMPStepReceiveResponse:
+                error = otrl_sm_step3(state, bytes, length, &output, &outputLength);
+                break;
+            case OTRSMPStepReceiveConfirmation:
+                error = otrl_sm_step4(state, bytes, length, &output, &outputLength);
+                break;
+            case OTRSMPStepReceiveFinal:
+                error = otrl_sm_step5(state, bytes, length);
+                break;
+        }
+        NSData *outputData = output ? [NSData dataWithBytesNoCopy:output length:outputLength freeWhenDone:YES] : nil;
+        [self performBlockAsync:^{
+            [self.pendingSMPContexts removeObject:key];
+            // Contexts in pendingSMPContexts aren't evicted, and eviction is the only place they're freed
+            BOOL current = context->msgstate == OTRL_MSGSTATE_ENCRYPTED &&
+            [sessionId isEqualToData:[NSData dataWithBytes:context->sessionid length:context->sessionid_len]] &&
+            [[self.smpGenerations objectForKey:key] unsignedIntegerValue] == generation;
+            if (!current) {
+                smp_state_release(state);
+                return;
+            }
+            [self bumpSMPGenerationForContext:context];
+            smp_state_move(context->smstate, state);
+            [self finishSMPStep:step context:context error:error output:outputData question:question];
+        }];
+    });
+}
+
+/** Must be called on internalQueue once step's state is in the context. Sends the next message and reports progress like libotr. */
+- (void) finishSMPStep:(OTRSMPStep)step context:(ConnContext*)context error:(gcry_error_t)error output:(nullable NSData*)output question:(nullable NSString*)question {
+    OTROpData *opdata = [[OTROpData alloc] initWithOTRKit:self tag:nil];
+    void *opdataPointer = (__bridge void*)opdata;
+    OtrlSMState *smstate = context->smstate;
+    if (smstate->sm_prog_state == OTRL_SMP_PROG_CHEATED) {
+        handle_smp_event_cb(opdataPointer, OTRL_SMPEVENT_CHEATED, context, 0, NULL);
+        smstate->nextExpected = OTRL_SMP_EXPECT1;
+        smstate->sm_prog_state = OTRL_SMP_PROG_OK;
+        return;
+    }
+    if (error) {
+        handle_smp_event_cb(opdataPointer, OTRL_SMPEVENT_ERROR, context, 0, NULL);
+        return;
+    }
+    BOOL succeeded = smstate->sm_prog_state == OTRL_SMP_PROG_SUCCEEDED;
+    switch (step) {
+        case OTRSMPStepInitiate: {
+            NSMutableData *data = [NSMutableData data];
+            if (question) {
+                NSData *questionData = [question dataUsingEncoding:NSUTF8StringEncoding];
+                [data appendData:questionData];
+                [data appendBytes:"\0" length:1];
+            }
+            [data appendData:output];
+            [self sendSMPTLVType:question ? OTRL_TLV_SMP1Q : OTRL_TLV_SMP1 data:data context:context opdata:opdataPointer];
+            smstate->nextExpected = OTRL_SMP_EXPECT2;
+            handle_smp_event_cb(opdataPointer, OTRL_SMPEVENT_IN_PROGRESS, context, kOTRKitSMPProgressInitiated, NULL);
+            break;
+        }
+        case OTRSMPStepReceiveRequest:
+            handle_smp_event_cb(opdataPointer, question ? OTRL_SMPEVENT_ASK_FOR_ANSWER : OTRL_SMPEVENT_ASK_FOR_SECRET, context, kOTRKitSMPProgressAsked, (char*)question.UTF8String);
+            break;
+        case OTRSMPStepRespond:
+            [self sendSMPTLVType:OTRL_TLV_SMP2 data:output context:context opdata:opdataPointer];
+            smstate->nextExpected = OTRL_SMP_EXPECT3;
+            handle_smp_event_cb(opdataPointer, OTRL_SMPEVENT_IN_PROGRESS, context, kOTRKitSMPProgressResponded, NULL);
+            break;
+        case OTRSMPStepReceiveResponse:
+            [self sendSMPTLVType:OTRL_TLV_SMP3 data:output context:context opdata:opdataPointer];
+            smstate->nextExpected = OTRL_SMP_EXPECT4;
+            handle_smp_event_cb(opdataPointer, OTRL_SMPEVENT_IN_PROGRESS, context, kOTRKitSMPProgressConfirming, NULL);
+            break;
+        case OTRSMPStepReceiveConfirmation:
+            [self sendSMPTLVType:OTRL_TLV_SMP4 data:output context:context opdata:opdataPointer];
+            // Whoever asked a question learns nothing about our trust in them
+            if (!smstate->received_question) {
+                [self setSMPTrust:succeeded context:context];
+            }
+            smstate->nextExpected = OTRL_SMP_EXPECT1;
+            handle_smp_event_cb(opdataPointer, succeeded ? OTRL_SMPEVENT_SUCCESS : OTRL_SMPEVENT_FAILURE, context, kOTRKitSMPProgressDone, NULL);
+            break;
+        case OTRSMPStepReceiveFinal:
+            [self setSMPTrust:succeeded context:context];
+            smstate->nextExpected = OTRL_SMP_EXPECT1;
+            handle_smp_event_cb(opdataPointer, succeeded ? OTRL_SMPEVENT_SUCCESS : OTRL_SMPEVENT_FAILURE, context, kOTRKitSMPProgressDone, NULL);
+            break;
+    }
+}
+
+/** Must be called on internalQueue. Sends an SMP TLV in an otherwise empty data message, as libotr does. */
+- (void) sendSMPTLVType:(unsigned short)type data:(NSData*)data context:(ConnContext*)context opdata:(void*)opdata {
+    OtrlTLV *tlv = otrl_tlv_new(type, (unsigned short)data.length, data.bytes);
+    char *message = NULL;
+    gcry_error_t error = otrl_proto_create_data(&message, context, "", tlv, OTRL_MSGFLAGS_IGNORE_UNREADABLE, NULL);
+    if (!error) {
+        otrl_message_fragment_and_send(&ui_ops, opdata, context, message, OTRL_FRAGMENT_SEND_ALL, NULL);
+    }
+    free(message);
+    otrl_tlv_free(tlv);
+}
+
+/** Must be called on internalQueue */
+- (void) setSMPTrust:(BOOL)trusted context:(ConnContext*)context {
+    if (!context->active_fingerprint) {
+        return;
+    }
+    otrl_context_set_trust(context->active_fingerprint, trusted ? "smp" : "");
+    [self indexInternalFingerprint:context->active_fingerprint];
+    [self writeFingerprints];
+    NSString *key = [[self class] contextKeyForUsername:context->username accountName:context->accountname protocol:context->protocol];
+    if ([self publishedConversationStateForKey:key]) {
+        [self publishConversationStateForUsername:@(context->username) accountName:@(context->accountname) protocol:@(context->protocol)];
+    }
+}
+
 #pragma mark TLV Handlers
 
 
 - (void) registerTLVHandler:(id<OTRTLVHandler>)handler {
+    [self registerTLVHandler:handler targetQueue:nil];
+}
+
+- (void) registerTLVHandler:(id<OTRTLVHandler>)handler targetQueue:(nullable dispatch_queue_t)targetQueue {
     NSParameterAssert(handler != nil);
     if (!handler) {
         return;
     }
-    [self performBlockAsync:^{
-        NSArray *handledTypes = [handler handledTLVTypes];
-        [handledTypes enumerateObjectsUsingBlock:^(NSNumber *type, NSUInteger idx, BOOL *stop) {
-            [self.tlvHandlers setObject:handler forKey:type];
+    OTRTLVSubscription *subscription = [[OTRTLVSubscription alloc] initWithHandler:handler targetQueue:targetQueue];
+    NSArray<NSNumber*> *handledTypes = [handler handledTLVTypes];
+    dispatch_sync(self.tlvHandlerQueue, ^{
+        NSMutableDictionary<NSNumber*, NSArray<OTRTLVSubscription*>*> *subscriptions = [self.tlvSubscriptions mutableCopy];
+        for (NSNumber *type in handledTypes) {
+            NSArray<OTRTLVSubscription*> *existing = [subscriptions objectForKey:type] ?: @[];
+            if ([[existing valueForKey:@"handler"] indexOfObjectIdenticalTo:handler] != NSNotFound) {
+                continue;
+            }
+            [subscriptions setObject:[existing arrayByAddingObject:subscription] forKey:type];
+        }
+        self.tlvSubscriptions = subscriptions;
+    });
+}
+
+- (void) unregisterTLVHandler:(id<OTRTLVHandler>)handler {
+    dispatch_sync(self.tlvHandlerQueue, ^{
+        NSMutableDictionary<NSNumber*, NSArray<OTRTLVSubscription*>*> *subscriptions = [NSMutableDictionary dictionary];
+        [self.tlvSubscriptions enumerateKeysAndObjectsUsingBlock:^(NSNumber *type, NSArray<OTRTLVSubscription*> *existing, BOOL *stop) {
+            NSIndexSet *kept = [existing indexesOfObjectsPassingTest:^BOOL(OTRTLVSubscription *subscription, NSUInteger idx, BOOL *stop) {
+                return subscription.handler != handler;
+            }];
+            if (kept.count) {
+                [subscriptions setObject:[existing objectsAtIndexes:kept] forKey:type];
+            }
         }];
-    }];
+        self.tlvSubscriptions = subscriptions;
+    });
+}
+
+/**
+ *  Must be called on internalQueue. Hands each subscriber its TLVs from one message
+ *  in a single block on its queue for the conversation, so decoding never waits on handlers.
+ *  Subscribers registered without a targetQueue are called right away instead.
+ */
+- (void) dispatchTLVs:(NSArray<OTRTLV*>*)tlvs
+             username:(NSString*)username
+          accountName:(NSString*)accountName
+             protocol:(NSString*)protocol
+          fingerprint:(OTRFingerprint*)fingerprint
+                  tag:(id)tag {
+    if (!tlvs.count) {
+        return;
+    }
+    __block NSDictionary<NSNumber*, NSArray<OTRTLVSubscription*>*> *subscriptions = nil;
+    dispatch_sync(self.tlvHandlerQueue, ^{
+        subscriptions = self.tlvSubscriptions;
+    });
+    if (!subscriptions.count) {
+        return;
+    }
+    // Keyed by subscription pointer, in order of first matching TLV
+    NSMapTable<OTRTLVSubscription*, NSMutableArray<OTRTLV*>*> *batches = [NSMapTable strongToStrongObjectsMapTable];
+    NSMutableArray<OTRTLVSubscription*> *order = [NSMutableArray array];
+    for (OTRTLV *tlv in tlvs) {
+        for (OTRTLVSubscription *subscription in [subscriptions objectForKey:@(tlv.type)]) {
+            NSMutableArray<OTRTLV*> *batch = [batches objectForKey:subscription];
+            if (!batch) {
+                batch = [NSMutableArray array];
+                [batches setObject:batch forKey:subscription];
+                [order addObject:subscription];
+            }
+            [batch addObject:tlv];
+        }
+    }
+    NSString *key = [[self class] contextKeyForUsername:username.UTF8String accountName:accountName.UTF8String protocol:protocol.UTF8String];
+    for (OTRTLVSubscription *subscription in order) {
+        NSArray<OTRTLV*> *batch = [batches objectForKey:subscription];
+        id<OTRTLVHandler> handler = subscription.handler;
+        dispatch_block_t handleBlock = ^{
+            for (OTRTLV *tlv in batch) {
+                [handler receiveTLV:tlv username:username accountName:accountName protocol:protocol fingerprint:fingerprint tag:tag];
+            }
+        };
+        if (subscription.targetQueue) {
+            dispatch_async([subscription queueForConversation:key], handleBlock);
+        } else {
+            handleBlock();
+        }
+    }
+}
+
+/** Must be called on internalQueue. Drops the per-conversation TLV queues of an evicted context. */
+- (void) forgetTLVQueuesForContextKey:(NSString*)key {
+    __block NSDictionary<NSNumber*, NSArray<OTRTLVSubscription*>*> *subscriptions = nil;
+    dispatch_sync(self.tlvHandlerQueue, ^{
+        subscriptions = self.tlvSubscriptions;
+    });
+    for (NSArray<OTRTLVSubscription*> *typeSubscriptions in subscriptions.allValues) {
+        for (OTRTLVSubscription *subscription in typeSubscriptions) {
+            [subscription.conversationQueues removeObjectForKey:key];
+        }
+    }
 }
 
 + (OtrlTLV*)tlvChainForTLVs:(NSArray<OTRTLV*>*)tlvs {
@@ -1588,6 +3853,22 @@ static OtrlMessageAppOps ui_ops = {
 
 #pragma mark Internal Utilities
 
+- (void) deliverCallback:(dispatch_block_t)block {
+    if (self.callbackMode == OTRKitCallbackModeInline) {
+        block();
+    } else {
+        dispatch_async(self.callbackQueue, block);
+    }
+}
+
+- (void) deliverCallbackAndWait:(dispatch_block_t)block {
+    if (self.callbackMode == OTRKitCallbackModeInline) {
+        block();
+    } else {
+        dispatch_sync(self.callbackQueue, block);
+    }
+}
+
 /** Will perform block synchronously on the internalQueue and block for result if called on another queue. */
 - (void) performBlock:(dispatch_block_t)block {
     NSParameterAssert(block != nil);
@@ -1599,14 +3880,19 @@ static OtrlMessageAppOps ui_ops = {
     }
 }
 
-/** Will perform block asynchronously on the internalQueue, unless we're already on internalQueue */
+/** Will perform block asynchronously on the internalQueue in the interactive lane, unless we're already on internalQueue */
 - (void) performBlockAsync:(dispatch_block_t)block {
+    [self performBlockAsync:block priority:OTRKitPriorityInteractive group:nil];
+}
+
+/** Will perform block asynchronously on the internalQueue in the given lane, unless we're already on internalQueue */
+- (void) performBlockAsync:(dispatch_block_t)block priority:(OTRKitPriority)priority group:(nullable NSString*)group {
     NSParameterAssert(block != nil);
     if (!block) { return; }
     if (dispatch_get_specific(IsOnInternalQueueKey)) {
         block();
     } else {
-        dispatch_async(_internalQueue, block);
+        [self.scheduler scheduleBlock:block priority:priority group:group];
     }
 }
 
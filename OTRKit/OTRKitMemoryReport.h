@@ -0,0 +1,41 @@
+//
+//  OTRKitMemoryReport.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+/** Snapshot of libotr state held in memory by an OTRKit instance. */
+@interface OTRKitMemoryReport : NSObject
+
+/** Number of master ConnContexts, one per buddy/account/protocol */
+@property (nonatomic, readonly) NSUInteger masterContextCount;
+/** Number of child ConnContexts, one per remote OTRv3 instance */
+@property (nonatomic, readonly) NSUInteger instanceContextCount;
+/** Number of contexts currently in OTRKitMessageStateEncrypted */
+@property (nonatomic, readonly) NSUInteger encryptedContextCount;
+/** Number of fingerprints attached to in-memory contexts */
+@property (nonatomic, readonly) NSUInteger fingerprintCount;
+/** Number of evicted contexts whose fingerprints are only kept in the fingerprint index */
+@property (nonatomic, readonly) NSUInteger evictedContextCount;
+/** Number of fingerprints kept for evicted contexts */
+@property (nonatomic, readonly) NSUInteger evictedFingerprintCount;
+/** Rough estimate of heap bytes used by contexts, session keys, SMP state and fingerprints */
+@property (nonatomic, readonly) NSUInteger estimatedBytes;
+
+- (instancetype) initWithMasterContextCount:(NSUInteger)masterContextCount
+                       instanceContextCount:(NSUInteger)instanceContextCount
+                      encryptedContextCount:(NSUInteger)encryptedContextCount
+                           fingerprintCount:(NSUInteger)fingerprintCount
+                        evictedContextCount:(NSUInteger)evictedContextCount
+                    evictedFingerprintCount:(NSUInteger)evictedFingerprintCount
+                             estimatedBytes:(NSUInteger)estimatedBytes NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+@end
+NS_ASSUME_NONNULL_END
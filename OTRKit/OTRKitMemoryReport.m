@@ -0,0 +1,36 @@
+//
+//  OTRKitMemoryReport.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRKitMemoryReport.h"
+
+@implementation OTRKitMemoryReport
+
+- (instancetype) initWithMasterContextCount:(NSUInteger)masterContextCount
+                       instanceContextCount:(NSUInteger)instanceContextCount
+                      encryptedContextCount:(NSUInteger)encryptedContextCount
+                           fingerprintCount:(NSUInteger)fingerprintCount
+                        evictedContextCount:(NSUInteger)evictedContextCount
+                    evictedFingerprintCount:(NSUInteger)evictedFingerprintCount
+                             estimatedBytes:(NSUInteger)estimatedBytes {
+    if (self = [super init]) {
+        _masterContextCount = masterContextCount;
+        _instanceContextCount = instanceContextCount;
+        _encryptedContextCount = encryptedContextCount;
+        _fingerprintCount = fingerprintCount;
+        _evictedContextCount = evictedContextCount;
+        _evictedFingerprintCount = evictedFingerprintCount;
+        _estimatedBytes = estimatedBytes;
+    }
+    return self;
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p contexts: %d instances: %d encrypted: %d fingerprints: %d evicted: %d (%d fingerprints) bytes: ~%d>", NSStringFromClass([self class]), self, (int)self.masterContextCount, (int)self.instanceContextCount, (int)self.encryptedContextCount, (int)self.fingerprintCount, (int)self.evictedContextCount, (int)self.evictedFingerprintCount, (int)self.estimatedBytes];
+}
+
+@end
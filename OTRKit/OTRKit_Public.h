@@ -38,8 +38,17 @@
 #import <OTRKit/OTRTLV.h>
 #import <OTRKit/OTRTLVHandler.h>
 #import <OTRKit/OTRFingerprint.h>
+#import <OTRKit/OTRFingerprintIndex.h>
+#import <OTRKit/OTREncodedMessage.h>
+#import <OTRKit/OTRSymmetricKeyUse.h>
+#import <OTRKit/OTRKitMemoryReport.h>
+#import <OTRKit/OTRPriorityScheduler.h>
+#import <OTRKit/OTRNotificationCoalescer.h>
+#import <OTRKit/OTRTrafficRecorder.h>
+#import <OTRKit/OTRSessionSnapshot.h>
 
 @class OTRKit;
+@class OTRConversationState;
 
 typedef NS_ENUM(NSUInteger, OTRKitMessageState) {
     OTRKitMessageStateUnknown,
@@ -222,6 +231,10 @@ updateMessageState:(OTRKitMessageState)messageState
 /**
  *  Implement this if you plan to handle SMP.
  *
+ *  Progress is reported as each step finishes: 0.2 after initiating, 0.25 when
+ *  asked for the secret, 0.4 after responding, 0.6 once the response is checked
+ *  and 1.0 with success or failure.
+ *
  *  @param otrKit      reference to shared instance
  *  @param event    SMP event
  *  @param progress percent progress of SMP negotiation
@@ -308,21 +321,129 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
 
 /**
  *  Defaults to main queue. All delegate and block callbacks will be done on this queue. Cannot be set to nil.
+ *  A concurrent queue spreads callbacks over threads, they may then run in parallel and out of order.
+ *  Not used in OTRKitCallbackModeInline.
  */
 @property (atomic, strong, readwrite) dispatch_queue_t callbackQueue;
 
+/**
+ *  OTRKitCallbackModeInline skips the hop to the callbackQueue: completion
+ *  blocks and delegate methods are called directly on OTRKit's internal queue,
+ *  or on the queue of the helper that produced them. This saves a context
+ *  switch per message for callers that don't need the main thread, such as
+ *  servers. Defaults to OTRKitCallbackModeQueue.
+ *
+ *  Inline callbacks must follow these rules:
+ *  - Return quickly. Every conversation waits while a callback runs.
+ *  - Asynchronous calls, e.g. encodeMessage:... or decodeMessage:... with
+ *    async:YES, are safe. They're queued behind the work in progress.
+ *  - Synchronous getters such as messageStateForUsername:... and
+ *    activeFingerprintForUsername:... are safe, they run immediately.
+ *  - Don't call encodeMessage:... or decodeMessage:... with async:NO from
+ *    injectMessage, handleMessageEvent, handleSMPEvent or other libotr
+ *    callbacks. libotr is in the middle of a call and isn't reentrant.
+ *  - Don't dispatch_sync to a queue that might be waiting on OTRKit.
+ *  Callbacks made on the internal queue run one at a time, in the same order
+ *  as with a serial callbackQueue. requestAdmissionWithCompletion: completions
+ *  run on OTRKit's admission queue instead.
+ */
+@property (atomic, readwrite) OTRKitCallbackMode callbackMode;
+
 /** 
  * By default uses `OTRKitPolicyDefault`
  */
 @property (atomic, readwrite) OTRKitPolicy otrPolicy;
 
+/**
+ *  Master contexts that have been idle for longer than this interval are forgotten
+ *  from memory during the poll cycle, as long as none of their instances are encrypted
+ *  or in the middle of an AKE or SMP. Their fingerprints and trust levels are kept
+ *  and restored when the buddy is seen again. Defaults to 0, which disables eviction.
+ */
+@property (atomic, readwrite) NSTimeInterval contextIdleTimeout;
+
+/**
+ *  Maximum number of AKEs started by initiateEncryptionWithUsernames:accountName:protocol:
+ *  that may be in flight at once. Defaults to 4.
+ */
+@property (atomic, readwrite) NSUInteger maxConcurrentSessionInitiations;
+
+/**
+ *  When non-zero, messages passed to the async encodeMessage: methods are held while
+ *  their conversation is plaintext under OTRKitPolicyAlways, and an AKE is started if one
+ *  isn't underway. Other policies send them right away as libotr would. When the
+ *  conversation goes secure the held messages are encrypted in order and their completions
+ *  run together in one callback, so libotr never stores and resends them with a [resent]
+ *  prefix. Messages still held after this long fail with a timeout error. OTR queries and
+ *  multi-recipient encodes aren't held. Defaults to 0, which leaves them to libotr.
+ */
+@property (atomic, readwrite) NSTimeInterval pendingMessageTimeout;
+
+/**
+ *  Limit on async encode and decode operations in flight, counted from the call until
+ *  its completion or delegate callback has run on the callbackQueue. This is a backpressure
+ *  signal rather than a hard cap: interactive work is always accepted, and callers use
+ *  queueDepth or requestAdmissionWithCompletion: to slow down. Defaults to 0, unlimited.
+ */
+@property (atomic, readwrite) NSUInteger maxInFlightOperations;
+
+/**
+ *  Number of async encode and decode operations currently in flight. KVO observable,
+ *  like NSOperationQueue's operationCount notifications may arrive on any thread.
+ */
+@property (atomic, readonly) NSUInteger queueDepth;
+
+/**
+ *  When enabled and queueDepth has reached maxInFlightOperations, OTRKitPriorityBulk
+ *  encodes fail immediately with an EBUSY error and maintenance polls are skipped,
+ *  instead of being queued. Defaults to NO.
+ */
+@property (atomic, readwrite) BOOL shedsNonInteractiveWork;
+
+/**
+ *  otrKit:updateMessageState:... is only called when the message state or
+ *  active fingerprint of a conversation changes, not on every heartbeat or
+ *  re-key. When this is non-zero, updates are also delivered at most this
+ *  often, keeping only the latest state per conversation and batching all
+ *  conversations into one block on the callbackQueue. Coalesced updates may
+ *  arrive after other delegate callbacks sent around the same time.
+ *  Defaults to 0, which delivers each change right away.
+ */
+@property (atomic, readwrite) NSTimeInterval messageStateCoalescingInterval;
+
+/**
+ *  When set, the shape of every decoded, encoded and injected message is
+ *  recorded for later replay, like the tests' OTRTrafficReplayer does: lengths, message kinds,
+ *  TLV types and timings. Message text, TLV bodies and keys are never kept.
+ *  Costs one property read per message while nil. Defaults to nil.
+ */
+@property (atomic, strong, readwrite, nullable) OTRTrafficRecorder *trafficRecorder;
+
+/**
+ *  Opt-in key for session snapshots, 16 or 32 bytes for AES-GCM. While set,
+ *  writeSessionSnapshotWithError: and sessionSnapshotInterval save the keys
+ *  of every encrypted conversation to sessionSnapshotPath, and
+ *  restoreSessionSnapshotWithCompletion: picks them up after a restart.
+ *  Keep it somewhere other than dataPath, e.g. the keychain. Defaults to nil.
+ */
+@property (atomic, copy, readwrite, nullable) NSData *sessionSnapshotKey;
+
+/**
+ *  While sessionSnapshotKey is set, a snapshot is also written from the poll
+ *  cycle this often. Defaults to 0, only writeSessionSnapshotWithError: writes.
+ */
+@property (atomic, readwrite) NSTimeInterval sessionSnapshotInterval;
+
 /**
  *  Path to where the OTR private keys and related data is stored.
  */
 @property (nonatomic, copy, readonly) NSString* dataPath;
 
 /**
- *  Path to the OTR private keys file.
+ *  Path to the OTR private keys file in libotr's format. Keys are kept in a
+ *  per-account journal in dataPath, this file is only read once to migrate
+ *  existing keys and then renamed with a ".migrated" suffix, so nothing takes
+ *  it for the current keys. Only exportLibotrFilesWithError: writes it again.
  */
 @property (nonatomic, strong, readonly) NSString* privateKeyPath;
 
@@ -332,10 +453,26 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
 @property (nonatomic, strong, readonly) NSString* fingerprintsPath;
 
 /**
- *  Path to the OTRv3 Instance tags file.
+ *  Path to the OTRv3 Instance tags file in libotr's format. Like privateKeyPath
+ *  it's only read once for migration, then renamed, and written by exportLibotrFilesWithError:.
  */
 @property (nonatomic, strong, readonly) NSString* instanceTagsPath;
 
+/**
+ *  Path to the encrypted session snapshot file.
+ */
+@property (nonatomic, strong, readonly) NSString* sessionSnapshotPath;
+
+/**
+ *  Writes every private key and instance tag to privateKeyPath and
+ *  instanceTagsPath in libotr's format, e.g. for backups or other libotr clients.
+ *  The files aren't updated by later changes, export again after generating keys.
+ *
+ *  @param error set if either file couldn't be written
+ *  @return whether both files were written
+ */
+- (BOOL) exportLibotrFilesWithError:(NSError**)error;
+
 #pragma mark Setup
 //////////////////////////////////////////////////////////////////////
 /// @name Setup
@@ -399,6 +536,22 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
              protocol:(NSString*)protocol
                   tag:(nullable id)tag;
 
+/**
+ * Same as encodeMessage:tlvs:username:accountName:protocol:tag: but lets you pick the
+ * scheduling lane. Work queued in OTRKitPriorityInteractive runs before OTRKitPriorityBulk,
+ * which runs before OTRKitPriorityMaintenance, and peers take turns within a lane.
+ * Messages to the same buddy in the same lane are always encoded in order, but an
+ * interactive message may overtake bulk work queued earlier for that buddy.
+ * @param priority scheduling lane. The other encode and decode methods use OTRKitPriorityInteractive.
+ */
+- (void)encodeMessage:(nullable NSString*)message
+                 tlvs:(nullable NSArray<OTRTLV*>*)tlvs
+             username:(NSString*)username
+          accountName:(NSString*)accountName
+             protocol:(NSString*)protocol
+                  tag:(nullable id)tag
+             priority:(OTRKitPriority)priority;
+
 /**
  * Encodes a message and optional array of OTRTLVs, splits it into fragments,
  * then injects the encoded data via the injectMessage: delegate method.
@@ -422,6 +575,28 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
                 async:(BOOL)async
            completion:(void (^)(NSString* _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint* _Nullable fingerprint, NSError* _Nullable error))completion;
 
+/**
+ * Encodes the same message and optional array of OTRTLVs for many recipients at once,
+ * for instance every member of a multi-user conversation. The plaintext and TLVs are
+ * prepared once, trust is evaluated for all recipients in a single hop to the callbackQueue,
+ * and every recipient is encoded in one turn of the internal queue.
+ *
+ * @param message The message to be encoded. May be nil if only sending TLVs.
+ * @param tlvs Array of OTRTLVs, the data length of each TLV must be smaller than UINT16_MAX or it will be ignored. May be nil if only sending message.
+ * @param usernames The intended recipients of the message. Duplicates are encoded once.
+ * @param accountName Your account name
+ * @param protocol the protocol of accountName, such as @"xmpp"
+ * @param tag optional tag to attach additional application-specific data to message. Only used locally.
+ * @param completion Called once on callbackQueue with one result per unique recipient, in the order of usernames.
+ */
+- (void)encodeMessage:(nullable NSString*)message
+                 tlvs:(nullable NSArray<OTRTLV*>*)tlvs
+            usernames:(NSArray<NSString*>*)usernames
+          accountName:(NSString*)accountName
+             protocol:(NSString*)protocol
+                  tag:(nullable id)tag
+           completion:(void (^)(NSArray<OTREncodedMessage*>* encodedMessages))completion;
+
 /**
  *  All messages should be sent through here before being processed by your program.
  * @note when using this method, you must implement the decodedMessage: delegate method.
@@ -480,6 +655,34 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
                             accountName:(NSString*)accountName
                                protocol:(NSString*)protocol;
 
+/**
+ *  Start OTR sessions with many buddies at once, e.g. your roster after reconnecting.
+ *  Buddies you've been active with most recently go first, and at most
+ *  maxConcurrentSessionInitiations AKEs are in flight at a time. Queries are encoded
+ *  in the OTRKitPriorityBulk lane so messages you encode or decode in the meantime
+ *  aren't stuck behind the whole roster. Buddies that are already encrypted or queued are skipped.
+ *
+ *  Progress is reported per buddy via the updateMessageState delegate method. An AKE
+ *  that hasn't completed after 30 seconds frees up its slot for the next buddy.
+ *
+ *  @param usernames   buddies you'd like to start OTR conversations with
+ *  @param accountName your account name
+ *  @param protocol    the protocol of accountName, such as @"xmpp"
+ */
+- (void)initiateEncryptionWithUsernames:(NSArray<NSString*>*)usernames
+                            accountName:(NSString*)accountName
+                               protocol:(NSString*)protocol;
+
+/**
+ *  Drop any queued session initiations for this account, for example when it goes offline.
+ *  AKEs already in flight are left to complete.
+ *
+ *  @param accountName your account name
+ *  @param protocol    the protocol of accountName, such as @"xmpp"
+ */
+- (void)cancelSessionInitiationsForAccountName:(NSString*)accountName
+                                      protocol:(NSString*)protocol;
+
 /**
  *  Disable encryption and inform buddy you no longer wish to communicate
  *  privately.
@@ -493,7 +696,8 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
                              protocol:(NSString*)protocol;
 
 /**
- *  Current encryption state for buddy.
+ *  Current encryption state for buddy. Answered from the published
+ *  conversation state when there is one, otherwise waits on the internal queue.
  *
  *  @param username    username of remote buddy
  *  @param accountName your account name
@@ -503,6 +707,22 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
                                   accountName:(NSString*)accountName
                                      protocol:(NSString*)protocol;
 
+/**
+ *  State of the conversation as of its last message state or trust change.
+ *  OTRKit publishes an immutable table of these that is swapped whenever one
+ *  changes, so this never waits on the internal queue and is cheap enough to
+ *  call for every row of a contact list. It reflects work the internal queue
+ *  has finished, not messages still waiting to be decoded.
+ *
+ *  @return nil if the conversation hasn't changed state since launch or was evicted
+ */
+- (nullable OTRConversationState*)conversationStateForUsername:(NSString*)username
+                                                   accountName:(NSString*)accountName
+                                                      protocol:(NSString*)protocol;
+
+/** Every published conversation state, in no particular order. Never waits on the internal queue. */
+- (NSArray<OTRConversationState*>*) allConversationStates;
+
 #pragma mark Socialist's Millionaire Protocol
 //////////////////////////////////////////////////////////////////////
 /// @name Socialist's Millionaire Protocol
@@ -511,6 +731,10 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
 /**
  *  Initiate's SMP with shared secret to verify buddy identity.
  *
+ *  The modular exponentiations of each SMP step run on a background queue, so
+ *  messages with this and other buddies keep flowing in the meantime. Results are
+ *  dropped if the session changes or SMP is aborted or restarted before they're done.
+ *
  *  @param username    username of remote buddy
  *  @param accountName your account name
  *  @param protocol    the protocol of accountName, such as @"xmpp"
@@ -573,6 +797,40 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
                                 useData:(nullable NSData*)useData
                                   error:(NSError**)error;
 
+/**
+ *  Batch version of requestSymmetricKeyForUsername:accountName:protocol:forUse:useData:error:
+ *  Every use is announced to the buddy in a single message, injected like any other
+ *  protocol message.
+ *
+ *  libotr has one extra key per set of session keys, so every use in the batch gets
+ *  the same key, just as if they had been requested one at a time.
+ *
+ *  @param username    username of remote buddy
+ *  @param accountName your account name
+ *  @param protocol    the protocol of accountName, such as @"xmpp"
+ *  @param uses        what the key will be used for, e.g. one per file
+ *  @param error       set if the session isn't encrypted
+ *  @return Symmetric key for every use, or nil for error.
+ */
+- (nullable NSData*) requestSymmetricKeyForUsername:(NSString*)username
+                                        accountName:(NSString*)accountName
+                                           protocol:(NSString*)protocol
+                                            forUses:(NSArray<OTRSymmetricKeyUse*>*)uses
+                                              error:(NSError**)error;
+
+/**
+ *  Key the buddy announced for this use in the current session, or nil. Keys are
+ *  cached as they arrive, whether or not the delegate implements
+ *  otrKit:receivedSymmetricKey:forUse:useData:username:accountName:protocol:,
+ *  and are dropped when the session ends or is re-keyed by a new AKE.
+ *  Safe to call from any thread, doesn't wait on message processing.
+ */
+- (nullable NSData*) receivedSymmetricKeyForUsername:(NSString*)username
+                                         accountName:(NSString*)accountName
+                                            protocol:(NSString*)protocol
+                                              forUse:(NSUInteger)use
+                                             useData:(nullable NSData*)useData;
+
 #pragma mark Fingerprint Verification
 //////////////////////////////////////////////////////////////////////
 /// @name Fingerprint Verification
@@ -582,6 +840,25 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
 /** Synchronously fetches every known fingerprint, excluding yourself. */
 - (NSArray<OTRFingerprint*>*) allFingerprints;
 
+/** Every known fingerprint with these bytes. The same key can be known under more than one username. */
+- (NSArray<OTRFingerprint*>*) fingerprintsWithData:(NSData*)fingerprintData;
+
+/** Number of known fingerprints matching query, excluding yourself. */
+- (NSUInteger) countOfFingerprintsMatchingQuery:(OTRFingerprintQuery*)query;
+
+/**
+ *  Synchronously pages through known fingerprints matching query, excluding yourself.
+ *  Lookups are served from an index kept alongside libotr, so neither this nor block
+ *  holds up message processing, and only one page is materialized at a time.
+ *
+ *  @param query    e.g. a single account or untrusted fingerprints
+ *  @param pageSize maximum number of fingerprints per page
+ *  @param block    called on the calling thread, set stop to YES to end early
+ */
+- (void) enumerateFingerprintsMatchingQuery:(OTRFingerprintQuery*)query
+                                   pageSize:(NSUInteger)pageSize
+                                 usingBlock:(void (^)(NSArray<OTRFingerprint*> *page, BOOL *stop))block;
+
 /** Synchronously fetches your own fingerprint for this device / account, which is implicitly trusted. */
 - (nullable OTRFingerprint*)fingerprintForAccountName:(NSString*)accountName
                                              protocol:(NSString*)protocol;
@@ -591,7 +868,11 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
                                           accountName:(NSString*)accountName
                                              protocol:(NSString*)protocol;
 
-/** Synchronously fetches fingerprint used in the current session with user. */
+/**
+ *  Synchronously fetches fingerprint used in the current session with user.
+ *  Like messageStateForUsername:accountName:protocol: this is answered from
+ *  the published conversation state when there is one.
+ */
 - (nullable OTRFingerprint*)activeFingerprintForUsername:(NSString*)username
                                              accountName:(NSString*)accountName
                                              protocol:(NSString*)protocol;
@@ -602,6 +883,70 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
 /** Delete fingerprint from the trust store. Will throw an error if you try to delete the active fingerprint, or the fingerprint isn't in the store. */
 - (BOOL) deleteFingerprint:(OTRFingerprint*)fingerprint error:(NSError**)error;
 
+#pragma mark Backpressure
+//////////////////////////////////////////////////////////////////////
+/// @name Backpressure
+//////////////////////////////////////////////////////////////////////
+
+/**
+ *  Defers the caller until queueDepth is below maxInFlightOperations. For example a
+ *  gateway can call this before reading the next inbound message off the wire.
+ *  Waiters are admitted in the order they asked.
+ *
+ *  @param completion called on callbackQueue once there's room, immediately if maxInFlightOperations is 0
+ */
+- (void) requestAdmissionWithCompletion:(dispatch_block_t)completion;
+
+#pragma mark Memory Management
+//////////////////////////////////////////////////////////////////////
+/// @name Memory Management
+//////////////////////////////////////////////////////////////////////
+
+/**
+ *  Synchronously forgets every master context that has been idle for longer than
+ *  contextIdleTimeout. This is done automatically from the poll cycle when
+ *  contextIdleTimeout is non-zero.
+ *
+ *  @return number of master contexts evicted
+ */
+- (NSUInteger) evictIdleContexts;
+
+/** Synchronously counts contexts and fingerprints held in memory. */
+- (OTRKitMemoryReport*) memoryReport;
+
+#pragma mark Session Snapshots
+//////////////////////////////////////////////////////////////////////
+/// @name Session Snapshots
+//////////////////////////////////////////////////////////////////////
+
+/**
+ *  Synchronously saves every encrypted conversation to sessionSnapshotPath,
+ *  encrypted with sessionSnapshotKey, replacing the previous snapshot. Call it
+ *  when the app is backgrounded or the service shuts down.
+ *
+ *  The file holds session keys, so anyone with it and the key can read
+ *  messages of those sessions until they're re-keyed. Messages received after
+ *  the snapshot was written can be replayed once after restoring it.
+ *
+ *  @return NO with a GPG_ERR_MISSING_KEY error if sessionSnapshotKey isn't set
+ */
+- (BOOL) writeSessionSnapshotWithError:(NSError**)error;
+
+/**
+ *  Reads the snapshot at sessionSnapshotPath, puts its conversations back into
+ *  the encrypted state without an AKE, and deletes the file so it can't be
+ *  restored twice. Call it right after init, before sending any messages.
+ *
+ *  Conversations that are already encrypted or in an AKE, or whose instance
+ *  tag changed, are skipped. If the buddy has moved on to newer keys in the
+ *  meantime, their next message fails to decrypt and libotr falls back to a
+ *  fresh AKE as usual. Send counters are advanced well past anything sent
+ *  after the snapshot was written, so no counter is used twice.
+ *
+ *  @param completion called on callbackQueue with the restored conversations. There's no error if there was no snapshot.
+ */
+- (void) restoreSessionSnapshotWithCompletion:(nullable void (^)(NSArray<OTRSessionSnapshot*> *restoredSessions, NSError * _Nullable error))completion;
+
 #pragma mark TLV Handlers
 //////////////////////////////////////////////////////////////////////
 /// @name TLV Handlers
@@ -610,9 +955,33 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
 /**
  *  You can register custom handlers for TLV types. For instance OTRDataHandler
  *  can handle OTRDATA TLVs (0x0100, 0x0101)
+ *
+ *  Same as registerTLVHandler:targetQueue: without a targetQueue, so handler is
+ *  called synchronously on OTRKit's internal queue while the message is decoded.
  */
 - (void) registerTLVHandler:(id<OTRTLVHandler>)handler;
 
+/**
+ *  Subscribes handler to the types in its handledTLVTypes. Several handlers
+ *  can subscribe to the same type, each gets every TLV of that type.
+ *  Registering the same handler twice has no effect.
+ *
+ *  With a targetQueue, handlers are called off OTRKit's internal queue so they
+ *  can't hold up decryption. TLVs of one conversation reach a handler in the
+ *  order they were received, one at a time, while different conversations may
+ *  be handled in parallel if targetQueue is concurrent. The registration is in place when
+ *  this returns, so TLVs of any message decoded afterwards are delivered.
+ *
+ *  @param handler the handler, retained until unregisterTLVHandler:
+ *  @param targetQueue where handler is called. If nil, handler is called synchronously on the internal queue.
+ */
+- (void) registerTLVHandler:(id<OTRTLVHandler>)handler targetQueue:(nullable dispatch_queue_t)targetQueue;
+
+/**
+ *  Stops delivering TLVs to handler. TLVs already dispatched may still arrive.
+ */
+- (void) unregisterTLVHandler:(id<OTRTLVHandler>)handler;
+
 #pragma mark Utility
 //////////////////////////////////////////////////////////////////////
 /// @name Utility
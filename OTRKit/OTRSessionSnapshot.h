@@ -0,0 +1,51 @@
+//
+//  OTRSessionSnapshot.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+/**
+ *  Saved state of one encrypted conversation, so it can pick up after a
+ *  restart without a new AKE. See OTRKit's sessionSnapshotKey.
+ *
+ *  Holds our current and previous DH keypairs, the buddy's public keys,
+ *  message counters and the MAC keys waiting to be revealed. The AES and MAC
+ *  session keys are derived again from those when restoring. Only the
+ *  properties below are exposed, key material never leaves the object
+ *  except encrypted.
+ */
+@interface OTRSessionSnapshot : NSObject
+
+@property (nonatomic, copy, readonly) NSString *username;
+@property (nonatomic, copy, readonly) NSString *accountName;
+@property (nonatomic, copy, readonly) NSString *protocol;
+/** 0 for OTRv2 sessions, which have no instance tags */
+@property (nonatomic, readonly) uint32_t ourInstanceTag;
+@property (nonatomic, readonly) uint32_t theirInstanceTag;
+@property (nonatomic, readonly) NSUInteger protocolVersion;
+/** The buddy's fingerprint the session was set up with */
+@property (nonatomic, strong, readonly) NSData *fingerprint;
+@property (nonatomic, strong, readonly) NSDate *lastSent;
+@property (nonatomic, strong, readonly) NSDate *lastReceived;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+/**
+ *  Encrypts snapshots with AES-GCM under a random IV.
+ *
+ *  @param key 16 or 32 bytes
+ */
++ (nullable NSData*) encryptedDataWithSnapshots:(NSArray<OTRSessionSnapshot*>*)snapshots key:(NSData*)key error:(NSError**)error;
+
+/**
+ *  @return nil with a GPG_ERR_INV_DATA error if data isn't a snapshot file, or the decryption error if the key is wrong or data was tampered with
+ */
++ (nullable NSArray<OTRSessionSnapshot*>*) snapshotsWithEncryptedData:(NSData*)data key:(NSData*)key error:(NSError**)error;
+
+@end
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,494 @@
+//
+//  OTRSessionSnapshot.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRSessionSnapshot.h"
+#import "OTRCryptoUtility.h"
+#import "OTRErrorUtility.h"
+#import "gcrypt.h"
+#import <libotr/context.h>
+#import <libotr/instag.h>
+#import <libotr/userstate.h>
+
+static NSString * const kOTRSessionSnapshotUsernameKey = @"user";
+static NSString * const kOTRSessionSnapshotAccountNameKey = @"account";
+static NSString * const kOTRSessionSnapshotProtocolKey = @"protocol";
+static NSString * const kOTRSessionSnapshotOurInstanceKey = @"ourInstance";
+static NSString * const kOTRSessionSnapshotTheirInstanceKey = @"theirInstance";
+static NSString * const kOTRSessionSnapshotVersionKey = @"version";
+static NSString * const kOTRSessionSnapshotFingerprintKey = @"fingerprint";
+static NSString * const kOTRSessionSnapshotSessionIDKey = @"sessionID";
+static NSString * const kOTRSessionSnapshotSessionIDHalfKey = @"sessionIDHalf";
+static NSString * const kOTRSessionSnapshotGenerationKey = @"generation";
+static NSString * const kOTRSessionSnapshotLastSentKey = @"lastSent";
+static NSString * const kOTRSessionSnapshotLastReceivedKey = @"lastReceived";
+static NSString * const kOTRSessionSnapshotOurKeyIDKey = @"ourKeyID";
+static NSString * const kOTRSessionSnapshotOurKeyGroupKey = @"ourKeyGroup";
+static NSString * const kOTRSessionSnapshotOurPrivateKeyKey = @"ourPrivate";
+static NSString * const kOTRSessionSnapshotOurPublicKeyKey = @"ourPublic";
+static NSString * const kOTRSessionSnapshotOurOldKeyGroupKey = @"ourOldKeyGroup";
+static NSString * const kOTRSessionSnapshotOurOldPrivateKeyKey = @"ourOldPrivate";
+static NSString * const kOTRSessionSnapshotOurOldPublicKeyKey = @"ourOldPublic";
+static NSString * const kOTRSessionSnapshotTheirKeyIDKey = @"theirKeyID";
+static NSString * const kOTRSessionSnapshotTheirPublicKeyKey = @"theirPublic";
+static NSString * const kOTRSessionSnapshotTheirOldPublicKeyKey = @"theirOldPublic";
+static NSString * const kOTRSessionSnapshotCountersKey = @"counters";
+static NSString * const kOTRSessionSnapshotSavedMACKeysKey = @"savedMACKeys";
+
+/** File starts with this, then a format version byte, IV, GCM tag and the encrypted plist */
+static const uint8_t kOTRSessionSnapshotMagic[4] = {'O', 'T', 'R', 'S'};
+static const uint8_t kOTRSessionSnapshotFormatVersion = 1;
+static const NSUInteger kOTRSessionSnapshotIVLength = 16;
+static const NSUInteger kOTRSessionSnapshotTagLength = 16;
+
+static const NSUInteger kOTRSessionSnapshotFingerprintLength = 20;
+/** Per session key slot: sendctr, rcvctr, then a byte of sendmacused | rcvmacused << 1 */
+static const NSUInteger kOTRSessionSnapshotCounterSlotLength = 16 + 16 + 1;
+static const NSUInteger kOTRSessionSnapshotCounterLength = 4 * kOTRSessionSnapshotCounterSlotLength;
+
+/**
+ *  Added to the top half of every send counter on restore. Messages sent after
+ *  the snapshot was written still used the old counters, so jumping well past
+ *  them keeps AES-CTR from ever reusing one. The buddy only checks they grow.
+ */
+static const uint8_t kOTRSessionSnapshotCounterSkipByte = 3;
+
+@interface OTRSessionSnapshot ()
+@property (nonatomic, readonly) NSData *sessionID;
+@property (nonatomic, readonly) OtrlSessionIdHalf sessionIDHalf;
+@property (nonatomic, readonly) unsigned int generation;
+@property (nonatomic, readonly) unsigned int ourKeyID;
+@property (nonatomic, readonly) unsigned int ourKeyGroup;
+@property (nonatomic, readonly) NSData *ourPrivateKey;
+@property (nonatomic, readonly) NSData *ourPublicKey;
+@property (nonatomic, readonly) unsigned int ourOldKeyGroup;
+@property (nonatomic, readonly, nullable) NSData *ourOldPrivateKey;
+@property (nonatomic, readonly, nullable) NSData *ourOldPublicKey;
+@property (nonatomic, readonly) unsigned int theirKeyID;
+@property (nonatomic, readonly) NSData *theirPublicKey;
+@property (nonatomic, readonly, nullable) NSData *theirOldPublicKey;
+/** kOTRSessionSnapshotCounterLength bytes, slots in sesskeys order */
+@property (nonatomic, readonly) NSData *counters;
+@property (nonatomic, readonly) NSData *savedMACKeys;
+@end
+
+#pragma mark MPI helpers
+
+static NSData* data_for_mpi(gcry_mpi_t mpi) {
+    if (!mpi) {
+        return nil;
+    }
+    unsigned char *buffer = NULL;
+    size_t length = 0;
+    if (gcry_mpi_aprint(GCRYMPI_FMT_USG, &buffer, &length, mpi) != GPG_ERR_NO_ERROR) {
+        return nil;
+    }
+    NSData *data = [NSData dataWithBytes:buffer length:length];
+    // Freed through libotr's allocator, which wipes it
+    gcry_free(buffer);
+    return data;
+}
+
+static gcry_mpi_t mpi_for_data(NSData *data) {
+    if (!data.length) {
+        return NULL;
+    }
+    gcry_mpi_t mpi = NULL;
+    if (gcry_mpi_scan(&mpi, GCRYMPI_FMT_USG, data.bytes, data.length, NULL) != GPG_ERR_NO_ERROR) {
+        return NULL;
+    }
+    return mpi;
+}
+
+/** Leaves the keypair blank without an error if either half is missing, i.e. there was no such keypair */
+static gcry_error_t restore_keypair(DH_keypair *keypair, unsigned int groupid, NSData *privateKey, NSData *publicKey) {
+    otrl_dh_keypair_init(keypair);
+    if (!privateKey.length || !publicKey.length) {
+        return GPG_ERR_NO_ERROR;
+    }
+    keypair->groupid = groupid;
+    keypair->priv = mpi_for_data(privateKey);
+    keypair->pub = mpi_for_data(publicKey);
+    if (!keypair->priv || !keypair->pub) {
+        otrl_dh_keypair_free(keypair);
+        return gcry_error(GPG_ERR_INV_DATA);
+    }
+    return GPG_ERR_NO_ERROR;
+}
+
+/** Adds 2^(8 * (7 - byte)) to libotr's 8 byte big-endian counter */
+static void skip_counter(unsigned char *ctr, uint8_t byte) {
+    for (int i = byte; i >= 0; i--) {
+        if (++ctr[i] != 0) {
+            break;
+        }
+    }
+}
+
+static BOOL is_data(id object) {
+    return [object isKindOfClass:[NSData class]];
+}
+
+static BOOL is_number(id object) {
+    return [object isKindOfClass:[NSNumber class]];
+}
+
+@implementation OTRSessionSnapshot
+
+#pragma mark libotr
+
+/** Called by OTRKit on its internal queue. nil unless the context holds session keys. */
+- (nullable instancetype) initWithContext:(ConnContext*)context {
+    NSParameterAssert(context != NULL);
+    if (!context || context->msgstate != OTRL_MSGSTATE_ENCRYPTED || !context->active_fingerprint) {
+        return nil;
+    }
+    ConnContextPriv *priv = context->context_priv;
+    if (!priv || !priv->our_dh_key.priv || !priv->our_dh_key.pub || !priv->their_y) {
+        return nil;
+    }
+    if (self = [super init]) {
+        _username = [NSString stringWithUTF8String:context->username];
+        _accountName = [NSString stringWithUTF8String:context->accountname];
+        _protocol = [NSString stringWithUTF8String:context->protocol];
+        _ourInstanceTag = context->our_instance;
+        _theirInstanceTag = context->their_instance;
+        _protocolVersion = context->protocol_version;
+        _fingerprint = [NSData dataWithBytes:context->active_fingerprint->fingerprint length:kOTRSessionSnapshotFingerprintLength];
+        _sessionID = [NSData dataWithBytes:context->sessionid length:MIN(context->sessionid_len, sizeof(context->sessionid))];
+        _sessionIDHalf = context->sessionid_half;
+        _generation = priv->generation;
+        _lastSent = [NSDate dateWithTimeIntervalSince1970:priv->lastsent];
+        _lastReceived = [NSDate dateWithTimeIntervalSince1970:priv->lastrecv];
+
+        _ourKeyID = priv->our_keyid;
+        _ourKeyGroup = priv->our_dh_key.groupid;
+        _ourPrivateKey = data_for_mpi(priv->our_dh_key.priv);
+        _ourPublicKey = data_for_mpi(priv->our_dh_key.pub);
+        _ourOldKeyGroup = priv->our_old_dh_key.groupid;
+        _ourOldPrivateKey = data_for_mpi(priv->our_old_dh_key.priv);
+        _ourOldPublicKey = data_for_mpi(priv->our_old_dh_key.pub);
+        _theirKeyID = priv->their_keyid;
+        _theirPublicKey = data_for_mpi(priv->their_y);
+        _theirOldPublicKey = data_for_mpi(priv->their_old_y);
+        if (!_username || !_accountName || !_protocol || !_ourPrivateKey || !_ourPublicKey || !_theirPublicKey) {
+            return nil;
+        }
+
+        NSMutableData *counters = [NSMutableData dataWithCapacity:kOTRSessionSnapshotCounterLength];
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                DH_sesskeys *sesskeys = &priv->sesskeys[i][j];
+                uint8_t flags = (sesskeys->sendmacused ? 1 : 0) | (sesskeys->rcvmacused ? 2 : 0);
+                [counters appendBytes:sesskeys->sendctr length:16];
+                [counters appendBytes:sesskeys->rcvctr length:16];
+                [counters appendBytes:&flags length:1];
+            }
+        }
+        _counters = counters;
+        _savedMACKeys = [NSData dataWithBytes:priv->saved_mac_keys length:priv->saved_mac_keys ? priv->numsavedkeys * 20 : 0];
+    }
+    return self;
+}
+
+/**
+ *  Called by OTRKit on its internal queue, after the master context exists.
+ *  Only restores into a context that isn't already encrypted or in an AKE,
+ *  and only if our instance tag hasn't changed since.
+ *
+ *  @return the restored context, or NULL if it was skipped
+ */
+- (nullable ConnContext*) restoreInUserState:(OtrlUserState)userState {
+    NSParameterAssert(userState != NULL);
+    if (!userState) {
+        return NULL;
+    }
+    const char *username = self.username.UTF8String;
+    const char *accountName = self.accountName.UTF8String;
+    const char *protocol = self.protocol.UTF8String;
+    if (self.ourInstanceTag != 0) {
+        OtrlInsTag *instag = otrl_instag_find(userState, accountName, protocol);
+        if (!instag || instag->instag != self.ourInstanceTag) {
+            return NULL;
+        }
+    }
+    otrl_instag_t theirInstance = self.theirInstanceTag >= OTRL_MIN_VALID_INSTAG ? self.theirInstanceTag : OTRL_INSTAG_MASTER;
+    ConnContext *context = otrl_context_find(userState, username, accountName, protocol, theirInstance, 1, NULL, NULL, NULL);
+    if (!context || context->msgstate != OTRL_MSGSTATE_PLAINTEXT || context->auth.authstate != OTRL_AUTHSTATE_NONE) {
+        return NULL;
+    }
+
+    // Parse everything before touching the context so a bad snapshot leaves it as it was
+    DH_keypair ourKey;
+    DH_keypair ourOldKey;
+    otrl_dh_keypair_init(&ourOldKey);
+    gcry_error_t err = restore_keypair(&ourKey, self.ourKeyGroup, self.ourPrivateKey, self.ourPublicKey);
+    if (!err) {
+        err = restore_keypair(&ourOldKey, self.ourOldKeyGroup, self.ourOldPrivateKey, self.ourOldPublicKey);
+    }
+    gcry_mpi_t theirY = mpi_for_data(self.theirPublicKey);
+    gcry_mpi_t theirOldY = mpi_for_data(self.theirOldPublicKey);
+    if (err || !ourKey.priv || !theirY || (self.theirOldPublicKey.length && !theirOldY)) {
+        otrl_dh_keypair_free(&ourKey);
+        otrl_dh_keypair_free(&ourOldKey);
+        gcry_mpi_release(theirY);
+        gcry_mpi_release(theirOldY);
+        return NULL;
+    }
+    DH_sesskeys sesskeys[2][2];
+    DH_keypair *ourKeys[2] = {&ourKey, &ourOldKey};
+    gcry_mpi_t theirKeys[2] = {theirY, theirOldY};
+    const unsigned char *counters = self.counters.bytes;
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            DH_sesskeys *sess = &sesskeys[i][j];
+            otrl_dh_session_blank(sess);
+            if (!err && ourKeys[i]->priv && theirKeys[j]) {
+                err = otrl_dh_session(sess, ourKeys[i], theirKeys[j]);
+                const unsigned char *slot = counters + (i * 2 + j) * kOTRSessionSnapshotCounterSlotLength;
+                memcpy(sess->sendctr, slot, 16);
+                memcpy(sess->rcvctr, slot + 16, 16);
+                sess->sendmacused = (slot[32] & 1) != 0;
+                sess->rcvmacused = (slot[32] & 2) != 0;
+                skip_counter(sess->sendctr, kOTRSessionSnapshotCounterSkipByte);
+            }
+        }
+    }
+    if (err) {
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                otrl_dh_session_free(&sesskeys[i][j]);
+            }
+        }
+        otrl_dh_keypair_free(&ourKey);
+        otrl_dh_keypair_free(&ourOldKey);
+        gcry_mpi_release(theirY);
+        gcry_mpi_release(theirOldY);
+        return NULL;
+    }
+
+    // Swap the derived state in, dropping whatever the plaintext context held
+    ConnContextPriv *priv = context->context_priv;
+    gcry_mpi_release(priv->their_y);
+    gcry_mpi_release(priv->their_old_y);
+    otrl_dh_keypair_free(&priv->our_dh_key);
+    otrl_dh_keypair_free(&priv->our_old_dh_key);
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            otrl_dh_session_free(&priv->sesskeys[i][j]);
+            priv->sesskeys[i][j] = sesskeys[i][j];
+        }
+    }
+    priv->their_keyid = self.theirKeyID;
+    priv->their_y = theirY;
+    priv->their_old_y = theirOldY;
+    priv->our_keyid = self.ourKeyID;
+    priv->our_dh_key = ourKey;
+    priv->our_old_dh_key = ourOldKey;
+    free(priv->saved_mac_keys);
+    priv->saved_mac_keys = NULL;
+    priv->numsavedkeys = 0;
+    if (self.savedMACKeys.length) {
+        priv->saved_mac_keys = malloc(self.savedMACKeys.length);
+        if (priv->saved_mac_keys) {
+            memcpy(priv->saved_mac_keys, self.savedMACKeys.bytes, self.savedMACKeys.length);
+            priv->numsavedkeys = (unsigned int)(self.savedMACKeys.length / 20);
+        }
+    }
+    priv->generation = self.generation;
+    priv->lastsent = (time_t)self.lastSent.timeIntervalSince1970;
+    priv->lastrecv = (time_t)self.lastReceived.timeIntervalSince1970;
+
+    context->active_fingerprint = otrl_context_find_fingerprint(context, (unsigned char*)self.fingerprint.bytes, 1, NULL);
+    memset(context->sessionid, 0, sizeof(context->sessionid));
+    memcpy(context->sessionid, self.sessionID.bytes, MIN(self.sessionID.length, sizeof(context->sessionid)));
+    context->sessionid_len = MIN(self.sessionID.length, sizeof(context->sessionid));
+    context->sessionid_half = self.sessionIDHalf;
+    context->protocol_version = (unsigned int)self.protocolVersion;
+    if (self.ourInstanceTag != 0) {
+        context->our_instance = self.ourInstanceTag;
+    }
+    context->msgstate = OTRL_MSGSTATE_ENCRYPTED;
+    context->otr_offer = OFFER_ACCEPTED;
+    ConnContext *master = context->m_context;
+    master->otr_offer = OFFER_ACCEPTED;
+    if (master != context) {
+        master->recent_child = context;
+        master->recent_rcvd_child = context;
+        master->recent_sent_child = context;
+    }
+    return context;
+}
+
+#pragma mark Serialization
+
+- (nullable instancetype) initWithDictionary:(NSDictionary<NSString*, id>*)dictionary {
+    if (![dictionary isKindOfClass:[NSDictionary class]]) {
+        return nil;
+    }
+    NSString *username = dictionary[kOTRSessionSnapshotUsernameKey];
+    NSString *accountName = dictionary[kOTRSessionSnapshotAccountNameKey];
+    NSString *protocol = dictionary[kOTRSessionSnapshotProtocolKey];
+    NSData *fingerprint = dictionary[kOTRSessionSnapshotFingerprintKey];
+    NSData *sessionID = dictionary[kOTRSessionSnapshotSessionIDKey];
+    NSData *ourPrivateKey = dictionary[kOTRSessionSnapshotOurPrivateKeyKey];
+    NSData *ourPublicKey = dictionary[kOTRSessionSnapshotOurPublicKeyKey];
+    NSData *ourOldPrivateKey = dictionary[kOTRSessionSnapshotOurOldPrivateKeyKey];
+    NSData *ourOldPublicKey = dictionary[kOTRSessionSnapshotOurOldPublicKeyKey];
+    NSData *theirPublicKey = dictionary[kOTRSessionSnapshotTheirPublicKeyKey];
+    NSData *theirOldPublicKey = dictionary[kOTRSessionSnapshotTheirOldPublicKeyKey];
+    NSData *counters = dictionary[kOTRSessionSnapshotCountersKey];
+    NSData *savedMACKeys = dictionary[kOTRSessionSnapshotSavedMACKeysKey];
+    NSArray<NSString*> *numberKeys = @[kOTRSessionSnapshotOurInstanceKey, kOTRSessionSnapshotTheirInstanceKey, kOTRSessionSnapshotVersionKey, kOTRSessionSnapshotSessionIDHalfKey, kOTRSessionSnapshotGenerationKey, kOTRSessionSnapshotLastSentKey, kOTRSessionSnapshotLastReceivedKey, kOTRSessionSnapshotOurKeyIDKey, kOTRSessionSnapshotOurKeyGroupKey, kOTRSessionSnapshotOurOldKeyGroupKey, kOTRSessionSnapshotTheirKeyIDKey];
+    for (NSString *key in numberKeys) {
+        if (!is_number(dictionary[key])) {
+            return nil;
+        }
+    }
+    if (![username isKindOfClass:[NSString class]] ||
+        ![accountName isKindOfClass:[NSString class]] ||
+        ![protocol isKindOfClass:[NSString class]] ||
+        !is_data(fingerprint) || fingerprint.length != kOTRSessionSnapshotFingerprintLength ||
+        !is_data(sessionID) ||
+        !is_data(ourPrivateKey) || !is_data(ourPublicKey) || !is_data(theirPublicKey) ||
+        (ourOldPrivateKey && !is_data(ourOldPrivateKey)) ||
+        (ourOldPublicKey && !is_data(ourOldPublicKey)) ||
+        (theirOldPublicKey && !is_data(theirOldPublicKey)) ||
+        !is_data(counters) || counters.length != kOTRSessionSnapshotCounterLength ||
+        !is_data(savedMACKeys) || savedMACKeys.length % 20 != 0) {
+        return nil;
+    }
+    if (self = [super init]) {
+        _username = [username copy];
+        _accountName = [accountName copy];
+        _protocol = [protocol copy];
+        _ourInstanceTag = [dictionary[kOTRSessionSnapshotOurInstanceKey] unsignedIntValue];
+        _theirInstanceTag = [dictionary[kOTRSessionSnapshotTheirInstanceKey] unsignedIntValue];
+        _protocolVersion = [dictionary[kOTRSessionSnapshotVersionKey] unsignedIntegerValue];
+        _fingerprint = fingerprint;
+        _sessionID = sessionID;
+        _sessionIDHalf = [dictionary[kOTRSessionSnapshotSessionIDHalfKey] intValue] == OTRL_SESSIONID_SECOND_HALF_BOLD ? OTRL_SESSIONID_SECOND_HALF_BOLD : OTRL_SESSIONID_FIRST_HALF_BOLD;
+        _generation = [dictionary[kOTRSessionSnapshotGenerationKey] unsignedIntValue];
+        _lastSent = [NSDate dateWithTimeIntervalSince1970:[dictionary[kOTRSessionSnapshotLastSentKey] doubleValue]];
+        _lastReceived = [NSDate dateWithTimeIntervalSince1970:[dictionary[kOTRSessionSnapshotLastReceivedKey] doubleValue]];
+        _ourKeyID = [dictionary[kOTRSessionSnapshotOurKeyIDKey] unsignedIntValue];
+        _ourKeyGroup = [dictionary[kOTRSessionSnapshotOurKeyGroupKey] unsignedIntValue];
+        _ourPrivateKey = ourPrivateKey;
+        _ourPublicKey = ourPublicKey;
+        _ourOldKeyGroup = [dictionary[kOTRSessionSnapshotOurOldKeyGroupKey] unsignedIntValue];
+        _ourOldPrivateKey = ourOldPrivateKey;
+        _ourOldPublicKey = ourOldPublicKey;
+        _theirKeyID = [dictionary[kOTRSessionSnapshotTheirKeyIDKey] unsignedIntValue];
+        _theirPublicKey = theirPublicKey;
+        _theirOldPublicKey = theirOldPublicKey;
+        _counters = counters;
+        _savedMACKeys = savedMACKeys;
+    }
+    return self;
+}
+
+- (NSDictionary<NSString*, id>*) dictionaryRepresentation {
+    NSMutableDictionary<NSString*, id> *dictionary = [@{kOTRSessionSnapshotUsernameKey: self.username,
+                                                        kOTRSessionSnapshotAccountNameKey: self.accountName,
+                                                        kOTRSessionSnapshotProtocolKey: self.protocol,
+                                                        kOTRSessionSnapshotOurInstanceKey: @(self.ourInstanceTag),
+                                                        kOTRSessionSnapshotTheirInstanceKey: @(self.theirInstanceTag),
+                                                        kOTRSessionSnapshotVersionKey: @(self.protocolVersion),
+                                                        kOTRSessionSnapshotFingerprintKey: self.fingerprint,
+                                                        kOTRSessionSnapshotSessionIDKey: self.sessionID,
+                                                        kOTRSessionSnapshotSessionIDHalfKey: @(self.sessionIDHalf),
+                                                        kOTRSessionSnapshotGenerationKey: @(self.generation),
+                                                        kOTRSessionSnapshotLastSentKey: @(self.lastSent.timeIntervalSince1970),
+                                                        kOTRSessionSnapshotLastReceivedKey: @(self.lastReceived.timeIntervalSince1970),
+                                                        kOTRSessionSnapshotOurKeyIDKey: @(self.ourKeyID),
+                                                        kOTRSessionSnapshotOurKeyGroupKey: @(self.ourKeyGroup),
+                                                        kOTRSessionSnapshotOurPrivateKeyKey: self.ourPrivateKey,
+                                                        kOTRSessionSnapshotOurPublicKeyKey: self.ourPublicKey,
+                                                        kOTRSessionSnapshotOurOldKeyGroupKey: @(self.ourOldKeyGroup),
+                                                        kOTRSessionSnapshotTheirKeyIDKey: @(self.theirKeyID),
+                                                        kOTRSessionSnapshotTheirPublicKeyKey: self.theirPublicKey,
+                                                        kOTRSessionSnapshotCountersKey: self.counters,
+                                                        kOTRSessionSnapshotSavedMACKeysKey: self.savedMACKeys} mutableCopy];
+    dictionary[kOTRSessionSnapshotOurOldPrivateKeyKey] = self.ourOldPrivateKey;
+    dictionary[kOTRSessionSnapshotOurOldPublicKeyKey] = self.ourOldPublicKey;
+    dictionary[kOTRSessionSnapshotTheirOldPublicKeyKey] = self.theirOldPublicKey;
+    return dictionary;
+}
+
++ (nullable NSData*) encryptedDataWithSnapshots:(NSArray<OTRSessionSnapshot*>*)snapshots key:(NSData*)key error:(NSError**)error {
+    NSMutableArray<NSDictionary*> *dictionaries = [NSMutableArray arrayWithCapacity:snapshots.count];
+    for (OTRSessionSnapshot *snapshot in snapshots) {
+        [dictionaries addObject:[snapshot dictionaryRepresentation]];
+    }
+    NSData *plist = [NSPropertyListSerialization dataWithPropertyList:dictionaries format:NSPropertyListBinaryFormat_v1_0 options:0 error:error];
+    if (!plist) {
+        return nil;
+    }
+    NSMutableData *iv = [NSMutableData dataWithLength:kOTRSessionSnapshotIVLength];
+    gcry_create_nonce(iv.mutableBytes, iv.length);
+    OTRCryptoData *encrypted = [OTRCryptoUtility encryptAESGCMData:plist key:key iv:iv error:error];
+    if (!encrypted) {
+        return nil;
+    }
+    NSMutableData *data = [NSMutableData dataWithCapacity:sizeof(kOTRSessionSnapshotMagic) + 1 + iv.length + encrypted.authTag.length + encrypted.data.length];
+    [data appendBytes:kOTRSessionSnapshotMagic length:sizeof(kOTRSessionSnapshotMagic)];
+    [data appendBytes:&kOTRSessionSnapshotFormatVersion length:1];
+    [data appendData:iv];
+    [data appendData:encrypted.authTag];
+    [data appendData:encrypted.data];
+    return data;
+}
+
++ (nullable NSArray<OTRSessionSnapshot*>*) snapshotsWithEncryptedData:(NSData*)data key:(NSData*)key error:(NSError**)error {
+    NSUInteger headerLength = sizeof(kOTRSessionSnapshotMagic) + 1;
+    const uint8_t *bytes = data.bytes;
+    if (data.length < headerLength + kOTRSessionSnapshotIVLength + kOTRSessionSnapshotTagLength ||
+        memcmp(bytes, kOTRSessionSnapshotMagic, sizeof(kOTRSessionSnapshotMagic)) != 0 ||
+        bytes[sizeof(kOTRSessionSnapshotMagic)] != kOTRSessionSnapshotFormatVersion) {
+        if (error) {
+            *error = [OTRErrorUtility errorForGPGError:GPG_ERR_INV_DATA];
+        }
+        return nil;
+    }
+    NSData *iv = [data subdataWithRange:NSMakeRange(headerLength, kOTRSessionSnapshotIVLength)];
+    NSData *tag = [data subdataWithRange:NSMakeRange(headerLength + kOTRSessionSnapshotIVLength, kOTRSessionSnapshotTagLength)];
+    NSUInteger ciphertextOffset = headerLength + kOTRSessionSnapshotIVLength + kOTRSessionSnapshotTagLength;
+    NSData *ciphertext = [data subdataWithRange:NSMakeRange(ciphertextOffset, data.length - ciphertextOffset)];
+    OTRCryptoData *encrypted = [[OTRCryptoData alloc] initWithData:ciphertext authTag:tag];
+    NSData *plist = [OTRCryptoUtility decryptAESGCMData:encrypted key:key iv:iv error:error];
+    if (!plist) {
+        return nil;
+    }
+    NSArray *dictionaries = [NSPropertyListSerialization propertyListWithData:plist options:NSPropertyListImmutable format:NULL error:error];
+    if (!dictionaries) {
+        return nil;
+    }
+    if (![dictionaries isKindOfClass:[NSArray class]]) {
+        if (error) {
+            *error = [OTRErrorUtility errorForGPGError:GPG_ERR_INV_DATA];
+        }
+        return nil;
+    }
+    NSMutableArray<OTRSessionSnapshot*> *snapshots = [NSMutableArray arrayWithCapacity:dictionaries.count];
+    for (NSDictionary *dictionary in dictionaries) {
+        OTRSessionSnapshot *snapshot = [[OTRSessionSnapshot alloc] initWithDictionary:dictionary];
+        if (!snapshot) {
+            if (error) {
+                *error = [OTRErrorUtility errorForGPGError:GPG_ERR_INV_DATA];
+            }
+            return nil;
+        }
+        [snapshots addObject:snapshot];
+    }
+    return snapshots;
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p %@ %@ %@ v%d instance: %08x>", NSStringFromClass([self class]), self, self.username, self.accountName, self.protocol, (int)self.protocolVersion, self.theirInstanceTag];
+}
+
+@end
@@ -0,0 +1,25 @@
+//
+//  OTRSymmetricKeyUse.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+/** What an OTR extra symmetric key will be used for. Sent to the buddy in an OTRTLVTypeSymmetricKey TLV. */
+@interface OTRSymmetricKeyUse : NSObject
+
+/** Integer tag describing the use of the key, sent as 4 bytes */
+@property (nonatomic, readonly) NSUInteger use;
+/** Use-specific data, e.g. which file */
+@property (nonatomic, copy, readonly, nullable) NSData *useData;
+
+- (instancetype) initWithUse:(NSUInteger)use useData:(nullable NSData*)useData NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+@end
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,26 @@
+//
+//  OTRSymmetricKeyUse.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRSymmetricKeyUse.h"
+
+@implementation OTRSymmetricKeyUse
+
+- (instancetype) initWithUse:(NSUInteger)use useData:(nullable NSData*)useData {
+    NSParameterAssert(use <= UINT32_MAX);
+    if (self = [super init]) {
+        _use = use;
+        _useData = [useData copy];
+    }
+    return self;
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p use: %lu useData: %lu bytes>", NSStringFromClass([self class]), self, (unsigned long)self.use, (unsigned long)self.useData.length];
+}
+
+@end
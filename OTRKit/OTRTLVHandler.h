@@ -15,7 +15,8 @@ NS_ASSUME_NONNULL_BEGIN
 @protocol OTRTLVHandler <NSObject>
 
 /**
- *  Process OTRTLV.
+ *  Process OTRTLV. Called on the targetQueue passed to registerTLVHandler:targetQueue:,
+ *  or synchronously on OTRKit's internal queue if there was none.
  *  @see OTRTLV
  *
  *  @param tlv      OTRTLV object
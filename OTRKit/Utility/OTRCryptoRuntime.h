@@ -0,0 +1,97 @@
+//
+//  OTRCryptoRuntime.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(NSUInteger, OTRCryptoRandomMode) {
+    /** The operating system's CSPRNG. Fastest safe choice, no pool to seed. */
+    OTRCryptoRandomModeSystem = 0,
+    /** libgcrypt's own CSPRNG pool, seeded from the system */
+    OTRCryptoRandomModeStandard = 1
+};
+
+NS_ASSUME_NONNULL_BEGIN
+@interface OTRCryptoRuntimeConfiguration : NSObject <NSCopying>
+
+/**
+ *  Size of the locked arena secure allocations (keys, MPIs, cipher handles)
+ *  are served from. Requests that don't fit fall back to the heap, still
+ *  wiped on free. 0 disables the arena. Defaults to 512 KiB.
+ */
+@property (nonatomic, readwrite) NSUInteger secureMemorySize;
+
+/** Defaults to OTRCryptoRandomModeSystem */
+@property (nonatomic, readwrite) OTRCryptoRandomMode randomMode;
+
+/** Seed the RNG on a background queue right after setup so the first AKE doesn't wait. Defaults to YES. */
+@property (nonatomic, readwrite) BOOL prewarmsEntropy;
+
+/** Same as init */
++ (instancetype) defaultConfiguration;
+
+@end
+
+/** Snapshot of secure memory use, high-water marks are since setup or the last reset */
+@interface OTRSecureMemoryStats : NSObject
+
+@property (nonatomic, readonly) NSUInteger arenaSize;
+/** NO if the system wouldn't lock the arena into RAM, it's still used */
+@property (nonatomic, readonly) BOOL arenaLocked;
+/** Arena bytes handed out, counting whole size-class slots */
+@property (nonatomic, readonly) NSUInteger arenaBytesInUse;
+@property (nonatomic, readonly) NSUInteger arenaHighWaterMark;
+/** Bytes requested by live secure allocations, in the arena or not */
+@property (nonatomic, readonly) NSUInteger secureBytesInUse;
+@property (nonatomic, readonly) NSUInteger secureHighWaterMark;
+@property (nonatomic, readonly) NSUInteger secureAllocationCount;
+/** Secure allocations served from the heap because the arena was full or they were too large */
+@property (nonatomic, readonly) NSUInteger fallbackAllocationCount;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+@end
+
+/**
+ *  One-time process-wide setup of libgcrypt and libotr.
+ *
+ *  OTRKit and OTRCryptoUtility set up with defaultConfiguration the first
+ *  time they're used. To change the configuration, call
+ *  setUpWithConfiguration:error: before that, e.g. at app launch. Setup is
+ *  thread safe and runs once, libgcrypt handles its own thread locking.
+ *
+ *  libotr replaces libgcrypt's allocator with one that treats all memory as
+ *  secure and wipes it on free, so libgcrypt's own secure memory pool is
+ *  never used. The runtime keeps that behaviour and adds the arena.
+ */
+@interface OTRCryptoRuntime : NSObject
+
+/**
+ *  @return NO with a GPG_ERR_INV_STATE error if the runtime was already set up
+ */
++ (BOOL) setUpWithConfiguration:(OTRCryptoRuntimeConfiguration*)configuration error:(NSError**)error;
+
+/** Sets up with defaultConfiguration unless already set up */
++ (void) setUp;
+
+/** nil until set up */
+@property (class, nonatomic, readonly, nullable) OTRCryptoRuntimeConfiguration *configuration;
+
+/**
+ *  How much of the arena new slots may be carved from, for benchmarking
+ *  smaller arenas without restarting. Slots already carved stay in use.
+ *  Defaults to the whole arena.
+ */
+@property (class, atomic, readwrite) NSUInteger secureMemoryLimit;
+
++ (OTRSecureMemoryStats*) secureMemoryStats;
+
+/** Restarts high-water marks from current use */
++ (void) resetHighWaterMarks;
+
+@end
+NS_ASSUME_NONNULL_END
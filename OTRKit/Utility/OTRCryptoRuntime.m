@@ -0,0 +1,379 @@
+//
+//  OTRCryptoRuntime.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRCryptoRuntime.h"
+#import "OTRErrorUtility.h"
+#import "gcrypt.h"
+#import <libotr/proto.h>
+#import <stdatomic.h>
+#import <pthread.h>
+#import <sys/mman.h>
+
+static const NSUInteger kOTRCryptoRuntimeDefaultSecureMemorySize = 512 * 1024;
+
+/** Arena slots are 64 bytes to 16 KiB in powers of two */
+#define OTR_ARENA_CLASS_COUNT 9
+static const size_t kOTRArenaMinimumSlotSize = 64;
+static const size_t kOTRArenaMaximumSlotSize = 64 << (OTR_ARENA_CLASS_COUNT - 1);
+
+/** Precedes every arena block, keeps the payload 16 byte aligned */
+typedef struct {
+    /** Bytes requested */
+    size_t size;
+    size_t sizeClass;
+} OTRArenaHeader;
+
+/**
+ *  Heap blocks use libotr's layout, one size_t holding the total size
+ *  including the header, so blocks libotr allocated during OTRL_INIT can
+ *  be freed by us. The top bit marks blocks that were requested as secure.
+ */
+static const size_t kOTRHeapHeaderSize = sizeof(size_t);
+static const size_t kOTRHeapSecureFlag = (size_t)1 << (sizeof(size_t) * 8 - 1);
+
+static uint8_t *OTRArenaStart = NULL;
+static size_t OTRArenaSize = 0;
+static BOOL OTRArenaLocked = NO;
+static _Atomic(size_t) OTRArenaBump;
+static _Atomic(size_t) OTRArenaLimit;
+static pthread_mutex_t OTRArenaLocks[OTR_ARENA_CLASS_COUNT];
+/** Freed slots per size class, linked through their first word */
+static void *OTRArenaFreeLists[OTR_ARENA_CLASS_COUNT];
+
+static _Atomic(size_t) OTRArenaBytesInUse;
+static _Atomic(size_t) OTRArenaHighWaterMark;
+static _Atomic(size_t) OTRSecureBytesInUse;
+static _Atomic(size_t) OTRSecureHighWaterMark;
+static _Atomic(size_t) OTRSecureAllocationCount;
+static _Atomic(size_t) OTRFallbackAllocationCount;
+
+static void OTRRaiseHighWaterMark(_Atomic(size_t) *highWaterMark, size_t value) {
+    size_t current = atomic_load(highWaterMark);
+    while (value > current && !atomic_compare_exchange_weak(highWaterMark, &current, value)) {
+    }
+}
+
+/** Called through a volatile pointer so the wipe isn't optimized away before free */
+static void *(*const volatile OTRMemset)(void*, int, size_t) = memset;
+
+static void OTRWipe(void *p, size_t n) {
+    if (n) {
+        OTRMemset(p, 0, n);
+    }
+}
+
+static BOOL OTRIsArenaPointer(const void *p) {
+    return OTRArenaStart && (const uint8_t*)p >= OTRArenaStart && (const uint8_t*)p < OTRArenaStart + OTRArenaSize;
+}
+
+#pragma mark Arena
+
+static void *OTRArenaAlloc(size_t n) {
+    if (!OTRArenaStart) {
+        return NULL;
+    }
+    size_t needed = n + sizeof(OTRArenaHeader);
+    if (needed < n || needed > kOTRArenaMaximumSlotSize) {
+        return NULL;
+    }
+    size_t sizeClass = 0;
+    size_t slotSize = kOTRArenaMinimumSlotSize;
+    while (slotSize < needed) {
+        slotSize <<= 1;
+        sizeClass++;
+    }
+    pthread_mutex_lock(&OTRArenaLocks[sizeClass]);
+    OTRArenaHeader *header = OTRArenaFreeLists[sizeClass];
+    if (header) {
+        OTRArenaFreeLists[sizeClass] = *(void**)header;
+    }
+    pthread_mutex_unlock(&OTRArenaLocks[sizeClass]);
+    if (!header) {
+        size_t offset = atomic_load(&OTRArenaBump);
+        do {
+            if (offset + slotSize > atomic_load(&OTRArenaLimit)) {
+                return NULL;
+            }
+        } while (!atomic_compare_exchange_weak(&OTRArenaBump, &offset, offset + slotSize));
+        header = (OTRArenaHeader*)(OTRArenaStart + offset);
+    }
+    header->size = n;
+    header->sizeClass = sizeClass;
+    OTRRaiseHighWaterMark(&OTRArenaHighWaterMark, atomic_fetch_add(&OTRArenaBytesInUse, slotSize) + slotSize);
+    return header + 1;
+}
+
+static void OTRArenaFree(void *p) {
+    OTRArenaHeader *header = (OTRArenaHeader*)p - 1;
+    size_t sizeClass = header->sizeClass;
+    atomic_fetch_sub(&OTRSecureBytesInUse, header->size);
+    OTRWipe(p, header->size);
+    atomic_fetch_sub(&OTRArenaBytesInUse, kOTRArenaMinimumSlotSize << sizeClass);
+    pthread_mutex_lock(&OTRArenaLocks[sizeClass]);
+    *(void**)header = OTRArenaFreeLists[sizeClass];
+    OTRArenaFreeLists[sizeClass] = header;
+    pthread_mutex_unlock(&OTRArenaLocks[sizeClass]);
+}
+
+#pragma mark Heap
+
+static void *OTRHeapAlloc(size_t n, BOOL secure) {
+    size_t total = n + kOTRHeapHeaderSize;
+    if (total < n || (total & kOTRHeapSecureFlag)) {
+        return NULL;
+    }
+    size_t *p = malloc(total);
+    if (!p) {
+        return NULL;
+    }
+    p[0] = total | (secure ? kOTRHeapSecureFlag : 0);
+    return (uint8_t*)p + kOTRHeapHeaderSize;
+}
+
+static void OTRHeapFree(void *p) {
+    size_t *real_p = (size_t*)((uint8_t*)p - kOTRHeapHeaderSize);
+    size_t total = real_p[0] & ~kOTRHeapSecureFlag;
+    if (real_p[0] & kOTRHeapSecureFlag) {
+        atomic_fetch_sub(&OTRSecureBytesInUse, total - kOTRHeapHeaderSize);
+    }
+    OTRWipe(real_p, total);
+    free(real_p);
+}
+
+#pragma mark libgcrypt allocation handlers
+
+static void *OTRAllocSecure(size_t n) {
+    void *p = OTRArenaAlloc(n);
+    if (!p) {
+        p = OTRHeapAlloc(n, YES);
+        if (!p) {
+            return NULL;
+        }
+        atomic_fetch_add(&OTRFallbackAllocationCount, 1);
+    }
+    atomic_fetch_add(&OTRSecureAllocationCount, 1);
+    OTRRaiseHighWaterMark(&OTRSecureHighWaterMark, atomic_fetch_add(&OTRSecureBytesInUse, n) + n);
+    return p;
+}
+
+static void *OTRAlloc(size_t n) {
+    return OTRHeapAlloc(n, NO);
+}
+
+/** Like libotr, everything counts as secure so libgcrypt never copies into plain memory */
+static int OTRIsSecure(const void *p) {
+    return 1;
+}
+
+static void OTRFree(void *p) {
+    if (!p) {
+        return;
+    }
+    if (OTRIsArenaPointer(p)) {
+        OTRArenaFree(p);
+    } else {
+        OTRHeapFree(p);
+    }
+}
+
+static void *OTRRealloc(void *p, size_t n) {
+    if (!p) {
+        return OTRAlloc(n);
+    }
+    if (!n) {
+        OTRFree(p);
+        return NULL;
+    }
+    size_t oldSize = 0;
+    BOOL secure = YES;
+    if (OTRIsArenaPointer(p)) {
+        OTRArenaHeader *header = (OTRArenaHeader*)p - 1;
+        oldSize = header->size;
+        size_t capacity = (kOTRArenaMinimumSlotSize << header->sizeClass) - sizeof(OTRArenaHeader);
+        if (n <= capacity) {
+            if (n < oldSize) {
+                OTRWipe((uint8_t*)p + n, oldSize - n);
+                atomic_fetch_sub(&OTRSecureBytesInUse, oldSize - n);
+            } else {
+                OTRRaiseHighWaterMark(&OTRSecureHighWaterMark, atomic_fetch_add(&OTRSecureBytesInUse, n - oldSize) + n - oldSize);
+            }
+            header->size = n;
+            return p;
+        }
+    } else {
+        size_t *real_p = (size_t*)((uint8_t*)p - kOTRHeapHeaderSize);
+        secure = (real_p[0] & kOTRHeapSecureFlag) != 0;
+        oldSize = (real_p[0] & ~kOTRHeapSecureFlag) - kOTRHeapHeaderSize;
+        if (n <= oldSize) {
+            // Shrink in place like libotr, the tail is wiped now and the rest on free
+            OTRWipe((uint8_t*)p + n, oldSize - n);
+            if (secure) {
+                atomic_fetch_sub(&OTRSecureBytesInUse, oldSize - n);
+            }
+            real_p[0] = (n + kOTRHeapHeaderSize) | (secure ? kOTRHeapSecureFlag : 0);
+            return p;
+        }
+    }
+    void *newP = secure ? OTRAllocSecure(n) : OTRAlloc(n);
+    if (!newP) {
+        return NULL;
+    }
+    memcpy(newP, p, oldSize);
+    OTRFree(p);
+    return newP;
+}
+
+static void OTRInstallAllocationHandlers(size_t arenaSize) {
+    for (NSUInteger i = 0; i < OTR_ARENA_CLASS_COUNT; i++) {
+        pthread_mutex_init(&OTRArenaLocks[i], NULL);
+    }
+    atomic_init(&OTRArenaBump, 0);
+    atomic_init(&OTRArenaLimit, 0);
+    if (arenaSize) {
+        size_t pageSize = (size_t)getpagesize();
+        arenaSize = (arenaSize + pageSize - 1) / pageSize * pageSize;
+        void *arena = mmap(NULL, arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (arena != MAP_FAILED) {
+            OTRArenaStart = arena;
+            OTRArenaSize = arenaSize;
+            OTRArenaLocked = (mlock(arena, arenaSize) == 0);
+            atomic_store(&OTRArenaLimit, arenaSize);
+        }
+    }
+    gcry_set_allocation_handler(OTRAlloc, OTRAllocSecure, OTRIsSecure, OTRRealloc, OTRFree);
+}
+
+@implementation OTRCryptoRuntimeConfiguration
+
+- (instancetype) init {
+    if (self = [super init]) {
+        _secureMemorySize = kOTRCryptoRuntimeDefaultSecureMemorySize;
+        _randomMode = OTRCryptoRandomModeSystem;
+        _prewarmsEntropy = YES;
+    }
+    return self;
+}
+
++ (instancetype) defaultConfiguration {
+    return [[self alloc] init];
+}
+
+- (id) copyWithZone:(nullable NSZone *)zone {
+    OTRCryptoRuntimeConfiguration *configuration = [[[self class] alloc] init];
+    configuration.secureMemorySize = self.secureMemorySize;
+    configuration.randomMode = self.randomMode;
+    configuration.prewarmsEntropy = self.prewarmsEntropy;
+    return configuration;
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p> secureMemorySize: %d randomMode: %d prewarmsEntropy: %d", NSStringFromClass([self class]), self, (int)self.secureMemorySize, (int)self.randomMode, (int)self.prewarmsEntropy];
+}
+
+@end
+
+@interface OTRSecureMemoryStats ()
+- (instancetype) initWithCurrentUse;
+@end
+
+@implementation OTRSecureMemoryStats
+
+- (instancetype) initWithCurrentUse {
+    if (self = [super init]) {
+        _arenaSize = OTRArenaSize;
+        _arenaLocked = OTRArenaLocked;
+        _arenaBytesInUse = atomic_load(&OTRArenaBytesInUse);
+        _arenaHighWaterMark = atomic_load(&OTRArenaHighWaterMark);
+        _secureBytesInUse = atomic_load(&OTRSecureBytesInUse);
+        _secureHighWaterMark = atomic_load(&OTRSecureHighWaterMark);
+        _secureAllocationCount = atomic_load(&OTRSecureAllocationCount);
+        _fallbackAllocationCount = atomic_load(&OTRFallbackAllocationCount);
+    }
+    return self;
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p> arena: %d/%d bytes (high %d, locked %d) secure: %d bytes (high %d) allocations: %d fallbacks: %d", NSStringFromClass([self class]), self, (int)self.arenaBytesInUse, (int)self.arenaSize, (int)self.arenaHighWaterMark, (int)self.arenaLocked, (int)self.secureBytesInUse, (int)self.secureHighWaterMark, (int)self.secureAllocationCount, (int)self.fallbackAllocationCount];
+}
+
+@end
+
+static OTRCryptoRuntimeConfiguration *OTRCryptoRuntimeCurrentConfiguration = nil;
+
+@implementation OTRCryptoRuntime
+
++ (BOOL) setUpWithConfiguration:(OTRCryptoRuntimeConfiguration*)configuration error:(NSError**)error {
+    NSParameterAssert(configuration != nil);
+    configuration = [configuration copy] ?: [OTRCryptoRuntimeConfiguration defaultConfiguration];
+    __block BOOL didSetUp = NO;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        [self performSetUpWithConfiguration:configuration];
+        didSetUp = YES;
+    });
+    if (!didSetUp && error) {
+        *error = [OTRErrorUtility errorForGPGError:GPG_ERR_INV_STATE];
+    }
+    return didSetUp;
+}
+
++ (void) setUp {
+    if (OTRCryptoRuntimeCurrentConfiguration) {
+        return;
+    }
+    [self setUpWithConfiguration:[OTRCryptoRuntimeConfiguration defaultConfiguration] error:nil];
+}
+
+/** Only called once */
++ (void) performSetUpWithConfiguration:(OTRCryptoRuntimeConfiguration*)configuration {
+    gcry_check_version(NULL);
+    // Only takes effect before the RNG is first used
+    if (configuration.randomMode == OTRCryptoRandomModeSystem) {
+        gcry_control(GCRYCTL_SET_PREFERRED_RNG_TYPE, GCRY_RNG_TYPE_SYSTEM);
+    } else {
+        gcry_control(GCRYCTL_SET_PREFERRED_RNG_TYPE, GCRY_RNG_TYPE_STANDARD);
+    }
+    gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+    OTRL_INIT;
+    // Must follow OTRL_INIT straight away, it installs libotr's handlers
+    OTRInstallAllocationHandlers(configuration.secureMemorySize);
+    if (configuration.prewarmsEntropy) {
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+            gcry_fast_poll();
+            uint8_t buffer[32];
+            gcry_randomize(buffer, sizeof(buffer), GCRY_STRONG_RANDOM);
+            gcry_create_nonce(buffer, sizeof(buffer));
+            OTRWipe(buffer, sizeof(buffer));
+        });
+    }
+    OTRCryptoRuntimeCurrentConfiguration = configuration;
+}
+
++ (nullable OTRCryptoRuntimeConfiguration*) configuration {
+    return [OTRCryptoRuntimeCurrentConfiguration copy];
+}
+
++ (NSUInteger) secureMemoryLimit {
+    return atomic_load(&OTRArenaLimit);
+}
+
++ (void) setSecureMemoryLimit:(NSUInteger)secureMemoryLimit {
+    [self setUp];
+    atomic_store(&OTRArenaLimit, MIN(secureMemoryLimit, OTRArenaSize));
+}
+
++ (OTRSecureMemoryStats*) secureMemoryStats {
+    return [[OTRSecureMemoryStats alloc] initWithCurrentUse];
+}
+
++ (void) resetHighWaterMarks {
+    atomic_store(&OTRArenaHighWaterMark, atomic_load(&OTRArenaBytesInUse));
+    atomic_store(&OTRSecureHighWaterMark, atomic_load(&OTRSecureBytesInUse));
+}
+
+@end
@@ -8,6 +8,7 @@
 
 #import "OTRCryptoUtility.h"
 #import "OTRErrorUtility.h"
+#import "OTRCryptoRuntime.h"
 #import "gcrypt.h"
 
 typedef NS_ENUM(NSUInteger, OTRCryptoMode) {
@@ -25,8 +26,7 @@ typedef NS_ENUM(NSUInteger, OTRCryptoMode) {
 @implementation OTRCryptoData
 
 + (void) initialize {
-    // This is needed to suppress the initialization warning
-    gcry_check_version(NULL);
+    [OTRCryptoRuntime setUp];
 }
 
 - (instancetype) init {
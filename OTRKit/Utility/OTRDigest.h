@@ -0,0 +1,53 @@
+//
+//  OTRDigest.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(NSUInteger, OTRDigestAlgorithm) {
+    /** 20 byte digest, used for OTRDATA File-Hash-SHA1 */
+    OTRDigestAlgorithmSHA1 = 0,
+    /** 32 byte digest */
+    OTRDigestAlgorithmSHA256 = 1
+};
+
+NS_ASSUME_NONNULL_BEGIN
+/**
+ *  Incremental hash backed by libgcrypt, which picks hardware accelerated
+ *  implementations where the CPU has them. Not thread safe, use one per
+ *  stream.
+ */
+@interface OTRDigest : NSObject
+
+@property (nonatomic, readonly) OTRDigestAlgorithm algorithm;
+/** Length of finalDigest in bytes */
+@property (nonatomic, readonly) NSUInteger digestLength;
+
+/** Returns nil if libgcrypt can't open the algorithm */
+- (nullable instancetype) initWithAlgorithm:(OTRDigestAlgorithm)algorithm NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+/** Ignored after finalDigest until reset */
+- (void) updateWithBytes:(const void*)bytes length:(NSUInteger)length;
+
+/** Hashes every byte range, so dispatch_data backed NSData isn't flattened first */
+- (void) updateWithData:(NSData*)data;
+
+/** Finishes the hash. Calling it again returns the same digest. */
+- (NSData*) finalDigest;
+
+/** Starts over for a new stream */
+- (void) reset;
+
++ (NSUInteger) digestLengthForAlgorithm:(OTRDigestAlgorithm)algorithm;
+
+/** One-shot hash of data */
++ (NSData*) digestWithAlgorithm:(OTRDigestAlgorithm)algorithm data:(NSData*)data;
+
+@end
+NS_ASSUME_NONNULL_END
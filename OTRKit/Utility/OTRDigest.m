@@ -0,0 +1,106 @@
+//
+//  OTRDigest.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRDigest.h"
+#import "OTRCryptoRuntime.h"
+#import "gcrypt.h"
+
+static int OTRGcryptAlgorithm(OTRDigestAlgorithm algorithm) {
+    switch (algorithm) {
+        case OTRDigestAlgorithmSHA256:
+            return GCRY_MD_SHA256;
+        case OTRDigestAlgorithmSHA1:
+        default:
+            return GCRY_MD_SHA1;
+    }
+}
+
+@interface OTRDigest () {
+    gcry_md_hd_t _handle;
+}
+@property (nonatomic, strong, nullable) NSData *digest;
+@end
+
+@implementation OTRDigest
+
++ (void) initialize {
+    [OTRCryptoRuntime setUp];
+}
+
+- (nullable instancetype) initWithAlgorithm:(OTRDigestAlgorithm)algorithm {
+    if (self = [super init]) {
+        _algorithm = algorithm;
+        _digestLength = [[self class] digestLengthForAlgorithm:algorithm];
+        if (gcry_md_open(&_handle, OTRGcryptAlgorithm(algorithm), 0) != GPG_ERR_NO_ERROR) {
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void) dealloc {
+    if (_handle) {
+        gcry_md_close(_handle);
+    }
+}
+
+- (void) updateWithBytes:(const void*)bytes length:(NSUInteger)length {
+    NSParameterAssert(!self.digest);
+    if (self.digest || !length) {
+        return;
+    }
+    gcry_md_write(_handle, bytes, length);
+}
+
+- (void) updateWithData:(NSData*)data {
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        [self updateWithBytes:bytes length:byteRange.length];
+    }];
+}
+
+- (NSData*) finalDigest {
+    if (!self.digest) {
+        int algorithm = OTRGcryptAlgorithm(self.algorithm);
+        // gcry_md_read finalizes and the buffer belongs to the handle
+        self.digest = [NSData dataWithBytes:gcry_md_read(_handle, algorithm) length:self.digestLength];
+    }
+    return self.digest;
+}
+
+- (void) reset {
+    gcry_md_reset(_handle);
+    self.digest = nil;
+}
+
++ (NSUInteger) digestLengthForAlgorithm:(OTRDigestAlgorithm)algorithm {
+    return gcry_md_get_algo_dlen(OTRGcryptAlgorithm(algorithm));
+}
+
++ (NSData*) digestWithAlgorithm:(OTRDigestAlgorithm)algorithm data:(NSData*)data {
+    NSUInteger digestLength = [self digestLengthForAlgorithm:algorithm];
+    NSMutableData *digest = [NSMutableData dataWithLength:digestLength];
+    __block NSUInteger rangeCount = 0;
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        rangeCount++;
+        *stop = (rangeCount > 1);
+    }];
+    if (rangeCount > 1) {
+        OTRDigest *incremental = [[OTRDigest alloc] initWithAlgorithm:algorithm];
+        [incremental updateWithData:data];
+        return [incremental finalDigest];
+    }
+    // Contiguous data skips opening a handle
+    gcry_md_hash_buffer(OTRGcryptAlgorithm(algorithm), digest.mutableBytes, data.bytes, data.length);
+    return digest;
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p> algorithm: %d finalized: %d", NSStringFromClass([self class]), self, (int)self.algorithm, self.digest != nil];
+}
+
+@end
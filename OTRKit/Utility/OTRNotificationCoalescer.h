@@ -0,0 +1,61 @@
+//
+//  OTRNotificationCoalescer.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+/** How OTRKit and OTRDataHandler deliver delegate callbacks and completion blocks */
+typedef NS_ENUM(NSUInteger, OTRKitCallbackMode) {
+    /** Dispatched asynchronously to the callbackQueue */
+    OTRKitCallbackModeQueue = 0,
+    /** Called right away on the thread that produced them, see OTRKit's callbackMode */
+    OTRKitCallbackModeInline = 1
+};
+
+/**
+ *  Batches delegate callbacks so bursts of updates reach the callback queue
+ *  as one block instead of one block each.
+ *
+ *  Keyed blocks replace any pending block with the same key, keeping its
+ *  place in line, so only the latest progress or state for a transfer or
+ *  conversation is delivered. They're flushed at most once per
+ *  minimumInterval. Blocks without a key (completions, errors) are never
+ *  dropped and flush right away along with anything pending ahead of them.
+ *  Blocks always run in the order they were first enqueued.
+ *
+ *  Thread safe.
+ */
+@interface OTRNotificationCoalescer : NSObject
+
+/** Queue blocks are delivered on */
+@property (atomic, strong, readwrite) dispatch_queue_t targetQueue;
+
+/**
+ *  Minimum time between flushes of keyed blocks. 0 still batches whatever
+ *  piles up before the flush gets to run.
+ */
+@property (atomic, readwrite) NSTimeInterval minimumInterval;
+
+- (instancetype) initWithTargetQueue:(dispatch_queue_t)targetQueue NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+/**
+ *  @param block block to run on targetQueue
+ *  @param key   pending block with the same key is replaced. nil is never replaced and flushes immediately.
+ */
+- (void) enqueueBlock:(dispatch_block_t)block forKey:(nullable NSString*)key;
+
+/** Drops a pending block, e.g. progress for a transfer that was cancelled */
+- (void) removeBlockForKey:(NSString*)key;
+
+/** Delivers everything pending now */
+- (void) flush;
+
+@end
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,112 @@
+//
+//  OTRNotificationCoalescer.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRNotificationCoalescer.h"
+
+@interface OTRNotificationCoalescer ()
+/** Guards pending state */
+@property (nonatomic, strong, readonly) dispatch_queue_t stateQueue;
+/** Keys of pending blocks in delivery order */
+@property (nonatomic, strong, readonly) NSMutableArray<NSString*> *pendingKeys;
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, dispatch_block_t> *pendingBlocks;
+/** Time the scheduled flush will run, 0 if none */
+@property (nonatomic) CFAbsoluteTime scheduledFlushTime;
+@property (nonatomic) CFAbsoluteTime lastFlushTime;
+/** Unique keys for unkeyed blocks */
+@property (nonatomic) NSUInteger unkeyedCount;
+@end
+
+@implementation OTRNotificationCoalescer
+
+- (instancetype) initWithTargetQueue:(dispatch_queue_t)targetQueue {
+    NSParameterAssert(targetQueue != nil);
+    if (self = [super init]) {
+        _targetQueue = targetQueue;
+        _stateQueue = dispatch_queue_create("OTRNotificationCoalescer State Queue", 0);
+        _pendingKeys = [NSMutableArray array];
+        _pendingBlocks = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (void) enqueueBlock:(dispatch_block_t)block forKey:(nullable NSString*)key {
+    NSParameterAssert(block != nil);
+    if (!block) {
+        return;
+    }
+    dispatch_async(self.stateQueue, ^{
+        NSString *pendingKey = key;
+        if (!pendingKey) {
+            // Keyed blocks can't collide with these, they'd need a leading newline
+            pendingKey = [NSString stringWithFormat:@"\n%lu", (unsigned long)self.unkeyedCount++];
+        }
+        if (![self.pendingBlocks objectForKey:pendingKey]) {
+            [self.pendingKeys addObject:pendingKey];
+        }
+        [self.pendingBlocks setObject:block forKey:pendingKey];
+        [self scheduleFlushImmediately:(key == nil)];
+    });
+}
+
+- (void) removeBlockForKey:(NSString*)key {
+    dispatch_async(self.stateQueue, ^{
+        if ([self.pendingBlocks objectForKey:key]) {
+            [self.pendingBlocks removeObjectForKey:key];
+            [self.pendingKeys removeObject:key];
+        }
+    });
+}
+
+- (void) flush {
+    dispatch_async(self.stateQueue, ^{
+        [self deliverPendingBlocks];
+    });
+}
+
+/** Must be called on stateQueue */
+- (void) scheduleFlushImmediately:(BOOL)immediately {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    CFAbsoluteTime flushTime = now;
+    if (!immediately) {
+        flushTime = MAX(now, self.lastFlushTime + self.minimumInterval);
+    }
+    // An earlier flush is already on its way
+    if (self.scheduledFlushTime && self.scheduledFlushTime <= flushTime) {
+        return;
+    }
+    self.scheduledFlushTime = flushTime;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)((flushTime - now) * NSEC_PER_SEC)), self.stateQueue, ^{
+        // A later flush we replaced still fires, but finds nothing to do
+        if (self.scheduledFlushTime != flushTime) {
+            return;
+        }
+        [self deliverPendingBlocks];
+    });
+}
+
+/** Must be called on stateQueue */
+- (void) deliverPendingBlocks {
+    self.scheduledFlushTime = 0;
+    self.lastFlushTime = CFAbsoluteTimeGetCurrent();
+    if (!self.pendingKeys.count) {
+        return;
+    }
+    NSMutableArray<dispatch_block_t> *blocks = [NSMutableArray arrayWithCapacity:self.pendingKeys.count];
+    for (NSString *key in self.pendingKeys) {
+        [blocks addObject:[self.pendingBlocks objectForKey:key]];
+    }
+    [self.pendingKeys removeAllObjects];
+    [self.pendingBlocks removeAllObjects];
+    dispatch_async(self.targetQueue, ^{
+        for (dispatch_block_t block in blocks) {
+            block();
+        }
+    });
+}
+
+@end
@@ -0,0 +1,52 @@
+//
+//  OTRPriorityScheduler.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(NSUInteger, OTRKitPriority) {
+    /** Typed messages, incoming messages, AKE and SMP */
+    OTRKitPriorityInteractive = 0,
+    /** OTRDATA chunks and background session setup */
+    OTRKitPriorityBulk = 1,
+    /** Poll timer, idle context eviction and other housekeeping */
+    OTRKitPriorityMaintenance = 2
+};
+
+NS_ASSUME_NONNULL_BEGIN
+/**
+ *  Runs blocks on a serial target queue in priority order instead of FIFO.
+ *
+ *  Each priority is a separate lane. Within a lane, blocks are grouped (e.g. by
+ *  conversation) and groups take turns round-robin, so one busy peer can't starve
+ *  the others. Blocks in the same lane and group always run in the order they
+ *  were scheduled. Higher lanes run first, but a lower lane is let through after
+ *  being skipped a few times in a row so bulk work keeps moving.
+ */
+@interface OTRPriorityScheduler : NSObject
+
+/** @param targetQueue must be a serial queue */
+- (instancetype) initWithTargetQueue:(dispatch_queue_t)targetQueue NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+/**
+ *  Schedule a block to run asynchronously on the target queue.
+ *
+ *  @param block    block to run
+ *  @param priority lane to run it in
+ *  @param group    blocks sharing a group run in FIFO order and share a round-robin turn. nil groups together.
+ */
+- (void) scheduleBlock:(dispatch_block_t)block
+              priority:(OTRKitPriority)priority
+                 group:(nullable NSString*)group;
+
+/** Number of blocks waiting to run in a lane */
+- (NSUInteger) pendingCountForPriority:(OTRKitPriority)priority;
+
+@end
+NS_ASSUME_NONNULL_END
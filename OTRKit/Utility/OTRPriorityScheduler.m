@@ -0,0 +1,166 @@
+//
+//  OTRPriorityScheduler.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRPriorityScheduler.h"
+
+static const NSUInteger kOTRPriorityLaneCount = OTRKitPriorityMaintenance + 1;
+/** How many times in a row a waiting lane can be passed over for a higher one */
+static const NSUInteger kOTRPriorityMaxSkips = 8;
+/** Used for nil groups */
+static NSString * const kOTRPriorityDefaultGroup = @"";
+
+/** Blocks waiting in one priority lane */
+@interface OTRPriorityLane : NSObject
+/** Groups with pending blocks, in round-robin order */
+@property (nonatomic, strong, readonly) NSMutableArray<NSString*> *groupOrder;
+@property (nonatomic, strong, readonly) NSMutableDictionary<NSString*, NSMutableArray<dispatch_block_t>*> *blocks;
+@property (nonatomic) NSUInteger count;
+/** Number of times this lane had work but a higher lane went first */
+@property (nonatomic) NSUInteger skipCount;
+@end
+
+@implementation OTRPriorityLane
+
+- (instancetype) init {
+    if (self = [super init]) {
+        _groupOrder = [NSMutableArray array];
+        _blocks = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (void) enqueueBlock:(dispatch_block_t)block group:(NSString*)group {
+    NSMutableArray<dispatch_block_t> *groupBlocks = [self.blocks objectForKey:group];
+    if (!groupBlocks) {
+        groupBlocks = [NSMutableArray array];
+        [self.blocks setObject:groupBlocks forKey:group];
+        [self.groupOrder addObject:group];
+    }
+    [groupBlocks addObject:block];
+    self.count++;
+}
+
+- (nullable dispatch_block_t) dequeueBlock {
+    NSString *group = self.groupOrder.firstObject;
+    if (!group) {
+        return nil;
+    }
+    [self.groupOrder removeObjectAtIndex:0];
+    NSMutableArray<dispatch_block_t> *groupBlocks = [self.blocks objectForKey:group];
+    dispatch_block_t block = groupBlocks.firstObject;
+    [groupBlocks removeObjectAtIndex:0];
+    if (groupBlocks.count) {
+        // Back of the line for this group's next block
+        [self.groupOrder addObject:group];
+    } else {
+        [self.blocks removeObjectForKey:group];
+    }
+    self.count--;
+    return block;
+}
+
+@end
+
+@interface OTRPriorityScheduler ()
+@property (nonatomic, strong, readonly) dispatch_queue_t targetQueue;
+/** Guards lanes */
+@property (nonatomic, strong, readonly) dispatch_queue_t stateQueue;
+@property (nonatomic, strong, readonly) NSArray<OTRPriorityLane*> *lanes;
+@end
+
+@implementation OTRPriorityScheduler
+
+- (instancetype) initWithTargetQueue:(dispatch_queue_t)targetQueue {
+    NSParameterAssert(targetQueue != nil);
+    if (self = [super init]) {
+        _targetQueue = targetQueue;
+        _stateQueue = dispatch_queue_create("OTRPriorityScheduler State Queue", 0);
+        NSMutableArray<OTRPriorityLane*> *lanes = [NSMutableArray arrayWithCapacity:kOTRPriorityLaneCount];
+        for (NSUInteger i = 0; i < kOTRPriorityLaneCount; i++) {
+            [lanes addObject:[[OTRPriorityLane alloc] init]];
+        }
+        _lanes = lanes;
+    }
+    return self;
+}
+
+- (void) scheduleBlock:(dispatch_block_t)block
+              priority:(OTRKitPriority)priority
+                 group:(nullable NSString*)group {
+    NSParameterAssert(block != nil);
+    NSParameterAssert(priority < kOTRPriorityLaneCount);
+    if (!block) {
+        return;
+    }
+    if (priority >= kOTRPriorityLaneCount) {
+        priority = OTRKitPriorityInteractive;
+    }
+    NSString *groupKey = group ?: kOTRPriorityDefaultGroup;
+    dispatch_sync(self.stateQueue, ^{
+        [self.lanes[priority] enqueueBlock:block group:groupKey];
+    });
+    // One pump per block, each pump runs whichever block is next when it gets its turn
+    dispatch_async(self.targetQueue, ^{
+        [self runNextBlock];
+    });
+}
+
+- (NSUInteger) pendingCountForPriority:(OTRKitPriority)priority {
+    if (priority >= kOTRPriorityLaneCount) {
+        return 0;
+    }
+    __block NSUInteger count = 0;
+    dispatch_sync(self.stateQueue, ^{
+        count = self.lanes[priority].count;
+    });
+    return count;
+}
+
+/** Runs on targetQueue */
+- (void) runNextBlock {
+    __block dispatch_block_t block = nil;
+    dispatch_sync(self.stateQueue, ^{
+        block = [self dequeueNextBlock];
+    });
+    if (block) {
+        block();
+    }
+}
+
+/** Must be called on stateQueue */
+- (nullable dispatch_block_t) dequeueNextBlock {
+    // A lane that has waited long enough goes first
+    OTRPriorityLane *nextLane = nil;
+    for (OTRPriorityLane *lane in self.lanes) {
+        if (lane.count && lane.skipCount >= kOTRPriorityMaxSkips) {
+            nextLane = lane;
+            break;
+        }
+    }
+    if (!nextLane) {
+        for (OTRPriorityLane *lane in self.lanes) {
+            if (lane.count) {
+                nextLane = lane;
+                break;
+            }
+        }
+    }
+    if (!nextLane) {
+        return nil;
+    }
+    for (OTRPriorityLane *lane in self.lanes) {
+        if (lane == nextLane) {
+            lane.skipCount = 0;
+        } else if (lane.count) {
+            lane.skipCount++;
+        }
+    }
+    return [nextLane dequeueBlock];
+}
+
+@end
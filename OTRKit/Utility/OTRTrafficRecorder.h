@@ -0,0 +1,140 @@
+//
+//  OTRTrafficRecorder.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <Foundation/Foundation.h>
+#import <OTRKit/OTRTLV.h>
+
+typedef NS_ENUM(NSUInteger, OTRTrafficEventType) {
+    /** Message passed to decodeMessage: */
+    OTRTrafficEventTypeDecode = 0,
+    /** Message returned from encodeMessage: */
+    OTRTrafficEventTypeEncode = 1,
+    /** Protocol message libotr sent through otrKit:injectMessage: */
+    OTRTrafficEventTypeInject = 2
+};
+
+typedef NS_ENUM(NSUInteger, OTRTrafficMessageKind) {
+    /** No OTR prefix, may carry the whitespace tag */
+    OTRTrafficMessageKindPlaintext = 0,
+    /** ?OTR? or ?OTRv23? */
+    OTRTrafficMessageKindQuery = 1,
+    /** DH commit, DH key, reveal signature or signature message */
+    OTRTrafficMessageKindKeyExchange = 2,
+    /** Encrypted data message */
+    OTRTrafficMessageKindData = 3,
+    /** One piece of a fragmented message */
+    OTRTrafficMessageKindFragment = 4,
+    /** ?OTR Error: */
+    OTRTrafficMessageKindError = 5
+};
+
+NS_ASSUME_NONNULL_BEGIN
+/**
+ *  Shape of one message OTRKit handled. Message text, TLV bodies and key
+ *  material are never kept, only their lengths. Names are replaced with
+ *  pseudonyms that are stable within one recording.
+ */
+@interface OTRTrafficEvent : NSObject
+
+@property (nonatomic, readonly) OTRTrafficEventType type;
+/** Seconds since the recorder was started or reset */
+@property (nonatomic, readonly) NSTimeInterval timestamp;
+@property (nonatomic, copy, readonly) NSString *username;
+@property (nonatomic, copy, readonly) NSString *accountName;
+@property (nonatomic, copy, readonly) NSString *protocol;
+/** Kind of the message on the wire */
+@property (nonatomic, readonly) OTRTrafficMessageKind messageKind;
+/** UTF-8 length of the message on the wire */
+@property (nonatomic, readonly) NSUInteger messageLength;
+/** UTF-8 length of the plaintext going into encode or coming out of decode, 0 if none */
+@property (nonatomic, readonly) NSUInteger plaintextLength;
+/** OTRTLVType of each TLV, in order */
+@property (nonatomic, copy, readonly) NSArray<NSNumber*> *tlvTypes;
+/** Body length of each TLV, parallel to tlvTypes */
+@property (nonatomic, copy, readonly) NSArray<NSNumber*> *tlvLengths;
+/** Time spent inside libotr, 0 for injected messages */
+@property (nonatomic, readonly) NSTimeInterval duration;
+
+- (instancetype) initWithType:(OTRTrafficEventType)type
+                    timestamp:(NSTimeInterval)timestamp
+                     username:(NSString*)username
+                  accountName:(NSString*)accountName
+                     protocol:(NSString*)protocol
+                  messageKind:(OTRTrafficMessageKind)messageKind
+                messageLength:(NSUInteger)messageLength
+              plaintextLength:(NSUInteger)plaintextLength
+                     tlvTypes:(NSArray<NSNumber*>*)tlvTypes
+                   tlvLengths:(NSArray<NSNumber*>*)tlvLengths
+                     duration:(NSTimeInterval)duration NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+/** Returns nil if dictionary isn't a valid dictionaryRepresentation */
+- (nullable instancetype) initWithDictionary:(NSDictionary<NSString*, id>*)dictionary;
+
+/** JSON-safe representation */
+- (NSDictionary<NSString*, id>*) dictionaryRepresentation;
+
+/** TLVs with the recorded types and zero-filled bodies of the recorded lengths */
+- (NSArray<OTRTLV*>*) redactedTLVs;
+
++ (OTRTrafficMessageKind) messageKindForMessage:(nullable NSString*)message;
+
+@end
+
+/**
+ *  Collects OTRTrafficEvents from an OTRKit, see OTRKit.trafficRecorder.
+ *  Recording only measures lengths on the calling thread, everything else
+ *  happens on a private queue. Thread safe.
+ */
+@interface OTRTrafficRecorder : NSObject
+
+/** Events recorded so far, in order */
+@property (nonatomic, readonly) NSArray<OTRTrafficEvent*> *events;
+
+/**
+ *  Recording stops once this many events are kept so a forgotten recorder
+ *  can't grow without bound. Defaults to 100000, 0 is unlimited.
+ */
+@property (atomic, readwrite) NSUInteger maximumEventCount;
+
+/** Events not kept because maximumEventCount was reached */
+@property (atomic, readonly) NSUInteger droppedEventCount;
+
+/** Drops all events and pseudonyms and restarts the clock */
+- (void) reset;
+
+/**
+ *  Called by OTRKit. message, plaintext and the TLV bodies are only measured.
+ *
+ *  @param type      where the message was seen
+ *  @param message   message on the wire
+ *  @param plaintext plaintext going into encode or coming out of decode
+ *  @param tlvs      TLVs sent or received along with plaintext
+ *  @param duration  time spent inside libotr
+ */
+- (void) recordEventWithType:(OTRTrafficEventType)type
+                     message:(nullable NSString*)message
+                   plaintext:(nullable NSString*)plaintext
+                        tlvs:(nullable NSArray<OTRTLV*>*)tlvs
+                    username:(NSString*)username
+                 accountName:(NSString*)accountName
+                    protocol:(NSString*)protocol
+                    duration:(NSTimeInterval)duration;
+
+/** All events as a JSON array */
+- (nullable NSData*) JSONDataWithError:(NSError**)error;
+
+- (BOOL) writeToURL:(NSURL*)url error:(NSError**)error;
+
++ (nullable NSArray<OTRTrafficEvent*>*) eventsWithJSONData:(NSData*)data error:(NSError**)error;
+
++ (nullable NSArray<OTRTrafficEvent*>*) eventsWithContentsOfURL:(NSURL*)url error:(NSError**)error;
+
+@end
+NS_ASSUME_NONNULL_END
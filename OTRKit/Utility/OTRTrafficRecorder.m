@@ -0,0 +1,306 @@
+//
+//  OTRTrafficRecorder.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRTrafficRecorder.h"
+#import "OTRErrorUtility.h"
+#import "gcrypt.h"
+
+static NSString * const kOTRTrafficTypeKey = @"type";
+static NSString * const kOTRTrafficTimestampKey = @"time";
+static NSString * const kOTRTrafficUsernameKey = @"user";
+static NSString * const kOTRTrafficAccountNameKey = @"account";
+static NSString * const kOTRTrafficProtocolKey = @"protocol";
+static NSString * const kOTRTrafficMessageKindKey = @"kind";
+static NSString * const kOTRTrafficMessageLengthKey = @"length";
+static NSString * const kOTRTrafficPlaintextLengthKey = @"plaintext";
+static NSString * const kOTRTrafficTLVsKey = @"tlvs";
+static NSString * const kOTRTrafficDurationKey = @"duration";
+
+/** OTR data message type, the third byte of the base64 header */
+static const uint8_t kOTRTrafficDataMessageType = 0x03;
+
+@implementation OTRTrafficEvent
+
+- (instancetype) initWithType:(OTRTrafficEventType)type
+                    timestamp:(NSTimeInterval)timestamp
+                     username:(NSString*)username
+                  accountName:(NSString*)accountName
+                     protocol:(NSString*)protocol
+                  messageKind:(OTRTrafficMessageKind)messageKind
+                messageLength:(NSUInteger)messageLength
+              plaintextLength:(NSUInteger)plaintextLength
+                     tlvTypes:(NSArray<NSNumber*>*)tlvTypes
+                   tlvLengths:(NSArray<NSNumber*>*)tlvLengths
+                     duration:(NSTimeInterval)duration {
+    NSParameterAssert(tlvTypes.count == tlvLengths.count);
+    if (self = [super init]) {
+        _type = type;
+        _timestamp = timestamp;
+        _username = [username copy];
+        _accountName = [accountName copy];
+        _protocol = [protocol copy];
+        _messageKind = messageKind;
+        _messageLength = messageLength;
+        _plaintextLength = plaintextLength;
+        _tlvTypes = [tlvTypes copy];
+        _tlvLengths = [tlvLengths copy];
+        _duration = duration;
+    }
+    return self;
+}
+
+- (nullable instancetype) initWithDictionary:(NSDictionary<NSString*, id>*)dictionary {
+    if (![dictionary isKindOfClass:[NSDictionary class]]) {
+        return nil;
+    }
+    NSNumber *type = dictionary[kOTRTrafficTypeKey];
+    NSNumber *timestamp = dictionary[kOTRTrafficTimestampKey];
+    NSString *username = dictionary[kOTRTrafficUsernameKey];
+    NSString *accountName = dictionary[kOTRTrafficAccountNameKey];
+    NSString *protocol = dictionary[kOTRTrafficProtocolKey];
+    NSNumber *kind = dictionary[kOTRTrafficMessageKindKey];
+    NSNumber *length = dictionary[kOTRTrafficMessageLengthKey];
+    NSNumber *plaintextLength = dictionary[kOTRTrafficPlaintextLengthKey];
+    NSArray *tlvs = dictionary[kOTRTrafficTLVsKey];
+    NSNumber *duration = dictionary[kOTRTrafficDurationKey];
+    if (![type isKindOfClass:[NSNumber class]] ||
+        ![timestamp isKindOfClass:[NSNumber class]] ||
+        ![username isKindOfClass:[NSString class]] ||
+        ![accountName isKindOfClass:[NSString class]] ||
+        ![protocol isKindOfClass:[NSString class]] ||
+        ![kind isKindOfClass:[NSNumber class]] ||
+        ![length isKindOfClass:[NSNumber class]] ||
+        ![plaintextLength isKindOfClass:[NSNumber class]] ||
+        ![tlvs isKindOfClass:[NSArray class]] ||
+        ![duration isKindOfClass:[NSNumber class]] ||
+        type.unsignedIntegerValue > OTRTrafficEventTypeInject ||
+        kind.unsignedIntegerValue > OTRTrafficMessageKindError) {
+        return nil;
+    }
+    NSMutableArray<NSNumber*> *tlvTypes = [NSMutableArray arrayWithCapacity:tlvs.count];
+    NSMutableArray<NSNumber*> *tlvLengths = [NSMutableArray arrayWithCapacity:tlvs.count];
+    for (NSArray *tlv in tlvs) {
+        if (![tlv isKindOfClass:[NSArray class]] || tlv.count != 2 ||
+            ![tlv[0] isKindOfClass:[NSNumber class]] || ![tlv[1] isKindOfClass:[NSNumber class]] ||
+            [tlv[0] unsignedIntegerValue] > UINT16_MAX || [tlv[1] unsignedIntegerValue] > UINT16_MAX) {
+            return nil;
+        }
+        [tlvTypes addObject:tlv[0]];
+        [tlvLengths addObject:tlv[1]];
+    }
+    return [self initWithType:type.unsignedIntegerValue
+                    timestamp:timestamp.doubleValue
+                     username:username
+                  accountName:accountName
+                     protocol:protocol
+                  messageKind:kind.unsignedIntegerValue
+                messageLength:length.unsignedIntegerValue
+              plaintextLength:plaintextLength.unsignedIntegerValue
+                     tlvTypes:tlvTypes
+                   tlvLengths:tlvLengths
+                     duration:duration.doubleValue];
+}
+
+- (NSDictionary<NSString*, id>*) dictionaryRepresentation {
+    NSMutableArray *tlvs = [NSMutableArray arrayWithCapacity:self.tlvTypes.count];
+    [self.tlvTypes enumerateObjectsUsingBlock:^(NSNumber *tlvType, NSUInteger idx, BOOL *stop) {
+        [tlvs addObject:@[tlvType, self.tlvLengths[idx]]];
+    }];
+    return @{kOTRTrafficTypeKey: @(self.type),
+             kOTRTrafficTimestampKey: @(self.timestamp),
+             kOTRTrafficUsernameKey: self.username,
+             kOTRTrafficAccountNameKey: self.accountName,
+             kOTRTrafficProtocolKey: self.protocol,
+             kOTRTrafficMessageKindKey: @(self.messageKind),
+             kOTRTrafficMessageLengthKey: @(self.messageLength),
+             kOTRTrafficPlaintextLengthKey: @(self.plaintextLength),
+             kOTRTrafficTLVsKey: tlvs,
+             kOTRTrafficDurationKey: @(self.duration)};
+}
+
+- (NSArray<OTRTLV*>*) redactedTLVs {
+    NSMutableArray<OTRTLV*> *tlvs = [NSMutableArray arrayWithCapacity:self.tlvTypes.count];
+    [self.tlvTypes enumerateObjectsUsingBlock:^(NSNumber *tlvType, NSUInteger idx, BOOL *stop) {
+        NSData *data = [NSMutableData dataWithLength:self.tlvLengths[idx].unsignedIntegerValue];
+        OTRTLV *tlv = [[OTRTLV alloc] initWithType:tlvType.unsignedShortValue data:data];
+        if (tlv) {
+            [tlvs addObject:tlv];
+        }
+    }];
+    return tlvs;
+}
+
++ (OTRTrafficMessageKind) messageKindForMessage:(nullable NSString*)message {
+    if (![message hasPrefix:@"?OTR"]) {
+        return OTRTrafficMessageKindPlaintext;
+    }
+    if ([message hasPrefix:@"?OTR:"]) {
+        // Four base64 characters cover the 2 byte protocol version and the message type
+        if (message.length >= 9) {
+            NSData *header = [[NSData alloc] initWithBase64EncodedString:[message substringWithRange:NSMakeRange(5, 4)] options:0];
+            if (header.length == 3 && ((const uint8_t*)header.bytes)[2] == kOTRTrafficDataMessageType) {
+                return OTRTrafficMessageKindData;
+            }
+        }
+        return OTRTrafficMessageKindKeyExchange;
+    }
+    if ([message hasPrefix:@"?OTR|"] || [message hasPrefix:@"?OTR,"]) {
+        return OTRTrafficMessageKindFragment;
+    }
+    if ([message hasPrefix:@"?OTR Error:"]) {
+        return OTRTrafficMessageKindError;
+    }
+    return OTRTrafficMessageKindQuery;
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p> type: %d kind: %d %@->%@ length: %d plaintext: %d tlvs: %@ t: %.3f", NSStringFromClass([self class]), self, (int)self.type, (int)self.messageKind, self.accountName, self.username, (int)self.messageLength, (int)self.plaintextLength, self.tlvTypes, self.timestamp];
+}
+
+@end
+
+@interface OTRTrafficRecorder ()
+/** Guards events and pseudonyms */
+@property (nonatomic, strong, readonly) dispatch_queue_t stateQueue;
+@property (nonatomic, strong) NSMutableArray<OTRTrafficEvent*> *mutableEvents;
+@property (nonatomic, strong) NSMutableDictionary<NSString*, NSString*> *usernamePseudonyms;
+@property (nonatomic, strong) NSMutableDictionary<NSString*, NSString*> *accountNamePseudonyms;
+@property (atomic) CFAbsoluteTime startTime;
+@property (atomic, readwrite) NSUInteger droppedEventCount;
+@end
+
+@implementation OTRTrafficRecorder
+
+- (instancetype) init {
+    if (self = [super init]) {
+        _stateQueue = dispatch_queue_create("OTRTrafficRecorder State Queue", 0);
+        _maximumEventCount = 100000;
+        _mutableEvents = [NSMutableArray array];
+        _usernamePseudonyms = [NSMutableDictionary dictionary];
+        _accountNamePseudonyms = [NSMutableDictionary dictionary];
+        _startTime = CFAbsoluteTimeGetCurrent();
+    }
+    return self;
+}
+
+- (NSArray<OTRTrafficEvent*>*) events {
+    __block NSArray<OTRTrafficEvent*> *events = nil;
+    dispatch_sync(self.stateQueue, ^{
+        events = [self.mutableEvents copy];
+    });
+    return events;
+}
+
+- (void) reset {
+    dispatch_sync(self.stateQueue, ^{
+        self.mutableEvents = [NSMutableArray array];
+        self.usernamePseudonyms = [NSMutableDictionary dictionary];
+        self.accountNamePseudonyms = [NSMutableDictionary dictionary];
+        self.droppedEventCount = 0;
+        self.startTime = CFAbsoluteTimeGetCurrent();
+    });
+}
+
+- (void) recordEventWithType:(OTRTrafficEventType)type
+                     message:(nullable NSString*)message
+                   plaintext:(nullable NSString*)plaintext
+                        tlvs:(nullable NSArray<OTRTLV*>*)tlvs
+                    username:(NSString*)username
+                 accountName:(NSString*)accountName
+                    protocol:(NSString*)protocol
+                    duration:(NSTimeInterval)duration {
+    NSTimeInterval timestamp = CFAbsoluteTimeGetCurrent() - self.startTime;
+    // Only the shape leaves this method, never the contents
+    OTRTrafficMessageKind kind = [OTRTrafficEvent messageKindForMessage:message];
+    NSUInteger messageLength = [message lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    NSUInteger plaintextLength = [plaintext lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    NSMutableArray<NSNumber*> *tlvTypes = [NSMutableArray arrayWithCapacity:tlvs.count];
+    NSMutableArray<NSNumber*> *tlvLengths = [NSMutableArray arrayWithCapacity:tlvs.count];
+    for (OTRTLV *tlv in tlvs) {
+        [tlvTypes addObject:@(tlv.type)];
+        [tlvLengths addObject:@(tlv.data.length)];
+    }
+    username = [username copy];
+    accountName = [accountName copy];
+    protocol = [protocol copy];
+    dispatch_async(self.stateQueue, ^{
+        NSUInteger maximumEventCount = self.maximumEventCount;
+        if (maximumEventCount && self.mutableEvents.count >= maximumEventCount) {
+            self.droppedEventCount++;
+            return;
+        }
+        NSString *usernamePseudonym = [self pseudonymForName:username prefix:@"user" pseudonyms:self.usernamePseudonyms];
+        NSString *accountNamePseudonym = [self pseudonymForName:accountName prefix:@"account" pseudonyms:self.accountNamePseudonyms];
+        OTRTrafficEvent *event = [[OTRTrafficEvent alloc] initWithType:type timestamp:timestamp username:usernamePseudonym accountName:accountNamePseudonym protocol:protocol messageKind:kind messageLength:messageLength plaintextLength:plaintextLength tlvTypes:tlvTypes tlvLengths:tlvLengths duration:duration];
+        [self.mutableEvents addObject:event];
+    });
+}
+
+/** Must be called on stateQueue */
+- (NSString*) pseudonymForName:(NSString*)name prefix:(NSString*)prefix pseudonyms:(NSMutableDictionary<NSString*, NSString*>*)pseudonyms {
+    NSString *pseudonym = [pseudonyms objectForKey:name];
+    if (!pseudonym) {
+        pseudonym = [NSString stringWithFormat:@"%@%d", prefix, (int)pseudonyms.count + 1];
+        [pseudonyms setObject:pseudonym forKey:name];
+    }
+    return pseudonym;
+}
+
+#pragma mark Serialization
+
+- (nullable NSData*) JSONDataWithError:(NSError**)error {
+    NSArray<OTRTrafficEvent*> *events = self.events;
+    NSMutableArray *dictionaries = [NSMutableArray arrayWithCapacity:events.count];
+    for (OTRTrafficEvent *event in events) {
+        [dictionaries addObject:[event dictionaryRepresentation]];
+    }
+    return [NSJSONSerialization dataWithJSONObject:dictionaries options:0 error:error];
+}
+
+- (BOOL) writeToURL:(NSURL*)url error:(NSError**)error {
+    NSData *data = [self JSONDataWithError:error];
+    if (!data) {
+        return NO;
+    }
+    return [data writeToURL:url options:NSDataWritingAtomic error:error];
+}
+
++ (nullable NSArray<OTRTrafficEvent*>*) eventsWithJSONData:(NSData*)data error:(NSError**)error {
+    NSArray *dictionaries = [NSJSONSerialization JSONObjectWithData:data options:0 error:error];
+    if (!dictionaries) {
+        return nil;
+    }
+    if (![dictionaries isKindOfClass:[NSArray class]]) {
+        if (error) {
+            *error = [OTRErrorUtility errorForGPGError:GPG_ERR_INV_DATA];
+        }
+        return nil;
+    }
+    NSMutableArray<OTRTrafficEvent*> *events = [NSMutableArray arrayWithCapacity:dictionaries.count];
+    for (NSDictionary *dictionary in dictionaries) {
+        OTRTrafficEvent *event = [[OTRTrafficEvent alloc] initWithDictionary:dictionary];
+        if (!event) {
+            if (error) {
+                *error = [OTRErrorUtility errorForGPGError:GPG_ERR_INV_DATA];
+            }
+            return nil;
+        }
+        [events addObject:event];
+    }
+    return events;
+}
+
++ (nullable NSArray<OTRTrafficEvent*>*) eventsWithContentsOfURL:(NSURL*)url error:(NSError**)error {
+    NSData *data = [NSData dataWithContentsOfURL:url options:0 error:error];
+    if (!data) {
+        return nil;
+    }
+    return [self eventsWithJSONData:data error:error];
+}
+
+@end
@@ -0,0 +1,112 @@
+//
+//  OTRCallbackModeTests.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRKitSessionBase.h"
+
+static const NSUInteger kOTRTestMessageCount = 500;
+
+@interface OTRCallbackModeTests : OTRKitSessionBase <OTRDataHandlerDelegate>
+@property (nonatomic, strong, nullable) XCTestExpectation *transferExpectation;
+@property (nonatomic, strong) NSData *fileData;
+@end
+
+@implementation OTRCallbackModeTests
+
+- (void)setUp {
+    [super setUp];
+    [self startSecureSession];
+}
+
+/** @return average seconds from encodeMessage: to its completion */
+- (NSTimeInterval) averageEncodeLatency {
+    XCTestExpectation *encoded = [self expectationWithDescription:@"Encoded"];
+    encoded.expectedFulfillmentCount = kOTRTestMessageCount;
+    __block CFAbsoluteTime totalLatency = 0;
+    for (NSUInteger i = 0; i < kOTRTestMessageCount; i++) {
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        [self.otrKitAlice encodeMessage:[NSString stringWithFormat:@"message %d", (int)i] tlvs:nil username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil async:YES completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+            // Completions are serial in both modes
+            totalLatency += CFAbsoluteTimeGetCurrent() - start;
+            XCTAssertTrue(wasEncrypted);
+            [encoded fulfill];
+        }];
+    }
+    [self waitForExpectations:@[encoded] timeout:60];
+    return totalLatency / kOTRTestMessageCount;
+}
+
+- (void) testCallbackModeLatency {
+    self.otrKitAlice.callbackMode = OTRKitCallbackModeQueue;
+    NSTimeInterval queueLatency = [self averageEncodeLatency];
+    self.otrKitAlice.callbackMode = OTRKitCallbackModeInline;
+    NSTimeInterval inlineLatency = [self averageEncodeLatency];
+    NSLog(@"%d encodes, average call to completion latency: callbackQueue %.1fus, inline %.1fus", (int)kOTRTestMessageCount, queueLatency * 1e6, inlineLatency * 1e6);
+}
+
+- (void) testInlineCallbacksAreReentrant {
+    self.otrKitAlice.callbackMode = OTRKitCallbackModeInline;
+    XCTestExpectation *encoded = [self expectationWithDescription:@"Encoded"];
+    [self.otrKitAlice encodeMessage:@"hi" tlvs:nil username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil async:YES completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+        XCTAssertFalse([NSThread isMainThread]);
+        // Synchronous getters run right away instead of deadlocking
+        XCTAssertEqual([self.otrKitAlice messageStateForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP], OTRKitMessageStateEncrypted);
+        XCTAssertNotNil([self.otrKitAlice activeFingerprintForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP]);
+        [encoded fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
+- (void) testInlineDataTransfer {
+    self.otrKitAlice.callbackMode = OTRKitCallbackModeInline;
+    self.otrKitBob.callbackMode = OTRKitCallbackModeInline;
+    OTRDataHandler *dataHandlerAlice = [[OTRDataHandler alloc] initWithOTRKit:self.otrKitAlice delegate:self];
+    OTRDataHandler *dataHandlerBob = [[OTRDataHandler alloc] initWithOTRKit:self.otrKitBob delegate:self];
+    dataHandlerAlice.callbackMode = OTRKitCallbackModeInline;
+    dataHandlerBob.callbackMode = OTRKitCallbackModeInline;
+    NSMutableData *data = [NSMutableData dataWithLength:64 * 1024];
+    XCTAssertEqual(SecRandomCopyBytes(kSecRandomDefault, data.length, data.mutableBytes), 0);
+    self.fileData = data;
+    self.transferExpectation = [self expectationWithDescription:@"Transfer complete"];
+    [dataHandlerAlice sendFileWithName:@"random.bin" fileData:data username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil];
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+}
+
+#pragma mark OTRDataHandlerDelegate methods
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+           transfer:(OTRDataTransfer*)transfer
+        fingerprint:(nullable OTRFingerprint*)fingerprint
+              error:(NSError*)error {
+    XCTFail(@"transfer failed: %@ %@", transfer, error);
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+    offeredTransfer:(OTRDataIncomingTransfer*)transfer
+        fingerprint:(OTRFingerprint*)fingerprint {
+    XCTAssertFalse([NSThread isMainThread]);
+    [dataHandler startIncomingTransfer:transfer];
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+           transfer:(OTRDataTransfer*)transfer
+           progress:(float)progress
+        fingerprint:(OTRFingerprint*)fingerprint {
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+   transferComplete:(OTRDataTransfer*)transfer
+        fingerprint:(OTRFingerprint*)fingerprint {
+    // Called on the handler's queue, stats must not deadlock
+    XCTAssertNotNil([dataHandler stats]);
+    if ([transfer isKindOfClass:[OTRDataIncomingTransfer class]]) {
+        XCTAssertEqualObjects(transfer.fileData, self.fileData);
+        [self.transferExpectation fulfill];
+    }
+}
+
+@end
@@ -0,0 +1,79 @@
+//
+//  OTRConversationStateTests.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRKitSessionBase.h"
+
+static const NSUInteger kOTRTestEncodeCount = 2000;
+static const NSUInteger kOTRTestReadCount = 200;
+
+@interface OTRConversationStateTests : OTRKitSessionBase
+@end
+
+@implementation OTRConversationStateTests
+
+- (void)setUp {
+    [super setUp];
+    [self startSecureSession];
+}
+
+- (void) testConversationStatePublished {
+    OTRConversationState *state = [self.otrKitAlice conversationStateForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP];
+    XCTAssertNotNil(state);
+    XCTAssertEqual(state.messageState, OTRKitMessageStateEncrypted);
+    XCTAssertEqual(state.trustLevel, OTRTrustLevelTrustedTofu);
+    XCTAssertEqual(state.instanceCount, 1);
+    XCTAssertEqual([self.otrKitAlice allConversationStates].count, 1);
+    XCTAssertNil([self.otrKitAlice conversationStateForUsername:@"carol@example.com" accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP]);
+
+    // Changing the returned fingerprint doesn't change the table, saving it does
+    OTRFingerprint *fingerprint = state.fingerprint;
+    XCTAssertNotNil(fingerprint);
+    fingerprint.trustLevel = OTRTrustLevelTrustedUser;
+    XCTAssertEqual([self.otrKitAlice conversationStateForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP].trustLevel, OTRTrustLevelTrustedTofu);
+    [self.otrKitAlice saveFingerprint:fingerprint];
+    state = [self.otrKitAlice conversationStateForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP];
+    XCTAssertEqual(state.trustLevel, OTRTrustLevelTrustedUser);
+    XCTAssertEqual([self.otrKitAlice activeFingerprintForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP].trustLevel, OTRTrustLevelTrustedUser);
+
+    XCTestExpectation *plaintext = [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(id _Nullable evaluatedObject, NSDictionary<NSString *,id> * _Nullable bindings) {
+        return [self.otrKitAlice messageStateForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP] == OTRKitMessageStatePlaintext;
+    }] evaluatedWithObject:self handler:nil];
+    [self.otrKitAlice disableEncryptionWithUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP];
+    [self waitForExpectations:@[plaintext] timeout:10];
+}
+
+/** Time reads while the internal queue is busy encoding */
+- (void) testConversationStateReadLatency {
+    XCTestExpectation *encoded = [self expectationWithDescription:@"Encoded"];
+    encoded.expectedFulfillmentCount = kOTRTestEncodeCount;
+    for (NSUInteger i = 0; i < kOTRTestEncodeCount; i++) {
+        [self.otrKitAlice encodeMessage:[NSString stringWithFormat:@"message %d", (int)i] tlvs:nil username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil async:YES completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+            [encoded fulfill];
+        }];
+    }
+
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < kOTRTestReadCount; i++) {
+        XCTAssertEqual([self.otrKitAlice messageStateForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP], OTRKitMessageStateEncrypted);
+        XCTAssertNotNil([self.otrKitAlice activeFingerprintForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP]);
+    }
+    CFAbsoluteTime publishedLatency = (CFAbsoluteTimeGetCurrent() - start) / kOTRTestReadCount;
+
+    // fingerprintsForUsername still goes through the internal queue, like every read did before
+    start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < kOTRTestReadCount; i++) {
+        XCTAssertEqual([self.otrKitAlice fingerprintsForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP].count, 1);
+    }
+    CFAbsoluteTime queuedLatency = (CFAbsoluteTimeGetCurrent() - start) / kOTRTestReadCount;
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+
+    XCTAssertLessThan(publishedLatency, queuedLatency);
+    NSLog(@"Reads during %d queued encodes: published state %.1fus, through the internal queue %.1fus", (int)kOTRTestEncodeCount, publishedLatency * 1e6, queuedLatency * 1e6);
+}
+
+@end
@@ -0,0 +1,158 @@
+//
+//  OTRDataCompressionTests.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRKitSessionBase.h"
+
+@interface OTRDataCompressionTests : OTRKitSessionBase <OTRDataHandlerDelegate>
+@property (nonatomic, strong) OTRDataHandler *dataHandlerAlice;
+@property (nonatomic, strong) OTRDataHandler *dataHandlerBob;
+@property (nonatomic, strong, nullable) XCTestExpectation *transfersExpectation;
+/** Expected file data keyed to file name */
+@property (nonatomic, strong) NSDictionary<NSString*, NSData*> *files;
+/** Encrypted message bytes sent by either kit, only touched on the main queue */
+@property (nonatomic) NSUInteger wireBytes;
+@end
+
+@implementation OTRDataCompressionTests
+
+- (void)setUp {
+    [super setUp];
+    self.dataHandlerAlice = [[OTRDataHandler alloc] initWithOTRKit:self.otrKitAlice delegate:self];
+    self.dataHandlerBob = [[OTRDataHandler alloc] initWithOTRKit:self.otrKitBob delegate:self];
+    [self startSecureSession];
+}
+
+/** Chat logs, JSON, an image and random binary, so both kinds of chunks are in the mix */
+- (NSDictionary<NSString*, NSData*>*) fileMix {
+    NSMutableString *log = [NSMutableString string];
+    for (NSUInteger i = 0; log.length < 200 * 1024; i++) {
+        [log appendFormat:@"[2026-10-19 12:%02d:%02d] <alice@example.com> message number %d, see you at %d\n", (int)(i / 60 % 60), (int)(i % 60), (int)i, (int)(i % 24)];
+    }
+    NSMutableArray *records = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 1500; i++) {
+        [records addObject:@{@"id": @(i), @"jid": [NSString stringWithFormat:@"user%d@example.com", (int)i], @"trusted": @(i % 3 == 0), @"fingerprint": [[NSUUID UUID] UUIDString]}];
+    }
+    NSData *json = [NSJSONSerialization dataWithJSONObject:records options:0 error:nil];
+    NSURL *imageURL = [[NSBundle bundleForClass:[self class]] URLForResource:@"test_image" withExtension:@"jpg"];
+    NSData *image = [NSData dataWithContentsOfURL:imageURL];
+    NSMutableData *binary = [NSMutableData dataWithLength:128 * 1024];
+    XCTAssertEqual(SecRandomCopyBytes(kSecRandomDefault, binary.length, binary.mutableBytes), 0);
+    XCTAssertNotNil(image);
+    return @{@"chat.log": [log dataUsingEncoding:NSUTF8StringEncoding],
+             @"roster.json": json,
+             @"test_image.jpg": image,
+             @"random.bin": binary};
+}
+
+/** Sends every file from Alice to Bob at once and waits for all of them */
+- (NSTimeInterval) transferFiles:(NSDictionary<NSString*, NSData*>*)files {
+    self.files = files;
+    self.wireBytes = 0;
+    self.transfersExpectation = [self expectationWithDescription:@"Transfers complete"];
+    self.transfersExpectation.expectedFulfillmentCount = files.count;
+    NSDate *start = [NSDate date];
+    [files enumerateKeysAndObjectsUsingBlock:^(NSString *fileName, NSData *fileData, BOOL *stop) {
+        [self.dataHandlerAlice sendFileWithName:fileName fileData:fileData username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil];
+    }];
+    [self waitForExpectationsWithTimeout:120 handler:nil];
+    self.transfersExpectation = nil;
+    return -[start timeIntervalSinceNow];
+}
+
+- (void) testCompressionBytesOnWire {
+    NSDictionary<NSString*, NSData*> *files = [self fileMix];
+    NSUInteger fileBytes = 0;
+    for (NSData *data in files.allValues) {
+        fileBytes += data.length;
+    }
+
+    self.dataHandlerAlice.compressesChunks = NO;
+    self.dataHandlerBob.compressesChunks = NO;
+    NSTimeInterval plainTime = [self transferFiles:files];
+    NSUInteger plainWireBytes = self.wireBytes;
+    OTRDataHandlerStats *plainStats = [self.dataHandlerAlice stats];
+    XCTAssertEqual(plainStats.servedChunkBytes, fileBytes);
+    XCTAssertEqual(plainStats.servedBodyBytes, fileBytes);
+
+    self.dataHandlerAlice.compressesChunks = YES;
+    self.dataHandlerBob.compressesChunks = YES;
+    NSTimeInterval deflateTime = [self transferFiles:files];
+    NSUInteger deflateWireBytes = self.wireBytes;
+    OTRDataHandlerStats *deflateStats = [self.dataHandlerAlice stats];
+    NSUInteger servedBodyBytes = deflateStats.servedBodyBytes - plainStats.servedBodyBytes;
+    XCTAssertEqual(deflateStats.servedChunkBytes - plainStats.servedChunkBytes, fileBytes);
+    // The image and random data go out as they are, the text has to make up the difference
+    NSUInteger incompressibleBytes = files[@"test_image.jpg"].length + files[@"random.bin"].length;
+    XCTAssertLessThan(servedBodyBytes, incompressibleBytes + (fileBytes - incompressibleBytes) / 2);
+    XCTAssertLessThan(deflateWireBytes, plainWireBytes);
+
+    NSLog(@"OTRDATA file mix of %d bytes: plain %d bytes on the wire in %.2fs, deflate %d bytes on the wire in %.2fs (%.0f%%)", (int)fileBytes, (int)plainWireBytes, plainTime, (int)deflateWireBytes, deflateTime, 100.0 * deflateWireBytes / plainWireBytes);
+}
+
+/** A receiver that doesn't send Accept-Encoding, like an older OTRKit, gets plain chunks */
+- (void) testCompressionNotNegotiated {
+    self.dataHandlerAlice.compressesChunks = YES;
+    self.dataHandlerBob.compressesChunks = NO;
+    NSDictionary<NSString*, NSData*> *files = [self fileMix];
+    [self transferFiles:@{@"chat.log": files[@"chat.log"]}];
+    OTRDataHandlerStats *stats = [self.dataHandlerAlice stats];
+    XCTAssertEqual(stats.servedChunkBytes, files[@"chat.log"].length);
+    XCTAssertEqual(stats.servedBodyBytes, stats.servedChunkBytes);
+}
+
+#pragma mark OTRKitDelegate methods
+
+- (void) otrKit:(OTRKit*)otrKit
+ encodedMessage:(nullable NSString*)encodedMessage
+   wasEncrypted:(BOOL)wasEncrypted
+       username:(NSString*)username
+    accountName:(NSString*)accountName
+       protocol:(NSString*)protocol
+    fingerprint:(nullable OTRFingerprint*)fingerprint
+            tag:(nullable id)tag
+          error:(nullable NSError*)error {
+    XCTAssertNil(error);
+    if (!encodedMessage) {
+        return;
+    }
+    self.wireBytes += encodedMessage.length;
+    [super otrKit:otrKit encodedMessage:encodedMessage wasEncrypted:wasEncrypted username:username accountName:accountName protocol:protocol fingerprint:fingerprint tag:tag error:error];
+}
+
+#pragma mark OTRDataHandlerDelegate methods
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+           transfer:(OTRDataTransfer*)transfer
+        fingerprint:(nullable OTRFingerprint*)fingerprint
+              error:(NSError*)error {
+    XCTFail(@"transfer failed: %@ %@", transfer, error);
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+    offeredTransfer:(OTRDataIncomingTransfer*)transfer
+        fingerprint:(OTRFingerprint*)fingerprint {
+    [dataHandler startIncomingTransfer:transfer];
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+           transfer:(OTRDataTransfer*)transfer
+           progress:(float)progress
+        fingerprint:(OTRFingerprint*)fingerprint {
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+   transferComplete:(OTRDataTransfer*)transfer
+        fingerprint:(OTRFingerprint*)fingerprint {
+    if (dataHandler != self.dataHandlerBob) {
+        return;
+    }
+    XCTAssertEqualObjects(transfer.fileData, self.files[transfer.fileName]);
+    [self.transfersExpectation fulfill];
+}
+
+@end
@@ -0,0 +1,188 @@
+//
+//  OTRDataManifestTests.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRKitSessionBase.h"
+
+static const NSUInteger kOTRTestFileCount = 40;
+
+@interface OTRDataManifestTests : OTRKitSessionBase <OTRDataHandlerDelegate>
+@property (nonatomic, strong) OTRDataHandler *dataHandlerAlice;
+@property (nonatomic, strong) OTRDataHandler *dataHandlerBob;
+@property (nonatomic, strong, nullable) XCTestExpectation *filesExpectation;
+@property (nonatomic, strong, nullable) XCTestExpectation *manifestExpectation;
+@property (nonatomic, strong, nullable) XCTestExpectation *errorExpectation;
+/** Expected file data keyed to file name */
+@property (nonatomic, strong) NSDictionary<NSString*, NSData*> *files;
+@property (nonatomic, strong, nullable) OTRDataManifestTransfer *offeredManifest;
+/** Starts offered transfers when set */
+@property (nonatomic) BOOL acceptsOffers;
+/** Everything below is only touched on the main queue */
+@property (nonatomic) NSUInteger messageCount;
+@property (nonatomic) NSUInteger offerCount;
+@property (nonatomic, strong) NSMutableArray<OTRDataTransfer*> *completedTransfers;
+@property (nonatomic, strong) NSMutableArray<NSError*> *errors;
+@end
+
+@implementation OTRDataManifestTests
+
+- (void)setUp {
+    [super setUp];
+    self.dataHandlerAlice = [[OTRDataHandler alloc] initWithOTRKit:self.otrKitAlice delegate:self];
+    self.dataHandlerBob = [[OTRDataHandler alloc] initWithOTRKit:self.otrKitBob delegate:self];
+    self.completedTransfers = [NSMutableArray array];
+    self.errors = [NSMutableArray array];
+    self.acceptsOffers = YES;
+    NSMutableDictionary *files = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < kOTRTestFileCount; i++) {
+        NSMutableData *data = [NSMutableData dataWithLength:2048 + i * 512];
+        XCTAssertEqual(SecRandomCopyBytes(kSecRandomDefault, data.length, data.mutableBytes), 0);
+        [files setObject:data forKey:[NSString stringWithFormat:@"IMG_%04d.jpg", (int)i]];
+    }
+    self.files = files;
+    [self startSecureSession];
+}
+
+- (NSArray<NSString*>*) sortedFileNames {
+    return [self.files.allKeys sortedArrayUsingSelector:@selector(compare:)];
+}
+
+/** @return messages exchanged for the transfer */
+- (NSUInteger) sendFilesAsManifest:(BOOL)asManifest {
+    self.messageCount = 0;
+    self.filesExpectation = [self expectationWithDescription:@"Files complete"];
+    self.filesExpectation.expectedFulfillmentCount = self.files.count;
+    NSArray<NSString*> *fileNames = [self sortedFileNames];
+    NSMutableArray<NSData*> *fileData = [NSMutableArray array];
+    for (NSString *fileName in fileNames) {
+        [fileData addObject:self.files[fileName]];
+    }
+    if (asManifest) {
+        self.manifestExpectation = [self expectationWithDescription:@"Manifest complete"];
+        NSArray<OTRDataOutgoingTransfer*> *transfers = [self.dataHandlerAlice sendFilesWithNames:fileNames fileData:fileData username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil];
+        XCTAssertEqual(transfers.count, fileNames.count);
+    } else {
+        [fileNames enumerateObjectsUsingBlock:^(NSString *fileName, NSUInteger idx, BOOL *stop) {
+            [self.dataHandlerAlice sendFileWithName:fileName fileData:fileData[idx] username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil];
+        }];
+    }
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+    self.filesExpectation = nil;
+    self.manifestExpectation = nil;
+    return self.messageCount;
+}
+
+- (void) testManifestRoundTrips {
+    NSDate *start = [NSDate date];
+    NSUInteger separateMessages = [self sendFilesAsManifest:NO];
+    NSTimeInterval separateTime = -[start timeIntervalSinceNow];
+    XCTAssertEqual(self.offerCount, kOTRTestFileCount);
+
+    self.offerCount = 0;
+    [self.completedTransfers removeAllObjects];
+    start = [NSDate date];
+    NSUInteger manifestMessages = [self sendFilesAsManifest:YES];
+    NSTimeInterval manifestTime = -[start timeIntervalSinceNow];
+    XCTAssertEqual(self.offerCount, 1);
+    // Every file completes before the manifest
+    XCTAssertEqual(self.completedTransfers.count, kOTRTestFileCount + 1);
+    XCTAssertTrue([self.completedTransfers.lastObject isKindOfClass:[OTRDataManifestTransfer class]]);
+    OTRDataManifestTransfer *manifest = (OTRDataManifestTransfer*)self.completedTransfers.lastObject;
+    XCTAssertEqual(manifest.files.count, kOTRTestFileCount);
+    XCTAssertEqual(manifest.bytesTransferred, manifest.fileLength);
+    XCTAssertEqualObjects([manifest.files valueForKey:@"fileName"], [self sortedFileNames]);
+    // The offer and its response are sent once instead of once per file
+    XCTAssertLessThanOrEqual(manifestMessages + 2 * (kOTRTestFileCount - 1), separateMessages);
+    XCTAssertTrue(self.errors.count == 0);
+    XCTAssertEqual([self.dataHandlerBob stats].incomingTransferCount, 0);
+    XCTAssertEqual([self.dataHandlerAlice stats].outgoingTransferCount, 0);
+
+    NSLog(@"%d files: %d messages in %.2fs separately, %d messages in %.2fs as a manifest", (int)kOTRTestFileCount, (int)separateMessages, separateTime, (int)manifestMessages, manifestTime);
+}
+
+- (void) testManifestCancelledBeforeStart {
+    self.acceptsOffers = NO;
+    XCTestExpectation *offered = [self expectationForPredicate:[NSPredicate predicateWithFormat:@"offerCount == 1"] evaluatedWithObject:self handler:nil];
+    [self.dataHandlerAlice sendFilesWithNames:[self sortedFileNames] fileData:[self.files objectsForKeys:[self sortedFileNames] notFoundMarker:[NSData data]] username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil];
+    [self waitForExpectations:@[offered] timeout:30];
+    XCTAssertEqual([self.dataHandlerBob stats].incomingTransferCount, 1);
+
+    self.errorExpectation = [self expectationWithDescription:@"Manifest cancelled"];
+    self.errorExpectation.assertForOverFulfill = YES;
+    XCTAssertNotNil(self.offeredManifest);
+    [self.dataHandlerBob cancelTransfer:self.offeredManifest];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    XCTAssertEqual(self.errors.firstObject.code, OTRDataErrorCancelled);
+    XCTAssertEqual([self.dataHandlerBob stats].incomingTransferCount, 0);
+}
+
+#pragma mark OTRKitDelegate methods
+
+- (void) otrKit:(OTRKit*)otrKit
+ encodedMessage:(nullable NSString*)encodedMessage
+   wasEncrypted:(BOOL)wasEncrypted
+       username:(NSString*)username
+    accountName:(NSString*)accountName
+       protocol:(NSString*)protocol
+    fingerprint:(nullable OTRFingerprint*)fingerprint
+            tag:(nullable id)tag
+          error:(nullable NSError*)error {
+    XCTAssertNil(error);
+    if (!encodedMessage) {
+        return;
+    }
+    self.messageCount++;
+    [super otrKit:otrKit encodedMessage:encodedMessage wasEncrypted:wasEncrypted username:username accountName:accountName protocol:protocol fingerprint:fingerprint tag:tag error:error];
+}
+
+#pragma mark OTRDataHandlerDelegate methods
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+           transfer:(OTRDataTransfer*)transfer
+        fingerprint:(nullable OTRFingerprint*)fingerprint
+              error:(NSError*)error {
+    [self.errors addObject:error];
+    XCTAssertTrue([transfer isKindOfClass:[OTRDataManifestTransfer class]]);
+    [self.errorExpectation fulfill];
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+    offeredTransfer:(OTRDataIncomingTransfer*)transfer
+        fingerprint:(OTRFingerprint*)fingerprint {
+    self.offerCount++;
+    if ([transfer isKindOfClass:[OTRDataManifestTransfer class]]) {
+        self.offeredManifest = (OTRDataManifestTransfer*)transfer;
+        XCTAssertEqual(((OTRDataManifestTransfer*)transfer).files.count, self.files.count);
+    }
+    if (self.acceptsOffers) {
+        [dataHandler startIncomingTransfer:transfer];
+    }
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+           transfer:(OTRDataTransfer*)transfer
+           progress:(float)progress
+        fingerprint:(OTRFingerprint*)fingerprint {
+    XCTAssertTrue(progress > 0 && progress <= 1);
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+   transferComplete:(OTRDataTransfer*)transfer
+        fingerprint:(OTRFingerprint*)fingerprint {
+    if (dataHandler != self.dataHandlerBob) {
+        return;
+    }
+    [self.completedTransfers addObject:transfer];
+    if ([transfer isKindOfClass:[OTRDataManifestTransfer class]]) {
+        [self.manifestExpectation fulfill];
+        return;
+    }
+    XCTAssertEqualObjects(transfer.fileData, self.files[transfer.fileName]);
+    [self.filesExpectation fulfill];
+}
+
+@end
@@ -0,0 +1,92 @@
+//
+//  OTRDataSchedulerTests.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRKitSessionBase.h"
+
+@interface OTRDataSchedulerTests : OTRKitSessionBase <OTRDataHandlerDelegate>
+@property (nonatomic, strong) OTRDataHandler *dataHandlerAlice;
+@property (nonatomic, strong) OTRDataHandler *dataHandlerBob;
+@property (nonatomic, strong, nullable) XCTestExpectation *transfersExpectation;
+/** Expected file data keyed to file name */
+@property (nonatomic, strong) NSDictionary<NSString*, NSData*> *files;
+/** Everything below is only touched on the main queue */
+@property (nonatomic, strong) NSMutableArray<NSString*> *completedFileNames;
+@property (nonatomic, strong) NSMutableDictionary<NSString*, NSDate*> *completionDates;
+@end
+
+@implementation OTRDataSchedulerTests
+
+- (void)setUp {
+    [super setUp];
+    self.dataHandlerAlice = [[OTRDataHandler alloc] initWithOTRKit:self.otrKitAlice delegate:self];
+    self.dataHandlerBob = [[OTRDataHandler alloc] initWithOTRKit:self.otrKitBob delegate:self];
+    self.completedFileNames = [NSMutableArray array];
+    self.completionDates = [NSMutableDictionary dictionary];
+    [self startSecureSession];
+}
+
+- (NSData*) randomDataWithLength:(NSUInteger)length {
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    XCTAssertEqual(SecRandomCopyBytes(kSecRandomDefault, data.length, data.mutableBytes), 0);
+    return data;
+}
+
+/** A photo offered right after a video finishes long before the video does */
+- (void) testSmallTransferNotStuckBehindLargeTransfer {
+    NSData *video = [self randomDataWithLength:2 * 1024 * 1024];
+    NSData *photo = [self randomDataWithLength:20 * 1024];
+    self.files = @{@"video.mov": video, @"photo.jpg": photo};
+    self.transfersExpectation = [self expectationWithDescription:@"Transfers complete"];
+    self.transfersExpectation.expectedFulfillmentCount = 2;
+    NSDate *start = [NSDate date];
+    [self.dataHandlerAlice sendFileWithName:@"video.mov" fileData:video username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil];
+    [self.dataHandlerAlice sendFileWithName:@"photo.jpg" fileData:photo username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil];
+    [self waitForExpectationsWithTimeout:120 handler:nil];
+
+    XCTAssertEqualObjects(self.completedFileNames, (@[@"photo.jpg", @"video.mov"]));
+    NSTimeInterval photoTime = [self.completionDates[@"photo.jpg"] timeIntervalSinceDate:start];
+    NSTimeInterval videoTime = [self.completionDates[@"video.mov"] timeIntervalSinceDate:start];
+    XCTAssertLessThan(photoTime, videoTime / 4);
+    XCTAssertEqual([self.dataHandlerBob stats].pendingOperationCount, 0);
+    NSLog(@"Photo of %d bytes done in %.2fs, video of %d bytes offered first done in %.2fs", (int)photo.length, photoTime, (int)video.length, videoTime);
+}
+
+#pragma mark OTRDataHandlerDelegate methods
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+           transfer:(OTRDataTransfer*)transfer
+        fingerprint:(nullable OTRFingerprint*)fingerprint
+              error:(NSError*)error {
+    XCTFail(@"transfer failed: %@ %@", transfer, error);
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+    offeredTransfer:(OTRDataIncomingTransfer*)transfer
+        fingerprint:(OTRFingerprint*)fingerprint {
+    [dataHandler startIncomingTransfer:transfer];
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+           transfer:(OTRDataTransfer*)transfer
+           progress:(float)progress
+        fingerprint:(OTRFingerprint*)fingerprint {
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+   transferComplete:(OTRDataTransfer*)transfer
+        fingerprint:(OTRFingerprint*)fingerprint {
+    if (dataHandler != self.dataHandlerBob) {
+        return;
+    }
+    XCTAssertEqualObjects(transfer.fileData, self.files[transfer.fileName]);
+    [self.completedFileNames addObject:transfer.fileName];
+    [self.completionDates setObject:[NSDate date] forKey:transfer.fileName];
+    [self.transfersExpectation fulfill];
+}
+
+@end
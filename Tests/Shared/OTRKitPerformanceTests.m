@@ -0,0 +1,207 @@
+//
+//  OTRKitPerformanceTests.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import <XCTest/XCTest.h>
+@import OTRKit;
+
+static NSString * const kOTRPerfAccountAlice = @"alice@example.com";
+static NSString * const kOTRPerfAccountBob = @"bob@example.com";
+static NSString * const kOTRPerfProtocolXMPP = @"xmpp";
+/** Number of sessions started at once, like logging in with many contacts */
+static const NSUInteger kOTRPerfBurstSessionCount = 20;
+
+/**
+ *  Alice talks to many peers at once. Each peer is a separate OTRKit instance
+ *  sharing a copy of Bob's private key so we only need to generate two keys.
+ */
+@interface OTRKitPerformanceTests : XCTestCase <OTRKitDelegate>
+@property (nonatomic, strong) OTRKit *otrKitAlice;
+@property (nonatomic, strong) NSArray<OTRKit*> *peerKits;
+/** Alice's username for each of peerKits, changed every round so each round does fresh AKEs */
+@property (nonatomic, strong) NSArray<NSString*> *peerUsernames;
+@property (nonatomic, strong) NSMutableSet<NSString*> *securePeers;
+@property (nonatomic, strong, nullable) XCTestExpectation *allSecureExpectation;
+@property (nonatomic, strong) NSMutableArray<NSString*> *dataPaths;
+@end
+
+@implementation OTRKitPerformanceTests
+
+- (NSString*) createDataPath {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    NSError *error = nil;
+    [[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:YES attributes:nil error:&error];
+    XCTAssertNil(error);
+    [self.dataPaths addObject:path];
+    return path;
+}
+
+- (void) generateKeyForOTRKit:(OTRKit*)otrKit accountName:(NSString*)accountName {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Generate key"];
+    [otrKit generatePrivateKeyForAccountName:accountName protocol:kOTRPerfProtocolXMPP completion:^(OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+        XCTAssertNotNil(fingerprint);
+        XCTAssertNil(error);
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+}
+
+- (void)setUp {
+    [super setUp];
+    self.dataPaths = [NSMutableArray array];
+    self.otrKitAlice = [[OTRKit alloc] initWithDelegate:self dataPath:[self createDataPath]];
+    [self generateKeyForOTRKit:self.otrKitAlice accountName:kOTRPerfAccountAlice];
+
+    NSString *bobPath = [self createDataPath];
+    OTRKit *otrKitBob = [[OTRKit alloc] initWithDelegate:self dataPath:bobPath];
+    [self generateKeyForOTRKit:otrKitBob accountName:kOTRPerfAccountBob];
+
+    NSMutableArray<OTRKit*> *peerKits = [NSMutableArray arrayWithCapacity:kOTRPerfBurstSessionCount];
+    for (NSUInteger i = 0; i < kOTRPerfBurstSessionCount; i++) {
+        NSString *peerPath = [self createDataPath];
+        NSError *error = nil;
+        for (NSString *fileName in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:bobPath error:&error]) {
+            [[NSFileManager defaultManager] copyItemAtPath:[bobPath stringByAppendingPathComponent:fileName] toPath:[peerPath stringByAppendingPathComponent:fileName] error:&error];
+            XCTAssertNil(error);
+        }
+        [peerKits addObject:[[OTRKit alloc] initWithDelegate:self dataPath:peerPath]];
+    }
+    self.peerKits = peerKits;
+}
+
+- (void)tearDown {
+    [OTRDHKeypairPool sharedPool].capacity = 16;
+    OTRCryptoRuntime.secureMemoryLimit = [OTRCryptoRuntime secureMemoryStats].arenaSize;
+    for (NSString *path in self.dataPaths) {
+        [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+    }
+    self.otrKitAlice = nil;
+    self.peerKits = nil;
+    [super tearDown];
+}
+
+- (void) waitForKeypairPoolToFill {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Fill keypair pool"];
+    [[OTRDHKeypairPool sharedPool] fillWithCompletion:^(NSUInteger count) {
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:120 handler:nil];
+}
+
+/** Measures time-to-secure for a burst of new sessions, started one by one or through the bulk API */
+- (void) measureBurstSessionsWithBulkInitiation:(BOOL)bulkInitiation {
+    __block NSUInteger round = 0;
+    [self measureMetrics:@[XCTPerformanceMetric_WallClockTime] automaticallyStartMeasuring:NO forBlock:^{
+        NSMutableArray<NSString*> *peerUsernames = [NSMutableArray arrayWithCapacity:kOTRPerfBurstSessionCount];
+        for (NSUInteger i = 0; i < kOTRPerfBurstSessionCount; i++) {
+            [peerUsernames addObject:[NSString stringWithFormat:@"bob%d-%d@example.com", (int)round, (int)i]];
+        }
+        round++;
+        self.peerUsernames = peerUsernames;
+        self.securePeers = [NSMutableSet set];
+        [self waitForKeypairPoolToFill];
+
+        self.allSecureExpectation = [self expectationWithDescription:@"All sessions secure"];
+        [self startMeasuring];
+        if (bulkInitiation) {
+            [self.otrKitAlice initiateEncryptionWithUsernames:peerUsernames accountName:kOTRPerfAccountAlice protocol:kOTRPerfProtocolXMPP];
+        } else {
+            for (NSString *username in peerUsernames) {
+                [self.otrKitAlice initiateEncryptionWithUsername:username accountName:kOTRPerfAccountAlice protocol:kOTRPerfProtocolXMPP];
+            }
+        }
+        [self waitForExpectationsWithTimeout:120 handler:nil];
+        [self stopMeasuring];
+    }];
+}
+
+- (void) testBurstSessionsWithKeypairPool {
+    [OTRDHKeypairPool sharedPool].capacity = kOTRPerfBurstSessionCount * 4;
+    [self measureBurstSessionsWithBulkInitiation:NO];
+}
+
+- (void) testBurstSessionsWithoutKeypairPool {
+    [OTRDHKeypairPool sharedPool].capacity = 0;
+    [self measureBurstSessionsWithBulkInitiation:NO];
+}
+
+/** Same burst with all of the arena, 32 KiB of it like libgcrypt's default pool, and none of it */
+- (void) measureBurstSessionsWithSecureMemoryLimit:(NSUInteger)secureMemoryLimit {
+    OTRCryptoRuntime.secureMemoryLimit = secureMemoryLimit;
+    [OTRCryptoRuntime resetHighWaterMarks];
+    [self measureBurstSessionsWithBulkInitiation:NO];
+    NSLog(@"Limit %d: %@", (int)secureMemoryLimit, [OTRCryptoRuntime secureMemoryStats]);
+}
+
+- (void) testBurstSessionsWithSecureArena {
+    [self measureBurstSessionsWithSecureMemoryLimit:NSUIntegerMax];
+}
+
+- (void) testBurstSessionsWithSmallSecureArena {
+    [self measureBurstSessionsWithSecureMemoryLimit:32 * 1024];
+}
+
+- (void) testBurstSessionsWithoutSecureArena {
+    [self measureBurstSessionsWithSecureMemoryLimit:0];
+}
+
+- (void) testBulkSessionInitiation {
+    self.otrKitAlice.maxConcurrentSessionInitiations = 4;
+    [self measureBurstSessionsWithBulkInitiation:YES];
+}
+
+#pragma mark OTRKitDelegate
+
+- (void) otrKit:(OTRKit*)otrKit
+  injectMessage:(NSString*)message
+       username:(NSString*)username
+    accountName:(NSString*)accountName
+       protocol:(NSString*)protocol
+    fingerprint:(nullable OTRFingerprint*)fingerprint
+            tag:(nullable id)tag {
+    if (otrKit == self.otrKitAlice) {
+        NSUInteger index = [self.peerUsernames indexOfObject:username];
+        if (index == NSNotFound) {
+            return;
+        }
+        [self.peerKits[index] decodeMessage:message username:kOTRPerfAccountAlice accountName:kOTRPerfAccountBob protocol:kOTRPerfProtocolXMPP tag:tag];
+    } else {
+        NSUInteger index = [self.peerKits indexOfObject:otrKit];
+        if (index == NSNotFound) {
+            return;
+        }
+        [self.otrKitAlice decodeMessage:message username:self.peerUsernames[index] accountName:kOTRPerfAccountAlice protocol:kOTRPerfProtocolXMPP tag:tag];
+    }
+}
+
+- (void)    otrKit:(OTRKit*)otrKit
+updateMessageState:(OTRKitMessageState)messageState
+          username:(NSString*)username
+       accountName:(NSString*)accountName
+          protocol:(NSString*)protocol
+       fingerprint:(OTRFingerprint*)fingerprint {
+    if (otrKit != self.otrKitAlice || messageState != OTRKitMessageStateEncrypted) {
+        return;
+    }
+    if (![self.peerUsernames containsObject:username]) {
+        return;
+    }
+    [self.securePeers addObject:username];
+    if (self.securePeers.count == self.peerUsernames.count) {
+        [self.allSecureExpectation fulfill];
+        self.allSecureExpectation = nil;
+    }
+}
+
+- (BOOL)       otrKit:(OTRKit*)otrKit
+   isUsernameLoggedIn:(NSString*)username
+          accountName:(NSString*)accountName
+             protocol:(NSString*)protocol {
+    return YES;
+}
+
+@end
@@ -19,5 +19,8 @@ extern NSString * const kOTRTestProtocolXMPP;
 @property (nonatomic, strong, readonly) OTRKit *otrKitAlice;
 @property (nonatomic, strong, readonly) OTRKit *otrKitBob;
 
+/** Alice starts OTR with Bob, waits until both kits report OTRKitMessageStateEncrypted */
+- (void) startSecureSession;
+
 @end
 NS_ASSUME_NONNULL_END
@@ -12,6 +12,11 @@ NSString * const kOTRTestAccountAlice = @"alice@example.com";
 NSString * const kOTRTestAccountBob = @"bob@example.com";
 NSString * const kOTRTestProtocolXMPP = @"xmpp";
 
+@interface OTRKitSessionBase ()
+@property (nonatomic, strong, nullable) XCTestExpectation *secureExpectation;
+@property (nonatomic, strong, readonly) NSMutableSet<OTRKit*> *secureKits;
+@end
+
 @implementation OTRKitSessionBase
 
 - (void)setUp {
@@ -30,6 +35,13 @@ NSString * const kOTRTestProtocolXMPP = @"xmpp";
     _otrKitBob = [[OTRKit alloc] initWithDelegate:self dataPath:path2];
     XCTAssertNotNil(self.otrKitAlice, "otrKitAlice failed to initialize");
     XCTAssertNotNil(self.otrKitBob, "otrKitBob failed to initialize");
+    _secureKits = [NSMutableSet set];
+}
+
+- (void) startSecureSession {
+    self.secureExpectation = [self expectationWithDescription:@"Session secure"];
+    [self.otrKitAlice initiateEncryptionWithUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP];
+    [self waitForExpectationsWithTimeout:30 handler:nil];
 }
 
 - (void)tearDown {
@@ -70,6 +82,43 @@ NSString * const kOTRTestProtocolXMPP = @"xmpp";
     }
 }
 
+/** Passes encoded messages to the other kit, as if they went over the network */
+- (void) otrKit:(OTRKit*)otrKit
+ encodedMessage:(nullable NSString*)encodedMessage
+   wasEncrypted:(BOOL)wasEncrypted
+       username:(NSString*)username
+    accountName:(NSString*)accountName
+       protocol:(NSString*)protocol
+    fingerprint:(nullable OTRFingerprint*)fingerprint
+            tag:(nullable id)tag
+          error:(nullable NSError*)error {
+    XCTAssertNil(error);
+    if (!encodedMessage) {
+        return;
+    }
+    if (otrKit == self.otrKitAlice) {
+        [self.otrKitBob decodeMessage:encodedMessage username:kOTRTestAccountAlice accountName:kOTRTestAccountBob protocol:kOTRTestProtocolXMPP tag:tag];
+    } else if (otrKit == self.otrKitBob) {
+        [self.otrKitAlice decodeMessage:encodedMessage username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:tag];
+    }
+}
+
+- (void)    otrKit:(OTRKit*)otrKit
+updateMessageState:(OTRKitMessageState)messageState
+          username:(NSString*)username
+       accountName:(NSString*)accountName
+          protocol:(NSString*)protocol
+       fingerprint:(OTRFingerprint*)fingerprint {
+    if (messageState != OTRKitMessageStateEncrypted) {
+        return;
+    }
+    [self.secureKits addObject:otrKit];
+    if (self.secureKits.count == 2) {
+        [self.secureExpectation fulfill];
+        self.secureExpectation = nil;
+    }
+}
+
 /**
  *  libotr likes to know if buddies are still "online". This method
  *  is called synchronously on the callback queue so be careful.
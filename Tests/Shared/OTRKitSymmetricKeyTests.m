@@ -0,0 +1,116 @@
+//
+//  OTRKitSymmetricKeyTests.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRKitSessionBase.h"
+
+/** Number of keys requested at once, like a burst of attachments */
+static const NSUInteger kOTRTestSymmetricKeyCount = 50;
+static const NSUInteger kOTRTestSymmetricKeyUse = 1;
+
+@interface OTRKitSymmetricKeyTests : OTRKitSessionBase
+@property (nonatomic, strong, nullable) XCTestExpectation *receivedKeysExpectation;
+/** Keys Bob's delegate was told about, keyed by useData. Only touched on main queue. */
+@property (nonatomic, strong) NSMutableDictionary<NSData*, NSData*> *receivedKeys;
+/** Messages Alice injected once the session was secure */
+@property (atomic) NSUInteger aliceInjectedCount;
+@end
+
+@implementation OTRKitSymmetricKeyTests
+
+- (void)setUp {
+    [super setUp];
+    self.receivedKeys = [NSMutableDictionary dictionary];
+    [self startSecureSession];
+    self.aliceInjectedCount = 0;
+}
+
+- (NSArray<OTRSymmetricKeyUse*>*) usesWithRound:(NSUInteger)round {
+    NSMutableArray<OTRSymmetricKeyUse*> *uses = [NSMutableArray arrayWithCapacity:kOTRTestSymmetricKeyCount];
+    for (NSUInteger i = 0; i < kOTRTestSymmetricKeyCount; i++) {
+        NSData *useData = [[NSString stringWithFormat:@"file-%d-%d.jpg", (int)round, (int)i] dataUsingEncoding:NSUTF8StringEncoding];
+        [uses addObject:[[OTRSymmetricKeyUse alloc] initWithUse:kOTRTestSymmetricKeyUse useData:useData]];
+    }
+    return uses;
+}
+
+- (void) testBatchSymmetricKeys {
+    NSArray<OTRSymmetricKeyUse*> *uses = [self usesWithRound:0];
+    self.receivedKeysExpectation = [self expectationWithDescription:@"Received keys"];
+    NSError *error = nil;
+    NSData *key = [self.otrKitAlice requestSymmetricKeyForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP forUses:uses error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual(key.length, 32);
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    // Every use announced in one message
+    XCTAssertEqual(self.aliceInjectedCount, 1);
+    XCTAssertEqual(self.receivedKeys.count, kOTRTestSymmetricKeyCount);
+    for (OTRSymmetricKeyUse *use in uses) {
+        XCTAssertEqualObjects([self.receivedKeys objectForKey:use.useData], key);
+        NSData *cachedKey = [self.otrKitBob receivedSymmetricKeyForUsername:kOTRTestAccountAlice accountName:kOTRTestAccountBob protocol:kOTRTestProtocolXMPP forUse:use.use useData:use.useData];
+        XCTAssertEqualObjects(cachedKey, key);
+    }
+    XCTAssertNil([self.otrKitBob receivedSymmetricKeyForUsername:kOTRTestAccountAlice accountName:kOTRTestAccountBob protocol:kOTRTestProtocolXMPP forUse:kOTRTestSymmetricKeyUse + 1 useData:uses.firstObject.useData]);
+
+    // Same key as asking one at a time
+    NSData *singleKey = [self.otrKitAlice requestSymmetricKeyForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP forUse:kOTRTestSymmetricKeyUse useData:uses.firstObject.useData error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(singleKey, key);
+
+    // Keys are only good for the session they arrived in
+    [self.otrKitBob disableEncryptionWithUsername:kOTRTestAccountAlice accountName:kOTRTestAccountBob protocol:kOTRTestProtocolXMPP];
+    // Waits for the disconnect to be processed
+    [self.otrKitBob memoryReport];
+    XCTAssertNil([self.otrKitBob receivedSymmetricKeyForUsername:kOTRTestAccountAlice accountName:kOTRTestAccountBob protocol:kOTRTestProtocolXMPP forUse:kOTRTestSymmetricKeyUse useData:uses.firstObject.useData]);
+}
+
+/** Time for a burst of keys to be derived, announced and cached on the other side */
+- (void) testBatchSymmetricKeysPerformance {
+    __block NSUInteger round = 1;
+    [self measureBlock:^{
+        NSArray<OTRSymmetricKeyUse*> *uses = [self usesWithRound:round++];
+        self.receivedKeys = [NSMutableDictionary dictionary];
+        self.receivedKeysExpectation = [self expectationWithDescription:@"Received keys"];
+        NSError *error = nil;
+        [self.otrKitAlice requestSymmetricKeyForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP forUses:uses error:&error];
+        XCTAssertNil(error);
+        [self waitForExpectationsWithTimeout:10 handler:nil];
+    }];
+}
+
+#pragma mark OTRKitDelegate methods
+
+- (void) otrKit:(OTRKit*)otrKit
+  injectMessage:(NSString*)message
+       username:(NSString*)username
+    accountName:(NSString*)accountName
+       protocol:(NSString*)protocol
+    fingerprint:(nullable OTRFingerprint*)fingerprint
+            tag:(nullable id)tag {
+    if (otrKit == self.otrKitAlice) {
+        self.aliceInjectedCount++;
+    }
+    [super otrKit:otrKit injectMessage:message username:username accountName:accountName protocol:protocol fingerprint:fingerprint tag:tag];
+}
+
+- (void)        otrKit:(OTRKit*)otrKit
+  receivedSymmetricKey:(NSData*)symmetricKey
+                forUse:(NSUInteger)use
+               useData:(NSData*)useData
+              username:(NSString*)username
+           accountName:(NSString*)accountName
+              protocol:(NSString*)protocol {
+    XCTAssertEqual(otrKit, self.otrKitBob);
+    XCTAssertEqual(use, kOTRTestSymmetricKeyUse);
+    [self.receivedKeys setObject:symmetricKey forKey:useData];
+    if (self.receivedKeys.count == kOTRTestSymmetricKeyCount) {
+        [self.receivedKeysExpectation fulfill];
+        self.receivedKeysExpectation = nil;
+    }
+}
+
+@end
@@ -302,7 +302,7 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString*)accountName
 
 - (void)dataHandler:(OTRDataHandler*)dataHandler
            transfer:(OTRDataTransfer*)transfer
-        fingerprint:(OTRFingerprint*)fingerprint
+        fingerprint:(nullable OTRFingerprint*)fingerprint
               error:(NSError*)error {
     XCTAssertNotNil(dataHandler);
     XCTAssertNotNil(transfer);
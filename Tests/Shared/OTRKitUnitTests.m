@@ -9,9 +9,12 @@
 #import <XCTest/XCTest.h>
 @import OTRKit;
 
-@interface OTRKitUnitTests : XCTestCase <OTRKitDelegate>
+@interface OTRKitUnitTests : XCTestCase <OTRKitDelegate, OTRDataHandlerDelegate>
 @property (nonatomic, strong) XCTestExpectation *expectation;
 @property (nonatomic, strong) OTRKit *otrKit;
+@property (nonatomic, strong) OTRDataHandler *dataHandler;
+/** OTRDataHandler errors by code, only touched on main queue */
+@property (nonatomic, strong) NSCountedSet<NSNumber*> *dataErrorCodes;
 @end
 
 @implementation OTRKitUnitTests
@@ -24,6 +27,7 @@
     [[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:YES attributes:nil error:&error];
     XCTAssertNil(error);
     self.otrKit = [[OTRKit alloc] initWithDelegate:self dataPath:path];
+    self.dataErrorCodes = [NSCountedSet set];
 }
 
 - (void)tearDown {
@@ -32,6 +36,7 @@
     NSError *error = nil;
     [[NSFileManager defaultManager] removeItemAtPath:self.otrKit.dataPath error:&error];
     XCTAssertNil(error);
+    self.dataHandler = nil;
     self.otrKit = nil;
 }
 
@@ -75,6 +80,520 @@
 }
 
 
+/** Keys outlive the OTRKit, get exported in libotr's format and imported from it */
+- (void) testPrivateKeyStoreMigration {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Generate Keys"];
+    NSString *protocol = @"xmpp";
+    NSArray<NSString*> *accountNames = @[@"alice@dukgo.com", @"bob@dukgo.com", @"carol@dukgo.com"];
+    NSMutableDictionary<NSString*, NSData*> *fingerprints = [NSMutableDictionary dictionary];
+    __block void (^generate)(NSUInteger) = nil;
+    __weak __block void (^weakGenerate)(NSUInteger) = nil;
+    weakGenerate = generate = ^(NSUInteger index) {
+        if (index == accountNames.count) {
+            [expectation fulfill];
+            return;
+        }
+        [self.otrKit generatePrivateKeyForAccountName:accountNames[index] protocol:protocol completion:^(OTRFingerprint *fingerprint, NSError *error) {
+            XCTAssertNotNil(fingerprint, @"%@", error);
+            fingerprints[accountNames[index]] = fingerprint.fingerprint;
+            weakGenerate(index + 1);
+        }];
+    };
+    generate(0);
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+    generate = nil;
+    // Generating a key no longer writes libotr's file
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:self.otrKit.privateKeyPath]);
+
+    OTRKit *reopened = [[OTRKit alloc] initWithDelegate:self dataPath:self.otrKit.dataPath];
+    for (NSString *accountName in accountNames) {
+        XCTAssertEqualObjects([reopened fingerprintForAccountName:accountName protocol:protocol].fingerprint, fingerprints[accountName]);
+    }
+
+    NSError *error = nil;
+    XCTAssertTrue([reopened exportLibotrFilesWithError:&error], @"%@", error);
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    [[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:YES attributes:nil error:nil];
+    for (NSString *sourcePath in @[reopened.privateKeyPath, reopened.instanceTagsPath]) {
+        XCTAssertTrue([[NSFileManager defaultManager] copyItemAtPath:sourcePath toPath:[path stringByAppendingPathComponent:sourcePath.lastPathComponent] error:&error], @"%@", error);
+    }
+    OTRKit *migrated = [[OTRKit alloc] initWithDelegate:self dataPath:path];
+    for (NSString *accountName in accountNames) {
+        XCTAssertEqualObjects([migrated fingerprintForAccountName:accountName protocol:protocol].fingerprint, fingerprints[accountName]);
+    }
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:[path stringByAppendingPathComponent:@"otr.private_key.store"]]);
+    // Nothing keeps the migrated file current, so it's moved out of the way
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:migrated.privateKeyPath]);
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:[migrated.privateKeyPath stringByAppendingString:@".migrated"]]);
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void) testFanOutEncode {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Fan-out encode"];
+    NSArray<NSString*> *usernames = @[@"bob@dukgo.com", @"carol@dukgo.com", @"bob@dukgo.com", @"dave@dukgo.com"];
+    [self.otrKit encodeMessage:@"Hello everyone" tlvs:nil usernames:usernames accountName:@"alice@dukgo.com" protocol:@"xmpp" tag:nil completion:^(NSArray<OTREncodedMessage *> * _Nonnull encodedMessages) {
+        XCTAssertEqual(encodedMessages.count, 3);
+        NSArray *resultUsernames = [encodedMessages valueForKey:NSStringFromSelector(@selector(username))];
+        XCTAssertEqualObjects(resultUsernames, (@[@"bob@dukgo.com", @"carol@dukgo.com", @"dave@dukgo.com"]));
+        for (OTREncodedMessage *result in encodedMessages) {
+            XCTAssertNil(result.error);
+            XCTAssertNotNil(result.encodedMessage);
+            XCTAssertFalse(result.wasEncrypted);
+            XCTAssertTrue([result.encodedMessage hasPrefix:@"Hello everyone"]);
+        }
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+}
+
+- (void) testFanOutEncodePerformance {
+    NSMutableArray<NSString*> *usernames = [NSMutableArray arrayWithCapacity:200];
+    for (NSUInteger i = 0; i < 200; i++) {
+        [usernames addObject:[NSString stringWithFormat:@"member%d@conference.dukgo.com", (int)i]];
+    }
+    [self measureBlock:^{
+        XCTestExpectation *expectation = [self expectationWithDescription:@"Fan-out encode 200 members"];
+        [self.otrKit encodeMessage:@"Hello everyone" tlvs:nil usernames:usernames accountName:@"alice@dukgo.com" protocol:@"xmpp" tag:nil completion:^(NSArray<OTREncodedMessage *> * _Nonnull encodedMessages) {
+            XCTAssertEqual(encodedMessages.count, usernames.count);
+            [expectation fulfill];
+        }];
+        [self waitForExpectationsWithTimeout:30 handler:nil];
+    }];
+}
+
+- (void) testQueueDepthAndAdmission {
+    NSUInteger messageCount = 10;
+    self.otrKit.maxInFlightOperations = 2;
+    __block NSUInteger encodedCount = 0;
+    XCTestExpectation *encodedExpectation = [self expectationWithDescription:@"All encoded"];
+    for (NSUInteger i = 0; i < messageCount; i++) {
+        [self.otrKit encodeMessage:@"Hello" tlvs:nil username:@"bob@dukgo.com" accountName:@"alice@dukgo.com" protocol:@"xmpp" tag:nil async:YES completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+            XCTAssertNil(error);
+            encodedCount++;
+            if (encodedCount == messageCount) {
+                [encodedExpectation fulfill];
+            }
+        }];
+    }
+    // Completions can't run until we spin the main queue, so everything is still in flight
+    XCTAssertEqual(self.otrKit.queueDepth, messageCount);
+    XCTestExpectation *admittedExpectation = [self expectationWithDescription:@"Admitted"];
+    [self.otrKit requestAdmissionWithCompletion:^{
+        XCTAssertLessThan(self.otrKit.queueDepth, 2);
+        XCTAssertGreaterThanOrEqual(encodedCount, messageCount - 1);
+        [admittedExpectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+    XCTAssertEqual(self.otrKit.queueDepth, 0);
+}
+
+- (void) testShedNonInteractiveWork {
+    self.otrKit.maxInFlightOperations = 1;
+    self.otrKit.shedsNonInteractiveWork = YES;
+    XCTestExpectation *interactiveExpectation = [self expectationWithDescription:@"Interactive encoded"];
+    XCTestExpectation *bulkExpectation = [self expectationWithDescription:@"Bulk shed"];
+    [self.otrKit encodeMessage:@"Hello" tlvs:nil username:@"bob@dukgo.com" accountName:@"alice@dukgo.com" protocol:@"xmpp" tag:nil async:YES completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+        XCTAssertNil(error);
+        [interactiveExpectation fulfill];
+    }];
+    // Over the limit, and the delegate method reports the error
+    self.expectation = bulkExpectation;
+    [self.otrKit encodeMessage:@"Chunk" tlvs:nil username:@"bob@dukgo.com" accountName:@"alice@dukgo.com" protocol:@"xmpp" tag:@"bulk" priority:OTRKitPriorityBulk];
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+    self.expectation = nil;
+}
+
+- (void) encodeMessagesToPeerCount:(NSUInteger)peerCount round:(NSUInteger)round {
+    NSMutableArray<NSString*> *usernames = [NSMutableArray arrayWithCapacity:peerCount];
+    for (NSUInteger i = 0; i < peerCount; i++) {
+        [usernames addObject:[NSString stringWithFormat:@"peer%d-%d@dukgo.com", (int)round, (int)i]];
+    }
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Encode to peers"];
+    [self.otrKit encodeMessage:@"Hello" tlvs:nil usernames:usernames accountName:@"alice@dukgo.com" protocol:@"xmpp" tag:nil completion:^(NSArray<OTREncodedMessage *> * _Nonnull encodedMessages) {
+        XCTAssertEqual(encodedMessages.count, peerCount);
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+}
+
+- (void) testEvictIdleContexts {
+    NSUInteger peerCount = 50;
+    // Disabled by default
+    [self encodeMessagesToPeerCount:peerCount round:0];
+    XCTAssertEqual([self.otrKit evictIdleContexts], 0);
+    XCTAssertEqual([self.otrKit memoryReport].masterContextCount, peerCount);
+    
+    self.otrKit.contextIdleTimeout = 0.5;
+    [NSThread sleepForTimeInterval:0.6];
+    XCTAssertEqual([self.otrKit evictIdleContexts], peerCount);
+    OTRKitMemoryReport *report = [self.otrKit memoryReport];
+    XCTAssertEqual(report.masterContextCount, 0);
+    XCTAssertEqual(report.instanceContextCount, 0);
+}
+
+/** Evicted contexts keep nothing but their index entries, and get their fingerprints back when seen again */
+- (void) testEvictedFingerprintsRestored {
+    NSUInteger buddyCount = 10;
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    NSError *error = nil;
+    [[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:YES attributes:nil error:&error];
+    XCTAssertNil(error);
+    NSMutableString *fingerprintsFile = [NSMutableString string];
+    for (NSUInteger i = 0; i < buddyCount; i++) {
+        uint32_t bytes[5] = {(uint32_t)i, 1, 2, 3, 4};
+        [fingerprintsFile appendFormat:@"buddy%d@example.com\talice@example.com\txmpp\t%@\tTrustedUser\n", (int)i, [[NSData dataWithBytes:bytes length:sizeof(bytes)] otr_hexString]];
+    }
+    [fingerprintsFile writeToFile:[path stringByAppendingPathComponent:@"otr.fingerprints"] atomically:YES encoding:NSUTF8StringEncoding error:&error];
+    XCTAssertNil(error);
+    OTRKit *otrKit = [[OTRKit alloc] initWithDelegate:self dataPath:path];
+    XCTAssertEqual([otrKit allFingerprints].count, buddyCount);
+
+    otrKit.contextIdleTimeout = 0.5;
+    // Contexts read from disk start their idle clock on the first sweep
+    XCTAssertEqual([otrKit evictIdleContexts], 0);
+    [NSThread sleepForTimeInterval:0.6];
+    XCTAssertEqual([otrKit evictIdleContexts], buddyCount);
+    OTRKitMemoryReport *report = [otrKit memoryReport];
+    XCTAssertEqual(report.masterContextCount, 0);
+    XCTAssertEqual(report.evictedContextCount, buddyCount);
+    XCTAssertEqual(report.evictedFingerprintCount, buddyCount);
+    XCTAssertEqual([otrKit allFingerprints].count, buddyCount);
+
+    // Saving recreates the context, and the file is written with the evicted ones appended
+    OTRFingerprint *fingerprint = [otrKit fingerprintsForUsername:@"buddy0@example.com" accountName:@"alice@example.com" protocol:@"xmpp"].firstObject;
+    XCTAssertEqual(fingerprint.trustLevel, OTRTrustLevelTrustedUser);
+    fingerprint.trustLevel = OTRTrustLevelUntrustedUser;
+    [otrKit saveFingerprint:fingerprint];
+    report = [otrKit memoryReport];
+    XCTAssertEqual(report.masterContextCount, 1);
+    XCTAssertEqual(report.fingerprintCount, 1);
+    XCTAssertEqual(report.evictedContextCount, buddyCount - 1);
+
+    OTRKit *reopened = [[OTRKit alloc] initWithDelegate:self dataPath:path];
+    NSArray<OTRFingerprint*> *fingerprints = [reopened allFingerprints];
+    XCTAssertEqual(fingerprints.count, buddyCount);
+    for (OTRFingerprint *reopenedFingerprint in fingerprints) {
+        OTRTrustLevel trustLevel = [reopenedFingerprint.username isEqualToString:@"buddy0@example.com"] ? OTRTrustLevelUntrustedUser : OTRTrustLevelTrustedUser;
+        XCTAssertEqual(reopenedFingerprint.trustLevel, trustLevel);
+    }
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+/** Soak test: context count and estimated memory should stay flat as peers come and go */
+- (void) testEvictIdleContextsSoak {
+    NSUInteger peerCount = 200;
+    self.otrKit.contextIdleTimeout = 0.5;
+    __block NSUInteger round = 0;
+    __block NSUInteger baselineBytes = 0;
+    [self measureBlock:^{
+        [self encodeMessagesToPeerCount:peerCount round:round++];
+        OTRKitMemoryReport *busyReport = [self.otrKit memoryReport];
+        XCTAssertEqual(busyReport.masterContextCount, peerCount);
+        [NSThread sleepForTimeInterval:0.6];
+        [self.otrKit evictIdleContexts];
+        OTRKitMemoryReport *report = [self.otrKit memoryReport];
+        XCTAssertEqual(report.masterContextCount, 0);
+        if (!baselineBytes) {
+            baselineBytes = busyReport.estimatedBytes;
+        }
+        XCTAssertEqual(busyReport.estimatedBytes, baselineBytes);
+    }];
+}
+
+/** Sends count different files, so they don't share a buffer */
+- (void) sendFilesWithCount:(NSUInteger)count length:(NSUInteger)length round:(NSUInteger)round {
+    for (NSUInteger i = 0; i < count; i++) {
+        NSMutableData *fileData = [NSMutableData dataWithLength:length];
+        uint32_t fileNumber[2] = {(uint32_t)round, (uint32_t)i};
+        [fileData replaceBytesInRange:NSMakeRange(0, sizeof(fileNumber)) withBytes:fileNumber];
+        NSString *fileName = [NSString stringWithFormat:@"file%d-%d.bin", (int)round, (int)i];
+        [self.dataHandler sendFileWithName:fileName fileData:fileData username:@"bob@dukgo.com" accountName:@"alice@dukgo.com" protocol:@"xmpp" tag:nil];
+    }
+}
+
+/** Wait for delegate callbacks already dispatched to the main queue */
+- (void) drainMainQueue {
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Main queue"];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [expectation fulfill];
+    });
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+}
+
+- (void) testCancelTransfer {
+    self.dataHandler = [[OTRDataHandler alloc] initWithOTRKit:self.otrKit delegate:self];
+    OTRDataOutgoingTransfer *transfer = [self.dataHandler sendFileWithName:@"file.bin" fileData:[NSMutableData dataWithLength:1024] username:@"bob@dukgo.com" accountName:@"alice@dukgo.com" protocol:@"xmpp" tag:nil];
+    OTRDataHandlerStats *stats = [self.dataHandler stats];
+    XCTAssertEqual(stats.outgoingTransferCount, 1);
+    XCTAssertEqual(stats.residentBytes, 1024);
+    XCTAssertEqual(stats.pendingRequestCount, 1);
+
+    [self.dataHandler cancelTransfer:transfer];
+    // Already gone, shouldn't be reported twice
+    [self.dataHandler cancelTransfer:transfer];
+    stats = [self.dataHandler stats];
+    XCTAssertEqual(stats.outgoingTransferCount, 0);
+    XCTAssertEqual(stats.residentBytes, 0);
+    XCTAssertEqual(stats.pendingRequestCount, 0);
+    XCTAssertEqual(stats.cancelledTransferCount, 1);
+    [self drainMainQueue];
+    XCTAssertEqual([self.dataErrorCodes countForObject:@(OTRDataErrorCancelled)], 1);
+}
+
+/** count chunk GETs for a new incoming transfer from username */
+- (NSArray<OTRDataGetOperation*>*) operationsForIncomingTransferFrom:(NSString*)username count:(NSUInteger)count transfer:(OTRDataIncomingTransfer**)outTransfer {
+    OTRDataIncomingTransfer *transfer = [[OTRDataIncomingTransfer alloc] initWithFileLength:count * 16384 username:username accountName:@"alice@dukgo.com" protocol:@"xmpp" tag:nil];
+    transfer.offeredURL = [NSURL URLWithString:[NSString stringWithFormat:@"otr-in-band:/storage/%@/file.bin", transfer.transferId]];
+    NSMutableArray<OTRDataGetOperation*> *operations = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [operations addObject:[[OTRDataGetOperation alloc] initWithRange:NSMakeRange(i * 16384, 16384) incomingTransfer:transfer dataHandler:self.dataHandler]];
+    }
+    if (outTransfer) {
+        *outTransfer = transfer;
+    }
+    return operations;
+}
+
+- (void) testTransferSchedulerTakesTurns {
+    self.dataHandler = [[OTRDataHandler alloc] initWithOTRKit:self.otrKit delegate:self];
+    OTRDataTransferScheduler *scheduler = [[OTRDataTransferScheduler alloc] initWithMaxOutstandingRequests:4 maxOutstandingRequestsPerPeer:2];
+    OTRDataIncomingTransfer *bigTransfer = nil;
+    OTRDataIncomingTransfer *smallTransfer = nil;
+    OTRDataIncomingTransfer *carolTransfer = nil;
+    [scheduler enqueueOperations:[self operationsForIncomingTransferFrom:@"bob@dukgo.com" count:100 transfer:&bigTransfer]];
+    // Bob's big transfer has had a head start when the small one joins
+    OTRDataGetOperation *first = [scheduler dequeueOperation];
+    XCTAssertEqual(first.incomingTransfer, bigTransfer);
+    [scheduler operationFinished:first];
+    [scheduler enqueueOperations:[self operationsForIncomingTransferFrom:@"bob@dukgo.com" count:2 transfer:&smallTransfer]];
+    [scheduler enqueueOperations:[self operationsForIncomingTransferFrom:@"carol@dukgo.com" count:3 transfer:&carolTransfer]];
+    XCTAssertEqual(scheduler.queuedCount, 104);
+
+    // Two each for Bob and Carol, and Bob's two are split between his transfers
+    NSMutableArray<OTRDataGetOperation*> *outstanding = [NSMutableArray array];
+    OTRDataGetOperation *operation = nil;
+    while ((operation = [scheduler dequeueOperation])) {
+        [outstanding addObject:operation];
+    }
+    XCTAssertEqual(outstanding.count, 4);
+    XCTAssertEqual(scheduler.outstandingCount, 4);
+    NSArray *transfers = [outstanding valueForKey:NSStringFromSelector(@selector(incomingTransfer))];
+    XCTAssertEqual([transfers indexesOfObjectsPassingTest:^BOOL(id obj, NSUInteger idx, BOOL *stop) { return obj == carolTransfer; }].count, 2);
+    XCTAssertTrue([transfers indexOfObjectIdenticalTo:smallTransfer] != NSNotFound);
+    XCTAssertTrue([transfers indexOfObjectIdenticalTo:bigTransfer] != NSNotFound);
+
+    // The small transfers are done within a few turns, then the big one gets every request
+    NSMutableArray<OTRDataIncomingTransfer*> *order = [NSMutableArray array];
+    while (outstanding.count) {
+        [scheduler operationFinished:outstanding.firstObject];
+        [order addObject:outstanding.firstObject.incomingTransfer];
+        [outstanding removeObjectAtIndex:0];
+        while ((operation = [scheduler dequeueOperation])) {
+            [outstanding addObject:operation];
+        }
+    }
+    XCTAssertEqual(order.count, 104);
+    NSUInteger lastSmall = 0;
+    for (NSUInteger i = 0; i < order.count; i++) {
+        if (order[i] != bigTransfer) {
+            lastSmall = i;
+        }
+    }
+    XCTAssertLessThan(lastSmall, 8);
+    XCTAssertEqual(scheduler.queuedCount, 0);
+    XCTAssertEqual(scheduler.outstandingCount, 0);
+}
+
+- (void) testTransferSchedulerPriorities {
+    self.dataHandler = [[OTRDataHandler alloc] initWithOTRKit:self.otrKit delegate:self];
+    OTRDataTransferScheduler *scheduler = [[OTRDataTransferScheduler alloc] initWithMaxOutstandingRequests:1 maxOutstandingRequestsPerPeer:1];
+    OTRDataIncomingTransfer *normalTransfer = nil;
+    OTRDataIncomingTransfer *highTransfer = nil;
+    [scheduler enqueueOperations:[self operationsForIncomingTransferFrom:@"bob@dukgo.com" count:50 transfer:&normalTransfer]];
+    [scheduler enqueueOperations:[self operationsForIncomingTransferFrom:@"bob@dukgo.com" count:50 transfer:&highTransfer]];
+    highTransfer.priority = OTRDataTransferPriorityHigh;
+    NSUInteger highCount = 0;
+    for (NSUInteger i = 0; i < 20; i++) {
+        OTRDataGetOperation *operation = [scheduler dequeueOperation];
+        XCTAssertNil([scheduler dequeueOperation]);
+        if (operation.incomingTransfer == highTransfer) {
+            highCount++;
+        }
+        [scheduler operationFinished:operation];
+    }
+    // 16 to 4
+    XCTAssertGreaterThanOrEqual(highCount, 15);
+    XCTAssertLessThan(highCount, 20);
+
+    // Removing a transfer frees its slot
+    OTRDataGetOperation *operation = [scheduler dequeueOperation];
+    XCTAssertNotNil(operation);
+    XCTAssertNil([scheduler dequeueOperation]);
+    [scheduler removeOperationsForTransfer:operation.incomingTransfer];
+    XCTAssertEqual(scheduler.outstandingCount, 0);
+    OTRDataGetOperation *next = [scheduler dequeueOperation];
+    XCTAssertNotNil(next);
+    XCTAssertNotEqual(next.incomingTransfer, operation.incomingTransfer);
+    // Finishing an operation of a removed transfer does nothing
+    [scheduler operationFinished:operation];
+    XCTAssertEqual(scheduler.outstandingCount, 1);
+}
+
+- (void) testEvictTransfersOverBudget {
+    NSUInteger fileLength = 1024 * 1024;
+    self.dataHandler = [[OTRDataHandler alloc] initWithOTRKit:self.otrKit delegate:self];
+    self.dataHandler.maxResidentBytes = 3 * fileLength;
+    [self sendFilesWithCount:5 length:fileLength round:0];
+    OTRDataHandlerStats *stats = [self.dataHandler stats];
+    XCTAssertEqual(stats.outgoingTransferCount, 3);
+    XCTAssertEqual(stats.residentBytes, 3 * fileLength);
+    XCTAssertEqual(stats.evictedTransferCount, 2);
+    [self drainMainQueue];
+    XCTAssertEqual([self.dataErrorCodes countForObject:@(OTRDataErrorEvicted)], 2);
+}
+
+- (void) testSharedContentFanOut {
+    NSUInteger peerCount = 20;
+    NSUInteger fileLength = 1024 * 1024;
+    self.dataHandler = [[OTRDataHandler alloc] initWithOTRKit:self.otrKit delegate:self];
+    NSData *fileData = [NSMutableData dataWithLength:fileLength];
+    // A copy with the same contents still shares the first buffer
+    NSData *fileDataCopy = [NSMutableData dataWithLength:fileLength];
+    NSMutableArray<OTRDataOutgoingTransfer*> *transfers = [NSMutableArray array];
+    for (NSUInteger i = 0; i < peerCount; i++) {
+        NSString *username = [NSString stringWithFormat:@"peer%d@dukgo.com", (int)i];
+        NSData *data = (i % 2) ? fileDataCopy : fileData;
+        [transfers addObject:[self.dataHandler sendFileWithName:@"image.jpg" fileData:data username:username accountName:@"alice@dukgo.com" protocol:@"xmpp" tag:nil]];
+    }
+    OTRDataHandlerStats *stats = [self.dataHandler stats];
+    XCTAssertEqual(stats.outgoingTransferCount, peerCount);
+    XCTAssertEqual(stats.residentBytes, fileLength);
+    for (OTRDataOutgoingTransfer *transfer in transfers) {
+        XCTAssertEqual(transfer.fileData, fileData);
+        XCTAssertEqualObjects(transfer.fileHash, transfers.firstObject.fileHash);
+    }
+
+    // Memory is only released with the last transfer
+    for (NSUInteger i = 0; i < peerCount - 1; i++) {
+        [self.dataHandler cancelTransfer:transfers[i]];
+    }
+    XCTAssertEqual([self.dataHandler stats].residentBytes, fileLength);
+    [self.dataHandler cancelTransfer:transfers.lastObject];
+    XCTAssertEqual([self.dataHandler stats].residentBytes, 0);
+}
+
+- (void) testSharedContentFanOutPerformance {
+    NSUInteger peerCount = 200;
+    self.dataHandler = [[OTRDataHandler alloc] initWithOTRKit:self.otrKit delegate:self];
+    NSData *fileData = [NSMutableData dataWithLength:4 * 1024 * 1024];
+    [self measureBlock:^{
+        NSMutableArray<OTRDataOutgoingTransfer*> *transfers = [NSMutableArray arrayWithCapacity:peerCount];
+        for (NSUInteger i = 0; i < peerCount; i++) {
+            NSString *username = [NSString stringWithFormat:@"member%d@conference.dukgo.com", (int)i];
+            [transfers addObject:[self.dataHandler sendFileWithName:@"image.jpg" fileData:fileData username:username accountName:@"alice@dukgo.com" protocol:@"xmpp" tag:nil]];
+        }
+        XCTAssertEqual([self.dataHandler stats].residentBytes, fileData.length);
+        for (OTRDataOutgoingTransfer *transfer in transfers) {
+            [self.dataHandler cancelTransfer:transfer];
+        }
+        XCTAssertEqual([self.dataHandler stats].outgoingTransferCount, 0);
+    }];
+}
+
+/** Soak test: offers nobody fetches should expire and resident bytes should return to zero every round */
+- (void) testExpireTransfersSoak {
+    NSUInteger fileCount = 8;
+    NSUInteger fileLength = 1024 * 1024;
+    self.dataHandler = [[OTRDataHandler alloc] initWithOTRKit:self.otrKit delegate:self];
+    self.dataHandler.offerTimeout = 0.5;
+    __block NSUInteger round = 0;
+    [self measureBlock:^{
+        [self sendFilesWithCount:fileCount length:fileLength round:round++];
+        OTRDataHandlerStats *busyStats = [self.dataHandler stats];
+        XCTAssertEqual(busyStats.outgoingTransferCount, fileCount);
+        XCTAssertEqual(busyStats.residentBytes, fileCount * fileLength);
+        // Nothing is stale yet
+        XCTAssertEqual([self.dataHandler expireStaleTransfers], 0);
+        [NSThread sleepForTimeInterval:0.6];
+        XCTAssertEqual([self.dataHandler expireStaleTransfers], fileCount);
+        OTRDataHandlerStats *stats = [self.dataHandler stats];
+        XCTAssertEqual(stats.outgoingTransferCount, 0);
+        XCTAssertEqual(stats.incomingTransferCount, 0);
+        XCTAssertEqual(stats.residentBytes, 0);
+        XCTAssertEqual(stats.pendingRequestCount, 0);
+        XCTAssertEqual(stats.pendingOperationCount, 0);
+    }];
+    XCTAssertEqual([self.dataHandler stats].expiredTransferCount, fileCount * round);
+}
+
+/** A 100k entry trust store read from disk, looked up by key and paged by trust level */
+- (void) testFingerprintStorePerformance {
+    NSUInteger fingerprintCount = 100000;
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    NSError *error = nil;
+    [[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:YES attributes:nil error:&error];
+    XCTAssertNil(error);
+    NSMutableArray<NSData*> *fingerprintDatas = [NSMutableArray arrayWithCapacity:fingerprintCount];
+    NSMutableString *fingerprintsFile = [NSMutableString string];
+    for (NSUInteger i = 0; i < fingerprintCount; i++) {
+        uint32_t bytes[5] = {(uint32_t)i, (uint32_t)(i * 2654435761u), 0, 0, 0};
+        NSData *fingerprintData = [NSData dataWithBytes:bytes length:sizeof(bytes)];
+        [fingerprintDatas addObject:fingerprintData];
+        NSString *trust = i % 2 ? @"UntrustedNew" : @"TrustedTofu";
+        [fingerprintsFile appendFormat:@"buddy%d@example.com\taccount%d@example.com\txmpp\t%@\t%@\n", (int)(i % 1000), (int)(i % 10), [fingerprintData otr_hexString], trust];
+    }
+    // Same format and name libotr uses in the data path
+    [fingerprintsFile writeToFile:[path stringByAppendingPathComponent:@"otr.fingerprints"] atomically:YES encoding:NSUTF8StringEncoding error:&error];
+    XCTAssertNil(error);
+    OTRKit *otrKit = [[OTRKit alloc] initWithDelegate:self dataPath:path];
+    XCTAssertEqual([otrKit allFingerprints].count, fingerprintCount);
+
+    OTRFingerprintQuery *untrustedQuery = [OTRFingerprintQuery queryWithTrustLevels:[NSIndexSet indexSetWithIndex:OTRTrustLevelUntrustedNew]];
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < fingerprintCount; i += 10) {
+            XCTAssertEqual([otrKit fingerprintsWithData:fingerprintDatas[i]].count, 1);
+        }
+        __block NSUInteger untrustedCount = 0;
+        [otrKit enumerateFingerprintsMatchingQuery:untrustedQuery pageSize:500 usingBlock:^(NSArray<OTRFingerprint *> *page, BOOL *stop) {
+            untrustedCount += page.count;
+        }];
+        XCTAssertEqual(untrustedCount, fingerprintCount / 2);
+    }];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+#pragma mark OTRDataHandlerDelegate
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+           transfer:(OTRDataTransfer*)transfer
+        fingerprint:(nullable OTRFingerprint*)fingerprint
+              error:(NSError*)error {
+    XCTAssertNotNil(transfer);
+    XCTAssertEqualObjects(error.domain, kOTRDataErrorDomain);
+    [self.dataErrorCodes addObject:@(error.code)];
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+    offeredTransfer:(OTRDataIncomingTransfer*)transfer
+        fingerprint:(OTRFingerprint*)fingerprint {
+    XCTFail(@"Unexpected offer: %@", transfer);
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+           transfer:(OTRDataTransfer*)transfer
+           progress:(float)progress
+        fingerprint:(OTRFingerprint*)fingerprint {
+    XCTFail(@"Unexpected progress: %@", transfer);
+}
+
+- (void)dataHandler:(OTRDataHandler*)dataHandler
+   transferComplete:(OTRDataTransfer*)transfer
+        fingerprint:(OTRFingerprint*)fingerprint {
+    XCTFail(@"Unexpected completion: %@", transfer);
+}
+
+#pragma mark OTRKitDelegate
+
 - (void) otrKit:(OTRKit*)otrKit
   injectMessage:(NSString*)message
        username:(NSString*)username
@@ -97,6 +616,12 @@
             tag:(nullable id)tag
           error:(nullable NSError*)error {
     XCTAssertNotNil(otrKit);
+    if ([tag isEqual:@"bulk"]) {
+        XCTAssertNotNil(error);
+        XCTAssertEqual(error.code, EBUSY);
+        [self.expectation fulfill];
+        return;
+    }
     if (!wasEncrypted) {
         NSLog(@"%@ encodedMessage: %@ %@->%@ tag: %@", otrKit, encodedMessage, accountName, username, tag);
     } else {
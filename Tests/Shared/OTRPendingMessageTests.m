@@ -0,0 +1,124 @@
+//
+//  OTRPendingMessageTests.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRKitSessionBase.h"
+
+static const NSUInteger kOTRTestPendingMessageCount = 10;
+
+@interface OTRPendingMessageTests : OTRKitSessionBase
+/** Everything below is only touched on the main queue */
+@property (nonatomic, strong) NSMutableArray<NSString*> *encodedMessages;
+@property (nonatomic, strong) NSMutableArray<NSString*> *decodedMessages;
+@property (nonatomic, strong, nullable) XCTestExpectation *decodedExpectation;
+@end
+
+@implementation OTRPendingMessageTests
+
+- (void)setUp {
+    [super setUp];
+    self.encodedMessages = [NSMutableArray array];
+    self.decodedMessages = [NSMutableArray array];
+    self.otrKitAlice.otrPolicy = OTRKitPolicyAlways;
+    self.otrKitBob.otrPolicy = OTRKitPolicyAlways;
+}
+
+- (NSArray<NSString*>*) messages {
+    NSMutableArray<NSString*> *messages = [NSMutableArray array];
+    for (NSUInteger i = 0; i < kOTRTestPendingMessageCount; i++) {
+        [messages addObject:[NSString stringWithFormat:@"message %d", (int)i]];
+    }
+    return messages;
+}
+
+/** Messages sent before the session exists start the AKE and arrive once, in order, encrypted */
+- (void) testMessagesHeldUntilSecure {
+    self.otrKitAlice.pendingMessageTimeout = 30;
+    self.decodedExpectation = [self expectationWithDescription:@"Messages decoded"];
+    self.decodedExpectation.expectedFulfillmentCount = kOTRTestPendingMessageCount;
+    NSArray<NSString*> *messages = [self messages];
+    NSDate *start = [NSDate date];
+    for (NSString *message in messages) {
+        [self.otrKitAlice encodeMessage:message tlvs:nil username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil];
+    }
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+    NSLog(@"%d messages held through the AKE delivered in %.2fs", (int)messages.count, -[start timeIntervalSinceNow]);
+
+    XCTAssertEqualObjects(self.decodedMessages, messages);
+    XCTAssertEqual(self.encodedMessages.count, messages.count);
+    for (NSString *encodedMessage in self.encodedMessages) {
+        XCTAssertTrue([encodedMessage hasPrefix:@"?OTR"]);
+    }
+    XCTAssertEqual(self.otrKitAlice.queueDepth, 0);
+}
+
+- (void) testHeldMessagesTimeOut {
+    self.otrKitAlice.pendingMessageTimeout = 0.5;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Timed out"];
+    // Bob never sees the query, so the AKE can't finish
+    self.otrKitBob.otrPolicy = OTRKitPolicyNever;
+    [self.otrKitAlice encodeMessage:@"hello" tlvs:nil username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil async:YES completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+        XCTAssertNil(encodedMessage);
+        XCTAssertNotNil(error);
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
+/** Opportunistic peers may not speak OTR, so messages go out right away instead of waiting for the timeout */
+- (void) testMessagesNotHeldWithoutRequiredEncryption {
+    self.otrKitAlice.otrPolicy = OTRKitPolicyOpportunistic;
+    self.otrKitAlice.pendingMessageTimeout = 30;
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Sent"];
+    [self.otrKitAlice encodeMessage:@"hello" tlvs:nil username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil async:YES completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+        XCTAssertNil(error);
+        XCTAssertFalse(wasEncrypted);
+        XCTAssertTrue([encodedMessage hasPrefix:@"hello"]);
+        [expectation fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+#pragma mark OTRKitDelegate methods
+
+- (void) otrKit:(OTRKit*)otrKit
+ encodedMessage:(nullable NSString*)encodedMessage
+   wasEncrypted:(BOOL)wasEncrypted
+       username:(NSString*)username
+    accountName:(NSString*)accountName
+       protocol:(NSString*)protocol
+    fingerprint:(nullable OTRFingerprint*)fingerprint
+            tag:(nullable id)tag
+          error:(nullable NSError*)error {
+    XCTAssertNil(error);
+    if (!encodedMessage || otrKit != self.otrKitAlice) {
+        return;
+    }
+    [self.encodedMessages addObject:encodedMessage];
+    [self.otrKitBob decodeMessage:encodedMessage username:kOTRTestAccountAlice accountName:kOTRTestAccountBob protocol:kOTRTestProtocolXMPP tag:tag];
+}
+
+- (void) otrKit:(OTRKit*)otrKit
+ decodedMessage:(nullable NSString*)decodedMessage
+           tlvs:(NSArray<OTRTLV*>*)tlvs
+   wasEncrypted:(BOOL)wasEncrypted
+       username:(NSString*)username
+    accountName:(NSString*)accountName
+       protocol:(NSString*)protocol
+    fingerprint:(nullable OTRFingerprint*)fingerprint
+            tag:(nullable id)tag
+          error:(nullable NSError *)error {
+    XCTAssertNil(error);
+    if (otrKit != self.otrKitBob || !decodedMessage.length) {
+        return;
+    }
+    XCTAssertTrue(wasEncrypted);
+    [self.decodedMessages addObject:decodedMessage];
+    [self.decodedExpectation fulfill];
+}
+
+@end
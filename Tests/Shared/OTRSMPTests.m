@@ -0,0 +1,140 @@
+//
+//  OTRSMPTests.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRKitSessionBase.h"
+
+static NSString * const kOTRTestSMPQuestion = @"Where did we meet?";
+static NSString * const kOTRTestSMPSecret = @"Paris";
+static const NSUInteger kOTRTestSMPRounds = 5;
+static const NSUInteger kOTRTestSMPMessageCount = 100;
+
+@interface OTRSMPTests : OTRKitSessionBase
+/** Everything below is only touched on the main queue */
+@property (nonatomic, strong) NSMutableArray<NSString*> *aliceEvents;
+@property (nonatomic, strong) NSMutableArray<NSString*> *bobEvents;
+/** Bob answers with this */
+@property (nonatomic, copy) NSString *bobSecret;
+/** Fulfilled each time Alice finishes */
+@property (nonatomic, strong, nullable) XCTestExpectation *smpExpectation;
+/** Alice starts over until this many rounds are done */
+@property (nonatomic) NSUInteger remainingRounds;
+@end
+
+@implementation OTRSMPTests
+
+- (void)setUp {
+    [super setUp];
+    self.aliceEvents = [NSMutableArray array];
+    self.bobEvents = [NSMutableArray array];
+    self.bobSecret = kOTRTestSMPSecret;
+    [self startSecureSession];
+}
+
+- (void) startSMP {
+    [self.otrKitAlice initiateSMPForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP question:kOTRTestSMPQuestion secret:kOTRTestSMPSecret];
+}
+
+- (void) testSMPReportsProgressInOrder {
+    self.smpExpectation = [self expectationWithDescription:@"SMP done"];
+    self.smpExpectation.expectedFulfillmentCount = 2;
+    [self startSMP];
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+
+    XCTAssertEqualObjects(self.aliceEvents, (@[@"progress 20", @"progress 60", @"success 100"]));
+    XCTAssertEqualObjects(self.bobEvents, (@[@"answer 25 Where did we meet?", @"progress 40", @"success 100"]));
+    OTRFingerprint *bobFingerprint = [self.otrKitAlice activeFingerprintForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP];
+    XCTAssertNotNil(bobFingerprint);
+}
+
+- (void) testSMPFailsWithWrongSecret {
+    self.bobSecret = @"London";
+    self.smpExpectation = [self expectationWithDescription:@"SMP done"];
+    self.smpExpectation.expectedFulfillmentCount = 2;
+    [self startSMP];
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+
+    XCTAssertEqualObjects(self.aliceEvents.lastObject, @"failure 100");
+    XCTAssertEqualObjects(self.bobEvents.lastObject, @"failure 100");
+}
+
+/** Round trips messages off the main queue while Alice and Bob run SMP back to back */
+- (void) testMessageLatencyDuringSMP {
+    self.remainingRounds = kOTRTestSMPRounds;
+    self.smpExpectation = [self expectationWithDescription:@"SMP rounds done"];
+    self.smpExpectation.expectedFulfillmentCount = 2 * kOTRTestSMPRounds;
+    XCTestExpectation *messagesExpectation = [self expectationWithDescription:@"Messages done"];
+    [self startSMP];
+
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        NSTimeInterval total = 0;
+        NSTimeInterval worst = 0;
+        NSUInteger decodedCount = 0;
+        for (NSUInteger i = 0; i < kOTRTestSMPMessageCount; i++) {
+            NSString *message = [NSString stringWithFormat:@"message %d", (int)i];
+            dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+            __block NSString *decoded = nil;
+            NSDate *start = [NSDate date];
+            [self.otrKitAlice encodeMessage:message tlvs:nil username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil async:YES completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+                [self.otrKitBob decodeMessage:encodedMessage username:kOTRTestAccountAlice accountName:kOTRTestAccountBob protocol:kOTRTestProtocolXMPP tag:nil async:YES completion:^(NSString * _Nullable decodedMessage, NSArray<OTRTLV *> * _Nonnull tlvs, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+                    decoded = decodedMessage;
+                    dispatch_semaphore_signal(semaphore);
+                }];
+            }];
+            dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
+            NSTimeInterval latency = -[start timeIntervalSinceNow];
+            total += latency;
+            worst = MAX(worst, latency);
+            if ([decoded isEqualToString:message]) {
+                decodedCount++;
+            }
+        }
+        XCTAssertEqual(decodedCount, kOTRTestSMPMessageCount);
+        NSLog(@"%d messages during %d SMP rounds: average %.2fms, worst %.2fms", (int)kOTRTestSMPMessageCount, (int)kOTRTestSMPRounds, total / kOTRTestSMPMessageCount * 1000, worst * 1000);
+        [messagesExpectation fulfill];
+    });
+    [self waitForExpectationsWithTimeout:120 handler:nil];
+    XCTAssertEqualObjects(self.aliceEvents.lastObject, @"success 100");
+}
+
+#pragma mark OTRKitDelegate methods
+
+- (void) otrKit:(OTRKit*)otrKit
+ handleSMPEvent:(OTRKitSMPEvent)event
+       progress:(double)progress
+       question:(NSString*)question
+       username:(NSString*)username
+    accountName:(NSString*)accountName
+       protocol:(NSString*)protocol {
+    NSMutableArray<NSString*> *events = otrKit == self.otrKitAlice ? self.aliceEvents : self.bobEvents;
+    int percent = (int)lround(progress * 100);
+    switch (event) {
+        case OTRKitSMPEventAskForAnswer:
+            [events addObject:[NSString stringWithFormat:@"answer %d %@", percent, question]];
+            [otrKit respondToSMPForUsername:username accountName:accountName protocol:protocol secret:self.bobSecret];
+            break;
+        case OTRKitSMPEventInProgress:
+            [events addObject:[NSString stringWithFormat:@"progress %d", percent]];
+            break;
+        case OTRKitSMPEventSuccess:
+        case OTRKitSMPEventFailure:
+            [events addObject:[NSString stringWithFormat:@"%@ %d", event == OTRKitSMPEventSuccess ? @"success" : @"failure", percent]];
+            [self.smpExpectation fulfill];
+            if (otrKit == self.otrKitAlice && self.remainingRounds > 1) {
+                self.remainingRounds--;
+                [self.aliceEvents removeAllObjects];
+                [self.bobEvents removeAllObjects];
+                [self startSMP];
+            }
+            break;
+        default:
+            XCTFail(@"unexpected SMP event %d", (int)event);
+            break;
+    }
+}
+
+@end
@@ -0,0 +1,140 @@
+//
+//  OTRSessionSnapshotTests.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRKitSessionBase.h"
+
+@interface OTRSessionSnapshotTests : OTRKitSessionBase
+@property (nonatomic, strong) NSData *snapshotKey;
+@end
+
+@implementation OTRSessionSnapshotTests
+
+- (void)setUp {
+    [super setUp];
+    NSMutableData *key = [NSMutableData dataWithLength:32];
+    XCTAssertEqual(SecRandomCopyBytes(kSecRandomDefault, key.length, key.mutableBytes), 0);
+    self.snapshotKey = key;
+    self.otrKitAlice.sessionSnapshotKey = key;
+    [self startSecureSession];
+}
+
+/** Encodes on sender and decodes on receiver, both synchronously */
+- (void) sendMessage:(NSString*)message from:(OTRKit*)sender to:(OTRKit*)receiver {
+    BOOL fromAlice = (receiver == self.otrKitBob);
+    NSString *senderAccount = fromAlice ? kOTRTestAccountAlice : kOTRTestAccountBob;
+    NSString *receiverAccount = fromAlice ? kOTRTestAccountBob : kOTRTestAccountAlice;
+    __block BOOL decoded = NO;
+    [sender encodeMessage:message tlvs:nil username:receiverAccount accountName:senderAccount protocol:kOTRTestProtocolXMPP tag:nil async:NO completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+        XCTAssertNil(error);
+        XCTAssertTrue(wasEncrypted);
+        [receiver decodeMessage:encodedMessage username:senderAccount accountName:receiverAccount protocol:kOTRTestProtocolXMPP tag:nil async:NO completion:^(NSString * _Nullable decodedMessage, NSArray<OTRTLV *> * _Nonnull tlvs, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+            XCTAssertNil(error);
+            XCTAssertTrue(wasEncrypted);
+            XCTAssertEqualObjects(decodedMessage, message);
+            decoded = YES;
+        }];
+    }];
+    XCTAssertTrue(decoded);
+}
+
+/** A new kit over Alice's dataPath, as if the app had been restarted */
+- (OTRKit*) restartedAliceWithKey:(NSData*)key restoredSessions:(NSArray<OTRSessionSnapshot*>**)restoredSessions error:(NSError**)error {
+    OTRKit *alice = [[OTRKit alloc] initWithDelegate:self dataPath:self.otrKitAlice.dataPath];
+    alice.sessionSnapshotKey = key;
+    XCTestExpectation *restored = [self expectationWithDescription:@"Restored"];
+    __block NSArray<OTRSessionSnapshot*> *sessions = nil;
+    __block NSError *restoreError = nil;
+    [alice restoreSessionSnapshotWithCompletion:^(NSArray<OTRSessionSnapshot *> * _Nonnull restoredSessions, NSError * _Nullable error) {
+        sessions = restoredSessions;
+        restoreError = error;
+        [restored fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    *restoredSessions = sessions;
+    *error = restoreError;
+    return alice;
+}
+
+- (void) testSessionSnapshotResume {
+    for (NSUInteger i = 0; i < 4; i++) {
+        [self sendMessage:[NSString stringWithFormat:@"before %d", (int)i] from:self.otrKitAlice to:self.otrKitBob];
+        [self sendMessage:[NSString stringWithFormat:@"reply %d", (int)i] from:self.otrKitBob to:self.otrKitAlice];
+    }
+    NSError *error = nil;
+    XCTAssertTrue([self.otrKitAlice writeSessionSnapshotWithError:&error]);
+    XCTAssertNil(error);
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:self.otrKitAlice.sessionSnapshotPath]);
+    NSData *snapshotData = [NSData dataWithContentsOfFile:self.otrKitAlice.sessionSnapshotPath];
+    XCTAssertFalse([[[NSString alloc] initWithData:snapshotData encoding:NSISOLatin1StringEncoding] containsString:kOTRTestAccountBob]);
+
+    // Sent after the snapshot, the restored session must not reuse these counters
+    [self sendMessage:@"after snapshot" from:self.otrKitAlice to:self.otrKitBob];
+
+    NSArray<OTRSessionSnapshot*> *restoredSessions = nil;
+    OTRKit *alice = [self restartedAliceWithKey:self.snapshotKey restoredSessions:&restoredSessions error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual(restoredSessions.count, 1);
+    OTRSessionSnapshot *snapshot = restoredSessions.firstObject;
+    XCTAssertEqualObjects(snapshot.username, kOTRTestAccountBob);
+    XCTAssertEqualObjects(snapshot.accountName, kOTRTestAccountAlice);
+    XCTAssertEqual(snapshot.protocolVersion, 3);
+    XCTAssertEqualObjects(snapshot.fingerprint, [self.otrKitAlice activeFingerprintForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP].fingerprint);
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:alice.sessionSnapshotPath]);
+    XCTAssertEqual([alice messageStateForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP], OTRKitMessageStateEncrypted);
+
+    // Both directions work without an AKE, the restarted kit can't inject one
+    for (NSUInteger i = 0; i < 4; i++) {
+        [self sendMessage:[NSString stringWithFormat:@"resumed %d", (int)i] from:alice to:self.otrKitBob];
+        [self sendMessage:[NSString stringWithFormat:@"resumed reply %d", (int)i] from:self.otrKitBob to:alice];
+    }
+
+    // Only restored once
+    OTRKit *again = [self restartedAliceWithKey:self.snapshotKey restoredSessions:&restoredSessions error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual(restoredSessions.count, 0);
+    XCTAssertEqual([again messageStateForUsername:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP], OTRKitMessageStatePlaintext);
+}
+
+- (void) testSessionSnapshotWrongKey {
+    NSError *error = nil;
+    XCTAssertTrue([self.otrKitAlice writeSessionSnapshotWithError:&error]);
+    NSMutableData *wrongKey = [self.snapshotKey mutableCopy];
+    ((uint8_t*)wrongKey.mutableBytes)[0] ^= 1;
+    NSArray<OTRSessionSnapshot*> *restoredSessions = nil;
+    [self restartedAliceWithKey:wrongKey restoredSessions:&restoredSessions error:&error];
+    XCTAssertNotNil(error);
+    XCTAssertEqual(restoredSessions.count, 0);
+    // Still there for the right key
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:self.otrKitAlice.sessionSnapshotPath]);
+
+    NSData *data = [NSData dataWithContentsOfFile:self.otrKitAlice.sessionSnapshotPath];
+    XCTAssertNil([OTRSessionSnapshot snapshotsWithEncryptedData:[data subdataWithRange:NSMakeRange(0, 10)] key:self.snapshotKey error:&error]);
+    XCTAssertNotNil(error);
+    NSMutableData *tampered = [data mutableCopy];
+    ((uint8_t*)tampered.mutableBytes)[tampered.length - 1] ^= 1;
+    error = nil;
+    XCTAssertNil([OTRSessionSnapshot snapshotsWithEncryptedData:tampered key:self.snapshotKey error:&error]);
+    XCTAssertNotNil(error);
+    XCTAssertEqual([OTRSessionSnapshot snapshotsWithEncryptedData:data key:self.snapshotKey error:&error].count, 1);
+
+    self.otrKitAlice.sessionSnapshotKey = nil;
+    XCTAssertFalse([self.otrKitAlice writeSessionSnapshotWithError:&error]);
+    XCTAssertNotNil(error);
+}
+
+- (void) testSessionSnapshotInterval {
+    self.otrKitAlice.sessionSnapshotInterval = 0.5;
+    NSString *path = self.otrKitAlice.sessionSnapshotPath;
+    XCTestExpectation *written = [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(id _Nullable evaluatedObject, NSDictionary<NSString *,id> * _Nullable bindings) {
+        return [[NSFileManager defaultManager] fileExistsAtPath:path];
+    }] evaluatedWithObject:self handler:nil];
+    [self waitForExpectations:@[written] timeout:10];
+    self.otrKitAlice.sessionSnapshotInterval = 0;
+}
+
+@end
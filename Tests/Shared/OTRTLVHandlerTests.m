@@ -0,0 +1,148 @@
+//
+//  OTRTLVHandlerTests.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRKitSessionBase.h"
+
+static const OTRTLVType kOTRTestTLVType = 0x1234;
+static const NSUInteger kOTRTestTLVCount = 50;
+
+/** Records the TLVs it receives and checks which queue they arrive on */
+@interface OTRTestTLVHandler : NSObject <OTRTLVHandler>
+@property (nonatomic, strong, readonly) dispatch_queue_t targetQueue;
+/** Sleeps this long for every TLV */
+@property (nonatomic) NSTimeInterval delay;
+/** Only touched on targetQueue */
+@property (nonatomic, strong, readonly) NSMutableArray<NSData*> *received;
+@property (nonatomic) BOOL wrongQueue;
+@property (nonatomic, strong, nullable) XCTestExpectation *expectation;
+@end
+
+@implementation OTRTestTLVHandler
+
+- (instancetype) init {
+    if (self = [super init]) {
+        _targetQueue = dispatch_queue_create("OTRTestTLVHandler", 0);
+        dispatch_queue_set_specific(_targetQueue, (__bridge void *)self, (__bridge void *)self, NULL);
+        _received = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void)receiveTLV:(OTRTLV*)tlv
+          username:(NSString*)username
+       accountName:(NSString*)accountName
+          protocol:(NSString*)protocol
+       fingerprint:(OTRFingerprint*)fingerprint
+               tag:(nullable id)tag {
+    if (dispatch_get_specific((__bridge void *)self) != (__bridge void *)self) {
+        self.wrongQueue = YES;
+    }
+    if (self.delay > 0) {
+        [NSThread sleepForTimeInterval:self.delay];
+    }
+    [self.received addObject:tlv.data];
+    [self.expectation fulfill];
+}
+
+- (NSArray<NSNumber*>*) handledTLVTypes {
+    return @[@(kOTRTestTLVType)];
+}
+
+@end
+
+@interface OTRTLVHandlerTests : OTRKitSessionBase
+@end
+
+@implementation OTRTLVHandlerTests
+
+- (void)setUp {
+    [super setUp];
+    [self startSecureSession];
+}
+
+/** Sends one TLV per message from Alice to Bob, encoding and decoding synchronously */
+- (void) sendTLVs:(NSArray<NSData*>*)payloads {
+    for (NSData *payload in payloads) {
+        OTRTLV *tlv = [[OTRTLV alloc] initWithType:kOTRTestTLVType data:payload];
+        __block BOOL decoded = NO;
+        [self.otrKitAlice encodeMessage:nil tlvs:@[tlv] username:kOTRTestAccountBob accountName:kOTRTestAccountAlice protocol:kOTRTestProtocolXMPP tag:nil async:NO completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+            XCTAssertNil(error);
+            [self.otrKitBob decodeMessage:encodedMessage username:kOTRTestAccountAlice accountName:kOTRTestAccountBob protocol:kOTRTestProtocolXMPP tag:nil async:NO completion:^(NSString * _Nullable decodedMessage, NSArray<OTRTLV *> * _Nonnull tlvs, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+                XCTAssertNil(error);
+                decoded = YES;
+            }];
+        }];
+        XCTAssertTrue(decoded);
+    }
+}
+
+- (NSArray<NSData*>*) payloads {
+    NSMutableArray<NSData*> *payloads = [NSMutableArray array];
+    for (NSUInteger i = 0; i < kOTRTestTLVCount; i++) {
+        [payloads addObject:[[NSString stringWithFormat:@"tlv %d", (int)i] dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    return payloads;
+}
+
+- (void) testTLVSubscribersReceiveInOrder {
+    OTRTestTLVHandler *first = [[OTRTestTLVHandler alloc] init];
+    OTRTestTLVHandler *second = [[OTRTestTLVHandler alloc] init];
+    first.expectation = [self expectationWithDescription:@"First handler"];
+    first.expectation.expectedFulfillmentCount = kOTRTestTLVCount;
+    second.expectation = [self expectationWithDescription:@"Second handler"];
+    second.expectation.expectedFulfillmentCount = kOTRTestTLVCount;
+    // Both registrations are in place before the first decode
+    [self.otrKitBob registerTLVHandler:first targetQueue:first.targetQueue];
+    [self.otrKitBob registerTLVHandler:second targetQueue:second.targetQueue];
+    [self.otrKitBob registerTLVHandler:second targetQueue:second.targetQueue];
+    NSArray<NSData*> *payloads = [self payloads];
+    [self sendTLVs:payloads];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    dispatch_sync(first.targetQueue, ^{
+        XCTAssertEqualObjects(first.received, payloads);
+        XCTAssertFalse(first.wrongQueue);
+    });
+    dispatch_sync(second.targetQueue, ^{
+        XCTAssertEqualObjects(second.received, payloads);
+        XCTAssertFalse(second.wrongQueue);
+    });
+
+    [self.otrKitBob unregisterTLVHandler:second];
+    first.expectation = [self expectationWithDescription:@"First handler again"];
+    [self sendTLVs:@[payloads.firstObject]];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    dispatch_sync(second.targetQueue, ^{
+        XCTAssertEqual(second.received.count, kOTRTestTLVCount);
+    });
+}
+
+/** Without a targetQueue the handler runs while the message is decoded, like before subscriptions */
+- (void) testTLVHandlerWithoutTargetQueueIsSynchronous {
+    OTRTestTLVHandler *handler = [[OTRTestTLVHandler alloc] init];
+    [self.otrKitBob registerTLVHandler:handler];
+    NSArray<NSData*> *payloads = [[self payloads] subarrayWithRange:NSMakeRange(0, 10)];
+    [self sendTLVs:payloads];
+    XCTAssertEqualObjects(handler.received, payloads);
+    // Not on its own queue
+    XCTAssertTrue(handler.wrongQueue);
+}
+
+/** Decoding doesn't wait for a slow handler */
+- (void) testSlowTLVHandlerDoesNotBlockDecode {
+    OTRTestTLVHandler *slow = [[OTRTestTLVHandler alloc] init];
+    slow.delay = 0.1;
+    slow.expectation = [self expectationWithDescription:@"Slow handler"];
+    slow.expectation.expectedFulfillmentCount = 10;
+    [self.otrKitBob registerTLVHandler:slow targetQueue:slow.targetQueue];
+    NSDate *start = [NSDate date];
+    [self sendTLVs:[[self payloads] subarrayWithRange:NSMakeRange(0, 10)]];
+    XCTAssertLessThan(-[start timeIntervalSinceNow], 10 * slow.delay);
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+}
+
+@end
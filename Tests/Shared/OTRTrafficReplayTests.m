@@ -0,0 +1,169 @@
+//
+//  OTRTrafficReplayTests.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRKitSessionBase.h"
+#import "OTRTrafficReplayer.h"
+
+static NSString * const kOTRTestSecret = @"correct horse battery staple";
+static const NSUInteger kOTRTestRecordedMessageCount = 20;
+
+@interface OTRTrafficReplayTests : OTRKitSessionBase
+@property (nonatomic, strong) OTRTrafficRecorder *recorder;
+@end
+
+@implementation OTRTrafficReplayTests
+
+- (void)setUp {
+    [super setUp];
+    self.recorder = [[OTRTrafficRecorder alloc] init];
+    self.otrKitAlice.trafficRecorder = self.recorder;
+    [self startSecureSession];
+}
+
+/** Alice and Bob take turns, Alice also sends an OTRDATA request */
+- (void) recordConversation {
+    for (NSUInteger i = 0; i < kOTRTestRecordedMessageCount; i++) {
+        BOOL fromAlice = (i % 2 == 0);
+        OTRKit *sender = fromAlice ? self.otrKitAlice : self.otrKitBob;
+        OTRKit *receiver = fromAlice ? self.otrKitBob : self.otrKitAlice;
+        NSString *senderAccount = fromAlice ? kOTRTestAccountAlice : kOTRTestAccountBob;
+        NSString *receiverAccount = fromAlice ? kOTRTestAccountBob : kOTRTestAccountAlice;
+        NSString *message = [NSString stringWithFormat:@"%@ %d", kOTRTestSecret, (int)i];
+        NSArray<OTRTLV*> *tlvs = nil;
+        if (i == 0) {
+            tlvs = @[[[OTRTLV alloc] initWithType:OTRTLVTypeDataRequest data:[kOTRTestSecret dataUsingEncoding:NSUTF8StringEncoding]]];
+        }
+        [sender encodeMessage:message tlvs:tlvs username:receiverAccount accountName:senderAccount protocol:kOTRTestProtocolXMPP tag:nil async:NO completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+            XCTAssertNil(error);
+            XCTAssertTrue(wasEncrypted);
+            [receiver decodeMessage:encodedMessage username:senderAccount accountName:receiverAccount protocol:kOTRTestProtocolXMPP tag:nil async:NO completion:^(NSString * _Nullable decodedMessage, NSArray<OTRTLV *> * _Nonnull tlvs, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+                XCTAssertEqualObjects(decodedMessage, message);
+            }];
+        }];
+    }
+}
+
+- (void) testTrafficRecorderRedacts {
+    [self recordConversation];
+    NSArray<OTRTrafficEvent*> *events = self.recorder.events;
+    NSUInteger encodeCount = 0;
+    NSUInteger decodeCount = 0;
+    NSUInteger injectCount = 0;
+    for (OTRTrafficEvent *event in events) {
+        XCTAssertNotEqualObjects(event.username, kOTRTestAccountBob);
+        XCTAssertNotEqualObjects(event.accountName, kOTRTestAccountAlice);
+        if (event.type == OTRTrafficEventTypeInject) {
+            injectCount++;
+        } else if (event.messageKind == OTRTrafficMessageKindData) {
+            NSUInteger expectedLength = [NSString stringWithFormat:@"%@ %d", kOTRTestSecret, (int)(encodeCount + decodeCount)].length;
+            XCTAssertEqual(event.plaintextLength, expectedLength);
+            if (event.type == OTRTrafficEventTypeEncode) {
+                encodeCount++;
+            } else {
+                decodeCount++;
+            }
+        }
+    }
+    // Alice's half of the AKE
+    XCTAssertGreaterThan(injectCount, 0);
+    XCTAssertEqual(encodeCount, kOTRTestRecordedMessageCount / 2);
+    XCTAssertEqual(decodeCount, kOTRTestRecordedMessageCount / 2);
+
+    OTRTrafficEvent *firstData = nil;
+    for (OTRTrafficEvent *event in events) {
+        if (event.messageKind == OTRTrafficMessageKindData) {
+            firstData = event;
+            break;
+        }
+    }
+    XCTAssertTrue([firstData.tlvTypes containsObject:@(OTRTLVTypeDataRequest)]);
+    NSUInteger tlvIndex = [firstData.tlvTypes indexOfObject:@(OTRTLVTypeDataRequest)];
+    XCTAssertEqual(firstData.tlvLengths[tlvIndex].unsignedIntegerValue, kOTRTestSecret.length);
+
+    NSError *error = nil;
+    NSData *json = [self.recorder JSONDataWithError:&error];
+    XCTAssertNil(error);
+    NSString *jsonString = [[NSString alloc] initWithData:json encoding:NSUTF8StringEncoding];
+    XCTAssertFalse([jsonString containsString:@"horse"]);
+    XCTAssertFalse([jsonString containsString:@"example.com"]);
+    XCTAssertFalse([jsonString containsString:@"?OTR"]);
+
+    NSURL *url = [NSURL fileURLWithPath:[self.otrKitAlice.dataPath stringByAppendingPathComponent:@"trace.json"]];
+    XCTAssertTrue([self.recorder writeToURL:url error:&error]);
+    XCTAssertNil(error);
+    NSArray<OTRTrafficEvent*> *readEvents = [OTRTrafficRecorder eventsWithContentsOfURL:url error:&error];
+    XCTAssertNil(error);
+    XCTAssertEqual(readEvents.count, events.count);
+    [readEvents enumerateObjectsUsingBlock:^(OTRTrafficEvent *event, NSUInteger idx, BOOL *stop) {
+        XCTAssertEqualObjects([event dictionaryRepresentation], [events[idx] dictionaryRepresentation]);
+    }];
+    XCTAssertNil([OTRTrafficRecorder eventsWithJSONData:[@"[{\"type\":1}]" dataUsingEncoding:NSUTF8StringEncoding] error:&error]);
+    XCTAssertNotNil(error);
+
+    self.recorder.maximumEventCount = events.count;
+    [self recordConversation];
+    XCTAssertEqual(self.recorder.events.count, events.count);
+    XCTAssertGreaterThan(self.recorder.droppedEventCount, 0);
+}
+
+- (OTRTrafficReplayReport*) replayEvents:(NSArray<OTRTrafficEvent*>*)events realTime:(BOOL)realTime {
+    OTRTrafficReplayer *replayer = [[OTRTrafficReplayer alloc] initWithEvents:events];
+    replayer.realTime = realTime;
+    replayer.randomSeed = 42;
+    XCTestExpectation *replayed = [self expectationWithDescription:@"Replayed"];
+    __block OTRTrafficReplayReport *report = nil;
+    [replayer replayWithCompletion:^(OTRTrafficReplayReport * _Nullable replayReport, NSError * _Nullable error) {
+        XCTAssertNil(error);
+        report = replayReport;
+        [replayed fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:120 handler:nil];
+    NSLog(@"Replay (realTime %d): %@", (int)realTime, report);
+    return report;
+}
+
+- (void) testTrafficReplay {
+    [self recordConversation];
+    NSArray<OTRTrafficEvent*> *events = self.recorder.events;
+    NSUInteger byteCount = kOTRTestSecret.length;
+    for (OTRTrafficEvent *event in events) {
+        if (event.messageKind == OTRTrafficMessageKindData) {
+            byteCount += event.plaintextLength;
+        }
+    }
+    for (NSNumber *realTime in @[@NO, @YES]) {
+        OTRTrafficReplayReport *report = [self replayEvents:events realTime:realTime.boolValue];
+        XCTAssertEqual(report.messageCount, kOTRTestRecordedMessageCount);
+        XCTAssertEqual(report.failedCount, 0);
+        XCTAssertEqual(report.byteCount, byteCount);
+        XCTAssertEqual(report.encodeLatency.count, kOTRTestRecordedMessageCount);
+        XCTAssertEqual(report.decodeLatency.count, kOTRTestRecordedMessageCount);
+        XCTAssertEqual(report.endToEndLatency.count, kOTRTestRecordedMessageCount);
+        XCTAssertGreaterThanOrEqual(report.endToEndLatency.p99, report.endToEndLatency.median);
+        XCTAssertGreaterThan(report.messagesPerSecond, 0);
+    }
+}
+
+/** A busy account: bursts of chat and file chunks to a handful of buddies, sent as fast as possible */
+- (void) testTrafficReplayBenchmark {
+    NSMutableArray<OTRTrafficEvent*> *events = [NSMutableArray array];
+    NSUInteger messageCount = 1000;
+    for (NSUInteger i = 0; i < messageCount; i++) {
+        NSString *username = [NSString stringWithFormat:@"user%d", (int)(i % 4) + 1];
+        BOOL fileChunk = (i % 5 == 0);
+        NSArray *tlvTypes = fileChunk ? @[@(OTRTLVTypeDataResponse)] : @[];
+        NSArray *tlvLengths = fileChunk ? @[@(16384)] : @[];
+        OTRTrafficEvent *event = [[OTRTrafficEvent alloc] initWithType:(i % 3 ? OTRTrafficEventTypeEncode : OTRTrafficEventTypeDecode) timestamp:i * 0.01 username:username accountName:@"account1" protocol:kOTRTestProtocolXMPP messageKind:OTRTrafficMessageKindData messageLength:0 plaintextLength:fileChunk ? 0 : 20 + (i * 37) % 400 tlvTypes:tlvTypes tlvLengths:tlvLengths duration:0];
+        [events addObject:event];
+    }
+    OTRTrafficReplayReport *report = [self replayEvents:events realTime:NO];
+    XCTAssertEqual(report.messageCount, messageCount);
+    XCTAssertEqual(report.failedCount, 0);
+}
+
+@end
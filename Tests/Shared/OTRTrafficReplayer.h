@@ -0,0 +1,101 @@
+//
+//  OTRTrafficReplayer.h
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+@import Foundation;
+@import OTRKit;
+
+NS_ASSUME_NONNULL_BEGIN
+/** Latency distribution for one stage of a replay, in seconds */
+@interface OTRTrafficLatency : NSObject
+
+@property (nonatomic, readonly) NSUInteger count;
+@property (nonatomic, readonly) NSTimeInterval mean;
+@property (nonatomic, readonly) NSTimeInterval median;
+@property (nonatomic, readonly) NSTimeInterval p99;
+@property (nonatomic, readonly) NSTimeInterval max;
+
+/** Samples don't need to be sorted */
+- (instancetype) initWithSamples:(const NSTimeInterval*)samples count:(NSUInteger)count NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+@end
+
+@interface OTRTrafficReplayReport : NSObject
+
+/** Messages sent through a secure session during the replay */
+@property (nonatomic, readonly) NSUInteger messageCount;
+/** Messages that failed to encode or decode */
+@property (nonatomic, readonly) NSUInteger failedCount;
+/** Plaintext and TLV bytes carried */
+@property (nonatomic, readonly) NSUInteger byteCount;
+/** Key generation and AKE for every conversation, not part of duration */
+@property (nonatomic, readonly) NSTimeInterval setupDuration;
+/** From the first message sent until the last one was decoded */
+@property (nonatomic, readonly) NSTimeInterval duration;
+@property (nonatomic, readonly) double messagesPerSecond;
+@property (nonatomic, readonly) double bytesPerSecond;
+
+/** encodeMessage: call until its completion ran */
+@property (nonatomic, strong, readonly) OTRTrafficLatency *encodeLatency;
+/** decodeMessage: call until its completion ran */
+@property (nonatomic, strong, readonly) OTRTrafficLatency *decodeLatency;
+/** encodeMessage: call until the other side's decode completion ran */
+@property (nonatomic, strong, readonly) OTRTrafficLatency *endToEndLatency;
+
+- (instancetype) initWithMessageCount:(NSUInteger)messageCount
+                          failedCount:(NSUInteger)failedCount
+                            byteCount:(NSUInteger)byteCount
+                        setupDuration:(NSTimeInterval)setupDuration
+                             duration:(NSTimeInterval)duration
+                        encodeLatency:(OTRTrafficLatency*)encodeLatency
+                        decodeLatency:(OTRTrafficLatency*)decodeLatency
+                      endToEndLatency:(OTRTrafficLatency*)endToEndLatency NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+@end
+
+/**
+ *  Feeds a recorded trace through two in-process OTRKits so changes can be
+ *  benchmarked against realistic traffic. One kit plays the recorded side,
+ *  the other plays every peer it talked to.
+ *
+ *  Every conversation in the trace is made secure up front. Then each
+ *  message that carried plaintext or application TLVs (OTRDATA) is sent
+ *  again in the same direction, with seeded filler of the recorded length
+ *  and TLVs of the recorded types and lengths. Protocol traffic (queries,
+ *  AKE, SMP, fragments) isn't replayed, the kits generate their own.
+ *
+ *  Each replayer runs once and uses fresh keys in temporary directories.
+ */
+@interface OTRTrafficReplayer : NSObject
+
+@property (nonatomic, copy, readonly) NSArray<OTRTrafficEvent*> *events;
+
+/** Send messages at their recorded offsets instead of as fast as possible. Defaults to NO. */
+@property (nonatomic, readwrite) BOOL realTime;
+
+/** Seed for filler text, the same seed and trace always send the same plaintext. Defaults to 0. */
+@property (nonatomic, readwrite) uint32_t randomSeed;
+
+/** Gives up if setting up the sessions takes longer than this. Defaults to 120 seconds. */
+@property (nonatomic, readwrite) NSTimeInterval setupTimeout;
+
+/** Queue the completion is called on. Defaults to main queue. */
+@property (nonatomic, strong, readwrite) dispatch_queue_t completionQueue;
+
+- (instancetype) initWithEvents:(NSArray<OTRTrafficEvent*>*)events NS_DESIGNATED_INITIALIZER;
+
+- (instancetype) init NS_UNAVAILABLE;
+
+/** Runs the replay. Can only be called once. */
+- (void) replayWithCompletion:(void (^)(OTRTrafficReplayReport * _Nullable report, NSError * _Nullable error))completion;
+
+@end
+NS_ASSUME_NONNULL_END
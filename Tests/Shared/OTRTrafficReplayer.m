@@ -0,0 +1,407 @@
+//
+//  OTRTrafficReplayer.m
+//  OTRKit
+//
+//  Created by agent on 10/19/26.
+//
+//
+
+#import "OTRTrafficReplayer.h"
+
+@implementation OTRTrafficLatency
+
+- (instancetype) initWithSamples:(const NSTimeInterval*)samples count:(NSUInteger)count {
+    if (self = [super init]) {
+        _count = count;
+        if (count) {
+            NSTimeInterval *sorted = malloc(count * sizeof(NSTimeInterval));
+            memcpy(sorted, samples, count * sizeof(NSTimeInterval));
+            qsort_b(sorted, count, sizeof(NSTimeInterval), ^int(const void *a, const void *b) {
+                NSTimeInterval x = *(const NSTimeInterval*)a;
+                NSTimeInterval y = *(const NSTimeInterval*)b;
+                return (x > y) - (x < y);
+            });
+            NSTimeInterval total = 0;
+            for (NSUInteger i = 0; i < count; i++) {
+                total += sorted[i];
+            }
+            _mean = total / count;
+            _median = sorted[count / 2];
+            _p99 = sorted[MIN(count - 1, (count * 99) / 100)];
+            _max = sorted[count - 1];
+            free(sorted);
+        }
+    }
+    return self;
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"n=%d mean=%.2fms median=%.2fms p99=%.2fms max=%.2fms", (int)self.count, self.mean * 1000, self.median * 1000, self.p99 * 1000, self.max * 1000];
+}
+
+@end
+
+@implementation OTRTrafficReplayReport
+
+- (instancetype) initWithMessageCount:(NSUInteger)messageCount
+                          failedCount:(NSUInteger)failedCount
+                            byteCount:(NSUInteger)byteCount
+                        setupDuration:(NSTimeInterval)setupDuration
+                             duration:(NSTimeInterval)duration
+                        encodeLatency:(OTRTrafficLatency*)encodeLatency
+                        decodeLatency:(OTRTrafficLatency*)decodeLatency
+                      endToEndLatency:(OTRTrafficLatency*)endToEndLatency {
+    if (self = [super init]) {
+        _messageCount = messageCount;
+        _failedCount = failedCount;
+        _byteCount = byteCount;
+        _setupDuration = setupDuration;
+        _duration = duration;
+        if (duration > 0) {
+            _messagesPerSecond = messageCount / duration;
+            _bytesPerSecond = byteCount / duration;
+        }
+        _encodeLatency = encodeLatency;
+        _decodeLatency = decodeLatency;
+        _endToEndLatency = endToEndLatency;
+    }
+    return self;
+}
+
+- (NSString*) description {
+    return [NSString stringWithFormat:@"<%@: %p> messages: %d failed: %d bytes: %d setup: %.2fs duration: %.3fs (%.0f msg/s, %.0f B/s)\n encode: %@\n decode: %@\n end to end: %@", NSStringFromClass([self class]), self, (int)self.messageCount, (int)self.failedCount, (int)self.byteCount, self.setupDuration, self.duration, self.messagesPerSecond, self.bytesPerSecond, self.encodeLatency, self.decodeLatency, self.endToEndLatency];
+}
+
+@end
+
+/** One recorded message that will be sent again */
+@interface OTRTrafficReplayMessage : NSObject
+/** YES if the recorded side sent it */
+@property (nonatomic) BOOL outbound;
+@property (nonatomic, copy) NSString *username;
+@property (nonatomic, copy) NSString *accountName;
+@property (nonatomic, copy) NSString *protocol;
+@property (nonatomic) NSUInteger plaintextLength;
+@property (nonatomic, copy) NSArray<OTRTLV*> *tlvs;
+@property (nonatomic) NSTimeInterval timestamp;
+@end
+
+@implementation OTRTrafficReplayMessage
+@end
+
+@interface OTRTrafficReplayer () <OTRKitDelegate>
+/** All replay state is only touched on this queue, it's also the kits' callbackQueue */
+@property (nonatomic, strong, readonly) dispatch_queue_t replayQueue;
+@property (nonatomic, strong) NSArray<OTRTrafficReplayMessage*> *messages;
+/** Plays the recorded side */
+@property (nonatomic, strong, nullable) OTRKit *localKit;
+/** Plays every peer */
+@property (nonatomic, strong, nullable) OTRKit *remoteKit;
+@property (nonatomic, strong) NSMutableArray<NSString*> *dataPaths;
+/** Conversation keys from the recorded side's point of view */
+@property (nonatomic, strong) NSSet<NSString*> *conversations;
+/** Conversation keys prefixed with which side reported them secure */
+@property (nonatomic, strong) NSMutableSet<NSString*> *secureConversations;
+@property (nonatomic, copy, nullable) void (^completion)(OTRTrafficReplayReport * _Nullable report, NSError * _Nullable error);
+/** Keeps the replayer alive while it runs, the kits only hold it weakly */
+@property (nonatomic, strong, nullable) OTRTrafficReplayer *runningReplayer;
+@property (nonatomic) BOOL started;
+@property (nonatomic) BOOL replaying;
+@property (nonatomic, copy) NSString *filler;
+@property (nonatomic) uint32_t randomState;
+@property (nonatomic) CFAbsoluteTime setupStartTime;
+@property (nonatomic) CFAbsoluteTime replayStartTime;
+@property (nonatomic) NSTimeInterval setupDuration;
+@property (nonatomic) NSUInteger finishedCount;
+@property (nonatomic) NSUInteger failedCount;
+@property (nonatomic) NSUInteger byteCount;
+@property (nonatomic, strong) NSMutableData *encodeSamples;
+@property (nonatomic, strong) NSMutableData *decodeSamples;
+@property (nonatomic, strong) NSMutableData *endToEndSamples;
+@end
+
+@implementation OTRTrafficReplayer
+
+- (instancetype) initWithEvents:(NSArray<OTRTrafficEvent*>*)events {
+    if (self = [super init]) {
+        _events = [events copy];
+        _setupTimeout = 120;
+        _completionQueue = dispatch_get_main_queue();
+        _replayQueue = dispatch_queue_create("OTRTrafficReplayer Queue", 0);
+        _dataPaths = [NSMutableArray array];
+        _secureConversations = [NSMutableSet set];
+        _encodeSamples = [NSMutableData data];
+        _decodeSamples = [NSMutableData data];
+        _endToEndSamples = [NSMutableData data];
+    }
+    return self;
+}
+
++ (NSString*) conversationKeyForUsername:(NSString*)username accountName:(NSString*)accountName protocol:(NSString*)protocol {
+    return [NSString stringWithFormat:@"%@\n%@\n%@", username, accountName, protocol];
+}
+
+#pragma mark Planning
+
+/** Messages that carried something for the user or app, in recorded order */
++ (NSArray<OTRTrafficReplayMessage*>*) messagesForEvents:(NSArray<OTRTrafficEvent*>*)events {
+    NSMutableArray<OTRTrafficReplayMessage*> *messages = [NSMutableArray array];
+    for (OTRTrafficEvent *event in events) {
+        BOOL outbound = NO;
+        if (event.type == OTRTrafficEventTypeEncode && event.messageKind != OTRTrafficMessageKindQuery) {
+            outbound = YES;
+        } else if (event.type == OTRTrafficEventTypeDecode &&
+                   (event.messageKind == OTRTrafficMessageKindData ||
+                    event.messageKind == OTRTrafficMessageKindFragment ||
+                    event.messageKind == OTRTrafficMessageKindPlaintext)) {
+            // The last piece of a fragmented message carries its plaintext, it's sent again whole
+            outbound = NO;
+        } else {
+            continue;
+        }
+        // libotr's own TLVs (padding, disconnect, SMP, symmetric key) are
+        // meaningless with redacted bodies, the protocol makes its own
+        NSMutableArray<OTRTLV*> *tlvs = [NSMutableArray array];
+        for (OTRTLV *tlv in [event redactedTLVs]) {
+            if (tlv.type >= OTRTLVTypeDataRequest) {
+                [tlvs addObject:tlv];
+            }
+        }
+        if (!event.plaintextLength && !tlvs.count) {
+            continue;
+        }
+        OTRTrafficReplayMessage *message = [[OTRTrafficReplayMessage alloc] init];
+        message.outbound = outbound;
+        message.username = event.username;
+        message.accountName = event.accountName;
+        message.protocol = event.protocol;
+        message.plaintextLength = event.plaintextLength;
+        message.tlvs = tlvs;
+        message.timestamp = event.timestamp;
+        [messages addObject:message];
+    }
+    return messages;
+}
+
+/** xorshift32, good enough for filler and cheap enough not to show up in the numbers */
+- (uint32_t) nextRandom {
+    uint32_t x = self.randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    self.randomState = x;
+    return x;
+}
+
+- (void) prepareFillerWithMaximumLength:(NSUInteger)maximumLength {
+    // Zero is a fixed point of xorshift
+    self.randomState = self.randomSeed ^ 0x9E3779B9;
+    if (!self.randomState) {
+        self.randomState = 1;
+    }
+    NSUInteger length = MAX(maximumLength * 2, 1);
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    uint8_t *bytes = data.mutableBytes;
+    for (NSUInteger i = 0; i < length; i++) {
+        bytes[i] = 'a' + ([self nextRandom] % 26);
+    }
+    self.filler = [[NSString alloc] initWithData:data encoding:NSASCIIStringEncoding];
+}
+
+- (nullable NSString*) fillerWithLength:(NSUInteger)length {
+    if (!length) {
+        return nil;
+    }
+    NSUInteger offset = [self nextRandom] % (self.filler.length - length + 1);
+    return [self.filler substringWithRange:NSMakeRange(offset, length)];
+}
+
+#pragma mark Replay
+
+- (void) replayWithCompletion:(void (^)(OTRTrafficReplayReport * _Nullable report, NSError * _Nullable error))completion {
+    NSParameterAssert(completion != nil);
+    dispatch_async(self.replayQueue, ^{
+        NSParameterAssert(!self.started);
+        if (self.started) {
+            return;
+        }
+        self.started = YES;
+        self.runningReplayer = self;
+        self.completion = completion;
+        self.messages = [[self class] messagesForEvents:self.events];
+        NSUInteger maximumLength = 0;
+        NSMutableSet<NSString*> *conversations = [NSMutableSet set];
+        for (OTRTrafficReplayMessage *message in self.messages) {
+            maximumLength = MAX(maximumLength, message.plaintextLength);
+            [conversations addObject:[[self class] conversationKeyForUsername:message.username accountName:message.accountName protocol:message.protocol]];
+        }
+        self.conversations = conversations;
+        [self prepareFillerWithMaximumLength:maximumLength];
+        if (!self.messages.count) {
+            [self finishWithError:nil];
+            return;
+        }
+        self.localKit = [self kitWithDataPath];
+        self.remoteKit = [self kitWithDataPath];
+        if (!self.localKit || !self.remoteKit) {
+            [self finishWithError:[NSError errorWithDomain:NSPOSIXErrorDomain code:ENOENT userInfo:nil]];
+            return;
+        }
+        self.setupStartTime = CFAbsoluteTimeGetCurrent();
+        for (NSString *conversation in conversations) {
+            NSArray<NSString*> *components = [conversation componentsSeparatedByString:@"\n"];
+            [self.localKit initiateEncryptionWithUsername:components[0] accountName:components[1] protocol:components[2]];
+        }
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.setupTimeout * NSEC_PER_SEC)), self.replayQueue, ^{
+            if (!self.replaying && self.completion) {
+                [self finishWithError:[NSError errorWithDomain:NSPOSIXErrorDomain code:ETIMEDOUT userInfo:nil]];
+            }
+        });
+    });
+}
+
+/** Must be called on replayQueue */
+- (nullable OTRKit*) kitWithDataPath {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    if (![[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:YES attributes:nil error:nil]) {
+        return nil;
+    }
+    [self.dataPaths addObject:path];
+    OTRKit *otrKit = [[OTRKit alloc] initWithDelegate:self dataPath:path];
+    otrKit.callbackQueue = self.replayQueue;
+    return otrKit;
+}
+
+/** Must be called on replayQueue */
+- (void) startReplay {
+    self.replaying = YES;
+    self.setupDuration = CFAbsoluteTimeGetCurrent() - self.setupStartTime;
+    self.replayStartTime = CFAbsoluteTimeGetCurrent();
+    NSTimeInterval firstTimestamp = self.messages.firstObject.timestamp;
+    for (OTRTrafficReplayMessage *message in self.messages) {
+        if (self.realTime) {
+            NSTimeInterval delay = MAX(message.timestamp - firstTimestamp, 0);
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.replayQueue, ^{
+                [self sendMessage:message];
+            });
+        } else {
+            [self sendMessage:message];
+        }
+    }
+}
+
+/** Must be called on replayQueue */
+- (void) sendMessage:(OTRTrafficReplayMessage*)message {
+    OTRKit *sender = message.outbound ? self.localKit : self.remoteKit;
+    OTRKit *receiver = message.outbound ? self.remoteKit : self.localKit;
+    // The sender's view of the conversation, the receiver's is the other way around
+    NSString *senderAccountName = message.outbound ? message.accountName : message.username;
+    NSString *senderUsername = message.outbound ? message.username : message.accountName;
+    NSString *protocol = message.protocol;
+    NSString *plaintext = [self fillerWithLength:message.plaintextLength];
+    NSUInteger byteCount = message.plaintextLength;
+    for (OTRTLV *tlv in message.tlvs) {
+        byteCount += tlv.data.length;
+    }
+    CFAbsoluteTime sendTime = CFAbsoluteTimeGetCurrent();
+    [sender encodeMessage:plaintext tlvs:message.tlvs username:senderUsername accountName:senderAccountName protocol:protocol tag:nil async:YES completion:^(NSString * _Nullable encodedMessage, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+        CFAbsoluteTime encodeTime = CFAbsoluteTimeGetCurrent();
+        [self addSample:encodeTime - sendTime to:self.encodeSamples];
+        if (error || !encodedMessage.length || !wasEncrypted) {
+            [self messageDidFinishWithByteCount:0 success:NO];
+            return;
+        }
+        [receiver decodeMessage:encodedMessage username:senderAccountName accountName:senderUsername protocol:protocol tag:nil async:YES completion:^(NSString * _Nullable decodedMessage, NSArray<OTRTLV *> * _Nonnull tlvs, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+            CFAbsoluteTime decodeTime = CFAbsoluteTimeGetCurrent();
+            [self addSample:decodeTime - encodeTime to:self.decodeSamples];
+            [self addSample:decodeTime - sendTime to:self.endToEndSamples];
+            [self messageDidFinishWithByteCount:byteCount success:(error == nil)];
+        }];
+    }];
+}
+
+- (void) addSample:(NSTimeInterval)sample to:(NSMutableData*)samples {
+    [samples appendBytes:&sample length:sizeof(sample)];
+}
+
+- (void) messageDidFinishWithByteCount:(NSUInteger)byteCount success:(BOOL)success {
+    self.finishedCount++;
+    if (success) {
+        self.byteCount += byteCount;
+    } else {
+        self.failedCount++;
+    }
+    if (self.finishedCount == self.messages.count) {
+        [self finishWithError:nil];
+    }
+}
+
+/** Must be called on replayQueue */
+- (void) finishWithError:(nullable NSError*)error {
+    void (^completion)(OTRTrafficReplayReport*, NSError*) = self.completion;
+    if (!completion) {
+        return;
+    }
+    self.completion = nil;
+    NSTimeInterval duration = self.replaying ? CFAbsoluteTimeGetCurrent() - self.replayStartTime : 0;
+    OTRTrafficReplayReport *report = nil;
+    if (!error) {
+        OTRTrafficLatency *encodeLatency = [[OTRTrafficLatency alloc] initWithSamples:self.encodeSamples.bytes count:self.encodeSamples.length / sizeof(NSTimeInterval)];
+        OTRTrafficLatency *decodeLatency = [[OTRTrafficLatency alloc] initWithSamples:self.decodeSamples.bytes count:self.decodeSamples.length / sizeof(NSTimeInterval)];
+        OTRTrafficLatency *endToEndLatency = [[OTRTrafficLatency alloc] initWithSamples:self.endToEndSamples.bytes count:self.endToEndSamples.length / sizeof(NSTimeInterval)];
+        report = [[OTRTrafficReplayReport alloc] initWithMessageCount:self.finishedCount - self.failedCount failedCount:self.failedCount byteCount:self.byteCount setupDuration:self.setupDuration duration:duration encodeLatency:encodeLatency decodeLatency:decodeLatency endToEndLatency:endToEndLatency];
+    }
+    self.localKit = nil;
+    self.remoteKit = nil;
+    for (NSString *path in self.dataPaths) {
+        [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+    }
+    dispatch_async(self.completionQueue, ^{
+        completion(report, error);
+    });
+    self.runningReplayer = nil;
+}
+
+#pragma mark OTRKitDelegate
+
+- (void) otrKit:(OTRKit*)otrKit
+  injectMessage:(NSString*)message
+       username:(NSString*)username
+    accountName:(NSString*)accountName
+       protocol:(NSString*)protocol
+    fingerprint:(nullable OTRFingerprint*)fingerprint
+            tag:(nullable id)tag {
+    OTRKit *receiver = (otrKit == self.localKit) ? self.remoteKit : self.localKit;
+    [receiver decodeMessage:message username:accountName accountName:username protocol:protocol tag:nil async:YES completion:^(NSString * _Nullable decodedMessage, NSArray<OTRTLV *> * _Nonnull tlvs, BOOL wasEncrypted, OTRFingerprint * _Nullable fingerprint, NSError * _Nullable error) {
+    }];
+}
+
+- (BOOL)       otrKit:(OTRKit*)otrKit
+   isUsernameLoggedIn:(NSString*)username
+          accountName:(NSString*)accountName
+             protocol:(NSString*)protocol {
+    return YES;
+}
+
+- (void)    otrKit:(OTRKit*)otrKit
+updateMessageState:(OTRKitMessageState)messageState
+          username:(NSString*)username
+       accountName:(NSString*)accountName
+          protocol:(NSString*)protocol
+       fingerprint:(OTRFingerprint*)fingerprint {
+    if (self.replaying || !self.completion || messageState != OTRKitMessageStateEncrypted) {
+        return;
+    }
+    NSString *conversation = nil;
+    if (otrKit == self.localKit) {
+        conversation = [@"local\n" stringByAppendingString:[[self class] conversationKeyForUsername:username accountName:accountName protocol:protocol]];
+    } else {
+        conversation = [@"remote\n" stringByAppendingString:[[self class] conversationKeyForUsername:accountName accountName:username protocol:protocol]];
+    }
+    [self.secureConversations addObject:conversation];
+    if (self.secureConversations.count == self.conversations.count * 2) {
+        [self startReplay];
+    }
+}
+
+@end
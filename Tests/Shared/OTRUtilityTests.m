@@ -65,4 +65,592 @@
 
 }
 
+- (void)testCryptoRuntime {
+    [OTRCryptoRuntime setUp];
+    XCTAssertNotNil(OTRCryptoRuntime.configuration);
+    NSError *error = nil;
+    XCTAssertFalse([OTRCryptoRuntime setUpWithConfiguration:[OTRCryptoRuntimeConfiguration defaultConfiguration] error:&error]);
+    XCTAssertNotNil(error);
+
+    OTRSecureMemoryStats *before = [OTRCryptoRuntime secureMemoryStats];
+    [self runAESGCMWithPlaintextData:[NSMutableData dataWithLength:1024]];
+    OTRSecureMemoryStats *after = [OTRCryptoRuntime secureMemoryStats];
+    NSLog(@"%@", after);
+    // Cipher handles are opened with GCRY_CIPHER_SECURE
+    XCTAssertGreaterThan(after.secureAllocationCount, before.secureAllocationCount);
+    XCTAssertGreaterThan(after.secureHighWaterMark, 0);
+    if (!after.arenaSize) {
+        return;
+    }
+    XCTAssertEqual(after.fallbackAllocationCount, before.fallbackAllocationCount);
+    XCTAssertGreaterThan(after.arenaHighWaterMark, 0);
+    [OTRCryptoRuntime resetHighWaterMarks];
+    OTRSecureMemoryStats *reset = [OTRCryptoRuntime secureMemoryStats];
+    XCTAssertLessThanOrEqual(reset.arenaHighWaterMark, after.arenaHighWaterMark);
+
+    OTRCryptoRuntime.secureMemoryLimit = 0;
+    XCTAssertEqual(OTRCryptoRuntime.secureMemoryLimit, 0);
+    // Clamped to the arena
+    OTRCryptoRuntime.secureMemoryLimit = NSUIntegerMax;
+    XCTAssertEqual(OTRCryptoRuntime.secureMemoryLimit, after.arenaSize);
+}
+
+/** Many threads encrypting attachments at once, like a burst of OTRDATA transfers */
+- (void)measureConcurrentAESGCMWithSecureMemoryLimit:(NSUInteger)secureMemoryLimit {
+    [OTRCryptoRuntime setUp];
+    NSUInteger arenaSize = [OTRCryptoRuntime secureMemoryStats].arenaSize;
+    OTRCryptoRuntime.secureMemoryLimit = secureMemoryLimit;
+    NSMutableData *key = [NSMutableData dataWithLength:32];
+    NSMutableData *iv = [NSMutableData dataWithLength:16];
+    NSData *plaintext = [NSMutableData dataWithLength:4096];
+    [OTRCryptoRuntime resetHighWaterMarks];
+    OTRSecureMemoryStats *before = [OTRCryptoRuntime secureMemoryStats];
+    [self measureBlock:^{
+        dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+            for (NSUInteger i = 0; i < 250; i++) {
+                NSError *error = nil;
+                OTRCryptoData *encrypted = [OTRCryptoUtility encryptAESGCMData:plaintext key:key iv:iv error:&error];
+                XCTAssertNotNil([OTRCryptoUtility decryptAESGCMData:encrypted key:key iv:iv error:&error]);
+            }
+        });
+    }];
+    OTRSecureMemoryStats *after = [OTRCryptoRuntime secureMemoryStats];
+    NSLog(@"Limit %d: %@ fallbacks during run: %d", (int)secureMemoryLimit, after, (int)(after.fallbackAllocationCount - before.fallbackAllocationCount));
+    OTRCryptoRuntime.secureMemoryLimit = arenaSize;
+}
+
+- (void)testConcurrentAESGCMPerformanceWithSecureArena {
+    [self measureConcurrentAESGCMWithSecureMemoryLimit:NSUIntegerMax];
+}
+
+- (void)testConcurrentAESGCMPerformanceWithoutSecureArena {
+    [self measureConcurrentAESGCMWithSecureMemoryLimit:0];
+}
+
+- (void)testDigest {
+    NSData *abc = [@"abc" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertEqualObjects([[abc otr_SHA1] otr_hexString], @"a9993e364706816aba3e25717850c26c9cd0d89d");
+    XCTAssertEqualObjects([[abc otr_SHA256] otr_hexString], @"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    XCTAssertEqualObjects([[[NSData data] otr_SHA1] otr_hexString], @"da39a3ee5e6b4b0d3255bfef95601890afd80709");
+
+    NSMutableData *data = [NSMutableData dataWithLength:100000];
+    XCTAssertEqual(SecRandomCopyBytes(kSecRandomDefault, data.length, data.mutableBytes), 0);
+    for (NSNumber *algorithm in @[@(OTRDigestAlgorithmSHA1), @(OTRDigestAlgorithmSHA256)]) {
+        NSData *expected = [OTRDigest digestWithAlgorithm:algorithm.unsignedIntegerValue data:data];
+        OTRDigest *digest = [[OTRDigest alloc] initWithAlgorithm:algorithm.unsignedIntegerValue];
+        XCTAssertEqual(expected.length, digest.digestLength);
+        // Uneven pieces, like chunks arriving off the wire
+        for (NSUInteger offset = 0; offset < data.length; offset += 777) {
+            NSUInteger length = MIN(777, data.length - offset);
+            [digest updateWithBytes:(const uint8_t*)data.bytes + offset length:length];
+        }
+        XCTAssertEqualObjects([digest finalDigest], expected);
+        XCTAssertEqualObjects([digest finalDigest], expected);
+        [digest reset];
+        [digest updateWithData:abc];
+        XCTAssertEqualObjects([digest finalDigest], [OTRDigest digestWithAlgorithm:algorithm.unsignedIntegerValue data:abc]);
+    }
+
+    // Non-contiguous data is hashed range by range
+    dispatch_data_t first = dispatch_data_create(data.bytes, 5000, NULL, DISPATCH_DATA_DESTRUCTOR_DEFAULT);
+    dispatch_data_t second = dispatch_data_create((const uint8_t*)data.bytes + 5000, data.length - 5000, NULL, DISPATCH_DATA_DESTRUCTOR_DEFAULT);
+    NSData *concatenated = (NSData*)dispatch_data_create_concat(first, second);
+    XCTAssertEqualObjects([concatenated otr_SHA1], [data otr_SHA1]);
+    XCTAssertEqualObjects([concatenated otr_hexString], [data otr_hexString]);
+}
+
+- (void)testHexEncoding {
+    NSMutableData *allBytes = [NSMutableData dataWithLength:256];
+    for (NSUInteger i = 0; i < 256; i++) {
+        ((uint8_t*)allBytes.mutableBytes)[i] = i;
+    }
+    NSString *hex = [allBytes otr_hexString];
+    XCTAssertEqual(hex.length, 512);
+    XCTAssertTrue([hex hasPrefix:@"000102"]);
+    XCTAssertTrue([hex hasSuffix:@"fdfeff"]);
+    XCTAssertEqualObjects([NSData otr_dataWithHexString:hex], allBytes);
+    XCTAssertEqualObjects([NSData otr_dataWithHexString:hex.uppercaseString], allBytes);
+    XCTAssertEqualObjects([[NSData data] otr_hexString], @"");
+    XCTAssertEqualObjects([NSData otr_dataWithHexString:@""], [NSData data]);
+    XCTAssertNil([NSData otr_dataWithHexString:@"abc"]);
+    XCTAssertNil([NSData otr_dataWithHexString:@"zz"]);
+    XCTAssertNil([NSData otr_dataWithHexString:@"0g"]);
+}
+
+- (void)testDeflate {
+    NSData *text = [[@"" stringByPaddingToLength:16384 withString:@"<message from='alice'>hello</message>\n" startingAtIndex:0] dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *deflated = [text otr_deflatedData];
+    XCTAssertNotNil(deflated);
+    XCTAssertLessThan(deflated.length, text.length / 10);
+    XCTAssertEqualObjects([deflated otr_inflatedDataWithLength:text.length], text);
+    XCTAssertNil([deflated otr_inflatedDataWithLength:text.length - 1]);
+    XCTAssertNil([deflated otr_inflatedDataWithLength:text.length + 1]);
+    XCTAssertNil([[deflated subdataWithRange:NSMakeRange(0, deflated.length / 2)] otr_inflatedDataWithLength:text.length]);
+
+    NSMutableData *random = [NSMutableData dataWithLength:16384];
+    XCTAssertEqual(SecRandomCopyBytes(kSecRandomDefault, random.length, random.mutableBytes), 0);
+    XCTAssertNil([random otr_deflatedData]);
+    XCTAssertNil([[NSData data] otr_deflatedData]);
+}
+
+- (void)testCompressedMimeTypes {
+    XCTAssertTrue(OTRKitIsCompressedMimeType(@"image/jpeg"));
+    XCTAssertTrue(OTRKitIsCompressedMimeType(@"IMAGE/PNG"));
+    XCTAssertTrue(OTRKitIsCompressedMimeType(@"video/mp4"));
+    XCTAssertTrue(OTRKitIsCompressedMimeType(@"audio/mp4"));
+    XCTAssertTrue(OTRKitIsCompressedMimeType(@"application/zip"));
+    XCTAssertTrue(OTRKitIsCompressedMimeType(@"application/vnd.openxmlformats-officedocument.wordprocessingml.document"));
+    XCTAssertTrue(OTRKitIsCompressedMimeType(OTRKitGetMimeTypeForExtension(@"jpg")));
+    XCTAssertFalse(OTRKitIsCompressedMimeType(@"image/svg+xml"));
+    XCTAssertFalse(OTRKitIsCompressedMimeType(@"audio/wav"));
+    XCTAssertFalse(OTRKitIsCompressedMimeType(@"text/plain"));
+    XCTAssertFalse(OTRKitIsCompressedMimeType(@"application/json"));
+    XCTAssertFalse(OTRKitIsCompressedMimeType(@"application/octet-stream"));
+    XCTAssertFalse(OTRKitIsCompressedMimeType(nil));
+}
+
+/** 64 MiB hashed in transfer sized chunks */
+- (void)testDigestPerformance {
+    NSMutableData *chunk = [NSMutableData dataWithLength:1024 * 1024];
+    XCTAssertEqual(SecRandomCopyBytes(kSecRandomDefault, chunk.length, chunk.mutableBytes), 0);
+    [self measureBlock:^{
+        OTRDigest *digest = [[OTRDigest alloc] initWithAlgorithm:OTRDigestAlgorithmSHA1];
+        for (NSUInteger i = 0; i < 64; i++) {
+            [digest updateWithData:chunk];
+        }
+        XCTAssertEqual([digest finalDigest].length, 20);
+    }];
+}
+
+- (void)testHexEncodingPerformance {
+    NSMutableData *data = [NSMutableData dataWithLength:16 * 1024 * 1024];
+    XCTAssertEqual(SecRandomCopyBytes(kSecRandomDefault, data.length, data.mutableBytes), 0);
+    [self measureBlock:^{
+        NSString *hex = [data otr_hexString];
+        XCTAssertEqual([NSData otr_dataWithHexString:hex].length, data.length);
+    }];
+}
+
+- (void)testPrioritySchedulerOrdering {
+    dispatch_queue_t targetQueue = dispatch_queue_create("testPrioritySchedulerOrdering", 0);
+    OTRPriorityScheduler *scheduler = [[OTRPriorityScheduler alloc] initWithTargetQueue:targetQueue];
+    NSMutableArray<NSString*> *order = [NSMutableArray array];
+    dispatch_suspend(targetQueue);
+    [scheduler scheduleBlock:^{ [order addObject:@"maintenance"]; } priority:OTRKitPriorityMaintenance group:nil];
+    [scheduler scheduleBlock:^{ [order addObject:@"bulk-alice-1"]; } priority:OTRKitPriorityBulk group:@"alice"];
+    [scheduler scheduleBlock:^{ [order addObject:@"bulk-alice-2"]; } priority:OTRKitPriorityBulk group:@"alice"];
+    [scheduler scheduleBlock:^{ [order addObject:@"bulk-bob-1"]; } priority:OTRKitPriorityBulk group:@"bob"];
+    [scheduler scheduleBlock:^{ [order addObject:@"interactive-bob-1"]; } priority:OTRKitPriorityInteractive group:@"bob"];
+    [scheduler scheduleBlock:^{ [order addObject:@"interactive-bob-2"]; } priority:OTRKitPriorityInteractive group:@"bob"];
+    XCTAssertEqual([scheduler pendingCountForPriority:OTRKitPriorityBulk], 3);
+    dispatch_resume(targetQueue);
+    dispatch_sync(targetQueue, ^{});
+    // Interactive first in order, then bulk peers take turns, then maintenance
+    NSArray *expected = @[@"interactive-bob-1", @"interactive-bob-2", @"bulk-alice-1", @"bulk-bob-1", @"bulk-alice-2", @"maintenance"];
+    XCTAssertEqualObjects(order, expected);
+    XCTAssertEqual([scheduler pendingCountForPriority:OTRKitPriorityBulk], 0);
+}
+
+- (void)testPrioritySchedulerStarvation {
+    dispatch_queue_t targetQueue = dispatch_queue_create("testPrioritySchedulerStarvation", 0);
+    OTRPriorityScheduler *scheduler = [[OTRPriorityScheduler alloc] initWithTargetQueue:targetQueue];
+    NSMutableArray<NSNumber*> *order = [NSMutableArray array];
+    dispatch_suspend(targetQueue);
+    [scheduler scheduleBlock:^{ [order addObject:@(OTRKitPriorityBulk)]; } priority:OTRKitPriorityBulk group:nil];
+    for (NSUInteger i = 0; i < 100; i++) {
+        [scheduler scheduleBlock:^{ [order addObject:@(OTRKitPriorityInteractive)]; } priority:OTRKitPriorityInteractive group:nil];
+    }
+    dispatch_resume(targetQueue);
+    dispatch_sync(targetQueue, ^{});
+    // Bulk work still gets a turn under a steady stream of interactive work
+    NSUInteger bulkIndex = [order indexOfObject:@(OTRKitPriorityBulk)];
+    XCTAssertNotEqual(bulkIndex, NSNotFound);
+    XCTAssertLessThan(bulkIndex, 20);
+}
+
+/** Latency of a typed message scheduled behind a file transfer's worth of chunk work */
+- (void)testPrioritySchedulerInteractiveLatency {
+    dispatch_queue_t targetQueue = dispatch_queue_create("testPrioritySchedulerInteractiveLatency", 0);
+    OTRPriorityScheduler *scheduler = [[OTRPriorityScheduler alloc] initWithTargetQueue:targetQueue];
+    NSMutableData *chunk = [NSMutableData dataWithLength:16 * 1024];
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < 200; i++) {
+            [scheduler scheduleBlock:^{
+                [chunk otr_SHA1];
+            } priority:OTRKitPriorityBulk group:@"transfer"];
+        }
+        XCTestExpectation *expectation = [self expectationWithDescription:@"Interactive block"];
+        [scheduler scheduleBlock:^{
+            XCTAssertGreaterThan([scheduler pendingCountForPriority:OTRKitPriorityBulk], 100);
+            [expectation fulfill];
+        } priority:OTRKitPriorityInteractive group:@"chat"];
+        [self waitForExpectationsWithTimeout:30 handler:nil];
+        dispatch_sync(targetQueue, ^{});
+    }];
+}
+
+
+- (void)testTransferCheckpointResume {
+    NSString *directory = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    NSMutableData *fileData = [NSMutableData dataWithLength:100];
+    uint8_t *bytes = fileData.mutableBytes;
+    for (NSUInteger i = 0; i < fileData.length; i++) {
+        bytes[i] = (uint8_t)i;
+    }
+    NSString *fileHash = [[fileData otr_SHA1] otr_hexString];
+    NSError *error = nil;
+    OTRDataTransferCheckpoint *checkpoint = [[OTRDataTransferCheckpoint alloc] initWithDirectory:directory fileHash:fileHash fileLength:fileData.length chunkLength:32 error:&error];
+    XCTAssertNotNil(checkpoint, @"%@", error);
+    XCTAssertEqual(checkpoint.chunkCount, 4);
+    XCTAssertEqual(checkpoint.receivedChunkCount, 0);
+    XCTAssertTrue(NSEqualRanges([checkpoint rangeForChunkAtIndex:3], NSMakeRange(96, 4)));
+
+    NSRange range = [checkpoint rangeForChunkAtIndex:1];
+    XCTAssertTrue([checkpoint writeData:[fileData subdataWithRange:range] range:range error:&error], @"%@", error);
+    range = [checkpoint rangeForChunkAtIndex:3];
+    XCTAssertTrue([checkpoint writeData:[fileData subdataWithRange:range] range:range error:&error], @"%@", error);
+    // Not a chunk boundary
+    XCTAssertFalse([checkpoint writeData:[fileData subdataWithRange:NSMakeRange(10, 32)] range:NSMakeRange(10, 32) error:nil]);
+    [checkpoint close];
+
+    // Offered again, picks up where it left off
+    checkpoint = [[OTRDataTransferCheckpoint alloc] initWithDirectory:directory fileHash:[fileHash uppercaseString] fileLength:fileData.length chunkLength:32 error:&error];
+    XCTAssertNotNil(checkpoint, @"%@", error);
+    XCTAssertEqual(checkpoint.receivedChunkCount, 2);
+    XCTAssertFalse([checkpoint hasChunkAtIndex:0]);
+    XCTAssertTrue([checkpoint hasChunkAtIndex:1]);
+    XCTAssertFalse([checkpoint hasChunkAtIndex:2]);
+    XCTAssertTrue([checkpoint hasChunkAtIndex:3]);
+    XCTAssertEqualObjects([checkpoint readChunkAtIndex:1 error:&error], [fileData subdataWithRange:[checkpoint rangeForChunkAtIndex:1]]);
+    XCTAssertEqualObjects([checkpoint readChunkAtIndex:3 error:&error], [fileData subdataWithRange:[checkpoint rangeForChunkAtIndex:3]]);
+    XCTAssertNil([checkpoint readChunkAtIndex:0 error:nil]);
+
+    // Same hash with a different length is a different checkpoint
+    OTRDataTransferCheckpoint *otherCheckpoint = [[OTRDataTransferCheckpoint alloc] initWithDirectory:directory fileHash:fileHash fileLength:fileData.length + 1 chunkLength:32 error:&error];
+    XCTAssertEqual(otherCheckpoint.receivedChunkCount, 0);
+    [otherCheckpoint remove];
+
+    [checkpoint remove];
+    checkpoint = [[OTRDataTransferCheckpoint alloc] initWithDirectory:directory fileHash:fileHash fileLength:fileData.length chunkLength:32 error:&error];
+    XCTAssertEqual(checkpoint.receivedChunkCount, 0);
+    [checkpoint remove];
+
+    // The hash comes from the peer and ends up in a file name
+    XCTAssertNil([[OTRDataTransferCheckpoint alloc] initWithDirectory:directory fileHash:@"../../../../../../../../../../etc/passwd" fileLength:fileData.length chunkLength:32 error:nil]);
+    [[NSFileManager defaultManager] removeItemAtPath:directory error:nil];
+}
+
+
+- (void)testDataContentStore {
+    OTRDataContentStore *store = [[OTRDataContentStore alloc] initWithChunkCacheLimit:1024];
+    NSData *data = [@"The quick brown fox jumps over the lazy dog" dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *dataCopy = [data mutableCopy];
+    OTRDataContent *content = [store retainContentWithData:data];
+    XCTAssertEqualObjects(content.fileHash, @"2fd4e1c67a2d28fced849ee1bb76e7391b93eb12");
+    XCTAssertEqual([store retainContentWithData:data], content);
+    XCTAssertEqual([store retainContentWithData:dataCopy], content);
+    XCTAssertEqual(content.data, data);
+    XCTAssertEqual(content.transferCount, 3);
+    XCTAssertEqual(store.contentCount, 1);
+    XCTAssertEqual(store.residentBytes, data.length);
+
+    NSData *chunk = [store chunkForContent:content range:NSMakeRange(4, 5)];
+    XCTAssertEqualObjects(chunk, [@"quick" dataUsingEncoding:NSUTF8StringEncoding]);
+    XCTAssertEqual([store chunkForContent:content range:NSMakeRange(4, 5)], chunk);
+    XCTAssertNil([store chunkForContent:content range:NSMakeRange(data.length - 1, 2)]);
+    XCTAssertNil([store chunkForContent:content range:NSMakeRange(NSUIntegerMax, 2)]);
+
+    [store releaseContent:content];
+    [store releaseContent:content];
+    XCTAssertEqual(store.contentCount, 1);
+    [store releaseContent:content];
+    XCTAssertEqual(store.contentCount, 0);
+    XCTAssertEqual(store.residentBytes, 0);
+}
+
+
+- (void)testNotificationCoalescerOrdering {
+    dispatch_queue_t targetQueue = dispatch_queue_create("Coalescer Target", 0);
+    OTRNotificationCoalescer *coalescer = [[OTRNotificationCoalescer alloc] initWithTargetQueue:targetQueue];
+    coalescer.minimumInterval = 60;
+    // Start the interval now so keyed blocks are held
+    XCTestExpectation *primed = [self expectationWithDescription:@"Primed"];
+    [coalescer enqueueBlock:^{
+        [primed fulfill];
+    } forKey:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    NSMutableArray<NSString*> *delivered = [NSMutableArray array];
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Delivered"];
+    for (NSUInteger i = 0; i < 100; i++) {
+        NSString *progress = [NSString stringWithFormat:@"a%d", (int)i];
+        [coalescer enqueueBlock:^{
+            [delivered addObject:progress];
+        } forKey:@"a"];
+        [coalescer enqueueBlock:^{
+            [delivered addObject:@"b"];
+        } forKey:@"b"];
+    }
+    [coalescer enqueueBlock:^{
+        [delivered addObject:@"done"];
+    } forKey:nil];
+    [coalescer enqueueBlock:^{
+        [expectation fulfill];
+    } forKey:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    // Only the latest block per key, in first-enqueued order, and unkeyed blocks flush without waiting out the interval
+    NSArray<NSString*> *expected = @[@"a99", @"b", @"done"];
+    XCTAssertEqualObjects(delivered, expected);
+}
+
+- (void)testNotificationCoalescerInterval {
+    dispatch_queue_t targetQueue = dispatch_queue_create("Coalescer Target", 0);
+    OTRNotificationCoalescer *coalescer = [[OTRNotificationCoalescer alloc] initWithTargetQueue:targetQueue];
+    coalescer.minimumInterval = 0.2;
+    __block NSUInteger deliveredCount = 0;
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    while (CFAbsoluteTimeGetCurrent() - start < 1.0) {
+        [coalescer enqueueBlock:^{
+            deliveredCount++;
+        } forKey:@"progress"];
+        [NSThread sleepForTimeInterval:0.001];
+    }
+    XCTestExpectation *expectation = [self expectationWithDescription:@"Flushed"];
+    [coalescer flush];
+    [coalescer enqueueBlock:^{
+        [expectation fulfill];
+    } forKey:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    // Hundreds of updates over a second, about 5 deliveries
+    XCTAssertGreaterThan(deliveredCount, 0);
+    XCTAssertLessThanOrEqual(deliveredCount, 8);
+}
+
+
+/** Fake trust store spread over 10 accounts and 1000 buddies each with a few devices, trust levels cycling */
+- (NSArray<OTRFingerprint*>*) fingerprintsWithCount:(NSUInteger)count {
+    NSMutableArray<OTRFingerprint*> *fingerprints = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        uint32_t bytes[5] = {(uint32_t)i, (uint32_t)(i * 2654435761u), 0, 0, 0};
+        NSData *fingerprintData = [NSData dataWithBytes:bytes length:sizeof(bytes)];
+        NSString *username = [NSString stringWithFormat:@"buddy%d@example.com", (int)(i % 1000)];
+        NSString *accountName = [NSString stringWithFormat:@"account%d@example.com", (int)(i % 10)];
+        OTRTrustLevel trustLevel = (OTRTrustLevel)(i % (OTRTrustLevelTrustedUser + 1));
+        [fingerprints addObject:[[OTRFingerprint alloc] initWithUsername:username accountName:accountName protocol:@"xmpp" fingerprint:fingerprintData trustLevel:trustLevel]];
+    }
+    return fingerprints;
+}
+
+- (void)testFingerprintIndex {
+    OTRFingerprintIndex *index = [[OTRFingerprintIndex alloc] init];
+    NSArray<OTRFingerprint*> *fingerprints = [self fingerprintsWithCount:1000];
+    [index resetWithFingerprints:fingerprints];
+    XCTAssertEqual(index.count, 1000);
+
+    OTRFingerprint *fingerprint = fingerprints[123];
+    OTRFingerprint *found = [index fingerprintForUsername:fingerprint.username accountName:fingerprint.accountName protocol:fingerprint.protocol fingerprintData:fingerprint.fingerprint];
+    XCTAssertTrue([found isEqualToFingerprint:fingerprint]);
+    XCTAssertNotEqual(found, fingerprint);
+    XCTAssertEqual([index fingerprintsWithData:fingerprint.fingerprint].count, 1);
+
+    // The same key under another username is a separate entry
+    OTRFingerprint *alias = [[OTRFingerprint alloc] initWithUsername:@"alias@example.com" accountName:fingerprint.accountName protocol:fingerprint.protocol fingerprint:fingerprint.fingerprint trustLevel:OTRTrustLevelUnknown];
+    [index saveFingerprint:alias];
+    XCTAssertEqual([index fingerprintsWithData:fingerprint.fingerprint].count, 2);
+    [index removeFingerprint:alias];
+    XCTAssertEqual([index fingerprintsWithData:fingerprint.fingerprint].count, 1);
+
+    OTRFingerprintQuery *accountQuery = [OTRFingerprintQuery queryWithAccountName:@"account3@example.com" protocol:@"xmpp"];
+    XCTAssertEqual([index countOfFingerprintsMatchingQuery:accountQuery], 100);
+    OTRFingerprintQuery *userQuery = [[OTRFingerprintQuery alloc] initWithAccountName:fingerprint.accountName protocol:fingerprint.protocol username:fingerprint.username trustLevels:nil];
+    XCTAssertEqual([index fingerprintsMatchingQuery:userQuery].count, 1);
+
+    NSMutableIndexSet *untrusted = [NSMutableIndexSet indexSetWithIndex:OTRTrustLevelUntrustedNew];
+    [untrusted addIndex:OTRTrustLevelUntrustedUser];
+    OTRFingerprintQuery *untrustedQuery = [OTRFingerprintQuery queryWithTrustLevels:untrusted];
+    XCTAssertEqual([index countOfFingerprintsMatchingQuery:untrustedQuery], 400);
+
+    // Pages come back in insertion order, and trusting an entry mid-walk doesn't repeat or skip others
+    __block NSUInteger pageCount = 0;
+    NSMutableArray<OTRFingerprint*> *walked = [NSMutableArray array];
+    [index enumerateFingerprintsMatchingQuery:untrustedQuery pageSize:64 usingBlock:^(NSArray<OTRFingerprint *> *page, BOOL *stop) {
+        XCTAssertLessThanOrEqual(page.count, 64);
+        pageCount++;
+        for (OTRFingerprint *pageFingerprint in page) {
+            XCTAssertFalse(pageFingerprint.isTrusted);
+            pageFingerprint.trustLevel = OTRTrustLevelTrustedUser;
+            [index saveFingerprint:pageFingerprint];
+        }
+        [walked addObjectsFromArray:page];
+    }];
+    XCTAssertEqual(pageCount, 7);
+    XCTAssertEqual(walked.count, 400);
+    for (NSUInteger i = 1; i < walked.count; i++) {
+        NSUInteger previous = [fingerprints indexOfObjectPassingTest:^BOOL(OTRFingerprint *obj, NSUInteger idx, BOOL *stop) {
+            return [obj.fingerprint isEqualToData:walked[i - 1].fingerprint];
+        }];
+        NSUInteger current = [fingerprints indexOfObjectPassingTest:^BOOL(OTRFingerprint *obj, NSUInteger idx, BOOL *stop) {
+            return [obj.fingerprint isEqualToData:walked[i].fingerprint];
+        }];
+        XCTAssertLessThan(previous, current);
+    }
+    XCTAssertEqual([index countOfFingerprintsMatchingQuery:untrustedQuery], 0);
+    XCTAssertEqual([index countOfFingerprintsMatchingQuery:[OTRFingerprintQuery queryWithTrustLevels:[NSIndexSet indexSetWithIndex:OTRTrustLevelTrustedUser]]], 600);
+
+    [index removeFingerprint:fingerprint];
+    XCTAssertEqual(index.count, 999);
+    XCTAssertEqual([index fingerprintsWithData:fingerprint.fingerprint].count, 0);
+    XCTAssertEqual([index fingerprintsMatchingQuery:userQuery].count, 0);
+}
+
+/** Lookups by key bytes in a 100k entry trust store */
+- (void)testFingerprintIndexLookupPerformance {
+    OTRFingerprintIndex *index = [[OTRFingerprintIndex alloc] init];
+    NSArray<OTRFingerprint*> *fingerprints = [self fingerprintsWithCount:100000];
+    [index resetWithFingerprints:fingerprints];
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < fingerprints.count; i += 10) {
+            OTRFingerprint *fingerprint = fingerprints[i];
+            XCTAssertNotNil([index fingerprintForUsername:fingerprint.username accountName:fingerprint.accountName protocol:fingerprint.protocol fingerprintData:fingerprint.fingerprint]);
+        }
+    }];
+}
+
+/** Paging through one account and through every untrusted key of a 100k entry trust store */
+- (void)testFingerprintIndexPagingPerformance {
+    OTRFingerprintIndex *index = [[OTRFingerprintIndex alloc] init];
+    [index resetWithFingerprints:[self fingerprintsWithCount:100000]];
+    OTRFingerprintQuery *accountQuery = [OTRFingerprintQuery queryWithAccountName:@"account7@example.com" protocol:@"xmpp"];
+    NSMutableIndexSet *untrusted = [NSMutableIndexSet indexSetWithIndex:OTRTrustLevelUntrustedNew];
+    [untrusted addIndex:OTRTrustLevelUntrustedUser];
+    OTRFingerprintQuery *untrustedQuery = [OTRFingerprintQuery queryWithTrustLevels:untrusted];
+    [self measureBlock:^{
+        __block NSUInteger accountCount = 0;
+        [index enumerateFingerprintsMatchingQuery:accountQuery pageSize:100 usingBlock:^(NSArray<OTRFingerprint *> *page, BOOL *stop) {
+            accountCount += page.count;
+        }];
+        XCTAssertEqual(accountCount, 10000);
+        __block NSUInteger untrustedCount = 0;
+        [index enumerateFingerprintsMatchingQuery:untrustedQuery pageSize:100 usingBlock:^(NSArray<OTRFingerprint *> *page, BOOL *stop) {
+            untrustedCount += page.count;
+        }];
+        XCTAssertEqual(untrustedCount, 40000);
+    }];
+}
+
+- (void)testAccountStoreJournal {
+    NSString *directory = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+    [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+    NSString *path = [directory stringByAppendingPathComponent:@"otr.private_key.store"];
+    NSData *record1 = [@" (account\n (name alice)\n )\n" dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *record2 = [@" (account\n (name alice, again)\n )\n" dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *record3 = [@" (account\n (name bob)\n )\n" dataUsingEncoding:NSUTF8StringEncoding];
+    NSError *error = nil;
+
+    OTRAccountStore *store = [[OTRAccountStore alloc] initWithPath:path];
+    XCTAssertFalse([store existsOnDisk]);
+    XCTAssertTrue([store setRecord:record1 forAccountName:@"alice@example.com" protocol:@"xmpp" error:&error], @"%@", error);
+    XCTAssertTrue([store setRecord:record3 forAccountName:@"bob@example.com" protocol:@"xmpp" error:&error], @"%@", error);
+    XCTAssertTrue([store setRecord:record2 forAccountName:@"alice@example.com" protocol:@"xmpp" error:&error], @"%@", error);
+    XCTAssertTrue([store setRecord:record3 forAccountName:@"carol@example.com" protocol:@"xmpp" error:&error], @"%@", error);
+    XCTAssertTrue([store setRecord:nil forAccountName:@"carol@example.com" protocol:@"xmpp" error:&error], @"%@", error);
+    XCTAssertTrue([store existsOnDisk]);
+
+    // Last write wins, removals stay removed
+    store = [[OTRAccountStore alloc] initWithPath:path];
+    XCTAssertTrue([store loadWithError:&error], @"%@", error);
+    XCTAssertEqual(store.count, 2);
+    XCTAssertEqualObjects([store recordForAccountName:@"alice@example.com" protocol:@"xmpp"], record2);
+    XCTAssertEqualObjects([store recordForAccountName:@"bob@example.com" protocol:@"xmpp"], record3);
+    XCTAssertNil([store recordForAccountName:@"carol@example.com" protocol:@"xmpp"]);
+    NSMutableArray<NSString*> *accountNames = [NSMutableArray array];
+    [store enumerateRecordsUsingBlock:^(NSString *accountName, NSString *protocol, NSData *record, BOOL *stop) {
+        XCTAssertEqualObjects(protocol, @"xmpp");
+        [accountNames addObject:accountName];
+    }];
+    XCTAssertEqualObjects(accountNames, (@[@"alice@example.com", @"bob@example.com"]));
+
+    // A write cut off halfway through is dropped on the next load
+    unsigned long long journalLength = store.journalLength;
+    NSFileHandle *journal = [NSFileHandle fileHandleForWritingAtPath:store.journalPath];
+    [journal seekToEndOfFile];
+    [journal writeData:[NSData dataWithBytes:"\0\0\1\0\1dave" length:9]];
+    [journal closeFile];
+    store = [[OTRAccountStore alloc] initWithPath:path];
+    XCTAssertTrue([store loadWithError:&error], @"%@", error);
+    XCTAssertEqual(store.count, 2);
+    XCTAssertEqual(store.journalLength, journalLength);
+    XCTAssertTrue([store setRecord:record1 forAccountName:@"dave@example.com" protocol:@"xmpp" error:&error], @"%@", error);
+    store = [[OTRAccountStore alloc] initWithPath:path];
+    XCTAssertTrue([store loadWithError:&error], @"%@", error);
+    XCTAssertEqualObjects([store recordForAccountName:@"dave@example.com" protocol:@"xmpp"], record1);
+
+    // Compaction keeps the records and empties the journal
+    XCTAssertTrue([store compactWithError:&error], @"%@", error);
+    XCTAssertEqual(store.journalLength, 0);
+    XCTAssertEqual([[[NSFileManager defaultManager] attributesOfItemAtPath:path error:nil][NSFilePosixPermissions] unsignedShortValue], 0600);
+    store = [[OTRAccountStore alloc] initWithPath:path];
+    XCTAssertTrue([store loadWithError:&error], @"%@", error);
+    XCTAssertEqual(store.count, 3);
+    XCTAssertEqualObjects([store recordForAccountName:@"alice@example.com" protocol:@"xmpp"], record2);
+
+    // A damaged compacted file is kept aside and never written over with what could be read
+    NSData *compacted = [NSData dataWithContentsOfFile:path];
+    NSData *damaged = [compacted subdataWithRange:NSMakeRange(0, compacted.length - 4)];
+    XCTAssertTrue([damaged writeToFile:path atomically:YES]);
+    store = [[OTRAccountStore alloc] initWithPath:path];
+    XCTAssertFalse([store loadWithError:&error]);
+    XCTAssertNotNil(error);
+    XCTAssertEqualObjects(store.loadError, error);
+    XCTAssertEqual(store.count, 2);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:store.damagedPath], damaged);
+    error = nil;
+    XCTAssertFalse([store setRecord:record1 forAccountName:@"erin@example.com" protocol:@"xmpp" error:&error]);
+    XCTAssertNotNil(error);
+    XCTAssertFalse([store compactWithError:nil]);
+    XCTAssertEqualObjects([NSData dataWithContentsOfFile:path], damaged);
+    [[NSFileManager defaultManager] removeItemAtPath:directory error:nil];
+}
+
+/** Adding accounts one by one only appends each new account, instead of rewriting every key */
+- (void)testAccountStoreProvisioningPerformance {
+    NSUInteger accountCount = 1000;
+    NSMutableData *record = [NSMutableData dataWithLength:1024];
+    XCTAssertEqual(SecRandomCopyBytes(kSecRandomDefault, record.length, record.mutableBytes), 0);
+    [self measureBlock:^{
+        NSString *directory = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString];
+        [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:nil];
+        OTRAccountStore *store = [[OTRAccountStore alloc] initWithPath:[directory stringByAppendingPathComponent:@"otr.private_key.store"]];
+        store.compactionThreshold = ULLONG_MAX;
+        unsigned long long rewriteBytes = 0;
+        for (NSUInteger i = 0; i < accountCount; i++) {
+            unsigned long long journalLength = store.journalLength;
+            NSString *accountName = [NSString stringWithFormat:@"user%d@example.com", (int)i];
+            XCTAssertTrue([store setRecord:record forAccountName:accountName protocol:@"xmpp" error:nil]);
+            XCTAssertLessThan(store.journalLength - journalLength, record.length + 64);
+            // Rewriting the whole file would write every account so far
+            rewriteBytes += (i + 1) * record.length;
+        }
+        NSLog(@"%d accounts: %llu bytes journaled, %llu bytes if the whole file was rewritten", (int)accountCount, store.journalLength, rewriteBytes);
+        [[NSFileManager defaultManager] removeItemAtPath:directory error:nil];
+    }];
+}
+
+/** The receiver resumed after fetching the first chunks, then retried one, so the sender saw more GETs than bytes */
+- (void)testOutgoingTransferCompletesAfterResume {
+    OTRDataOutgoingTransfer *transfer = [[OTRDataOutgoingTransfer alloc] initWithFileLength:100 username:@"bob@example.com" accountName:@"alice@example.com" protocol:@"xmpp" tag:nil];
+    XCTAssertFalse([transfer addServedRange:NSMakeRange(0, 32)]);
+    XCTAssertFalse([transfer addServedRange:NSMakeRange(32, 32)]);
+    XCTAssertEqual(transfer.bytesTransferred, 64);
+
+    // Resumed with the first chunk lost, plus a retried GET
+    XCTAssertFalse([transfer addServedRange:NSMakeRange(0, 32)]);
+    XCTAssertFalse([transfer addServedRange:NSMakeRange(64, 32)]);
+    XCTAssertFalse([transfer addServedRange:NSMakeRange(64, 32)]);
+    XCTAssertEqual(transfer.bytesTransferred, 96);
+
+    // Past the end of the file doesn't count
+    XCTAssertTrue([transfer addServedRange:NSMakeRange(96, 32)]);
+    XCTAssertEqual(transfer.bytesTransferred, 100);
+}
+
 @end
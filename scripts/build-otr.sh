@@ -11,6 +11,14 @@ tar zxf "libotr-${LIBOTR_VERSION}.tar.gz"
 
 pushd "libotr-${LIBOTR_VERSION}"
 
+   # Apply patches
+   # Allow OTRKit to supply precomputed DH keypairs
+   patch < "${TOPDIR}/patches/libotr-dh.h.diff" src/dh.h
+   patch < "${TOPDIR}/patches/libotr-dh.c.diff" src/dh.c
+   # Allow OTRKit to run SMP steps off its internal queue
+   patch < "${TOPDIR}/patches/libotr-message.h.diff" src/message.h
+   patch < "${TOPDIR}/patches/libotr-message.c.diff" src/message.c
+
    LDFLAGS="-L${ARCH_BUILT_LIBS_DIR} -fPIE ${PLATFORM_VERSION_MIN} -fembed-bitcode"
    CFLAGS=" -arch ${ARCH} -fPIE -isysroot ${SDK_PATH} -I${ARCH_BUILT_HEADERS_DIR} ${PLATFORM_VERSION_MIN} -fembed-bitcode"
    CPPFLAGS=" -arch ${ARCH} -fPIE -isysroot ${SDK_PATH} -I${ARCH_BUILT_HEADERS_DIR} ${PLATFORM_VERSION_MIN} -fembed-bitcode"